@@ -30,6 +30,21 @@ void BackgroundPublishRK::start()
     {
         os_mutex_create(&mutex);
 
+        // single item queue used as a wake signal so the thread can block
+        // instead of polling while it waits for work or for a publish to
+        // complete
+        os_queue_create(&wakeQueue, sizeof(uint8_t), 1, NULL);
+
+        // all of the publish slots are allocated here so publish() never
+        // allocates memory
+        if(!slots)
+        {
+            slots = new PublishSlot[queueSize];
+        }
+        head = tail = started = 0;
+        rateTokens = rateLimitBurst;
+        state = BACKGROUND_PUBLISH_IDLE;
+
         // use OS_THREAD_PRIORITY_DEFAULT so that application, system, and
         // background publish thread will all run at the same priority and
         // be able to preempt each other
@@ -44,6 +59,7 @@ void BackgroundPublishRK::stop()
     if(thread)
     {
         state = BACKGROUND_PUBLISH_STOP;
+        wake();
         thread->dispose();
         delete thread;
         thread = NULL;
@@ -54,58 +70,140 @@ void BackgroundPublishRK::thread_f()
 {
     while(true)
     {
-        while(state == BACKGROUND_PUBLISH_IDLE)
+        if(state == BACKGROUND_PUBLISH_STOP)
         {
-            // yield to rest of system while we wait
-            // a condition variable would be ideal but doesn't look like
-            // std::condition_variable is supported
-            delay(1);
+            return;
         }
 
+        completePublishes();
+
         if(state == BACKGROUND_PUBLISH_STOP)
         {
             return;
         }
 
+        system_tick_t rateLimitWaitMs = startPublishes();
+
+        if(tail.load() == head.load())
+        {
+            // nothing queued or in flight, block until publish() or stop()
+            // posts a wake signal
+            waitForWake(CONCURRENT_WAIT_FOREVER);
+        }
+        else if(rateLimitWaitMs && rateLimitWaitMs < COMPLETION_CHECK_MS)
+        {
+            // a completion can still wake us before the rate limit expires
+            waitForWake(rateLimitWaitMs);
+        }
+        else
+        {
+            // the timeout is only a safety net, normally a Future callback
+            // or publish() wakes us. completePublishes() polls the futures
+            // of the publishes in flight when it expires
+            waitForWake(COMPLETION_CHECK_MS);
+        }
+    }
+}
+
+system_tick_t BackgroundPublishRK::startPublishes()
+{
+    // refill the token bucket, one token per rateLimitMs
+    if(rateLimitMs)
+    {
+        while(rateTokens < rateLimitBurst && millis() - rateTokenMillis >= rateLimitMs)
+        {
+            rateTokens++;
+            rateTokenMillis += rateLimitMs;
+        }
+    }
+
+    while(started != head.load(std::memory_order_acquire) && started - tail.load() < maxInFlight)
+    {
+        if(rateLimitMs && rateTokens == 0)
+        {
+            system_tick_t elapsed = millis() - rateTokenMillis;
+            return (elapsed < rateLimitMs) ? (rateLimitMs - elapsed) : 1;
+        }
+
+        PublishSlot &slot = slotFor(started);
+
         // temporarily acquire the lock
         // this allows a calling thread to block the publish thread if it needs
-        // additional synchronization around a publish request and acts as a
-        // memory barrier around publish arguments to ensure all updates
-        // are complete
+        // additional synchronization around a publish request
         lock();
         unlock();
 
+        slot.slot_state = BACKGROUND_PUBLISH_SLOT_IN_FLIGHT;
+
         // kick off the publish
         // WITH_ACK does not work as expected from a background thread
         // use the Future<bool> object directly as its default wait
         // (used by WITH_ACK) short-circuits when not called from the
         // main application thread
-        auto ok = Particle.publish(event_name, event_data, event_flags);
+        // the future is kept in the slot so completePublishes() can poll it
+        slot.publish_result = Particle.publish(slot.event_name, slot.event_data, slot.event_flags);
+
+        // have the future record the result and wake the thread when it
+        // completes. if it has already completed the callback runs immediately.
+        slot.publish_result.onSuccess([this, &slot](bool) {
+            slot.slot_state = BACKGROUND_PUBLISH_SLOT_SUCCEEDED;
+            wake();
+        });
+        slot.publish_result.onError([this, &slot](const particle::Error &) {
+            slot.slot_state = BACKGROUND_PUBLISH_SLOT_FAILED;
+            wake();
+        });
 
-        // then wait for publish to complete
-        while(!ok.isDone() && state != BACKGROUND_PUBLISH_STOP)
+        if(rateLimitMs)
         {
-            // yield to rest of system while we wait
-            delay(1);
+            if(rateTokens == rateLimitBurst)
+            {
+                // bucket was full, start refilling from now
+                rateTokenMillis = millis();
+            }
+            rateTokens--;
         }
+        started++;
+    }
+    return 0;
+}
 
-        if(completed_cb)
+void BackgroundPublishRK::completePublishes()
+{
+    // callbacks are called in publish() order, so a publish that completes
+    // early waits for the ones before it
+    while(tail.load() != started)
+    {
+        PublishSlot &slot = slotFor(tail.load());
+
+        uint8_t slotState = slot.slot_state;
+        if(slotState == BACKGROUND_PUBLISH_SLOT_IN_FLIGHT && slot.publish_result.isDone())
         {
-            completed_cb(ok.isSucceeded(),
-                event_name,
-                event_data,
-                event_context);
+            // done without a callback having run (woken by the
+            // COMPLETION_CHECK_MS timeout)
+            slotState = slot.publish_result.isSucceeded() ? BACKGROUND_PUBLISH_SLOT_SUCCEEDED : BACKGROUND_PUBLISH_SLOT_FAILED;
+        }
+        if(slotState != BACKGROUND_PUBLISH_SLOT_SUCCEEDED && slotState != BACKGROUND_PUBLISH_SLOT_FAILED)
+        {
+            break;
         }
 
-        WITH_LOCK(*this)
+        if(slot.completed_cb)
         {
-            if(state == BACKGROUND_PUBLISH_STOP)
-            {
-                return;
-            }
-            event_context = NULL;
-            completed_cb = NULL;
-            state = BACKGROUND_PUBLISH_IDLE;
+            slot.completed_cb(slotState == BACKGROUND_PUBLISH_SLOT_SUCCEEDED,
+                slot.event_name,
+                slot.event_data,
+                slot.event_context);
+        }
+        slot.completed_cb = NULL;
+        slot.event_context = NULL;
+
+        // release the slot to publish()
+        tail.store(tail.load() + 1, std::memory_order_release);
+
+        if(state == BACKGROUND_PUBLISH_STOP)
+        {
+            return;
         }
     }
 }
@@ -113,10 +211,11 @@ void BackgroundPublishRK::thread_f()
 bool BackgroundPublishRK::publish(const char *name, const char *data, PublishFlags flags, PublishCompletedCallback cb, const void *context)
 {
     // protect against separate threads trying to publish at the same time
+    // (the thread does not take this lock to access the queue)
     WITH_LOCK(*this)
 
-    // check currently in idle state and ready to accept publish request
-    if(!thread || state != BACKGROUND_PUBLISH_IDLE)
+    // check the thread is running
+    if(!thread || state == BACKGROUND_PUBLISH_STOP)
     {
         return false;
     }
@@ -128,25 +227,52 @@ bool BackgroundPublishRK::publish(const char *name, const char *data, PublishFla
         return false;
     }
 
-    // have the lock and thread is currently idle
-    // safe to prepare publish request
-    strncpy(event_name, name, sizeof(event_name));
-    event_name[sizeof(event_name)-1] = '\0'; // ensure null termination
+    // check there is a free slot
+    uint32_t seq = head.load();
+    if(seq - tail.load(std::memory_order_acquire) >= queueSize)
+    {
+        return false;
+    }
+
+    // the thread does not touch slots between tail and head until head is
+    // advanced below, so it's safe to prepare the publish request
+    PublishSlot &slot = slotFor(seq);
+
+    strncpy(slot.event_name, name, sizeof(slot.event_name));
+    slot.event_name[sizeof(slot.event_name)-1] = '\0'; // ensure null termination
 
     if(data)
     {
-        strncpy(event_data, data, sizeof(event_data));
-        event_data[sizeof(event_data)-1] = '\0'; // ensure null termination
+        strncpy(slot.event_data, data, sizeof(slot.event_data));
+        slot.event_data[sizeof(slot.event_data)-1] = '\0'; // ensure null termination
     }
     else
     {
-        event_data[0] = '\0'; // null terminate at start for no event data
+        slot.event_data[0] = '\0'; // null terminate at start for no event data
     }
 
-    completed_cb = cb;
-    event_context = context;
-    event_flags = flags;
-    state = BACKGROUND_PUBLISH_REQUESTED;
+    slot.completed_cb = cb;
+    slot.event_context = context;
+    slot.event_flags = flags;
+    slot.slot_state = BACKGROUND_PUBLISH_SLOT_QUEUED;
+
+    head.store(seq + 1, std::memory_order_release);
+
+    wake();
 
     return true;
 }
+
+void BackgroundPublishRK::wake()
+{
+    // if the queue is full a wake is already pending, which is fine
+    uint8_t item = 0;
+    os_queue_put(wakeQueue, &item, 0, NULL);
+}
+
+bool BackgroundPublishRK::waitForWake(system_tick_t timeoutMs)
+{
+    // a stale signal only causes the caller to check its condition again
+    uint8_t item;
+    return os_queue_take(wakeQueue, &item, timeoutMs, NULL) == 0;
+}
@@ -7,6 +7,8 @@
 
 #include <protocol_defs.h>
 
+#include <atomic>
+
 /**
  * @brief Internal state of the publish thread
  */
@@ -16,6 +18,16 @@ typedef enum {
     BACKGROUND_PUBLISH_STOP,		//!< Thread stopped (need to start again to publish)
 } publish_thread_state_t;
 
+/**
+ * @brief State of one slot in the publish queue
+ */
+typedef enum {
+    BACKGROUND_PUBLISH_SLOT_QUEUED = 0,	//!< Filled in by publish(), not started yet
+    BACKGROUND_PUBLISH_SLOT_IN_FLIGHT,	//!< Particle.publish called, waiting for the result
+    BACKGROUND_PUBLISH_SLOT_SUCCEEDED,	//!< Publish succeeded, callback not called yet
+    BACKGROUND_PUBLISH_SLOT_FAILED,		//!< Publish failed, callback not called yet
+} publish_slot_state_t;
+
 /**
  * @brief Optional callback function
  *
@@ -69,6 +81,44 @@ public:
      */
     void stop();
 
+    /**
+     * @brief Sets the number of publish requests that can be queued (default: 4). Call before start().
+     *
+     * Each slot is pre-allocated during start() and holds a full size event name and data, about 1100
+     * bytes each. publish() returns false when all of the slots are in use.
+     */
+    BackgroundPublishRK &withQueueSize(size_t size) { if (!slots && size > 0) queueSize = size; return *this; };
+
+    /**
+     * @brief Gets the number of publish requests that can be queued
+     */
+    size_t getQueueSize() const { return queueSize; };
+
+    /**
+     * @brief Sets the maximum number of publishes that can be waiting for a result at the same time (default: 2)
+     *
+     * With WITH_ACK, most of the time for each publish is spent waiting for the cloud to acknowledge it.
+     * Keeping more than one publish in flight overlaps those waits. Completion callbacks are always called
+     * in the order the events were passed to publish().
+     */
+    BackgroundPublishRK &withMaxInFlight(size_t maxInFlight) { if (maxInFlight > 0) this->maxInFlight = maxInFlight; return *this; };
+
+    /**
+     * @brief Sets the publish rate limit (default: burst of 4, then one every 1000 milliseconds)
+     *
+     * @param intervalMs Average time between publishes in milliseconds
+     *
+     * @param burst Number of publishes that can be made back-to-back after the device has been idle
+     *
+     * The defaults match the Particle cloud limit of one event per second with a burst of up to 4.
+     */
+    BackgroundPublishRK &withRateLimit(system_tick_t intervalMs, size_t burst) { rateLimitMs = intervalMs; rateLimitBurst = (burst > 0) ? burst : 1; return *this; };
+
+    /**
+     * @brief Returns the number of publish requests that are queued or in flight
+     */
+    size_t getNumPending() const { return (size_t)(head.load() - tail.load()); };
+
     /**
      * @brief Publish method. Use this instead of Particle.publish().
      *
@@ -86,6 +136,10 @@ public:
      *
      * @param context Optional parameter passed to the callback. You can store a C++ object
      * instance or a state structure pointer here.
+     *
+     * @return true if the event was queued, false if the queue is full, the thread is not
+     * running, or name is NULL. This never blocks waiting for the cloud and does not allocate
+     * memory.
      */
     bool publish(const char *name,
         const char *data = NULL,
@@ -130,18 +184,74 @@ private:
     BackgroundPublishRK& operator=(const BackgroundPublishRK&) = delete;
 
 
+    /**
+     * @brief Wake the publish thread if it is blocked in waitForWake()
+     *
+     * Safe to call from any thread, including from a Future completion callback.
+     */
+    void wake();
+
+    /**
+     * @brief Block the publish thread until wake() is called or the timeout expires
+     *
+     * @param timeoutMs Maximum time to wait in milliseconds, or CONCURRENT_WAIT_FOREVER
+     *
+     * @return true if woken by wake(), false on timeout
+     */
+    bool waitForWake(system_tick_t timeoutMs);
+
+    /**
+     * @brief One pre-allocated publish request
+     */
+    struct PublishSlot {
+        // arguments for Particle.publish
+        char event_name[particle::protocol::MAX_EVENT_NAME_LENGTH+1];	//!< name passed to publish
+        char event_data[particle::protocol::MAX_EVENT_DATA_LENGTH+1];	//!< event data passed to publish (may be empty string)
+        PublishFlags event_flags; 	//!< event flags, typically PRIVATE, PRIVATE | WITH_ACK, or PRIVATE | NO_ACK.
+        // callback when publish completes
+        PublishCompletedCallback completed_cb = NULL; 	//!< Completion callback (optional)
+        const void *event_context = NULL; 		//!< Context passed to completion (optional)
+        std::atomic<uint8_t> slot_state{BACKGROUND_PUBLISH_SLOT_QUEUED}; //!< publish_slot_state_t, set from the Future callbacks
+        particle::Future<bool> publish_result; //!< Future from Particle.publish, polled in case no callback wakes the thread
+    };
+
+    /**
+     * @brief Start queued publishes, up to maxInFlight and the rate limit
+     *
+     * @return Milliseconds until the rate limit allows the next publish, or 0 if not rate limited
+     */
+    system_tick_t startPublishes();
+
+    /**
+     * @brief Call the completion callbacks for finished publishes, oldest first, and free their slots
+     */
+    void completePublishes();
+
+    /**
+     * @brief Gets the slot for a sequence number (head, tail, or started)
+     */
+    PublishSlot &slotFor(uint32_t seq) { return slots[seq % queueSize]; };
+
     Thread *thread = NULL;		//!< Thread object pointer. Allocated during start()
     void thread_f();			//!< Thread function, passed to the Thread object
     os_mutex_t mutex;	//!< Mutex to protect access to class members from multiple threads
+    os_queue_t wakeQueue = NULL;	//!< Single item queue used to wake the thread instead of polling
+    static const system_tick_t COMPLETION_CHECK_MS = 1000; //!< Safety net timeout while waiting for a publish to complete
     volatile publish_thread_state_t state = BACKGROUND_PUBLISH_IDLE; //!< Current state
 
-    // arguments for Particle.publish
-    char event_name[particle::protocol::MAX_EVENT_NAME_LENGTH+1];	//!< name passed to publish
-    char event_data[particle::protocol::MAX_EVENT_DATA_LENGTH+1];	//!< event data passed to publish (may be empty string)
-    PublishFlags event_flags; 	//!< event flags, typically PRIVATE, PRIVATE | WITH_ACK, or PRIVATE | NO_ACK.
-    // callback when publish completes
-    PublishCompletedCallback completed_cb = NULL; 	//!< Completion callback (optional)
-    const void *event_context = NULL; 		//!< Context passed to completion (optional)
+    // Single producer (publish(), serialized by the mutex) / single consumer (the thread) ring of slots.
+    // Sequence numbers increase forever and are reduced modulo queueSize to get the slot.
+    PublishSlot *slots = NULL;	//!< Array of queueSize slots. Allocated during start()
+    size_t queueSize = 4;		//!< Number of slots
+    std::atomic<uint32_t> head{0};	//!< Sequence number of the next slot publish() will fill (written by the producer)
+    std::atomic<uint32_t> tail{0};	//!< Sequence number of the oldest slot not yet completed (written by the thread)
+    uint32_t started = 0;		//!< Sequence number of the next slot to start publishing (thread only)
+
+    size_t maxInFlight = 2;		//!< Maximum number of publishes waiting for a result
+    system_tick_t rateLimitMs = 1000; //!< Average time between publishes
+    size_t rateLimitBurst = 4;	//!< Maximum number of publishes back-to-back
+    size_t rateTokens = 4;		//!< Publishes available now (token bucket, thread only)
+    system_tick_t rateTokenMillis = 0; //!< millis() when rateTokens was last refilled (thread only)
 
     static BackgroundPublishRK *_instance; //!< Singleton instance of this class
 };
@@ -116,11 +116,13 @@ void JsonBuffer::nullTerminate() {
 
 //
 
-JsonParser::JsonParser() : JsonBuffer(), tokens(0), tokensEnd(0), maxTokens(0) {
+JsonParser::JsonParser() : JsonBuffer(), tokens(0), tokensEnd(0), maxTokens(0),
+		keyIndexEnabled(false), keyIndexBuilt(false), keyIndexValid(false), keyIndex(0), keyIndexSize(0) {
 }
 
 JsonParser::JsonParser(char *buffer, size_t bufferLen, JsonParserGeneratorRK::jsmntok_t *tokens, size_t maxTokens) :
-		JsonBuffer(buffer, bufferLen), tokens(tokens), maxTokens(maxTokens) {
+		JsonBuffer(buffer, bufferLen), tokens(tokens), maxTokens(maxTokens),
+		keyIndexEnabled(false), keyIndexBuilt(false), keyIndexValid(false), keyIndex(0), keyIndexSize(0) {
 
 }
 
@@ -129,6 +131,20 @@ JsonParser::~JsonParser() {
 	if (!staticBuffers && tokens) {
 		free(tokens);
 	}
+	if (keyIndex) {
+		free(keyIndex);
+	}
+}
+
+void JsonParser::enableKeyIndex(bool enable) {
+	keyIndexEnabled = enable;
+	invalidateKeyIndex();
+
+	if (!enable && keyIndex) {
+		free(keyIndex);
+		keyIndex = 0;
+		keyIndexSize = 0;
+	}
 }
 
 bool JsonParser::allocateTokens(size_t maxTokens) {
@@ -155,6 +171,8 @@ bool JsonParser::allocateTokens(size_t maxTokens) {
 }
 
 bool JsonParser::parse() {
+	invalidateKeyIndex();
+
 	if (offset == 0) {
 		// If addString or addData is not called, or called with an empty string,
 		// do not return true, see issue #7.
@@ -310,10 +328,48 @@ bool JsonParser::getKeyValueTokenByIndex(const JsonParserGeneratorRK::jsmntok_t
 
 bool JsonParser::getValueTokenByKey(const JsonParserGeneratorRK::jsmntok_t *container, const char *name, const JsonParserGeneratorRK::jsmntok_t *&value) const {
 
+	if (!container) {
+		return false;
+	}
+	size_t nameLen = strlen(name);
+
+	if (keyIndexEnabled) {
+		if (!keyIndexBuilt) {
+			keyIndexValid = buildKeyIndex();
+			keyIndexBuilt = true;
+		}
+		if (keyIndexValid) {
+			size_t containerIndex = container - tokens;
+			size_t mask = keyIndexSize - 1;
+
+			for(size_t ii = keyIndexHash(containerIndex, name, nameLen) & mask; keyIndex[ii].key; ii = (ii + 1) & mask) {
+				const JsonParserGeneratorRK::jsmntok_t *key = &tokens[keyIndex[ii].key - 1];
+				if (keyIndex[ii].container == containerIndex &&
+					(size_t)(key->end - key->start) == nameLen &&
+					memcmp(&buffer[key->start], name, nameLen) == 0) {
+					// The value token always follows the key token
+					value = key + 1;
+					return true;
+				}
+			}
+			return false;
+		}
+	}
+
 	const JsonParserGeneratorRK::jsmntok_t *key;
 	String keyName;
 
 	for(size_t ii = 0; getKeyValueTokenByIndex(container, key, value, ii); ii++) {
+		size_t keyLen = key->end - key->start;
+		const char *keyData = &buffer[key->start];
+
+		if (!memchr(keyData, '\\', keyLen)) {
+			// No escapes, so compare the raw data without making a copy
+			if (keyLen == nameLen && memcmp(keyData, name, nameLen) == 0) {
+				return true;
+			}
+		}
+		else
 		if (getTokenValue(key, keyName) && keyName == name) {
 			return true;
 		}
@@ -321,6 +377,95 @@ bool JsonParser::getValueTokenByKey(const JsonParserGeneratorRK::jsmntok_t *cont
 	return false;
 }
 
+bool JsonParser::buildKeyIndex() const {
+	size_t numTokens = tokensEnd - tokens;
+	if (numTokens == 0 || numTokens >= 0xffff) {
+		return false;
+	}
+
+	// For objects, size is the number of keys
+	size_t numKeys = 0;
+	for(const JsonParserGeneratorRK::jsmntok_t *token = tokens; token < tokensEnd; token++) {
+		if (token->type == JsonParserGeneratorRK::JSMN_OBJECT) {
+			numKeys += token->size;
+		}
+	}
+
+	// Keep the table at most half full
+	size_t size = 8;
+	while(size < 2 * numKeys) {
+		size *= 2;
+	}
+	if (size > keyIndexSize) {
+		if (keyIndex) {
+			free(keyIndex);
+		}
+		keyIndex = (KeyIndexEntry *)malloc(size * sizeof(KeyIndexEntry));
+		if (!keyIndex) {
+			keyIndexSize = 0;
+			return false;
+		}
+		keyIndexSize = size;
+	}
+	memset(keyIndex, 0, keyIndexSize * sizeof(KeyIndexEntry));
+
+	size_t mask = keyIndexSize - 1;
+
+	for(const JsonParserGeneratorRK::jsmntok_t *container = tokens; container < tokensEnd; container++) {
+		if (container->type != JsonParserGeneratorRK::JSMN_OBJECT) {
+			continue;
+		}
+		size_t containerIndex = container - tokens;
+
+		const JsonParserGeneratorRK::jsmntok_t *key = container + 1;
+		while(key < tokensEnd && key->end < container->end) {
+			const JsonParserGeneratorRK::jsmntok_t *value = key;
+			if (!skipObject(container, value)) {
+				break;
+			}
+
+			const char *keyData = &buffer[key->start];
+			size_t keyLen = key->end - key->start;
+			if (memchr(keyData, '\\', keyLen)) {
+				// Escaped keys would need to be decoded before hashing
+				return false;
+			}
+
+			// If a key occurs more than once, the first one is used, the same as the linear search
+			size_t ii = keyIndexHash(containerIndex, keyData, keyLen) & mask;
+			for(; keyIndex[ii].key; ii = (ii + 1) & mask) {
+				const JsonParserGeneratorRK::jsmntok_t *otherKey = &tokens[keyIndex[ii].key - 1];
+				if (keyIndex[ii].container == containerIndex &&
+					(size_t)(otherKey->end - otherKey->start) == keyLen &&
+					memcmp(&buffer[otherKey->start], keyData, keyLen) == 0) {
+					break;
+				}
+			}
+			if (!keyIndex[ii].key) {
+				keyIndex[ii].container = (uint16_t) containerIndex;
+				keyIndex[ii].key = (uint16_t) (key - tokens + 1);
+			}
+
+			key = value;
+			if (!skipObject(container, key)) {
+				break;
+			}
+		}
+	}
+
+	return true;
+}
+
+// [static]
+uint32_t JsonParser::keyIndexHash(size_t containerIndex, const char *key, size_t keyLen) {
+	uint32_t hash = 2166136261UL;
+	for(size_t ii = 0; ii < keyLen; ii++) {
+		hash ^= (uint8_t) key[ii];
+		hash *= 16777619UL;
+	}
+	return hash ^ (uint32_t)(containerIndex * 2654435761UL);
+}
+
 bool JsonParser::getValueTokenByIndex(const JsonParserGeneratorRK::jsmntok_t *container, size_t desiredIndex, const JsonParserGeneratorRK::jsmntok_t *&value) const {
 	size_t index = 0;
 	const JsonParserGeneratorRK::jsmntok_t *token = container + 1;
@@ -885,6 +1030,9 @@ void JsonWriter::insertValue(bool value) {
 }
 
 void JsonWriter::insertValue(float value) {
+	if (insertFixed(value, (floatPlaces >= 0) ? floatPlaces : 6)) {
+		return;
+	}
 	if (floatPlaces >= 0) {
 		insertsprintf("%.*f", floatPlaces, value);
 	}
@@ -893,6 +1041,9 @@ void JsonWriter::insertValue(float value) {
 	}
 }
 void JsonWriter::insertValue(double value) {
+	if (insertFixed(value, (floatPlaces >= 0) ? floatPlaces : 6)) {
+		return;
+	}
 	if (floatPlaces >= 0) {
 		insertsprintf("%.*lf", floatPlaces, value);
 	}
@@ -901,6 +1052,138 @@ void JsonWriter::insertValue(double value) {
 	}
 }
 
+void JsonWriter::insertUnsigned(uint64_t value, bool negative) {
+	char buf[21];
+	char *cp = &buf[sizeof(buf)];
+
+	do {
+		*--cp = '0' + (char)(value % 10);
+		value /= 10;
+	} while(value);
+
+	if (negative) {
+		*--cp = '-';
+	}
+	insertData(cp, &buf[sizeof(buf)] - cp);
+}
+
+bool JsonWriter::insertFixed(double value, int places) {
+	static const uint32_t pow5[] = { 1, 5, 25, 125, 625, 3125, 15625, 78125, 390625, 1953125 };
+	static const uint32_t pow10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+
+	if (places < 0 || places > 9) {
+		return false;
+	}
+
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	bool negative = (bits >> 63) != 0;
+	int exponent = (int)((bits >> 52) & 0x7ff);
+	uint64_t mantissa = bits & 0xfffffffffffffULL;
+
+	if (exponent == 0x7ff) {
+		// NaN or infinite
+		return false;
+	}
+	if (exponent == 0) {
+		// Subnormal (or zero)
+		exponent = 1;
+	}
+	else {
+		mantissa |= 0x10000000000000ULL;
+	}
+	exponent -= 1075;
+
+	// value = mantissa * 2^exponent, so value * 10^places = mantissa * 5^places * 2^(exponent + places).
+	// mantissa * 5^places is less than 2^74 so it's stored in two 64-bit words.
+	uint64_t lo32 = (mantissa & 0xffffffff) * pow5[places];
+	uint64_t hi32 = (mantissa >> 32) * pow5[places];
+	uint64_t lo = lo32 + (hi32 << 32);
+	uint64_t hi = (hi32 >> 32) + ((lo < lo32) ? 1 : 0);
+
+	int shift = -(exponent + places);
+
+	uint64_t scaled;
+	if (shift <= 0) {
+		// An integer. Must be less than 10^18.
+		if (hi || shift < -63 || (lo >> 60) || (lo << -shift) >> -shift != lo || (lo << -shift) >= 1000000000000000000ULL) {
+			return false;
+		}
+		scaled = lo << -shift;
+	}
+	else
+	if (shift >= 76) {
+		// Less than 1/2 in the last place, rounds to 0
+		scaled = 0;
+	}
+	else {
+		// Integer part and the bits shifted out
+		bool half, belowHalf;
+		if (shift >= 64) {
+			scaled = hi >> (shift - 64);
+			half = (shift == 64) ? ((lo >> 63) & 1) : ((hi >> (shift - 65)) & 1);
+			belowHalf = (shift == 64) ? ((lo << 1) != 0) : (lo != 0 || (shift > 65 && (hi << (129 - shift)) != 0));
+		}
+		else {
+			if (hi >> shift) {
+				return false;
+			}
+			scaled = (lo >> shift) | ((shift > 0 && hi) ? (hi << (64 - shift)) : 0);
+			half = (lo >> (shift - 1)) & 1;
+			belowHalf = (shift > 1) && (lo << (65 - shift)) != 0;
+		}
+
+		// Round to nearest, ties to even, the same as printf
+		if (half && (belowHalf || (scaled & 1))) {
+			scaled++;
+		}
+		if (scaled >= 1000000000000000000ULL) {
+			return false;
+		}
+	}
+
+	char buf[24];
+	char *cp = &buf[sizeof(buf)];
+
+	uint64_t intPart = scaled / pow10[places];
+	uint32_t fracPart = (uint32_t)(scaled % pow10[places]);
+
+	for(int ii = 0; ii < places; ii++) {
+		*--cp = '0' + (char)(fracPart % 10);
+		fracPart /= 10;
+	}
+	if (places > 0) {
+		*--cp = '.';
+	}
+	do {
+		*--cp = '0' + (char)(intPart % 10);
+		intPart /= 10;
+	} while(intPart);
+
+	if (negative) {
+		*--cp = '-';
+	}
+	insertData(cp, &buf[sizeof(buf)] - cp);
+
+	return true;
+}
+
+void JsonWriter::insertData(const char *data, size_t dataLen) {
+	size_t spaceAvailable = bufferLen - offset;
+
+	if (dataLen <= spaceAvailable) {
+		memcpy(&buffer[offset], data, dataLen);
+		offset += dataLen;
+	}
+	else {
+		// Truncated, no more space left
+		memcpy(&buffer[offset], data, spaceAvailable);
+		offset = bufferLen;
+		truncated = true;
+	}
+}
+
 
 void JsonWriter::insertKeyObject(const char *key) {
 	insertCheckSeparator();
@@ -1045,6 +1328,8 @@ bool JsonModifier::startModify(const JsonParserGeneratorRK::jsmntok_t *token) {
 		// Modification or insertion already in progress
 		return false;
 	}
+	jp.invalidateKeyIndex();
+
 	start = token->start;
 	origAfter = jp.getOffset() - token->end;
 	saveLoc = jp.getBufferLen() - origAfter;
@@ -1067,6 +1352,8 @@ bool JsonModifier::startAppend(const JsonParserGeneratorRK::jsmntok_t *arrayOrOb
 		return false;
 	}
 
+	jp.invalidateKeyIndex();
+
 	start = arrayOrObjectToken->end - 1; // Before the closing ] or }
 	origAfter = jp.getOffset() - start;
 	saveLoc = jp.getBufferLen() - origAfter;
@@ -1147,6 +1434,548 @@ int JsonModifier::findRightComma(const JsonParserGeneratorRK::jsmntok_t *tok) co
 
 
 
+JsonStreamParser::JsonStreamParser(char *buffer, size_t bufferLen, Level *levels, size_t maxDepth) :
+	buffer(buffer), bufferLen(bufferLen), levels(levels), maxDepth(maxDepth) {
+	reset();
+}
+
+JsonStreamParser::~JsonStreamParser() {
+
+}
+
+void JsonStreamParser::reset() {
+	state = STATE_VALUE;
+	error = ERROR_NONE;
+	depth = 0;
+	isKey = false;
+	valueOffset = 0;
+	valueLen = 0;
+	highSurrogate = 0;
+	nextChunk = 0;
+	if (buffer && bufferLen) {
+		buffer[0] = 0;
+	}
+}
+
+bool JsonStreamParser::addData(const char *data, size_t dataLen) {
+	for(size_t ii = 0; ii < dataLen; ii++) {
+		if (!processChar(data[ii])) {
+			return false;
+		}
+	}
+	return state != STATE_ERROR;
+}
+
+bool JsonStreamParser::addChunkedData(const char *event, const char *data) {
+	// Multipart hook-response events end in /0, /1, ...
+	int responseIndex = 0;
+	const char *slashOffset = strrchr(event, '/');
+	if (slashOffset) {
+		responseIndex = atoi(slashOffset + 1);
+	}
+
+	if (state == STATE_ERROR) {
+		return false;
+	}
+	if (responseIndex != nextChunk) {
+		return setError(ERROR_CHUNK_ORDER);
+	}
+	nextChunk++;
+
+	return addString(data);
+}
+
+bool JsonStreamParser::finish() {
+	if (state == STATE_PRIMITIVE && depth == 0) {
+		if (isIncompletePrimitive()) {
+			// Ended in the middle of a literal or number, the same as an unterminated string
+			return setError(ERROR_INCOMPLETE);
+		}
+		endPrimitive();
+	}
+	if (state == STATE_DONE) {
+		return true;
+	}
+	if (state != STATE_ERROR) {
+		setError(ERROR_INCOMPLETE);
+	}
+	return false;
+}
+
+const char *JsonStreamParser::getKey(size_t level) const {
+	if (level < 1 || level > depth || levels[level - 1].isArray) {
+		return "";
+	}
+	return &buffer[levels[level - 1].keyOffset];
+}
+
+size_t JsonStreamParser::getIndex(size_t level) const {
+	if (level < 1 || level > depth) {
+		return 0;
+	}
+	return levels[level - 1].index;
+}
+
+bool JsonStreamParser::getValue(bool &result) const {
+	if (valueType != VALUE_BOOL) {
+		return false;
+	}
+	result = (buffer[valueOffset] == 't');
+	return true;
+}
+
+bool JsonStreamParser::getValue(int &result) const {
+	if (valueType != VALUE_NUMBER) {
+		return false;
+	}
+	result = (int) strtol(getValue(), NULL, 10);
+	return true;
+}
+
+bool JsonStreamParser::getValue(unsigned long &result) const {
+	if (valueType != VALUE_NUMBER) {
+		return false;
+	}
+	result = strtoul(getValue(), NULL, 10);
+	return true;
+}
+
+bool JsonStreamParser::getValue(float &result) const {
+	if (valueType != VALUE_NUMBER) {
+		return false;
+	}
+	result = strtof(getValue(), NULL);
+	return true;
+}
+
+bool JsonStreamParser::getValue(double &result) const {
+	if (valueType != VALUE_NUMBER) {
+		return false;
+	}
+	result = strtod(getValue(), NULL);
+	return true;
+}
+
+bool JsonStreamParser::getValue(String &result) const {
+	if (valueType != VALUE_STRING) {
+		return false;
+	}
+	result = getValue();
+	return true;
+}
+
+bool JsonStreamParser::processChar(char c) {
+	bool isSpace = (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+
+	switch(state) {
+	case STATE_ERROR:
+		return false;
+
+	case STATE_DONE:
+		if (!isSpace) {
+			return setError(ERROR_INVALID);
+		}
+		break;
+
+	case STATE_ARRAY_FIRST:
+		if (isSpace) {
+			break;
+		}
+		if (c == ']') {
+			return endContainer();
+		}
+		state = STATE_VALUE;
+		return processChar(c);
+
+	case STATE_VALUE:
+		if (isSpace) {
+			break;
+		}
+		if (c == '{') {
+			return startContainer(false);
+		}
+		if (c == '[') {
+			return startContainer(true);
+		}
+		valueOffset = getFreeOffset();
+		valueLen = 0;
+		if (c == '"') {
+			isKey = false;
+			state = STATE_STRING;
+		}
+		else
+		if (c == '-' || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z')) {
+			state = STATE_PRIMITIVE;
+			return appendChar(c);
+		}
+		else {
+			return setError(ERROR_INVALID);
+		}
+		break;
+
+	case STATE_OBJECT_FIRST:
+	case STATE_OBJECT_KEY:
+		if (isSpace) {
+			break;
+		}
+		if (c == '}' && state == STATE_OBJECT_FIRST) {
+			return endContainer();
+		}
+		if (c != '"') {
+			return setError(ERROR_INVALID);
+		}
+		// The key is stored at the current level so it's available to events for the value
+		isKey = true;
+		valueOffset = levels[depth - 1].keyOffset;
+		valueLen = 0;
+		state = STATE_STRING;
+		break;
+
+	case STATE_COLON:
+		if (isSpace) {
+			break;
+		}
+		if (c != ':') {
+			return setError(ERROR_INVALID);
+		}
+		state = STATE_VALUE;
+		break;
+
+	case STATE_AFTER_VALUE:
+		if (isSpace) {
+			break;
+		}
+		if (c == ',') {
+			Level &level = levels[depth - 1];
+			level.index++;
+			if (level.isArray) {
+				state = STATE_VALUE;
+			}
+			else {
+				state = STATE_OBJECT_KEY;
+			}
+			break;
+		}
+		if ((c == ']' && levels[depth - 1].isArray) || (c == '}' && !levels[depth - 1].isArray)) {
+			return endContainer();
+		}
+		return setError(ERROR_INVALID);
+
+	case STATE_STRING:
+		if (highSurrogate && c != '\\') {
+			// Unpaired high surrogate
+			if (!appendUtf8(highSurrogate)) {
+				return false;
+			}
+			highSurrogate = 0;
+		}
+		if (c == '"') {
+			if (isKey) {
+				buffer[valueOffset + valueLen] = 0;
+				levels[depth - 1].keyLen = valueLen;
+				state = STATE_COLON;
+				break;
+			}
+			return endValue(VALUE_STRING);
+		}
+		if (c == '\\') {
+			state = STATE_ESCAPE;
+			break;
+		}
+		if ((unsigned char)c < 0x20) {
+			// Control characters must be escaped
+			return setError(ERROR_INVALID);
+		}
+		return appendChar(c);
+
+	case STATE_ESCAPE:
+		state = STATE_STRING;
+		if (c == 'u') {
+			unicode = 0;
+			unicodeDigits = 0;
+			state = STATE_UNICODE;
+			break;
+		}
+		if (highSurrogate) {
+			if (!appendUtf8(highSurrogate)) {
+				return false;
+			}
+			highSurrogate = 0;
+		}
+		switch(c) {
+		case '"':
+		case '\\':
+		case '/':
+			return appendChar(c);
+		case 'b':
+			return appendChar('\b');
+		case 'f':
+			return appendChar('\f');
+		case 'n':
+			return appendChar('\n');
+		case 'r':
+			return appendChar('\r');
+		case 't':
+			return appendChar('\t');
+		default:
+			return setError(ERROR_INVALID);
+		}
+
+	case STATE_UNICODE:
+		if (c >= '0' && c <= '9') {
+			unicode = (unicode << 4) | (c - '0');
+		}
+		else
+		if (c >= 'a' && c <= 'f') {
+			unicode = (unicode << 4) | (c - 'a' + 10);
+		}
+		else
+		if (c >= 'A' && c <= 'F') {
+			unicode = (unicode << 4) | (c - 'A' + 10);
+		}
+		else {
+			return setError(ERROR_INVALID);
+		}
+		if (++unicodeDigits < 4) {
+			break;
+		}
+		state = STATE_STRING;
+
+		if (highSurrogate && unicode >= 0xdc00 && unicode <= 0xdfff) {
+			// Second half of a surrogate pair
+			uint32_t codePoint = 0x10000 + ((highSurrogate - 0xd800) << 10) + (unicode - 0xdc00);
+			highSurrogate = 0;
+			return appendUtf8(codePoint);
+		}
+		if (highSurrogate) {
+			if (!appendUtf8(highSurrogate)) {
+				return false;
+			}
+			highSurrogate = 0;
+		}
+		if (unicode >= 0xd800 && unicode <= 0xdbff) {
+			// First half of a surrogate pair, wait for the second half
+			highSurrogate = (uint16_t) unicode;
+			break;
+		}
+		return appendUtf8(unicode);
+
+	case STATE_PRIMITIVE:
+		if (c == '-' || c == '+' || c == '.' || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
+			return appendChar(c);
+		}
+		if (!endPrimitive()) {
+			return false;
+		}
+		// The character after the primitive still needs to be processed
+		return processChar(c);
+	}
+
+	return true;
+}
+
+bool JsonStreamParser::startContainer(bool isArray) {
+	if (!callCallback(isArray ? EVENT_ARRAY_START : EVENT_OBJECT_START)) {
+		return false;
+	}
+	if (depth >= maxDepth) {
+		return setError(ERROR_TOO_DEEP);
+	}
+	size_t keyOffset = getFreeOffset();
+	if (keyOffset >= bufferLen) {
+		return setError(ERROR_TOO_LONG);
+	}
+
+	Level &level = levels[depth++];
+	level.isArray = isArray;
+	level.index = 0;
+	level.keyOffset = keyOffset;
+	level.keyLen = 0;
+	buffer[keyOffset] = 0;
+
+	state = isArray ? STATE_ARRAY_FIRST : STATE_OBJECT_FIRST;
+	return true;
+}
+
+bool JsonStreamParser::endContainer() {
+	bool isArray = levels[--depth].isArray;
+
+	if (!callCallback(isArray ? EVENT_ARRAY_END : EVENT_OBJECT_END)) {
+		return false;
+	}
+	afterValue();
+	return true;
+}
+
+bool JsonStreamParser::endValue(ValueType valueType) {
+	buffer[valueOffset + valueLen] = 0;
+	this->valueType = valueType;
+
+	if (!callCallback(EVENT_VALUE)) {
+		return false;
+	}
+	afterValue();
+	return true;
+}
+
+void JsonStreamParser::afterValue() {
+	state = (depth == 0) ? STATE_DONE : STATE_AFTER_VALUE;
+}
+
+bool JsonStreamParser::endPrimitive() {
+	buffer[valueOffset + valueLen] = 0;
+
+	const char *cp = &buffer[valueOffset];
+	if (strcmp(cp, "true") == 0 || strcmp(cp, "false") == 0) {
+		return endValue(VALUE_BOOL);
+	}
+	if (strcmp(cp, "null") == 0) {
+		return endValue(VALUE_NULL);
+	}
+
+	// Number: -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+	if (*cp == '-') {
+		cp++;
+	}
+	if (*cp == '0') {
+		cp++;
+	}
+	else
+	if (*cp >= '1' && *cp <= '9') {
+		while(*cp >= '0' && *cp <= '9') {
+			cp++;
+		}
+	}
+	else {
+		return setError(ERROR_INVALID);
+	}
+	if (*cp == '.') {
+		cp++;
+		if (*cp < '0' || *cp > '9') {
+			return setError(ERROR_INVALID);
+		}
+		while(*cp >= '0' && *cp <= '9') {
+			cp++;
+		}
+	}
+	if (*cp == 'e' || *cp == 'E') {
+		cp++;
+		if (*cp == '+' || *cp == '-') {
+			cp++;
+		}
+		if (*cp < '0' || *cp > '9') {
+			return setError(ERROR_INVALID);
+		}
+		while(*cp >= '0' && *cp <= '9') {
+			cp++;
+		}
+	}
+	if (*cp) {
+		return setError(ERROR_INVALID);
+	}
+	return endValue(VALUE_NUMBER);
+}
+
+bool JsonStreamParser::isIncompletePrimitive() {
+	buffer[valueOffset + valueLen] = 0;
+
+	const char *cp = &buffer[valueOffset];
+	size_t len = strlen(cp);
+	static const char * const literals[] = { "true", "false", "null" };
+	for(size_t ii = 0; ii < sizeof(literals) / sizeof(literals[0]); ii++) {
+		if (len < strlen(literals[ii]) && strncmp(cp, literals[ii], len) == 0) {
+			return true;
+		}
+	}
+
+	// Number ending after the sign, decimal point, or exponent
+	if (*cp == '-') {
+		cp++;
+		if (!*cp) {
+			return true;
+		}
+	}
+	if (*cp == '0') {
+		cp++;
+	}
+	else
+	if (*cp >= '1' && *cp <= '9') {
+		while(*cp >= '0' && *cp <= '9') {
+			cp++;
+		}
+	}
+	else {
+		return false;
+	}
+	if (*cp == '.') {
+		cp++;
+		if (!*cp) {
+			return true;
+		}
+		while(*cp >= '0' && *cp <= '9') {
+			cp++;
+		}
+	}
+	if (*cp == 'e' || *cp == 'E') {
+		cp++;
+		if (*cp == '+' || *cp == '-') {
+			cp++;
+		}
+		return !*cp;
+	}
+	return false;
+}
+
+bool JsonStreamParser::appendChar(char c) {
+	// Leave room for the null terminator
+	if (valueOffset + valueLen + 1 >= bufferLen) {
+		return setError(ERROR_TOO_LONG);
+	}
+	buffer[valueOffset + valueLen++] = c;
+	return true;
+}
+
+bool JsonStreamParser::appendUtf8(uint32_t unicode) {
+	if (unicode <= 0x7f) {
+		return appendChar((char)unicode);
+	}
+	if (unicode <= 0x7ff) {
+		return appendChar((char)(0b11000000 | (unicode >> 6))) &&
+			appendChar((char)(0b10000000 | (unicode & 0b111111)));
+	}
+	if (unicode <= 0xffff) {
+		return appendChar((char)(0b11100000 | (unicode >> 12))) &&
+			appendChar((char)(0b10000000 | ((unicode >> 6) & 0b111111))) &&
+			appendChar((char)(0b10000000 | (unicode & 0b111111)));
+	}
+	return appendChar((char)(0b11110000 | (unicode >> 18))) &&
+		appendChar((char)(0b10000000 | ((unicode >> 12) & 0b111111))) &&
+		appendChar((char)(0b10000000 | ((unicode >> 6) & 0b111111))) &&
+		appendChar((char)(0b10000000 | (unicode & 0b111111)));
+}
+
+bool JsonStreamParser::callCallback(EventType event) {
+	if (callback && !callback(*this, event)) {
+		return setError(ERROR_CANCELED);
+	}
+	return true;
+}
+
+bool JsonStreamParser::setError(ErrorType error) {
+	this->error = error;
+	state = STATE_ERROR;
+	return false;
+}
+
+size_t JsonStreamParser::getFreeOffset() const {
+	if (depth == 0) {
+		return 0;
+	}
+	const Level &level = levels[depth - 1];
+	return level.keyOffset + level.keyLen + 1;
+}
+
+
 // begin jsmn.cpp
 // https://github.com/zserge/jsmn
 namespace JsonParserGeneratorRK {
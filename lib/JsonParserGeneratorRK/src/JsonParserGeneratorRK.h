@@ -4,6 +4,7 @@
 
 #include "Particle.h"
 
+#include <functional>
 #include <vector>
 
 // You can mostly ignore the stuff in this namespace block. It's part of the jsmn library
@@ -320,6 +321,30 @@ public:
 	 */
 	bool parse();
 
+	/**
+	 * @brief Enables a hash index of object keys to speed up getValueTokenByKey()
+	 *
+	 * @param enable true to enable the index, false to disable it and free its memory
+	 *
+	 * Without the index, getValueTokenByKey() compares each key in the object in turn, so looking up
+	 * every key of an object with n keys takes O(n^2) time. With the index enabled, the first call to
+	 * getValueTokenByKey() after parse() builds an open-addressing hash table of all of the keys in all
+	 * objects, and each lookup after that is a hash and typically one compare. The table is allocated on 
+	 * the heap (4 bytes per entry, at least twice the number of keys) even when using JsonParserStatic.
+	 *
+	 * The index is rebuilt after the data is changed by parse() or JsonModifier. If any key contains a 
+	 * backslash escape, or there are more than 65534 tokens, the linear search is used instead.
+	 */
+	void enableKeyIndex(bool enable = true);
+
+	/**
+	 * @brief Discards the key index, if enabled. It will be rebuilt on the next getValueTokenByKey().
+	 *
+	 * This is done automatically by parse() and JsonModifier. You only need to call it if you modify
+	 * the buffer or tokens directly.
+	 */
+	void invalidateKeyIndex() { keyIndexBuilt = keyIndexValid = false; };
+
 	/**
 	 * @brief Get a JsonReference object. This is used for fluent-style access to the data.
 	 */
@@ -768,10 +793,33 @@ public:
 	static void appendUtf8(uint16_t unicode, JsonParserString &str);
 
 protected:
+	/**
+	 * @brief Entry in the key index hash table
+	 */
+	typedef struct {
+		uint16_t container; //!< Index of the object token containing the key
+		uint16_t key; //!< Index of the key token + 1, 0 = empty entry
+	} KeyIndexEntry;
+
+	/**
+	 * @brief Builds the key index for the current tokens. Returns false if the index cannot be used.
+	 */
+	bool buildKeyIndex() const;
+
+	/**
+	 * @brief Hash of a key (FNV-1a) combined with the index of the object token containing it
+	 */
+	static uint32_t keyIndexHash(size_t containerIndex, const char *key, size_t keyLen);
+
 	JsonParserGeneratorRK::jsmntok_t *tokens; //!< Array of tokens after parsing.
 	JsonParserGeneratorRK::jsmntok_t *tokensEnd; //!< Pointer into tokens, points after last used token.
 	size_t	maxTokens; //!< Number of tokens that can be stored in tokens.
 	JsonParserGeneratorRK::jsmn_parser parser;//!< The JSMN parser object.
+	bool keyIndexEnabled; //!< enableKeyIndex() has been called
+	mutable bool keyIndexBuilt; //!< buildKeyIndex() has been called since the last change
+	mutable bool keyIndexValid; //!< The key index can be used for lookups
+	mutable KeyIndexEntry *keyIndex; //!< Key index hash table (heap allocated)
+	mutable size_t keyIndexSize; //!< Number of entries in keyIndex (power of 2)
 
 	friend class JsonModifier; // To access the tokens for modifying a JSON object in place
 };
@@ -996,7 +1044,7 @@ public:
 	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
 	 * as those functions take care of inserting the separators between items.
 	 */
-	void insertValue(int value) { insertsprintf("%d", value); }
+	void insertValue(int value) { insertSigned(value); }
 
 	/**
 	 * @brief Inserts an unsigned integer value.
@@ -1004,7 +1052,7 @@ public:
 	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
 	 * as those functions take care of inserting the separators between items.
 	 */
-	void insertValue(unsigned int value) { insertsprintf("%u", value); }
+	void insertValue(unsigned int value) { insertUnsigned(value); }
 
 	/**
 	 * @brief Inserts a long integer value.
@@ -1012,7 +1060,7 @@ public:
 	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
 	 * as those functions take care of inserting the separators between items.
 	 */
-	void insertValue(long value) { insertsprintf("%ld", value); }
+	void insertValue(long value) { insertSigned(value); }
 
 	/**
 	 * @brief Inserts an unsigned long integer value.
@@ -1020,7 +1068,7 @@ public:
 	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
 	 * as those functions take care of inserting the separators between items.
 	 */
-	void insertValue(unsigned long value) { insertsprintf("%lu", value); }
+	void insertValue(unsigned long value) { insertUnsigned(value); }
 
 	/**
 	 * @brief Inserts a floating point value.
@@ -1233,6 +1281,40 @@ public:
 	 */
 	void insertvsprintf(const char *fmt, va_list ap);
 
+	/**
+	 * @brief Used internally to insert a signed integer without using snprintf
+	 */
+	void insertSigned(int64_t value) { insertUnsigned((value < 0) ? (0 - (uint64_t)value) : (uint64_t)value, value < 0); }
+
+	/**
+	 * @brief Used internally to insert an unsigned integer without using snprintf
+	 *
+	 * @param value The value to insert
+	 *
+	 * @param negative Insert a - before the value
+	 */
+	void insertUnsigned(uint64_t value, bool negative = false);
+
+	/**
+	 * @brief Used internally to insert a floating point value with a fixed number of decimal places
+	 *
+	 * @param value The value to insert
+	 *
+	 * @param places The number of decimal places (0 - 9)
+	 *
+	 * @return true if the value was inserted, or false if it's not supported by this method and snprintf 
+	 * must be used instead (more than 9 decimal places, larger than 10^18 after scaling, NaN or infinite).
+	 *
+	 * The output is the same as snprintf "%.*f": the decimal value is rounded exactly, with ties rounded
+	 * to even, and a negative value that rounds to zero keeps its - sign.
+	 */
+	bool insertFixed(double value, int places);
+
+	/**
+	 * @brief Used internally to insert bytes that don't need escaping, such as a formatted number
+	 */
+	void insertData(const char *data, size_t dataLen);
+
 	/**
 	 * @brief Used internally to set the current isFirst flag in the context
 	 */
@@ -1485,6 +1567,361 @@ protected:
 	//bool addSeparator = false;	//!< Set by startAppend() and used by insertCheckSeparator()
 };
 
+/**
+ * @brief Streaming (SAX-style) JSON parser
+ *
+ * Unlike JsonParser, this does not keep the whole document and an array of tokens. Data is added in
+ * chunks of any size as it arrives, such as the parts of a multipart webhook response or reads from
+ * a file, and a callback is called for each object, array, and value as soon as it's complete.
+ *
+ * Memory use is fixed. The buffer holds the key at each level of the current path, plus the current
+ * key and value, and there is one Level per level of nesting. If a key or value is too large for the
+ * buffer, or the data is nested too deeply, parsing stops with an error.
+ *
+ * Typically you use JsonStreamParserStatic to allocate the buffers. In the callback, use getDepth(),
+ * getKey(), and getIndex() to find where the event is and getValue() to read the value:
+ *
+ * ```
+ * JsonStreamParserStatic<256, 8> streamParser;
+ * streamParser.setCallback([](JsonStreamParser &sp, JsonStreamParser::EventType event) {
+ *     int value;
+ *     if (event == JsonStreamParser::EVENT_VALUE && sp.getDepth() == 1 && strcmp(sp.getKey(), "a") == 0 && sp.getValue(value)) {
+ *         // Outer object key "a" was an integer
+ *     }
+ *     return true;
+ * });
+ * ```
+ */
+class JsonStreamParser {
+public:
+	/**
+	 * @brief Type of event passed to the callback
+	 */
+	enum EventType {
+		EVENT_OBJECT_START,	//!< An object is starting. getKey() and getIndex() are the position of the object.
+		EVENT_OBJECT_END,	//!< An object has ended. getKey() and getIndex() are the position of the object.
+		EVENT_ARRAY_START,	//!< An array is starting. getKey() and getIndex() are the position of the array.
+		EVENT_ARRAY_END,	//!< An array has ended. getKey() and getIndex() are the position of the array.
+		EVENT_VALUE			//!< A string, number, bool, or null. Use getValueType() and getValue().
+	};
+
+	/**
+	 * @brief Type of value for EVENT_VALUE
+	 */
+	enum ValueType {
+		VALUE_STRING,		//!< String, with escapes decoded to UTF-8
+		VALUE_NUMBER,		//!< Number. getValue() returns the number as it appears in the JSON
+		VALUE_BOOL,			//!< true or false
+		VALUE_NULL			//!< null
+	};
+
+	/**
+	 * @brief Reason parsing stopped, from getError()
+	 */
+	enum ErrorType {
+		ERROR_NONE,			//!< No error
+		ERROR_INVALID,		//!< The data is not valid JSON
+		ERROR_TOO_LONG,		//!< A key or value did not fit in the buffer
+		ERROR_TOO_DEEP,		//!< Objects and arrays are nested more deeply than maxDepth
+		ERROR_CANCELED,		//!< The callback returned false
+		ERROR_CHUNK_ORDER,	//!< addChunkedData() received a chunk out of order
+		ERROR_INCOMPLETE	//!< finish() was called before the end of the data
+	};
+
+	/**
+	 * @brief Callback function called for each event
+	 *
+	 * Return true to continue parsing or false to stop. The key and value are only valid during the callback.
+	 */
+	typedef std::function<bool(JsonStreamParser &parser, EventType event)> Callback;
+
+	/**
+	 * @brief One level of nesting (object or array)
+	 */
+	typedef struct {
+		bool isArray;		//!< true for an array, false for an object
+		size_t index;		//!< Index of the current member of the object or array (0 = first)
+		size_t keyOffset;	//!< Offset in the buffer of the key of the current member (empty for arrays)
+		size_t keyLen;		//!< Length of the key of the current member
+	} Level;
+
+	/**
+	 * @brief Construct a streaming parser using the specified buffers
+	 *
+	 * @param buffer Buffer for the keys in the path and the current value. Must hold the keys of all levels
+	 * of the path plus the largest value, each with a null terminator.
+	 *
+	 * @param bufferLen The length of buffer in bytes
+	 *
+	 * @param levels Array of maxDepth levels
+	 *
+	 * @param maxDepth The maximum number of nested objects and arrays
+	 */
+	JsonStreamParser(char *buffer, size_t bufferLen, Level *levels, size_t maxDepth);
+
+	/**
+	 * @brief Destructor. The buffers are not freed.
+	 */
+	virtual ~JsonStreamParser();
+
+	/**
+	 * @brief Sets the function to call for each event
+	 */
+	void setCallback(Callback callback) { this->callback = callback; };
+
+	/**
+	 * @brief Discards any partially parsed data and errors so a new document can be parsed
+	 */
+	void reset();
+
+	/**
+	 * @brief Parses more data. The callback is called for each event that is completed by this data.
+	 *
+	 * @param data Pointer to the data. Does not need to be null-terminated.
+	 *
+	 * @param dataLen Length of the data in bytes
+	 *
+	 * @return true if the data was parsed, false if there was an error (see getError()). After an error,
+	 * additional data is ignored until reset() is called.
+	 */
+	bool addData(const char *data, size_t dataLen);
+
+	/**
+	 * @brief Parses more data from a c-string
+	 */
+	bool addString(const char *data) { return addData(data, strlen(data)); }
+
+	/**
+	 * @brief Parses a part of a multipart webhook response
+	 *
+	 * @param event The event name, ending with /0, /1, ...
+	 *
+	 * @param data The event data (c-string)
+	 *
+	 * Unlike JsonBuffer::addChunkedData(), the chunks are parsed as they arrive and not stored, so they
+	 * must arrive in order. If not, this returns false with ERROR_CHUNK_ORDER and you can request the data 
+	 * again or fall back to JsonParser.
+	 */
+	bool addChunkedData(const char *event, const char *data);
+
+	/**
+	 * @brief Call after all of the data has been added
+	 *
+	 * @return true if a complete JSON value was parsed. If the data ended early, including in the middle of a
+	 * string, literal, or number, getError() returns ERROR_INCOMPLETE.
+	 *
+	 * This is needed to complete a document that is only a number, since there is no way to know when the 
+	 * number ends. For objects and arrays the final EVENT_OBJECT_END or EVENT_ARRAY_END is called from addData().
+	 */
+	bool finish();
+
+	/**
+	 * @brief Returns true if a complete JSON value has been parsed
+	 */
+	bool isDone() const { return state == STATE_DONE; };
+
+	/**
+	 * @brief Returns the reason parsing stopped, or ERROR_NONE
+	 */
+	ErrorType getError() const { return error; };
+
+	/**
+	 * @brief Number of objects and arrays containing the current event (0 = the outermost value)
+	 */
+	size_t getDepth() const { return depth; };
+
+	/**
+	 * @brief Key of the current event in its object, or an empty string if it's in an array or the outermost value
+	 */
+	const char *getKey() const { return getKey(depth); };
+
+	/**
+	 * @brief Key at a level of the path, from 1 (key in the outermost object) to getDepth() (same as getKey())
+	 */
+	const char *getKey(size_t level) const;
+
+	/**
+	 * @brief Index of the current event in its object or array (0 = first)
+	 */
+	size_t getIndex() const { return getIndex(depth); };
+
+	/**
+	 * @brief Index at a level of the path, from 1 (index in the outermost object or array) to getDepth()
+	 */
+	size_t getIndex(size_t level) const;
+
+	/**
+	 * @brief Returns true if the container at a level of the path is an array, from 1 to getDepth()
+	 */
+	bool isArray(size_t level) const { return (level >= 1 && level <= depth) ? levels[level - 1].isArray : false; };
+
+	/**
+	 * @brief Type of the value for EVENT_VALUE
+	 */
+	ValueType getValueType() const { return valueType; };
+
+	/**
+	 * @brief Value for EVENT_VALUE as a c-string
+	 *
+	 * For strings, escapes are decoded and the result is UTF-8. For numbers, bool, and null it's the
+	 * JSON text, such as "1.5", "true", or "null".
+	 */
+	const char *getValue() const { return &buffer[valueOffset]; };
+
+	/**
+	 * @brief Length of the value returned by getValue() in bytes
+	 */
+	size_t getValueLen() const { return valueLen; };
+
+	/**
+	 * @brief Gets a bool value. Returns false if the value is not a bool.
+	 */
+	bool getValue(bool &result) const;
+
+	/**
+	 * @brief Gets an integer value. Returns false if the value is not a number.
+	 */
+	bool getValue(int &result) const;
+
+	/**
+	 * @brief Gets an unsigned long value. Returns false if the value is not a number.
+	 */
+	bool getValue(unsigned long &result) const;
+
+	/**
+	 * @brief Gets a float value. Returns false if the value is not a number.
+	 */
+	bool getValue(float &result) const;
+
+	/**
+	 * @brief Gets a double value. Returns false if the value is not a number.
+	 */
+	bool getValue(double &result) const;
+
+	/**
+	 * @brief Gets a string value. Returns false if the value is not a string.
+	 */
+	bool getValue(String &result) const;
+
+protected:
+	/**
+	 * @brief Parser state
+	 */
+	enum State {
+		STATE_VALUE,		//!< Expecting a value
+		STATE_ARRAY_FIRST,	//!< After [, expecting a value or ]
+		STATE_OBJECT_FIRST,	//!< After {, expecting a key or }
+		STATE_OBJECT_KEY,	//!< After , in an object, expecting a key
+		STATE_COLON,		//!< After a key, expecting :
+		STATE_AFTER_VALUE,	//!< After a value in an object or array, expecting , or the end of the object or array
+		STATE_STRING,		//!< In a string
+		STATE_ESCAPE,		//!< After a backslash in a string
+		STATE_UNICODE,		//!< In the hex digits of a \u escape
+		STATE_PRIMITIVE,	//!< In a number, true, false, or null
+		STATE_DONE,			//!< The outermost value is complete
+		STATE_ERROR			//!< Stopped because of an error
+	};
+
+	/**
+	 * @brief Processes one character. Returns false on error.
+	 */
+	bool processChar(char c);
+
+	/**
+	 * @brief Starts an object or array. Returns false on error.
+	 */
+	bool startContainer(bool isArray);
+
+	/**
+	 * @brief Ends the current object or array. Returns false on error.
+	 */
+	bool endContainer();
+
+	/**
+	 * @brief Called when a string or primitive value is complete. Returns false on error.
+	 */
+	bool endValue(ValueType valueType);
+
+	/**
+	 * @brief Updates the state after a value, object, or array is complete
+	 */
+	void afterValue();
+
+	/**
+	 * @brief Checks a completed primitive and calls endValue(). Returns false on error.
+	 */
+	bool endPrimitive();
+
+	/**
+	 * @brief Returns true if the primitive is the start of a literal or number that was cut off, such as "tru" or "1e"
+	 */
+	bool isIncompletePrimitive();
+
+	/**
+	 * @brief Appends a byte to the current key or value. Returns false if the buffer is full.
+	 */
+	bool appendChar(char c);
+
+	/**
+	 * @brief Appends a Unicode code point as UTF-8. Returns false if the buffer is full.
+	 */
+	bool appendUtf8(uint32_t unicode);
+
+	/**
+	 * @brief Calls the callback. Returns false if it returned false.
+	 */
+	bool callCallback(EventType event);
+
+	/**
+	 * @brief Sets the error and the error state. Always returns false.
+	 */
+	bool setError(ErrorType error);
+
+	/**
+	 * @brief Offset in the buffer after the key at the current level, where a value or key is stored
+	 */
+	size_t getFreeOffset() const;
+
+	char *buffer; //!< Buffer for the keys in the path and the current key or value
+	size_t bufferLen; //!< Length of buffer in bytes
+	Level *levels; //!< Array of maxDepth levels
+	size_t maxDepth; //!< Maximum nesting of objects and arrays
+	Callback callback; //!< Function to call for each event
+
+	State state = STATE_VALUE; //!< Current parser state
+	ErrorType error = ERROR_NONE; //!< Reason for STATE_ERROR
+	size_t depth = 0; //!< Number of levels in use
+	bool isKey = false; //!< STATE_STRING is a key instead of a value
+	size_t valueOffset = 0; //!< Offset in buffer of the current key or value
+	size_t valueLen = 0; //!< Length of the current key or value
+	ValueType valueType = VALUE_NULL; //!< Type of the value for EVENT_VALUE
+	uint32_t unicode = 0; //!< Code point being decoded in STATE_UNICODE
+	uint8_t unicodeDigits = 0; //!< Number of hex digits decoded in STATE_UNICODE
+	uint16_t highSurrogate = 0; //!< First half of a UTF-16 surrogate pair, 0 if none
+	int nextChunk = 0; //!< Index of the next part expected by addChunkedData()
+};
+
+/**
+ * @brief Creates a JsonStreamParser with static buffers
+ *
+ * @param BUFFER_SIZE The size of the buffer. It must hold the keys of every level of the path plus 
+ * the largest key or value, each with a null terminator.
+ *
+ * @param MAX_DEPTH The maximum number of nested objects and arrays.
+ */
+template <size_t BUFFER_SIZE, size_t MAX_DEPTH>
+class JsonStreamParserStatic : public JsonStreamParser {
+public:
+	/**
+	 * @brief Construct a JsonStreamParser using static buffers
+	 */
+	explicit JsonStreamParserStatic() : JsonStreamParser(staticBuffer, BUFFER_SIZE, staticLevels, MAX_DEPTH) {};
+
+private:
+	char staticBuffer[BUFFER_SIZE]; //!< The static buffer for the path and value
+	Level staticLevels[MAX_DEPTH]; //!< The static levels
+};
+
 
 
 #endif /* __JSONPARSERGENERATORRK_H */
@@ -2,6 +2,7 @@
 #include "LocalTimeRK.h"
 
 #include <time.h>
+#include <chrono>
 
 // This test program assumes it's run with TZ set to "UTC" so strftime prints the same format
 // as a Particle device when using the native strftime. The Makefile calls it this way:
@@ -3316,12 +3317,335 @@ void test3() {
 	assertStr("", conv.format("%Y-%m-%d %H:%M:%S").c_str(), "2021-07-08 18:52:00");
 }
 
+const char *cacheTestConfigs[] = {
+	"EST5EDT,M3.2.0/2:00:00,M11.1.0/2:00:00",
+	"CET-1CEST,M3.5.0/2,M10.5.0/3",
+	"AEST-10AEDT,M10.1.0/2,M4.1.0/3",
+	"NZST-12NZDT,M9.5.0/2,M4.1.0/3",
+	"ACST-9:30",
+	0
+};
+
+void testTransitionCache() {
+	// The cached time changes in convert() must match calculating them every time
+	uint32_t seed = 1;
+	for(size_t ii = 0; cacheTestConfigs[ii]; ii++) {
+		LocalTimeConvert conv;
+		conv.withConfig(LocalTimePosixTimezone(cacheTestConfigs[ii]));
+
+		time_t time = LocalTime::stringToTime("1990-01-01 00:00:00");
+		time_t endTime = LocalTime::stringToTime("2100-01-01 00:00:00");
+		while(time < endTime) {
+			// Mostly small steps forward with occasional jumps in either direction
+			seed = seed * 1103515245 + 12345;
+			int step = (int)((seed >> 8) % 100000);
+			if ((seed & 0xff) < 3) {
+				step = -step * 10;
+			}
+			time += step;
+
+			conv.withTime(time).convert();
+
+			if (conv.config.hasDST()) {
+				struct tm dstTimeInfo, standardTimeInfo;
+				LocalTime::timeToTm(time, &dstTimeInfo);
+				standardTimeInfo = dstTimeInfo;
+
+				time_t dstStart = conv.config.dstStart.calculate(&dstTimeInfo, conv.config.standardHMS);
+				time_t standardStart = conv.config.standardStart.calculate(&standardTimeInfo, conv.config.dstHMS);
+
+				assert(conv.dstStart == dstStart);
+				assert(conv.standardStart == standardStart);
+				assertStr("", LocalTime::getTmString(&conv.dstStartTimeInfo).c_str(), LocalTime::getTmString(&dstTimeInfo).c_str());
+				assertStr("", LocalTime::getTmString(&conv.standardStartTimeInfo).c_str(), LocalTime::getTmString(&standardTimeInfo).c_str());
+			}
+			else {
+				assertInt("", (int)conv.position, (int)LocalTimeConvert::Position::NO_DST);
+			}
+		}
+	}
+
+	// Parsing a new configuration must not use the time changes from the old one
+	{
+		LocalTimeConvert conv;
+		conv.withConfig(LocalTimePosixTimezone("EST5EDT,M3.2.0/2:00:00,M11.1.0/2:00:00"));
+		conv.withTime(LocalTime::stringToTime("2022-07-01 00:00:00")).convert();
+		assertTime("", conv.dstStart, "tm_year=122 tm_mon=2 tm_mday=13 tm_hour=7 tm_min=0 tm_sec=0 tm_wday=0");
+
+		conv.config.parse("CET-1CEST,M3.5.0/2,M10.5.0/3");
+		conv.convert();
+		assertTime("", conv.dstStart, "tm_year=122 tm_mon=2 tm_mday=27 tm_hour=1 tm_min=0 tm_sec=0 tm_wday=0");
+	}
+}
+
+void benchConvert() {
+	// Converts a time every 15 minutes for 10 years, like walking forward through a schedule
+	LocalTimeConvert conv;
+	conv.withConfig(LocalTimePosixTimezone("EST5EDT,M3.2.0/2:00:00,M11.1.0/2:00:00"));
+
+	time_t startTime = LocalTime::stringToTime("2022-01-01 00:00:00");
+	size_t numCalls = 10 * 365 * 96;
+	int dstCount = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for(size_t ii = 0; ii < numCalls; ii++) {
+		conv.withTime(startTime + (time_t)ii * 900).convert();
+		if (conv.isDST()) {
+			dstCount++;
+		}
+	}
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("convert() %.0f calls per second (%d of %u in DST)\n", numCalls / elapsed, dstCount, (unsigned)numCalls);
+}
+
+const char *scheduleTestConfigs[] = {
+	"EST5EDT,M3.2.0/2:00:00,M11.1.0/2:00:00",
+	"CET-1CEST,M3.5.0/2,M10.5.0/3",
+	"AEST-10AEDT,M10.1.0/2,M4.1.0/3",
+	"NZST-12NZDT,M9.5.0/2,M4.1.0/3",
+	"ACST-9:30",
+	"NPT-5:45",
+	0
+};
+
+// Forces LocalTimeScheduleItem::getNextScheduledTime() to use the day by day code. The except
+// date never matches, so the result is not affected.
+LocalTimeScheduleItem iterativeScheduleItem(LocalTimeScheduleItem item) {
+	item.timeRange.withExceptDates({LocalTimeYMD("1970-01-01")});
+	return item;
+}
+
+void testScheduleFastPath() {
+	struct {
+		LocalTimeScheduleItem::ScheduleItemType type;
+		int increment;
+		const char *start;
+		const char *end;
+	} items[] = {
+		{ LocalTimeScheduleItem::ScheduleItemType::MINUTE_OF_HOUR, 1, "00:00:00", "23:59:59" },
+		{ LocalTimeScheduleItem::ScheduleItemType::MINUTE_OF_HOUR, 5, "00:00:00", "23:59:59" },
+		{ LocalTimeScheduleItem::ScheduleItemType::MINUTE_OF_HOUR, 15, "00:00:00", "23:59:59" },
+		{ LocalTimeScheduleItem::ScheduleItemType::MINUTE_OF_HOUR, 15, "09:00:00", "17:00:00" },
+		{ LocalTimeScheduleItem::ScheduleItemType::MINUTE_OF_HOUR, 7, "00:00:30", "06:30:00" },
+		{ LocalTimeScheduleItem::ScheduleItemType::MINUTE_OF_HOUR, 30, "22:15:10", "23:59:59" },
+		{ LocalTimeScheduleItem::ScheduleItemType::MINUTE_OF_HOUR, 59, "00:03:00", "23:59:59" },
+		{ LocalTimeScheduleItem::ScheduleItemType::HOUR_OF_DAY, 1, "00:00:00", "23:59:59" },
+		{ LocalTimeScheduleItem::ScheduleItemType::HOUR_OF_DAY, 2, "00:15:00", "23:59:59" },
+		{ LocalTimeScheduleItem::ScheduleItemType::HOUR_OF_DAY, 3, "06:30:00", "18:00:00" },
+		{ LocalTimeScheduleItem::ScheduleItemType::HOUR_OF_DAY, 5, "05:00:00", "05:00:00" },
+		{ LocalTimeScheduleItem::ScheduleItemType::HOUR_OF_DAY, 24, "00:00:00", "23:59:59" },
+	};
+
+	uint32_t seed = 1;
+	int numChecked = 0;
+
+	for(size_t ii = 0; scheduleTestConfigs[ii]; ii++) {
+		LocalTimePosixTimezone tz(scheduleTestConfigs[ii]);
+
+		for(size_t jj = 0; jj < sizeof(items) / sizeof(items[0]); jj++) {
+			LocalTimeScheduleItem item;
+			item.scheduleItemType = items[jj].type;
+			item.increment = items[jj].increment;
+			item.timeRange.hmsStart = LocalTimeHMS(items[jj].start);
+			item.timeRange.hmsEnd = LocalTimeHMS(items[jj].end);
+			LocalTimeScheduleItem iterativeItem = iterativeScheduleItem(item);
+
+			LocalTimeConvert conv;
+			conv.withConfig(tz);
+
+			time_t startTime = LocalTime::stringToTime("2022-01-01 00:00:00");
+			for(int kk = 0; kk < 3000; kk++) {
+				seed = seed * 1103515245 + 12345;
+				time_t time = startTime + (time_t)((seed >> 1) % (10 * 366 * 86400));
+
+				if (kk % 2 && tz.hasDST()) {
+					// Every other time is within 3 days of a time change
+					conv.withTime(time).convert();
+					seed = seed * 1103515245 + 12345;
+					time = (((seed >> 4) & 1) ? conv.dstStart : conv.standardStart) + (time_t)((seed >> 8) % (6 * 86400)) - 3 * 86400;
+				}
+
+				LocalTimeConvert fastConv, iterativeConv;
+				fastConv.withConfig(tz).withTime(time).convert();
+				iterativeConv = fastConv;
+
+				bool fastResult = item.getNextScheduledTime(fastConv);
+				bool iterativeResult = iterativeItem.getNextScheduledTime(iterativeConv);
+				if (fastResult != iterativeResult || fastConv.time != iterativeConv.time) {
+					printf("schedule mismatch tz=%s item=%d time=%s fast=%d %s iterative=%d %s\n", scheduleTestConfigs[ii], (int)jj, 
+						LocalTime::timeToString(time).c_str(), 
+						fastResult, LocalTime::timeToString(fastConv.time).c_str(),
+						iterativeResult, LocalTime::timeToString(iterativeConv.time).c_str());
+					assert(false);
+				}
+				numChecked++;
+			}
+		}
+	}
+	printf("schedule fast path matched %d times\n", numChecked);
+}
+
+void benchScheduleFastPath() {
+	LocalTimeScheduleItem every15;
+	every15.scheduleItemType = LocalTimeScheduleItem::ScheduleItemType::MINUTE_OF_HOUR;
+	every15.increment = 15;
+
+	LocalTimeScheduleItem every2Hours;
+	every2Hours.scheduleItemType = LocalTimeScheduleItem::ScheduleItemType::HOUR_OF_DAY;
+	every2Hours.increment = 2;
+	every2Hours.timeRange.hmsStart = LocalTimeHMS("06:15:00");
+	every2Hours.timeRange.hmsEnd = LocalTimeHMS("18:00:00");
+
+	LocalTimeScheduleItem *items[2] = { &every15, &every2Hours };
+	const char *names[2] = { "every 15 minutes", "every 2 hours 06:15-18:00" };
+
+	for(size_t ii = 0; ii < 2; ii++) {
+		LocalTimeScheduleItem iterativeItem = iterativeScheduleItem(*items[ii]);
+		double callsPerSec[2];
+
+		for(size_t jj = 0; jj < 2; jj++) {
+			const LocalTimeScheduleItem &item = (jj == 0) ? iterativeItem : *items[ii];
+			LocalTimeConvert conv;
+			conv.withConfig(LocalTimePosixTimezone("EST5EDT,M3.2.0/2:00:00,M11.1.0/2:00:00"));
+
+			// Wake every 7 minutes for 30 days
+			time_t startTime = LocalTime::stringToTime("2022-06-01 00:00:00");
+			int numCalls = 30 * 24 * 60 / 7;
+
+			auto start = std::chrono::steady_clock::now();
+			for(int kk = 0; kk < numCalls; kk++) {
+				conv.withTime(startTime + kk * 7 * 60).convert();
+				item.getNextScheduledTime(conv);
+			}
+			double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			callsPerSec[jj] = numCalls / elapsed;
+		}
+		printf("getNextScheduledTime() %s: %.0f calls per second iterative, %.0f fast (%.1fx)\n", names[ii], callsPerSec[0], callsPerSec[1], callsPerSec[1] / callsPerSec[0]);
+	}
+}
+
+void addSchedulePlanTestSchedules(LocalTimeScheduleManager &manager) {
+	manager.getScheduleByName("quick")
+		.withFlags(LocalTimeSchedule::FLAG_QUICK_WAKE)
+		.withHourOfDay(2, LocalTimeRange(LocalTimeHMS("06:15:00"), LocalTimeHMS("18:00:00")))
+		.withTimes({LocalTimeHMSRestricted(LocalTimeHMS("03:30:00"), LocalTimeRestrictedDate(LocalTimeDayOfWeek::MASK_WEEKDAY))});
+	manager.getScheduleByName("data")
+		.withFlags(LocalTimeSchedule::FLAG_QUICK_WAKE)
+		.withMinuteOfHour(15, LocalTimeRange(LocalTimeHMS("05:00:00"), LocalTimeHMS("21:59:59")));
+	manager.getScheduleByName("full")
+		.withFlags(LocalTimeSchedule::FLAG_FULL_WAKE)
+		.withMinuteOfHour(60, LocalTimeRange(LocalTimeHMS("05:00:00"), LocalTimeHMS("21:59:59")));
+	manager.getScheduleByName("monthly")
+		.withFlags(LocalTimeSchedule::FLAG_FULL_WAKE)
+		.withDayOfMonth(15, LocalTimeRange(LocalTimeHMS("12:00:00"), LocalTimeHMS("12:00:00")));
+}
+
+void testSchedulePlan() {
+	LocalTimeScheduleManager direct, planned;
+	addSchedulePlanTestSchedules(direct);
+	addSchedulePlanTestSchedules(planned);
+	planned.withPlanHorizon();
+
+	uint32_t seed = 1;
+	int numChecked = 0;
+
+	// The same planned manager is used for every timezone to make sure timezone changes are detected
+	for(size_t ii = 0; scheduleTestConfigs[ii]; ii++) {
+		LocalTimeConvert conv;
+		conv.withConfig(LocalTimePosixTimezone(scheduleTestConfigs[ii]));
+
+		time_t time = LocalTime::stringToTime("2022-01-01 00:00:00");
+		for(int kk = 0; kk < 20000; kk++) {
+			seed = seed * 1103515245 + 12345;
+			int rand = (int)((seed >> 4) % 1000);
+			if (rand < 2) {
+				// Occasionally jump forward or backward up to a year
+				time += (time_t)((seed >> 12) % (2 * 366 * 86400)) - 366 * 86400;
+			}
+			else {
+				// Usually move forward up to 20 minutes, like waking from sleep
+				time += rand + ((seed >> 12) % 1200);
+			}
+
+			if (kk == 10000) {
+				// Schedule changes must be detected without calling invalidatePlan()
+				direct.getScheduleByName("full").withMinuteOfHour(20, LocalTimeRange(LocalTimeHMS("01:00:00"), LocalTimeHMS("02:00:00")));
+				planned.getScheduleByName("full").withMinuteOfHour(20, LocalTimeRange(LocalTimeHMS("01:00:00"), LocalTimeHMS("02:00:00")));
+			}
+
+			conv.withTime(time).convert();
+
+			time_t directTimes[3] = { direct.getNextWake(conv), direct.getNextFullWake(conv), direct.getNextDataCapture(conv) };
+			time_t plannedTimes[3] = { planned.getNextWake(conv), planned.getNextFullWake(conv), planned.getNextDataCapture(conv) };
+			for(size_t jj = 0; jj < 3; jj++) {
+				if (directTimes[jj] != plannedTimes[jj]) {
+					printf("plan mismatch tz=%s query=%d time=%s direct=%s planned=%s\n", scheduleTestConfigs[ii], (int)jj, 
+						LocalTime::timeToString(time).c_str(), 
+						LocalTime::timeToString(directTimes[jj]).c_str(),
+						LocalTime::timeToString(plannedTimes[jj]).c_str());
+					assert(false);
+				}
+			}
+			numChecked++;
+		}
+
+		direct.schedules.clear();
+		planned.schedules.clear();
+		addSchedulePlanTestSchedules(direct);
+		addSchedulePlanTestSchedules(planned);
+	}
+	printf("schedule plan matched %d times\n", numChecked);
+}
+
+void benchSchedulePlan() {
+	double wakesPerSec[2];
+
+	for(size_t ii = 0; ii < 2; ii++) {
+		LocalTimeScheduleManager manager;
+		addSchedulePlanTestSchedules(manager);
+		if (ii == 1) {
+			manager.withPlanHorizon();
+		}
+
+		LocalTimeConvert conv;
+		conv.withConfig(LocalTimePosixTimezone("EST5EDT,M3.2.0/2:00:00,M11.1.0/2:00:00"));
+
+		// Wake at each scheduled time for 30 days, calculating the next wake, full wake, and data capture each time
+		time_t time = LocalTime::stringToTime("2022-06-01 00:00:00");
+		time_t endTime = time + 30 * 86400;
+		int numWakes = 0;
+		time_t check = 0;
+
+		auto start = std::chrono::steady_clock::now();
+		while(time < endTime) {
+			conv.withTime(time).convert();
+			time_t nextWake = manager.getNextWake(conv);
+			check += manager.getNextFullWake(conv) + manager.getNextDataCapture(conv);
+			time = nextWake;
+			numWakes++;
+		}
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		wakesPerSec[ii] = numWakes / elapsed;
+		if (check == 0) {
+			printf("no wakes\n");
+		}
+	}
+	printf("wake path (3 schedule queries): %.0f wakes per second direct, %.0f planned (%.1fx)\n", wakesPerSec[0], wakesPerSec[1], wakesPerSec[1] / wakesPerSec[0]);
+}
+
 int main(int argc, char *argv[]) {
 	testLocalTimeChange();
 	testLocalTimePosixTimezone();
 	test1();
 	test3();
 	testFiles();
+	testTransitionCache();
+	benchConvert();
+	testScheduleFastPath();
+	benchScheduleFastPath();
+	testSchedulePlan();
+	benchSchedulePlan();
 
 	// test2 sets the global timezone configuration
 	test2();
@@ -1,5 +1,7 @@
 #include "LocalTimeRK.h"
 
+#include <algorithm>
+
 LocalTime *LocalTime::_instance;
 
 //
@@ -442,9 +444,12 @@ void LocalTimePosixTimezone::clear() {
     standardStart.clear();
     standardName = "";
     standardHMS.clear();
+    invalidateTransitions();
 }
 
 bool LocalTimePosixTimezone::parse(const char *str) {
+    invalidateTransitions();
+
     char *mutableCopy = strdup(str);
 
     char *token, *save = mutableCopy;
@@ -519,6 +524,57 @@ bool LocalTimePosixTimezone::parse(const char *str) {
     return valid;
 }
 
+// [static]
+Mutex LocalTimePosixTimezone::transitionsMutex;
+
+LocalTimePosixTimezone::TransitionYear LocalTimePosixTimezone::getTransitions(time_t time) const {
+    WITH_LOCK(transitionsMutex) {
+        for(size_t ii = 0; ii < sizeof(transitions) / sizeof(transitions[0]); ii++) {
+            if (transitions[ii].set && time >= transitions[ii].yearStart && time < transitions[ii].yearEnd) {
+                return transitions[ii];
+            }
+        }
+
+        struct tm timeInfo;
+        LocalTime::timeToTm(time, &timeInfo);
+
+        // The current and next year always go in different slots
+        TransitionYear &ty = transitions[timeInfo.tm_year & 1];
+        ty.year = timeInfo.tm_year;
+
+        struct tm yearInfo = {0};
+        yearInfo.tm_year = ty.year;
+        yearInfo.tm_mday = 1;
+        ty.yearStart = LocalTime::tmToTime(&yearInfo);
+
+        yearInfo = {0};
+        yearInfo.tm_year = ty.year + 1;
+        yearInfo.tm_mday = 1;
+        ty.yearEnd = LocalTime::tmToTime(&yearInfo);
+
+        // Only tm_year is used from the input to calculate()
+        // See LocalTimeConvert::convert() for why standardHMS is used for dstStart and dstHMS for standardStart
+        ty.dstStartTimeInfo = timeInfo;
+        ty.dstStart = dstStart.calculate(&ty.dstStartTimeInfo, standardHMS);
+
+        ty.standardStartTimeInfo = timeInfo;
+        ty.standardStart = standardStart.calculate(&ty.standardStartTimeInfo, dstHMS);
+
+        ty.set = true;
+
+        return ty;
+    }
+    return TransitionYear();
+}
+
+void LocalTimePosixTimezone::invalidateTransitions() const {
+    WITH_LOCK(transitionsMutex) {
+        for(size_t ii = 0; ii < sizeof(transitions) / sizeof(transitions[0]); ii++) {
+            transitions[ii].set = false;
+        }
+    }
+}
+
 //
 // LocalTimeValue
 //
@@ -596,6 +652,10 @@ int LocalTimeValue::ordinal() const {
 //
 bool LocalTimeScheduleItem::getNextScheduledTime(LocalTimeConvert &conv) const {
 
+    if (getNextScheduledTimeFast(conv)) {
+        return true;
+    }
+
     LocalTimeConvert tempConv(conv);
     
     LocalTimeYMD endYMD;
@@ -822,6 +882,117 @@ void LocalTimeScheduleItem::fromJson(JSONValue jsonObj) {
     timeRange.fromJson(jsonObj);
 }
 
+bool LocalTimeScheduleItem::getNextScheduledTimeFast(LocalTimeConvert &conv) const {
+    if (scheduleItemType != ScheduleItemType::MINUTE_OF_HOUR && scheduleItemType != ScheduleItemType::HOUR_OF_DAY) {
+        return false;
+    }
+    if (increment <= 0 || LocalTime::instance().getScheduleLookaheadDays() < 1) {
+        return false;
+    }
+
+    // Every date must be valid so the result is always today or tomorrow
+    if (!timeRange.onlyOnDates.empty() || !timeRange.exceptDates.empty() || 
+        (timeRange.onlyOnDays.getMask() & LocalTimeDayOfWeek::MASK_ALL) != LocalTimeDayOfWeek::MASK_ALL) {
+        return false;
+    }
+
+    // The HMS comparisons below are done in seconds, which is only the same as LocalTimeHMS::compareTo
+    // if the values are normalized
+    const LocalTimeHMS &hmsStart = timeRange.hmsStart;
+    const LocalTimeHMS &hmsEnd = timeRange.hmsEnd;
+    if (hmsStart.ignore || hmsEnd.ignore ||
+        hmsStart.hour < 0 || hmsStart.hour > 23 || hmsStart.minute < 0 || hmsStart.minute > 59 || hmsStart.second < 0 || hmsStart.second > 59 ||
+        hmsEnd.hour < 0 || hmsEnd.hour > 23 || hmsEnd.minute < 0 || hmsEnd.minute > 59 || hmsEnd.second < 0 || hmsEnd.second > 59) {
+        return false;
+    }
+    int startSec = hmsStart.toSeconds();
+    int endSec = hmsEnd.toSeconds();
+
+    // Local midnight at the start of today, UTC. Local time is (time - dayStart) as long as the
+    // UTC offset does not change, so there must not be a time change from the day before until the
+    // end of tomorrow. The extra day on each side covers LocalTimeValue::toUTC(), which tests the
+    // standard time offset first. Crossing into a new UTC year also uses the iterative code.
+    int localSec = conv.localTimeValue.hms().toSeconds();
+    time_t dayStart = conv.time - localSec;
+
+    if (conv.config.hasDST()) {
+        time_t windowStart = dayStart - 86400;
+        time_t windowEnd = dayStart + 3 * 86400;
+
+        LocalTimePosixTimezone::TransitionYear ty = conv.config.getTransitions(windowStart);
+        if (windowEnd >= ty.yearEnd) {
+            return false;
+        }
+        if ((ty.dstStart > windowStart && ty.dstStart <= windowEnd) || 
+            (ty.standardStart > windowStart && ty.standardStart <= windowEnd)) {
+            return false;
+        }
+    }
+
+    // Same as the MINUTE_OF_HOUR calculation in getNextScheduledTime(), which rounds in UTC minutes 
+    // using the local minute
+    int startingModulo = hmsStart.minute % increment;
+    auto nextMinuteMultiple = [&](time_t time) {
+        time += increment * 60;
+        int localMinute = (int)(((time - dayStart) % 3600) / 60);
+        return time - (time % 60) + hmsStart.second - ((localMinute - startingModulo) % increment) * 60;
+    };
+
+    time_t result = 0;
+    bool found = false;
+
+    int cmp = timeRange.compareTo(conv.localTimeValue.hms());
+    if (cmp < 0) {
+        // Before time range, beginning of time range today
+        result = dayStart + startSec;
+        found = true;
+    }
+    else
+    if (cmp == 0) {
+        if (scheduleItemType == ScheduleItemType::HOUR_OF_DAY) {
+            // First multiple of increment hours after hmsStart that's after the current time
+            int step = increment * 3600;
+            int nextSec = startSec + ((localSec - startSec) / step + 1) * step;
+            if (nextSec <= endSec) {
+                result = dayStart + nextSec;
+                found = true;
+            }
+        }
+        else {
+            result = nextMinuteMultiple(conv.time);
+            if ((int)((result - dayStart) % 86400) < endSec) {
+                found = true;
+            }
+            else
+            if (result - dayStart >= 86400) {
+                return false;
+            }
+        }
+    }
+
+    if (!found) {
+        // Tomorrow, starting at 00:00:00
+        time_t tomorrow = dayStart + 86400;
+        if (startSec > 0) {
+            result = tomorrow + startSec;
+        }
+        else
+        if (scheduleItemType == ScheduleItemType::HOUR_OF_DAY) {
+            result = tomorrow;
+        }
+        else {
+            result = nextMinuteMultiple(tomorrow);
+            if ((int)((result - tomorrow) % 86400) >= endSec) {
+                return false;
+            }
+        }
+    }
+
+    conv.time = result;
+    conv.convert();
+    return true;
+}
+
 //
 // LocalTimeSchedule
 //
@@ -903,10 +1074,26 @@ void LocalTimeSchedule::fromJson(JSONValue jsonArray) {
 
 
 bool LocalTimeSchedule::getNextScheduledTime(LocalTimeConvert &conv) const {
+    // Same as the filter version below, but without copying each item to pass to the filter
+    time_t closestTime = 0;
 
-    return getNextScheduledTime(conv, [](LocalTimeScheduleItem &item) {
+    for(auto it = scheduleItems.begin(); it != scheduleItems.end(); ++it) {
+        LocalTimeConvert tmpConvert(conv);
+        if (it->getNextScheduledTime(tmpConvert)) {
+            if (closestTime == 0 || tmpConvert.time < closestTime) {
+                closestTime = tmpConvert.time;
+            }
+        }
+    }
+
+    if (closestTime != 0) {
+        conv.time = closestTime;
+        conv.convert();
         return true;
-    });
+    }
+    else {
+        return false;
+    }
 }
 
 bool LocalTimeSchedule::getNextScheduledTime(LocalTimeConvert &conv, std::function<bool(LocalTimeScheduleItem &item)> filter) const {
@@ -917,7 +1104,7 @@ bool LocalTimeSchedule::getNextScheduledTime(LocalTimeConvert &conv, std::functi
         if (filter(item)) {
             LocalTimeConvert tmpConvert(conv);
             bool bResult = item.getNextScheduledTime(tmpConvert);
-            if (bResult && closestTime == 0 || tmpConvert.time < closestTime) {
+            if (bResult && (closestTime == 0 || tmpConvert.time < closestTime)) {
                 closestTime = tmpConvert.time;
             }
         }
@@ -976,54 +1163,157 @@ time_t LocalTimeScheduleManager::getNextTimeByName(const char *name, const Local
 }
 
 time_t LocalTimeScheduleManager::getNextWake(const LocalTimeConvert &conv) const {
+    return getNextTime(conv, LocalTimeSchedule::FLAG_ANY_WAKE, NULL);
+}
+
+time_t LocalTimeScheduleManager::getNextFullWake(const LocalTimeConvert &conv) const {
+    return getNextTime(conv, LocalTimeSchedule::FLAG_FULL_WAKE, NULL);
+}
+
+time_t LocalTimeScheduleManager::getNextDataCapture(const LocalTimeConvert &conv) const {
+    return getNextTime(conv, 0, "data");
+}
+
+time_t LocalTimeScheduleManager::getNextTime(const LocalTimeConvert &conv, uint32_t flagMask, const char *name) const {
+    bool usePlan = updatePlan(conv);
     time_t nextTime = 0;
 
-    for(auto it = schedules.begin(); it != schedules.end(); ++it) {
-        if ((it->flags & LocalTimeSchedule::FLAG_ANY_WAKE) != 0) {
+    for(size_t ii = 0; ii < schedules.size(); ii++) {
+        const LocalTimeSchedule &schedule = schedules[ii];
+        if ((schedule.flags & flagMask) == 0 && (!name || !schedule.name.equals(name))) {
+            continue;
+        }
+
+        time_t scheduleTime = 0;
+        bool found = false;
+
+        if (usePlan) {
+            const std::vector<time_t> &times = plans[ii].times;
+            auto it = std::upper_bound(times.begin(), times.end(), conv.time);
+            if (it != times.end()) {
+                scheduleTime = *it;
+                found = true;
+            }
+            // Otherwise the schedule had no more times after the end of its plan, but there could be
+            // one within the lookahead days from conv, so check the schedule
+        }
+        if (!found) {
             LocalTimeConvert tempConv(conv);
-            if (it->getNextScheduledTime(tempConv)) {
-                if (nextTime == 0 || tempConv.time < nextTime) {
-                    nextTime = tempConv.time;
-                }
+            if (schedule.getNextScheduledTime(tempConv)) {
+                scheduleTime = tempConv.time;
             }
         }
+
+        if (scheduleTime != 0 && (nextTime == 0 || scheduleTime < nextTime)) {
+            nextTime = scheduleTime;
+        }
     }
     return nextTime;
 }
 
-time_t LocalTimeScheduleManager::getNextFullWake(const LocalTimeConvert &conv) const {
-    time_t nextTime = 0;
+bool LocalTimeScheduleManager::updatePlan(const LocalTimeConvert &conv) const {
+    if (planHorizon <= 0) {
+        return false;
+    }
 
-    for(auto it = schedules.begin(); it != schedules.end(); ++it) {
-        if ((it->flags & LocalTimeSchedule::FLAG_FULL_WAKE) != 0) {
-            LocalTimeConvert tempConv(conv);
-            if (it->getNextScheduledTime(tempConv)) {
-                if (nextTime == 0 || tempConv.time < nextTime) {
-                    nextTime = tempConv.time;
-                }
+    uint32_t signature = getPlanSignature(conv);
+    if (planValid && signature == planSignature && conv.time >= planStart && conv.time < planValidUntil) {
+        return true;
+    }
+
+    // Calculate each schedule's times by repeatedly getting the next scheduled time. One time after 
+    // the end of the horizon is included so any time before planValidUntil has its next time in the plan.
+    planStart = conv.time;
+    planValidUntil = conv.time + planHorizon;
+    planSignature = signature;
+    plans.clear();
+    plans.resize(schedules.size());
+
+    for(size_t ii = 0; ii < schedules.size(); ii++) {
+        SchedulePlan &plan = plans[ii];
+        LocalTimeConvert tempConv(conv);
+
+        while(true) {
+            time_t lastTime = tempConv.time;
+            if (!schedules[ii].getNextScheduledTime(tempConv) || tempConv.time <= lastTime) {
+                plan.exhausted = true;
+                break;
             }
+            plan.times.push_back(tempConv.time);
+
+            if (tempConv.time > planStart + planHorizon || plan.times.size() >= maxPlanTimes) {
+                break;
+            }
+        }
+
+        if (!plan.exhausted && plan.times.back() < planValidUntil) {
+            // Stopped at maxPlanTimes
+            planValidUntil = plan.times.back();
         }
     }
-    return nextTime;
+    planValid = true;
+
+    return true;
 }
 
-time_t LocalTimeScheduleManager::getNextDataCapture(const LocalTimeConvert &conv) const {
-    time_t nextTime = 0;
+uint32_t LocalTimeScheduleManager::getPlanSignature(const LocalTimeConvert &conv) const {
+    // FNV-1a
+    uint32_t hash = 2166136261U;
+    auto add = [&hash](int value) {
+        for(size_t ii = 0; ii < sizeof(value); ii++) {
+            hash = (hash ^ (uint8_t)(value >> (ii * 8))) * 16777619U;
+        }
+    };
+    auto addHMS = [&add](const LocalTimeHMS &hms) {
+        add(hms.hour);
+        add(hms.minute);
+        add(hms.second);
+        add(hms.ignore);
+    };
+    auto addChange = [&add, &addHMS](const LocalTimeChange &change) {
+        add(change.month);
+        add(change.week);
+        add(change.dayOfWeek);
+        add(change.valid);
+        addHMS(change.hms);
+    };
+    auto addDates = [&add](const std::vector<LocalTimeYMD> &dates) {
+        add((int)dates.size());
+        for(auto it = dates.begin(); it != dates.end(); ++it) {
+            add(it->getYear() * 10000 + it->getMonth() * 100 + it->getDay());
+        }
+    };
+
+    add(LocalTime::instance().getScheduleLookaheadDays());
 
+    add(conv.config.valid);
+    addHMS(conv.config.standardHMS);
+    addHMS(conv.config.dstHMS);
+    addChange(conv.config.dstStart);
+    addChange(conv.config.standardStart);
+
+    add((int)schedules.size());
     for(auto it = schedules.begin(); it != schedules.end(); ++it) {
-        if (it->name.equals("data")) {
-            LocalTimeConvert tempConv(conv);
-            if (it->getNextScheduledTime(tempConv)) {
-                if (nextTime == 0 || tempConv.time < nextTime) {
-                    nextTime = tempConv.time;
-                }
-            }
+        add((int)it->flags);
+        for(const char *cp = it->name.c_str(); *cp; cp++) {
+            add(*cp);
+        }
+        add((int)it->scheduleItems.size());
+        for(auto it2 = it->scheduleItems.begin(); it2 != it->scheduleItems.end(); ++it2) {
+            add((int)it2->scheduleItemType);
+            add(it2->increment);
+            add(it2->dayOfWeek);
+            add(it2->flags);
+            addHMS(it2->timeRange.hmsStart);
+            addHMS(it2->timeRange.hmsEnd);
+            add(it2->timeRange.onlyOnDays.getMask());
+            addDates(it2->timeRange.onlyOnDates);
+            addDates(it2->timeRange.exceptDates);
         }
     }
-    return nextTime;
+    return hash;
 }
 
-
 void LocalTimeScheduleManager::forEach(std::function<void(LocalTimeSchedule &schedule)> callback) {
     for(auto it = schedules.begin(); it != schedules.end(); ++it) {
         callback(*it);
@@ -1047,6 +1337,8 @@ LocalTimeSchedule &LocalTimeScheduleManager::getScheduleByName(const char *name)
 
 
 void LocalTimeScheduleManager::setFromJsonObject(const JSONValue &jsonObj) {
+    invalidatePlan();
+
     JSONObjectIterator iter(jsonObj);
     while(iter.next()) {
         String key = (const char *)iter.name();
@@ -1107,17 +1399,20 @@ void LocalTimeConvert::convert() {
     }
 
     if (config.hasDST()) {
-        // We need to worry about daylight saving time
-        LocalTime::timeToTm(time, &dstStartTimeInfo);
-        standardStartTimeInfo = dstStartTimeInfo;
+        // We need to worry about daylight saving time. The time changes for this year come from the
+        // cache in config, and are only calculated when time moves into a year that's not cached.
+        //
+        // Note that the start of DST is calculated using standardHMS because when you enter DST at 
+        // a local standard time; you have not yet entered DST. The start of standard time uses
+        // dstHMS: when entering standard time you are leaving DST. For example you leave DST at 
+        // 2 AM EDT (-0400) so that's the adjustment to UTC.
+        LocalTimePosixTimezone::TransitionYear ty = config.getTransitions(time);
 
-        // Calculate start of DST. Note that the second parameter is standardHMS because when you enter DST at 
-        // a local standard time; you have not yet entered DST.
-        dstStart = config.dstStart.calculate(&dstStartTimeInfo, config.standardHMS);
+        dstStart = ty.dstStart;
+        dstStartTimeInfo = ty.dstStartTimeInfo;
 
-        // Calculate start of standard time. Same for the second parameter here, when entering standard time
-        // you are leaving DST. For example you leave DST at 2 AM EDT (-0400) so that's the adjustment to UTC.
-        standardStart = config.standardStart.calculate(&standardStartTimeInfo, config.dstHMS);
+        standardStart = ty.standardStart;
+        standardStartTimeInfo = ty.standardStartTimeInfo;
 
         if (dstStart < standardStart) {
             // Northern Hemisphere, DST is in summer
@@ -1224,6 +1519,14 @@ void LocalTimeConvert::nextTime(LocalTimeHMS hms) {
 
 
 void LocalTimeConvert::nextDay(LocalTimeHMS hms) {
+    if (!hms.ignore) {
+        // Start from noon local time. On the day of a daylight saving transition the day is 23 or 25 
+        // hours long, and adding 86400 seconds to a time near midnight would skip a day or stay on the
+        // same day (which made schedules that stepped through days using midnight loop forever).
+        localTimeValue.tm_hour = 12;
+        localTimeValue.tm_min = localTimeValue.tm_sec = 0;
+        time = localTimeValue.toUTC(config);
+    }
     time += 86400;
     convert();
 
@@ -1074,6 +1074,44 @@ public:
      */
     bool isZ() const { return !valid || (!hasDST() && standardHMS.toSeconds() == 0); };
 
+    /**
+     * @brief The UTC times of the time changes in one year (UTC year)
+     */
+    class TransitionYear {
+    public:
+        bool set = false;           //!< true if the values below have been calculated
+        int year = 0;               //!< tm_year (121 = 2021)
+        time_t yearStart = 0;       //!< January 1 00:00:00 UTC of year
+        time_t yearEnd = 0;         //!< January 1 00:00:00 UTC of the following year
+        time_t dstStart = 0;        //!< When DST starts, UTC
+        struct tm dstStartTimeInfo; //!< The struct tm that corresponds to dstStart (UTC)
+        time_t standardStart = 0;   //!< When standard time starts, UTC
+        struct tm standardStartTimeInfo; //!< The struct tm that corresponds to standardStart (UTC)
+    };
+
+    /**
+     * @brief Gets the time changes for the year containing time, calculating them if necessary
+     *
+     * @param time The time, Unix time at UTC
+     *
+     * Only valid if hasDST() is true. The results are cached for two consecutive years, so
+     * converting times that are close together (such as when walking forward through a
+     * schedule) does not need to calculate the time changes again. This is used by
+     * LocalTimeConvert::convert().
+     *
+     * The cache is updated from const methods, so it's protected by a mutex and a copy is
+     * returned. It's safe to convert times with the same configuration from more than one thread.
+     */
+    TransitionYear getTransitions(time_t time) const;
+
+    /**
+     * @brief Clears the cached time changes
+     *
+     * This is done automatically by parse() and clear(). You only need to call this if you
+     * modify dstHMS, standardHMS, dstStart, or standardStart directly.
+     */
+    void invalidateTransitions() const;
+
     String dstName; //!< Daylight saving timezone name (empty string if no DST)
     LocalTimeHMS dstHMS; //!< Daylight saving time shift (relative to UTC)
     String standardName; //!< Standard time timezone name
@@ -1081,6 +1119,17 @@ public:
     LocalTimeChange dstStart; //!< Rule for when DST starts
     LocalTimeChange standardStart; //!< Rule for when standard time starts. 
     bool valid = false; //!< true if the configuration looks valid
+
+protected:
+    /**
+     * @brief Time changes for the current and next year, in the slot tm_year % 2
+     */
+    mutable TransitionYear transitions[2];
+
+    /**
+     * @brief Protects transitions in all configurations. Shared so configurations can still be copied.
+     */
+    static Mutex transitionsMutex;
 };
 
 /**
@@ -1480,6 +1529,19 @@ public:
     int flags = 0; //!< Optional scheduling flags
     String name; //!< Optional name
     ScheduleItemType scheduleItemType = ScheduleItemType::NONE; //!< The type of schedule item
+
+protected:
+    /**
+     * @brief Calculates the next MINUTE_OF_HOUR or HOUR_OF_DAY time directly instead of stepping through it
+     *
+     * @param conv LocalTimeConvert object, updated if the next time was calculated
+     * @return true if conv was updated, or false if getNextScheduledTime() must step through the schedule
+     *
+     * This is only used when the UTC offset does not change from the local midnight before conv until the
+     * end of the next day (no daylight saving transition), there are no date restrictions, and the next time
+     * is today or tomorrow. The result is the same as the iterative code in getNextScheduledTime().
+     */
+    bool getNextScheduledTimeFast(LocalTimeConvert &conv) const;
 };
 
 /**
@@ -1798,7 +1860,79 @@ public:
      */
     void setFromJsonObject(const JSONValue &obj);
 
+    /**
+     * @brief Enables the plan, a cache of the upcoming times of each schedule
+     * 
+     * @param horizonSeconds How far ahead to calculate (default: 48 hours). 0 disables the plan, which is the default.
+     * @return LocalTimeScheduleManager& 
+     * 
+     * Without a plan, getNextWake(), getNextFullWake(), and getNextDataCapture() step through every schedule
+     * each time they are called. With a plan, the upcoming times of each schedule are calculated once and 
+     * the calls are a binary search in the plan. The plan is calculated again when the time passes the end 
+     * of the plan, or if a schedule, the timezone configuration, or the schedule lookahead days setting 
+     * changes. The results are the same either way.
+     * 
+     * Each upcoming time uses sizeof(time_t) bytes of RAM, and each schedule is limited to maxPlanTimes
+     * times, so every 15 minutes for 48 hours is 193 times.
+     */
+    LocalTimeScheduleManager &withPlanHorizon(int horizonSeconds = 48 * 3600) { 
+        planHorizon = horizonSeconds; 
+        invalidatePlan(); 
+        return *this; 
+    };
+
+    /**
+     * @brief Discards the plan so it will be calculated again on next use
+     * 
+     * Changes to schedules and the timezone configuration are detected automatically so you normally 
+     * don't need to call this.
+     */
+    void invalidatePlan() const { 
+        planValid = false; 
+    };
+
+    static const size_t maxPlanTimes = 256; //!< Maximum number of times in the plan for each schedule
+
     std::vector<LocalTimeSchedule> schedules; //!< Vector of all of the schedules. Names and flags are in the schedule object
+
+protected:
+    /**
+     * @brief Get the next time of any schedule that has a flag in flagMask or is named name
+     * 
+     * @param conv The LocalTimeConvert that contains the time and timezone information to use
+     * @param flagMask Schedules with any of these flags set are checked (0 = none)
+     * @param name Schedules with this name are checked (NULL = none)
+     * @return time_t Time of 0 if there is no schedule
+     */
+    time_t getNextTime(const LocalTimeConvert &conv, uint32_t flagMask, const char *name) const;
+
+    /**
+     * @brief Calculates the plan again if it can't be used at the time in conv
+     * 
+     * @return true if the plan can be used
+     */
+    bool updatePlan(const LocalTimeConvert &conv) const;
+
+    /**
+     * @brief Gets a hash of all of the settings that affect the plan
+     */
+    uint32_t getPlanSignature(const LocalTimeConvert &conv) const;
+
+    /**
+     * @brief The upcoming times of one schedule
+     */
+    class SchedulePlan {
+    public:
+        std::vector<time_t> times;  //!< Upcoming times, sorted
+        bool exhausted = false;     //!< true if there were no more times after the last time in times (within the lookahead days)
+    };
+
+    int planHorizon = 0;                        //!< How far ahead to calculate the plan in seconds, 0 = no plan
+    mutable bool planValid = false;             //!< true if plans has been calculated
+    mutable time_t planStart = 0;               //!< The time the plan was calculated at
+    mutable time_t planValidUntil = 0;          //!< The plan can be used for times before this
+    mutable uint32_t planSignature = 0;         //!< getPlanSignature() when the plan was calculated
+    mutable std::vector<SchedulePlan> plans;    //!< The plan for each schedule, same index as schedules
 };
 
 /**
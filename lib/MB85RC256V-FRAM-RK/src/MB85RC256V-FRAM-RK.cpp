@@ -14,25 +14,56 @@ void MB85RC::begin() {
 	wire.begin();
 }
 
+MB85RC &MB85RC::withBufferSize(size_t i2cBufferSize) {
+	if (i2cBufferSize < 3) {
+		i2cBufferSize = 3;
+	}
+	readChunkSize = i2cBufferSize;
+	writeChunkSize = i2cBufferSize - 2;
+	return *this;
+}
+
 bool MB85RC::erase() {
+	return erase(0, memorySize);
+}
 
-	WITH_LOCK(wire) {
-		size_t framAddr = 0;
-		size_t totalLen = memorySize;
+bool MB85RC::erase(size_t framAddr, size_t numBytes) {
+	bool result = true;
 
-		uint8_t zero[30];
-		memset(zero, 0, sizeof(zero));
+	if (framAddr >= memorySize) {
+		return false;
+	}
+	if (numBytes > memorySize - framAddr) {
+		numBytes = memorySize - framAddr;
+	}
+
+	WITH_LOCK(wire) {
+		size_t totalLen = numBytes;
 
+		// Zeros are written directly to the Wire buffer so each transaction can be as large as the buffer
 		while(totalLen > 0) {
 			size_t count = totalLen;
-			if (count > sizeof(zero)) {
-				count = sizeof(zero);
+			if (count > writeChunkSize) {
+				count = writeChunkSize;
+			}
+			if ((framAddr < 65536) && ((framAddr + count) > 65536)) {
+				// Don't cross the 65536 boundary (only matters on the MB85RC1M)
+				count = 65536 - framAddr;
 			}
 
-			bool result = writeData(framAddr, zero, count);
-			if (!result) {
+			wire.beginTransmission(getDeviceAddr(framAddr));
+			wire.write(framAddr >> 8);
+			wire.write(framAddr);
+
+			for(size_t ii = 0; ii < count; ii++) {
+				wire.write(0);
+			}
+
+			int stat = wire.endTransmission(true);
+			if (stat != 0) {
 				Log.info("writeData failed during erase framAddr=%u", framAddr);
-				return false;
+				result = false;
+				break;
 			}
 
 			totalLen -= count;
@@ -40,7 +71,7 @@ bool MB85RC::erase() {
 		}
 	}
 
-	return true;
+	return result;
 }
 
 
@@ -61,8 +92,8 @@ bool MB85RC::readData(size_t framAddr, uint8_t *data, size_t dataLen) {
 			}
 
 			size_t bytesToRead = dataLen;
-			if (bytesToRead > 32) {
-				bytesToRead = 32;
+			if (bytesToRead > readChunkSize) {
+				bytesToRead = readChunkSize;
 			}
 
 			wire.requestFrom((uint8_t)(addr | DEVICE_ADDR), bytesToRead, (uint8_t) true);
@@ -92,7 +123,7 @@ bool MB85RC::writeData(size_t framAddr, const uint8_t *data, size_t dataLen) {
 			wire.write(framAddr >> 8);
 			wire.write(framAddr);
 
-			for(size_t ii = 0; ii < 30 && dataLen > 0; ii++) {
+			for(size_t ii = 0; ii < writeChunkSize && dataLen > 0; ii++) {
 				wire.write(*data);
 				framAddr++;
 				data++;
@@ -181,9 +212,9 @@ bool MB85RC1M::readData(size_t framAddr, uint8_t *data, size_t dataLen) {
 
 		while(dataLen > 0) {
 			size_t count = dataLen;
-			if (count > 32) {
-				// Don't read more than 32 bytes (limit of Wire implementation)
-				count = 32;
+			if (count > readChunkSize) {
+				// Don't read more than the Wire buffer size (32 bytes unless withBufferSize() was used)
+				count = readChunkSize;
 			}
 			if ((framAddr < 65536) && ((framAddr + count) >= 65536)) {
 				// Crosses boundary at 65536, only write up to the boundary
@@ -224,9 +255,9 @@ bool MB85RC1M::writeData(size_t framAddr, const uint8_t *data, size_t dataLen) {
 	WITH_LOCK(wire) {
 		while(dataLen > 0) {
 			size_t count = dataLen;
-			if (count > 30) {
-				// Don't write more than 30 bytes (limit of Wire implementation)
-				count = 30;
+			if (count > writeChunkSize) {
+				// Don't write more than the Wire buffer size less the 2 address bytes
+				count = writeChunkSize;
 			}
 			if ((framAddr < 65536) && ((framAddr + count) >= 65536)) {
 				// Crosses boundary at 65536, only write up to the boundary
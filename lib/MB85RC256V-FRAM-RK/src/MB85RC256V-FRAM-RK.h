@@ -28,13 +28,53 @@ public:
 	 */
 	inline size_t length() { return memorySize; }
 
+	/**
+	 * @brief Sets the size of the I2C buffer so reads and writes use larger transactions
+	 *
+	 * @param i2cBufferSize The size of the Wire transmit and receive buffers in bytes. The default is
+	 * 32, the Device OS default. Writes use 2 bytes of each transaction for the address, so the largest
+	 * write is i2cBufferSize - 2 bytes.
+	 *
+	 * On Gen3 devices (Device OS 1.5.0 and later) you can make the Wire buffers larger by defining
+	 * acquireWireBuffer() in your application. Pass the same size here and a whole structure can be
+	 * read or written in a single transaction, saving the start, address, and stop overhead and the
+	 * Wire lock for each 30 byte chunk.
+	 *
+	 * Do not set this larger than the actual buffer size or transactions will be truncated.
+	 */
+	MB85RC &withBufferSize(size_t i2cBufferSize);
+
+	/**
+	 * @brief Returns the maximum number of bytes read in one I2C transaction
+	 */
+	inline size_t getReadChunkSize() const { return readChunkSize; }
+
+	/**
+	 * @brief Returns the maximum number of bytes written in one I2C transaction (not including the address)
+	 */
+	inline size_t getWriteChunkSize() const { return writeChunkSize; }
+
 	/**
 	 * @brief Erases the FRAM device
 	 *
-	 * This is generally a slow operation because it requires writing to every location.
+	 * This is generally a slow operation because it requires writing to every location. Each
+	 * transaction is as large as the Wire buffer (see withBufferSize()), so enlarging the buffer
+	 * makes this much faster.
 	 */
 	bool erase();
 
+	/**
+	 * @brief Erases (sets to 0) part of the FRAM device
+	 *
+	 * @param framAddr The address in the FRAM to start erasing at
+	 *
+	 * @param numBytes The number of bytes to erase. This is limited to the end of the device.
+	 *
+	 * If you only use part of the FRAM, or only part of it needs to be reset, this is much faster
+	 * than erasing the whole device.
+	 */
+	bool erase(size_t framAddr, size_t numBytes);
+
 	/**
 	 * @brief Read from FRAM using EEPROM-style API
 	 *
@@ -96,10 +136,20 @@ public:
 
 	static const uint8_t DEVICE_ADDR = 0b1010000;
 
+	static const size_t DEFAULT_BUFFER_SIZE = 32; //!< Device OS default Wire buffer size
+
 protected:
+	/**
+	 * @brief Returns the 7-bit I2C address to use for framAddr. Overridden by the MB85RC1M, which uses the
+	 * low address bit as bit 16 of framAddr.
+	 */
+	virtual uint8_t getDeviceAddr(size_t framAddr) const { return (uint8_t)(addr | DEVICE_ADDR); }
+
 	TwoWire &wire;
 	size_t memorySize;
 	int addr; // This is just 0-7, the (0b1010000 of the 7-bit address is ORed in later)
+	size_t readChunkSize = DEFAULT_BUFFER_SIZE; // Maximum bytes per read transaction
+	size_t writeChunkSize = DEFAULT_BUFFER_SIZE - 2; // Maximum data bytes per write transaction (2 address bytes)
 
 };
 
@@ -191,8 +241,202 @@ public:
 	virtual bool writeData(size_t framAddr, const uint8_t *data, size_t dataLen);
 
 	uint8_t getI2CAddr(size_t framAddr) const;
+
+protected:
+	virtual uint8_t getDeviceAddr(size_t framAddr) const { return getI2CAddr(framAddr); }
 };
 
 
 
+/**
+ * @brief Write-back RAM cache for the start of an FRAM device
+ *
+ * @param T The FRAM class to cache (MB85RC64, MB85RC256V, MB85RC512, or MB85RC1M)
+ *
+ * @param CACHE_SIZE The number of bytes at the start of the FRAM (starting at address 0) to mirror in RAM.
+ * Put your frequently accessed structures at the start of the FRAM and make this large enough to cover them.
+ *
+ * @param PAGE_SIZE The granularity of dirty tracking in bytes
+ *
+ * Reads of the cached region are served from RAM. Writes to the cached region only update RAM and mark
+ * the affected pages dirty; nothing goes over I2C until you call flush(), which writes runs of adjacent
+ * dirty pages in as few transactions as possible. Reads and writes outside the cached region go straight
+ * to the device.
+ *
+ * You must call flush() before sleep or reset or changes will be lost. A typical pattern is to call it at
+ * the end of loop() and from a sleep or reset hook.
+ *
+ * The cache is loaded from the device in one read on the first access.
+ *
+ * ```
+ * MB85RCWriteCache<MB85RC64, 256> fram(Wire, 0);
+ * ```
+ */
+template <class T, size_t CACHE_SIZE, size_t PAGE_SIZE = 16>
+class MB85RCWriteCache : public T {
+public:
+	/**
+	 * @brief Object to interface with an FRAM chip with a RAM cache of the first CACHE_SIZE bytes
+	 *
+	 * @param wire The I2C interface, typically Wire (pins D0 and D1).
+	 *
+	 * @param addr The address 0-7 based on the setting of A0, A1 and A2.
+	 */
+	MB85RCWriteCache(TwoWire &wire, int addr = 0) : T(wire, addr) {};
+
+	/**
+	 * @brief Read from FRAM. The cached region is served from RAM.
+	 */
+	virtual bool readData(size_t framAddr, uint8_t *data, size_t dataLen) {
+		if (framAddr < CACHE_SIZE && load()) {
+			size_t count = CACHE_SIZE - framAddr;
+			if (count > dataLen) {
+				count = dataLen;
+			}
+			memcpy(data, &cache[framAddr], count);
+			framAddr += count;
+			data += count;
+			dataLen -= count;
+		}
+		if (dataLen == 0) {
+			return true;
+		}
+		return T::readData(framAddr, data, dataLen);
+	}
+
+	/**
+	 * @brief Write to FRAM. Writes to the cached region are held in RAM until flush().
+	 */
+	virtual bool writeData(size_t framAddr, const uint8_t *data, size_t dataLen) {
+		if (framAddr < CACHE_SIZE && load()) {
+			size_t count = CACHE_SIZE - framAddr;
+			if (count > dataLen) {
+				count = dataLen;
+			}
+			if (memcmp(&cache[framAddr], data, count) != 0) {
+				memcpy(&cache[framAddr], data, count);
+				for(size_t page = framAddr / PAGE_SIZE; page <= (framAddr + count - 1) / PAGE_SIZE; page++) {
+					dirty[page / 8] |= (uint8_t)(1 << (page % 8));
+				}
+			}
+			framAddr += count;
+			data += count;
+			dataLen -= count;
+		}
+		if (dataLen == 0) {
+			return true;
+		}
+		return T::writeData(framAddr, data, dataLen);
+	}
+
+	/**
+	 * @brief Writes all dirty pages to the device
+	 *
+	 * Adjacent dirty pages are written with a single writeData call. Returns false if any write failed;
+	 * the pages that failed stay dirty and will be retried on the next flush.
+	 */
+	bool flush() {
+		bool result = true;
+
+		size_t page = 0;
+		while(page < NUM_PAGES) {
+			if (!isPageDirty(page)) {
+				page++;
+				continue;
+			}
+			size_t firstPage = page;
+			while(page < NUM_PAGES && isPageDirty(page)) {
+				page++;
+			}
+			size_t start = firstPage * PAGE_SIZE;
+			size_t end = page * PAGE_SIZE;
+			if (end > CACHE_SIZE) {
+				end = CACHE_SIZE;
+			}
+			if (T::writeData(start, &cache[start], end - start)) {
+				for(size_t ii = firstPage; ii < page; ii++) {
+					dirty[ii / 8] &= (uint8_t)~(1 << (ii % 8));
+				}
+			}
+			else {
+				result = false;
+			}
+		}
+		return result;
+	}
+
+	/**
+	 * @brief Returns true if there are changes in RAM that have not been written to the device
+	 */
+	bool isDirty() const {
+		for(size_t ii = 0; ii < sizeof(dirty); ii++) {
+			if (dirty[ii]) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/**
+	 * @brief Discards the cache (including unflushed changes) so it's reloaded from the device on the next access
+	 */
+	void invalidate() {
+		loaded = false;
+		memset(dirty, 0, sizeof(dirty));
+	}
+
+	/**
+	 * @brief Erases the FRAM device, including the cached region
+	 */
+	bool erase() {
+		return erase(0, T::length());
+	}
+
+	/**
+	 * @brief Erases (sets to 0) part of the FRAM device, including any part of the cached region
+	 *
+	 * The cached bytes in the range are set to 0. Unflushed changes outside the range are kept. Pages
+	 * that are entirely in the range are clean once the device is erased; if the erase fails, the pages
+	 * in the range are left dirty so the next flush() writes the zeros.
+	 */
+	bool erase(size_t framAddr, size_t numBytes) {
+		bool result = T::erase(framAddr, numBytes);
+
+		if (loaded && framAddr < CACHE_SIZE && numBytes > 0) {
+			size_t end = (numBytes > CACHE_SIZE - framAddr) ? CACHE_SIZE : framAddr + numBytes;
+			memset(&cache[framAddr], 0, end - framAddr);
+
+			for(size_t page = framAddr / PAGE_SIZE; page <= (end - 1) / PAGE_SIZE; page++) {
+				size_t pageStart = page * PAGE_SIZE;
+				size_t pageEnd = (pageStart + PAGE_SIZE < CACHE_SIZE) ? pageStart + PAGE_SIZE : CACHE_SIZE;
+				if (!result) {
+					dirty[page / 8] |= (uint8_t)(1 << (page % 8));
+				}
+				else if (pageStart >= framAddr && pageEnd <= end) {
+					dirty[page / 8] &= (uint8_t)~(1 << (page % 8));
+				}
+			}
+		}
+		return result;
+	}
+
+protected:
+	static const size_t NUM_PAGES = (CACHE_SIZE + PAGE_SIZE - 1) / PAGE_SIZE;
+
+	bool load() {
+		if (!loaded) {
+			loaded = T::readData(0, cache, CACHE_SIZE);
+		}
+		return loaded;
+	}
+
+	bool isPageDirty(size_t page) const {
+		return (dirty[page / 8] & (1 << (page % 8))) != 0;
+	}
+
+	uint8_t cache[CACHE_SIZE];
+	uint8_t dirty[(NUM_PAGES + 7) / 8] = {0};
+	bool loaded = false;
+};
+
 #endif /* __MB85RC256V_FRAM_RK */
@@ -2,6 +2,7 @@
 
 #include "BackgroundPublishRK.h"
 
+#include <algorithm>
 #include <dirent.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -53,7 +54,13 @@ void PublishQueuePosix::setup() {
     // Start the background publish thread
     BackgroundPublishRK::instance().start();
 
-    fileQueue.scanDir();
+    if (useSegmentLog) {
+        segmentLog.withDirPath(fileQueue.getDirPath());
+        segmentLog.scan();
+    }
+    else {
+        fileQueue.scanDir();
+    }
 
     checkQueueLimits();
 
@@ -77,9 +84,9 @@ bool PublishQueuePosix::publishCommon(const char *eventName, const char *eventDa
     WITH_LOCK(*this) {
         ramQueue.push_back(event);
 
-        _log.trace("fileQueueLen=%u ramQueueLen=%u connected=%d", fileQueue.getQueueLen(), ramQueue.size(), Particle.connected());
+        _log.trace("fileQueueLen=%u ramQueueLen=%u connected=%d", getFileQueueLen(), ramQueue.size(), Particle.connected());
 
-        if (fileQueue.getQueueLen() == 0 && (ramQueue.size() <= ramQueueSize) && Particle.connected()) {
+        if (getFileQueueLen() == 0 && (ramQueue.size() <= ramQueueSize) && Particle.connected()) {
             // No files in the disk-based queue, RAM-based queue is not full, and we are cloud connected
             // Leave the event in the RAM queue and return true
             _log.trace("queued to ramQueue");
@@ -125,6 +132,15 @@ void PublishQueuePosix::writeQueueToFiles() {
             PublishQueueEvent *event = ramQueue.front();
             ramQueue.pop_front();
 
+            if (useSegmentLog) {
+                if (segmentLog.append(event)) {
+                    // This message is monitored by the automated test tool. If you edit this, change that too.
+                    _log.trace("writeQueueToFiles fileNum=%d", segmentLog.getTailFileNum());
+                }
+                delete event;
+                continue;
+            }
+
             int fileNum = fileQueue.reserveFile();
 
             int fd = open(fileQueue.getPathForFileNum(fileNum), O_RDWR | O_CREAT);
@@ -204,7 +220,12 @@ void PublishQueuePosix::clearQueues() {
             delete event;
         }
 
-        fileQueue.removeAll(true);
+        if (useSegmentLog) {
+            segmentLog.removeAll();
+        }
+        else {
+            fileQueue.removeAll(true);
+        }
     }
 
     _log.trace("clearQueues");
@@ -230,7 +251,15 @@ void PublishQueuePosix::checkQueueLimits() {
             writeQueueToFiles();
         }
 
-        while(fileQueue.getQueueLen() > (int)fileQueueSize) {
+        while(useSegmentLog && segmentLog.getQueueLen() > fileQueueSize) {
+            int fileNum = segmentLog.getHeadFileNum();
+            if (!segmentLog.removeHead()) {
+                break;
+            }
+            _log.info("discarded event from segment %d", fileNum);
+        }
+
+        while(!useSegmentLog && fileQueue.getQueueLen() > (int)fileQueueSize) {
             int fileNum = fileQueue.getFileFromQueue(true);
             if (fileNum) {
                 fileQueue.removeFileNum(fileNum, false);
@@ -246,7 +275,7 @@ size_t PublishQueuePosix::getNumEvents() {
     WITH_LOCK(*this) {
         result = ramQueue.size();
         if (result == 0) {
-            result = fileQueue.getQueueLen();
+            result = getFileQueueLen();
 
             if (curEvent && curFileNum == 0) {
                 // This happens when we are sending an event from the RAM queue
@@ -296,17 +325,32 @@ void PublishQueuePosix::stateWait() {
         return;
     }
     
-    curFileNum = fileQueue.getFileFromQueue(false);
-    if (curFileNum) {
-        curEvent = readQueueFile(curFileNum);
-        if (!curEvent) {
-            // Probably a corrupted file, discard
-            _log.info("discarding corrupted file %d", curFileNum);
-            fileQueue.getFileFromQueue(true);
-            fileQueue.removeFileNum(curFileNum, false);
+    if (useSegmentLog) {
+        curFileNum = segmentLog.getHeadFileNum();
+        curSegmentOffset = segmentLog.getHeadOffset();
+        if (curFileNum) {
+            curEvent = segmentLog.readHead();
+            if (!curEvent) {
+                // Probably a corrupted record, discard
+                _log.info("discarding corrupted record in segment %d", curFileNum);
+                segmentLog.removeHead();
+            }
         }
     }
     else {
+        curFileNum = fileQueue.getFileFromQueue(false);
+        if (curFileNum) {
+            curEvent = readQueueFile(curFileNum);
+            if (!curEvent) {
+                // Probably a corrupted file, discard
+                _log.info("discarding corrupted file %d", curFileNum);
+                fileQueue.getFileFromQueue(true);
+                fileQueue.removeFileNum(curFileNum, false);
+            }
+        }
+    }
+
+    if (!curFileNum) {
         if (!ramQueue.empty()) {
             curEvent = ramQueue.front();
             ramQueue.pop_front();
@@ -326,11 +370,26 @@ void PublishQueuePosix::stateWait() {
         // This message is monitored by the automated test tool. If you edit this, change that too.
         _log.trace("publishing %s event=%s data=%s", (curFileNum ? "file" : "ram"), curEvent->eventName, curEvent->eventData);
 
-        if (BackgroundPublishRK::instance().publish(curEvent->eventName, curEvent->eventData, curEvent->flags, 
+        if (!BackgroundPublishRK::instance().publish(curEvent->eventName, curEvent->eventData, curEvent->flags, 
             [this](bool succeeded, const char *eventName, const char *eventData, const void *context) {
                 publishCompleteCallback(succeeded, eventName, eventData);
             })) {
-            // Successfully started publish
+            // The BackgroundPublishRK queue is full (other callers can use it too) so the callback
+            // will never be called. Leave the event in the queue and try again later.
+            _log.trace("background publish queue full");
+            if (curFileNum) {
+                delete curEvent;
+            }
+            else {
+                WITH_LOCK(*this) {
+                    ramQueue.push_front(curEvent);
+                }
+            }
+            curEvent = NULL;
+            curFileNum = 0;
+            durationMs = waitBetweenPublish;
+            stateTime = millis();
+            stateHandler = &PublishQueuePosix::stateWait;
         }
     }
     else {
@@ -347,6 +406,15 @@ void PublishQueuePosix::statePublishWait() {
         // Remove from the queue
         _log.trace("publish success %d", curFileNum);
 
+        if (curFileNum && useSegmentLog) {
+            // Was from the segmented log - only remove it if it's still the oldest event
+            if (segmentLog.getHeadFileNum() == curFileNum && segmentLog.getHeadOffset() == curSegmentOffset) {
+                segmentLog.removeHead();
+                _log.trace("removed record from segment %d", curFileNum);
+            }
+            curFileNum = 0;
+        }
+        else
         if (curFileNum) {
             // Was from the file-based queue
             int fileNum = fileQueue.getFileFromQueue(false);
@@ -389,6 +457,15 @@ void PublishQueuePosix::statePublishWait() {
 }
 
 
+size_t PublishQueuePosix::getFileQueueLen() const {
+    if (useSegmentLog) {
+        return segmentLog.getQueueLen();
+    }
+    else {
+        return (size_t) fileQueue.getQueueLen();
+    }
+}
+
 PublishQueuePosix::PublishQueuePosix() {
     fileQueue.withDirPath("/usr/pubqueue");
 }
@@ -404,3 +481,333 @@ void PublishQueuePosix::systemEventHandler(system_event_t event, int param) {
     }
 }
 
+
+PublishQueueSegmentLog::PublishQueueSegmentLog() {
+    segmentFiles.withFilenameExtension("seg");
+}
+
+PublishQueueSegmentLog::~PublishQueueSegmentLog() {
+
+}
+
+bool PublishQueueSegmentLog::scan() {
+    segments.clear();
+    numEvents = 0;
+    headEventSize = 0;
+
+    if (!segmentFiles.scanDir()) {
+        return false;
+    }
+
+    PublishQueueSegmentHead head;
+    if (!readHeadFile(head)) {
+        head.fileNum = 0;
+        head.headOffset = 0;
+    }
+
+    // The segments deque is used from here on, so empty the SequentialFile queue as it's read
+    while(true) {
+        Segment seg;
+        seg.fileNum = segmentFiles.getFileFromQueue(true);
+        if (!seg.fileNum) {
+            break;
+        }
+
+        if ((uint32_t)seg.fileNum < head.fileNum) {
+            // Fully sent
+            segmentFiles.removeFileNum(seg.fileNum, false);
+            continue;
+        }
+        seg.headOffset = ((uint32_t)seg.fileNum == head.fileNum) ? head.headOffset : 0;
+
+        if (scanSegment(seg)) {
+            segments.push_back(seg);
+            numEvents += seg.numEvents;
+        }
+        else {
+            // Not a valid segment
+            segmentFiles.removeFileNum(seg.fileNum, false);
+        }
+    }
+    // Directory order is not guaranteed to be numeric order
+    std::sort(segments.begin(), segments.end(), [](const Segment &a, const Segment &b) {
+        return a.fileNum < b.fileNum;
+    });
+
+    // Remove segments with nothing left to send, except the newest if events can still be appended to it
+    for(auto it = segments.begin(); it != segments.end(); ) {
+        if (it->numEvents == 0 && (it + 1 != segments.end() || it->size >= maxSegmentSize)) {
+            segmentFiles.removeFileNum(it->fileNum, false);
+            it = segments.erase(it);
+        }
+        else {
+            it++;
+        }
+    }
+
+    if (segments.empty()) {
+        // File numbers start over at 1 after a scan of an empty directory, so the old head file
+        // would make the next segments look like they had already been sent
+        unlink(getHeadPath());
+    }
+
+    _log.trace("segment log scan found %u events in %u segments", numEvents, segments.size());
+
+    return true;
+}
+
+bool PublishQueueSegmentLog::scanSegment(Segment &seg) {
+    bool result = false;
+
+    uint32_t sentOffset = seg.headOffset;
+    seg.headOffset = seg.size = 0;
+    seg.numEvents = 0;
+
+    int fd = open(segmentFiles.getPathForFileNum(seg.fileNum), O_RDONLY);
+    if (fd != -1) {
+        struct stat sb;
+        fstat(fd, &sb);
+
+        PublishQueueSegmentHeader hdr;
+        if (read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+            hdr.magic == SEGMENT_MAGIC &&
+            hdr.version == SEGMENT_VERSION &&
+            hdr.headerSize == sizeof(PublishQueueSegmentHeader) &&
+            hdr.nameLen == sizeof(PublishQueueEvent::eventName)) {
+
+            // Follow the length prefixes from the first record; stop at a record that runs past the 
+            // end of the file (the device reset while it was being written). Records before the
+            // offset from the head file have been sent.
+            seg.size = sizeof(PublishQueueSegmentHeader);
+            while(seg.size + sizeof(PublishQueueSegmentRecord) <= (uint32_t)sb.st_size) {
+                PublishQueueSegmentRecord rec;
+                lseek(fd, seg.size, SEEK_SET);
+                if (read(fd, &rec, sizeof(rec)) != sizeof(rec) ||
+                    rec.eventSize < sizeof(PublishQueueEvent) ||
+                    seg.size + sizeof(rec) + rec.eventSize > (uint32_t)sb.st_size) {
+                    break;
+                }
+                if (seg.size >= sentOffset) {
+                    if (seg.numEvents++ == 0) {
+                        seg.headOffset = seg.size;
+                    }
+                }
+                seg.size += sizeof(rec) + rec.eventSize;
+            }
+            if (seg.numEvents == 0) {
+                seg.headOffset = seg.size;
+            }
+            result = true;
+        }
+        else {
+            _log.trace("segment %d bad header", seg.fileNum);
+        }
+        close(fd);
+    }
+    return result;
+}
+
+bool PublishQueueSegmentLog::newSegment() {
+    Segment seg;
+    seg.fileNum = segmentFiles.reserveFile();
+    seg.headOffset = seg.size = sizeof(PublishQueueSegmentHeader);
+    seg.numEvents = 0;
+
+    int fd = open(segmentFiles.getPathForFileNum(seg.fileNum), O_RDWR | O_CREAT | O_TRUNC);
+    if (fd == -1) {
+        _log.error("could not create segment %d errno=%d", seg.fileNum, errno);
+        return false;
+    }
+
+    PublishQueueSegmentHeader hdr;
+    hdr.magic = SEGMENT_MAGIC;
+    hdr.version = SEGMENT_VERSION;
+    hdr.headerSize = sizeof(PublishQueueSegmentHeader);
+    hdr.nameLen = sizeof(PublishQueueEvent::eventName);
+    bool result = (write(fd, &hdr, sizeof(hdr)) == sizeof(hdr));
+    close(fd);
+
+    if (result) {
+        segments.push_back(seg);
+    }
+    return result;
+}
+
+bool PublishQueueSegmentLog::append(const PublishQueueEvent *event) {
+    if (segments.empty() || segments.back().size >= maxSegmentSize) {
+        if (!newSegment()) {
+            return false;
+        }
+    }
+    Segment &seg = segments.back();
+
+    PublishQueueSegmentRecord rec;
+    rec.eventSize = (uint16_t)(sizeof(PublishQueueEvent) + strlen(event->eventData));
+    rec.crc = crc16((const uint8_t *)event, rec.eventSize);
+
+    bool result = false;
+
+    int fd = open(segmentFiles.getPathForFileNum(seg.fileNum), O_RDWR);
+    if (fd != -1) {
+        // Write at the end of the last complete record, which overwrites any partially written record
+        lseek(fd, seg.size, SEEK_SET);
+        result = (write(fd, &rec, sizeof(rec)) == sizeof(rec)) &&
+            (write(fd, event, rec.eventSize) == rec.eventSize);
+        close(fd);
+    }
+
+    if (result) {
+        seg.size += sizeof(rec) + rec.eventSize;
+        seg.numEvents++;
+        numEvents++;
+    }
+    else {
+        _log.error("segment %d append failed", seg.fileNum);
+    }
+    return result;
+}
+
+PublishQueueEvent *PublishQueueSegmentLog::readHead() {
+    PublishQueueEvent *result = NULL;
+
+    if (segments.empty() || segments.front().numEvents == 0) {
+        return NULL;
+    }
+    const Segment &seg = segments.front();
+
+    int fd = open(segmentFiles.getPathForFileNum(seg.fileNum), O_RDONLY);
+    if (fd != -1) {
+        PublishQueueSegmentRecord rec;
+        lseek(fd, seg.headOffset, SEEK_SET);
+        if (read(fd, &rec, sizeof(rec)) == sizeof(rec) && rec.eventSize >= sizeof(PublishQueueEvent)) {
+            result = (PublishQueueEvent *)new char[rec.eventSize];
+            if (result) {
+                if (read(fd, result, rec.eventSize) == rec.eventSize && 
+                    crc16((const uint8_t *)result, rec.eventSize) == rec.crc &&
+                    ((char *)result)[rec.eventSize - 1] == 0 && 
+                    strlen(result->eventName) < (sizeof(PublishQueueEvent::eventName) - 1)) {
+                    _log.trace("readHead segment %d offset %lu event=%s data=%s", seg.fileNum, seg.headOffset, result->eventName, result->eventData);
+                    headEventSize = rec.eventSize;
+                }
+                else {
+                    _log.trace("readHead segment %d offset %lu corrupted", seg.fileNum, seg.headOffset);
+                    delete[] (char *)result;
+                    result = NULL;
+                }
+            }
+        }
+        close(fd);
+    }
+    return result;
+}
+
+bool PublishQueueSegmentLog::removeHead() {
+    if (segments.empty() || segments.front().numEvents == 0) {
+        return false;
+    }
+    Segment &seg = segments.front();
+
+    PublishQueueSegmentRecord rec;
+    rec.eventSize = headEventSize;
+    headEventSize = 0;
+
+    if (rec.eventSize == 0) {
+        // Not read by readHead() first, get the size from the record
+        int fd = open(segmentFiles.getPathForFileNum(seg.fileNum), O_RDONLY);
+        if (fd != -1) {
+            lseek(fd, seg.headOffset, SEEK_SET);
+            if (read(fd, &rec, sizeof(rec)) != sizeof(rec)) {
+                rec.eventSize = 0;
+            }
+            close(fd);
+        }
+    }
+
+    if (rec.eventSize != 0) {
+        seg.headOffset += sizeof(rec) + rec.eventSize;
+        seg.numEvents--;
+        numEvents--;
+
+        // Keep the segment if it has more events, or if it's the newest and not full yet, so the 
+        // next events are appended to it instead of creating another file
+        if (seg.numEvents > 0 || (segments.size() == 1 && seg.size < maxSegmentSize)) {
+            return writeHeadFile();
+        }
+    }
+    else {
+        _log.info("discarding %u events in unreadable segment %d", seg.numEvents, seg.fileNum);
+        numEvents -= seg.numEvents;
+    }
+
+    // Segments after this one start at their first record, so the head file does not need to change
+    removeFrontSegment();
+    return true;
+}
+
+void PublishQueueSegmentLog::removeFrontSegment() {
+    segmentFiles.removeFileNum(segments.front().fileNum, false);
+    segments.pop_front();
+}
+
+void PublishQueueSegmentLog::removeAll() {
+    segmentFiles.removeAll(false);
+    unlink(getHeadPath());
+    segments.clear();
+    numEvents = 0;
+    headEventSize = 0;
+}
+
+int PublishQueueSegmentLog::getHeadFileNum() const {
+    return (numEvents && !segments.empty()) ? segments.front().fileNum : 0;
+}
+
+int PublishQueueSegmentLog::getTailFileNum() const {
+    return segments.empty() ? 0 : segments.back().fileNum;
+}
+
+uint32_t PublishQueueSegmentLog::getHeadOffset() const {
+    return (numEvents && !segments.empty()) ? segments.front().headOffset : 0;
+}
+
+bool PublishQueueSegmentLog::readHeadFile(PublishQueueSegmentHead &head) {
+    bool result = false;
+
+    int fd = open(getHeadPath(), O_RDONLY);
+    if (fd != -1) {
+        result = (read(fd, &head, sizeof(head)) == sizeof(head)) && head.check == ~(head.fileNum ^ head.headOffset);
+        close(fd);
+    }
+    return result;
+}
+
+bool PublishQueueSegmentLog::writeHeadFile() {
+    bool result = false;
+
+    PublishQueueSegmentHead head;
+    head.fileNum = (uint32_t)segments.front().fileNum;
+    head.headOffset = segments.front().headOffset;
+    head.check = ~(head.fileNum ^ head.headOffset);
+
+    int fd = open(getHeadPath(), O_RDWR | O_CREAT, 0666);
+    if (fd != -1) {
+        result = (write(fd, &head, sizeof(head)) == sizeof(head));
+        close(fd);
+    }
+    if (!result) {
+        _log.error("could not write segment head file errno=%d", errno);
+    }
+    return result;
+}
+
+// [static]
+uint16_t PublishQueueSegmentLog::crc16(const uint8_t *data, size_t len) {
+    uint16_t crc = 0xffff;
+
+    while(len--) {
+        crc ^= (uint16_t)(*data++) << 8;
+        for(int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
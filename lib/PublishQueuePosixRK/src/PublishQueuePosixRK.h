@@ -40,6 +40,207 @@ struct PublishQueueEvent {
     char eventData[1]; //!< Variable size event data
 };
 
+/**
+ * @brief Structure stored at the beginning of each segment file when using the segmented log
+ * 
+ * The header is followed by zero or more records. Each record is a PublishQueueSegmentRecord
+ * followed by a PublishQueueEvent sized to fit its data. The header is only written when the 
+ * segment is created; which records have been sent is kept in the head file 
+ * (PublishQueueSegmentHead).
+ */
+struct PublishQueueSegmentHeader {
+    uint32_t magic;         //!< PublishQueueSegmentLog::SEGMENT_MAGIC = 0x31b67664
+    uint8_t version;        //!< PublishQueueSegmentLog::SEGMENT_VERSION = 1
+    uint8_t headerSize;     //!< sizeof(PublishQueueSegmentHeader) = 8
+    uint16_t nameLen;       //!< sizeof(PublishQueueEvent::eventName) = 64
+};
+
+/**
+ * @brief Contents of the head file ("head" in the queue directory) when using the segmented log
+ * 
+ * Segments numbered below fileNum have been sent, as have the records before headOffset in
+ * segment fileNum. This is a separate 12 byte file so sending an event does not modify a segment
+ * file (on LittleFS, modifying a file rewrites its data up to the end).
+ */
+struct PublishQueueSegmentHead {
+    uint32_t fileNum;       //!< Segment file number of the oldest record that has not been sent
+    uint32_t headOffset;    //!< File offset of the oldest record that has not been sent
+    uint32_t check;         //!< ~(fileNum ^ headOffset), to detect a partially written file
+};
+
+/**
+ * @brief Structure stored before each event in a segment file
+ */
+struct PublishQueueSegmentRecord {
+    uint16_t eventSize;     //!< Number of bytes of PublishQueueEvent that follow (includes data null terminator)
+    uint16_t crc;           //!< CRC-16/CCITT of the event bytes
+};
+
+/**
+ * @brief Segmented log storage for the file-based queue
+ * 
+ * Instead of one file per event, events are appended as length-prefixed, CRC-checked records to a
+ * small number of sequentially numbered segment files. A segment is closed when it reaches the
+ * maximum segment size and a new one is started. The position of the oldest unsent record is 
+ * stored in a small head file, so sending an event is a 12 byte write to that file instead of an
+ * unlink, and a fully sent segment is removed in one unlink. The newest segment is kept when all of
+ * its events have been sent, and later events are appended to it until it is full.
+ * 
+ * At boot only the segment files need to be listed (instead of one file per event), and the records
+ * are counted by following the length prefixes.
+ * 
+ * You normally don't use this class directly; use PublishQueuePosix::withSegmentedLog().
+ */
+class PublishQueueSegmentLog {
+public:
+    /**
+     * @brief Constructor
+     */
+    PublishQueueSegmentLog();
+
+    /**
+     * @brief Destructor
+     */
+    virtual ~PublishQueueSegmentLog();
+
+    /**
+     * @brief Sets the directory to use for segment files
+     * 
+     * @param dirPath the pathname, Unix-style with / as the directory separator.
+     * 
+     * The segment files have a .seg filename extension.
+     */
+    PublishQueueSegmentLog &withDirPath(const char *dirPath) { segmentFiles.withDirPath(dirPath); return *this; };
+
+    /**
+     * @brief Sets the size at which a segment is closed and a new one started (default: 16384)
+     * 
+     * @param size Size in bytes. A segment can be slightly larger because the event that crosses this 
+     * size is written to the current segment.
+     */
+    PublishQueueSegmentLog &withMaxSegmentSize(size_t size) { maxSegmentSize = size; return *this; };
+
+    /**
+     * @brief Scans the directory for segment files and counts the queued events. Call during setup.
+     * 
+     * Records that were only partially written (reset during a write) are ignored.
+     */
+    bool scan();
+
+    /**
+     * @brief Appends an event to the newest segment, starting a new segment if necessary
+     * 
+     * @param event The event to append. The event is not modified or deleted.
+     */
+    bool append(const PublishQueueEvent *event);
+
+    /**
+     * @brief Read the oldest event in the queue
+     * 
+     * May return NULL if the queue is empty, the record is corrupted, or out of memory.
+     * 
+     * You must delete the result from this method when you are done using it. 
+     */
+    PublishQueueEvent *readHead();
+
+    /**
+     * @brief Removes the oldest event from the queue
+     * 
+     * If this was the last event in its segment, the segment file is removed, unless it is the 
+     * newest segment and is not full yet.
+     */
+    bool removeHead();
+
+    /**
+     * @brief Removes all segment files and empties the queue
+     */
+    void removeAll();
+
+    /**
+     * @brief Returns the file number of the segment containing the oldest event, or 0 if the queue is empty
+     */
+    int getHeadFileNum() const;
+
+    /**
+     * @brief Returns the file number of the newest segment, the one events are appended to, or 0 if there is none
+     */
+    int getTailFileNum() const;
+
+    /**
+     * @brief Returns the file offset of the oldest event within its segment, or 0 if the queue is empty
+     * 
+     * Together with getHeadFileNum() this identifies the oldest event.
+     */
+    uint32_t getHeadOffset() const;
+
+    /**
+     * @brief Returns the number of events in the queue
+     */
+    size_t getQueueLen() const { return numEvents; };
+
+    /**
+     * @brief Calculate the CRC-16/CCITT (polynomial 0x1021, initial value 0xffff) of a buffer
+     */
+    static uint16_t crc16(const uint8_t *data, size_t len);
+
+    /**
+     * @brief Magic bytes stored at the beginning of segment files for validity checking
+     */
+    static const uint32_t SEGMENT_MAGIC = 0x31b67664;
+
+    /**
+     * @brief Version of the segment header
+     */
+    static const uint8_t SEGMENT_VERSION = 1;
+
+protected:
+    /**
+     * @brief Information about a segment file kept in RAM
+     */
+    struct Segment {
+        int fileNum;            //!< SequentialFile file number
+        uint32_t headOffset;    //!< Offset of the oldest unsent record
+        uint32_t size;          //!< Offset of the end of the last complete record
+        size_t numEvents;       //!< Number of unsent records
+    };
+
+    /**
+     * @brief Read the header of a segment file and count the records after seg.headOffset
+     */
+    bool scanSegment(Segment &seg);
+
+    /**
+     * @brief Remove the oldest segment file from the queue
+     */
+    void removeFrontSegment();
+
+    /**
+     * @brief Create a new, empty segment file and add it to the end of segments
+     */
+    bool newSegment();
+
+    /**
+     * @brief Read the head file. Returns false if it does not exist or is not valid.
+     */
+    bool readHeadFile(PublishQueueSegmentHead &head);
+
+    /**
+     * @brief Write the file number and headOffset of the oldest segment to the head file
+     */
+    bool writeHeadFile();
+
+    /**
+     * @brief Returns the pathname of the head file
+     */
+    String getHeadPath() const { return String(segmentFiles.getDirPath()) + "/head"; };
+
+    SequentialFile segmentFiles; //!< Used to number and find the segment files
+    std::deque<Segment> segments; //!< Segments in order, oldest first
+    size_t numEvents = 0; //!< Total number of unsent events in all segments
+    size_t maxSegmentSize = 16384; //!< Size at which a new segment is started
+    uint16_t headEventSize = 0; //!< Size of the oldest event if readHead() has read it, so removeHead() does not read it again
+};
+
 /**
  * @brief Class for asynchronous publishing of events
  * 
@@ -105,6 +306,25 @@ public:
      */
     PublishQueuePosix &withDirPath(const char *dirPath) { fileQueue.withDirPath(dirPath); return *this; };
 
+    /**
+     * @brief Store the file-based queue in a segmented log instead of one file per event
+     * 
+     * @param maxSegmentSize The size at which a segment file is closed and a new one started
+     * 
+     * Each event is appended as a record to a segment file in the queue directory, which avoids
+     * creating, closing, and unlinking a file for every event and makes scanning the queue at boot
+     * much faster when many events are queued. See PublishQueueSegmentLog.
+     * 
+     * Call this before setup(). Events queued in the one-file-per-event format are not read in this
+     * mode, so switch on a device with an empty queue or use a new queue directory.
+     */
+    PublishQueuePosix &withSegmentedLog(size_t maxSegmentSize = 16384) { useSegmentLog = true; segmentLog.withMaxSegmentSize(maxSegmentSize); return *this; };
+
+    /**
+     * @brief Returns true if the segmented log is used for the file-based queue
+     */
+    bool getSegmentedLog() const { return useSegmentLog; };
+
     /**
      * @brief Gets the directory path set using withDirPath()
      * 
@@ -328,6 +548,11 @@ protected:
      */
     PublishQueueEvent *newRamEvent(const char *eventName, const char *eventData, PublishFlags flags);
 
+    /**
+     * @brief Gets the number of events in the file-based queue (files or segmented log)
+     */
+    size_t getFileQueueLen() const;
+
     /**
      * @brief Read an event from a sequentially numbered file 
      * 
@@ -373,6 +598,13 @@ protected:
      */
     SequentialFile fileQueue;
 
+    /**
+     * @brief Segmented log used instead of fileQueue when withSegmentedLog() is used
+     */
+    PublishQueueSegmentLog segmentLog;
+
+    bool useSegmentLog = false; //!< true to use segmentLog instead of one file per event
+
 
     size_t ramQueueSize = 2; //!< size of the queue in RAM
     size_t fileQueueSize = 100; //!< size of the queue on the flash file system
@@ -382,6 +614,7 @@ protected:
 
     PublishQueueEvent *curEvent = 0; //!< Current event being published
     int curFileNum = 0; //!< Current file number being published (0 if from RAM queue)
+    uint32_t curSegmentOffset = 0; //!< Offset in the segment of the event being published (segmented log only)
     unsigned long stateTime = 0; //!< millis() value when entering the state, used for stateWait
     unsigned long durationMs = 0; //!< how long to wait before publishing in milliseconds, used in stateWait
     bool publishComplete = false; //!< true if the publish has completed (successfully or not)
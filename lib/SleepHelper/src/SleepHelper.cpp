@@ -32,6 +32,8 @@ static SleepHelperWakeEvents _wakeEvents[] = {
     { SleepHelper::eventsEnabledTimeToConnect, "ttc", 50 },
     { SleepHelper::eventsEnabledResetReason, "rr", 50 },
     { SleepHelper::eventsEnabledBatterySoC, "soc", 50 },
+    { SleepHelper::eventsEnabledWakeProfile, "wp", 40 },
+    { SleepHelper::eventsEnabledEnergy, "en", 40 },
 };
 
 static const SleepHelperWakeEvents *_findWakeEvent(uint64_t flag) {
@@ -44,6 +46,33 @@ static const SleepHelperWakeEvents *_findWakeEvent(uint64_t flag) {
     return 0;
 }
 
+/**
+ * @brief Returns the time of local midnight at the start of the day containing time, or 0 if time is 0
+ */
+static time_t localDayStart(time_t time) {
+    if (time == 0) {
+        return 0;
+    }
+    LocalTimeConvert conv;
+    conv.withTime(time).convert();
+    conv.atLocalTime(LocalTimeHMS("00:00:00"));
+    return conv.time;
+}
+
+float SleepHelper::getEnergyTodayMah() const {
+    if (!Time.isValid()) {
+        return 0;
+    }
+    return persistentData.getValue_energyDayUah(localDayStart(Time.now())) / 1000.0;
+}
+
+float SleepHelper::getEnergyYesterdayMah() const {
+    if (!Time.isValid()) {
+        return 0;
+    }
+    return persistentData.getValue_energyPrevDayUah(localDayStart(Time.now())) / 1000.0;
+}
+
 // [static]
 int SleepHelper::eventsEnablePriority(uint64_t flag) {
     const SleepHelperWakeEvents *ev = _findWakeEvent(flag);
@@ -93,6 +122,9 @@ void SleepHelper::setup() {
     getScheduleDataCapture().withFlags(LocalTimeSchedule::FLAG_QUICK_WAKE);
     getScheduleFull().withFlags(LocalTimeSchedule::FLAG_FULL_WAKE);
 
+    // Cache the upcoming schedule times so each wake doesn't need to step through the schedules again
+    scheduleManager.withPlanHorizon();
+
     // This library directly uses BackgroundPublishRK to publish from a worker thread to 
     // avoid blocking. You can safely use this at the same time as using 
     // PublishQueuePosixRK to handle publishing with saving publishes to
@@ -260,6 +292,7 @@ void SleepHelper::dataCaptureHandler() {
         // Previously started capture, waiting for callbacks to finish
         if (!dataCaptureFunctions.whileAnyTrue()) {
             dataCaptureActive = false;
+            wakeProfiler.dataCaptureEnd(millis());
         }
     }
     else {
@@ -274,6 +307,7 @@ void SleepHelper::dataCaptureHandler() {
                 // Capture now
                 dataCaptureFunctions.setStartState();
                 dataCaptureActive = true;
+                wakeProfiler.dataCaptureStart(millis());
                 updateSchedule = true;
             }
         }
@@ -291,7 +325,32 @@ void SleepHelper::dataCaptureHandler() {
 
 }
 
+void SleepHelper::setCellularSignal(float strength, float quality) {
+    if (!connectTimeoutPolicyAdded) {
+        return;
+    }
+    uint8_t signalClass = connectTimeoutPolicy.signalClass(strength, quality);
+    if (signalClass == ConnectTimeoutPolicy::signalUnknown || signalClass == persistentData.getValue_connectSignalClass()) {
+        return;
+    }
+    persistentData.setValue_connectSignalClass(signalClass);
+
+    if (connectDeadlineMs != 0) {
+        updateConnectDeadline();
+        appLog.info("connect deadline %lu ms (signal %s)", connectDeadlineMs, (signalClass == ConnectTimeoutPolicy::signalPoor) ? "poor" : "good");
+    }
+}
+
+void SleepHelper::updateConnectDeadline() {
+    uint16_t counts[ConnectTimeoutPolicy::NUM_SIGNAL_CLASSES][ConnectTimeoutPolicy::NUM_BINS];
+
+    persistentData.getValue_connectHistogram(counts);
+    connectDeadlineMs = connectTimeoutPolicy.deadlineMs(counts, persistentData.getValue_connectSignalClass(), persistentData.getValue_connectFailures());
+}
+
 void SleepHelper::stateHandlerStart() {
+    wakeProfiler.enterPhase(WakeCycleProfile::phaseStart, millis());
+
     appLog.info("stateHandlerStart");
 
     // This handles when we do a quick wake cycle by schedule and we've woken up
@@ -317,10 +376,17 @@ void SleepHelper::stateHandlerStart() {
     connectAttemptStartMillis = millis();
     networkConnectedMillis = 0;
     reconnectAttemptStartMillis = 0;
+
+    if (connectTimeoutPolicyAdded) {
+        updateConnectDeadline();
+        appLog.info("connect deadline %lu ms", connectDeadlineMs);
+    }
 }
 
 
 void SleepHelper::stateHandlerConnectWait() {
+    wakeProfiler.enterPhase(WakeCycleProfile::phaseConnectWait, millis());
+
     if (Particle.connected()) {
         stateHandler = &SleepHelper::stateHandlerTimeValidWait;
         return;
@@ -334,8 +400,18 @@ void SleepHelper::stateHandlerConnectWait() {
 
     system_tick_t elapsedMs = millis() - connectAttemptStartMillis;
 
-    if (maximumTimeToConnectFunctions.whileAnyFalse(false, elapsedMs)) {
+    if (maximumTimeToConnectFunctions.whileAnyTrue(false, elapsedMs)) {
         appLog.info("timed out connecting to cloud");
+        if (connectTimeoutPolicyAdded) {
+            // Count it as taking longer than it was allowed. Otherwise only the attempts that were fast
+            // enough would be counted and the time allowed would keep getting shorter.
+            persistentData.addValue_connectTime(persistentData.getValue_connectSignalClass(), elapsedMs, connectTimeoutPolicy.getDecayTotal());
+
+            uint8_t failures = persistentData.getValue_connectFailures();
+            if (failures < 255) {
+                persistentData.setValue_connectFailures(failures + 1);
+            }
+        }
         stateHandler = &SleepHelper::stateHandlerDisconnectBeforeSleep;
         return;
     }
@@ -343,6 +419,8 @@ void SleepHelper::stateHandlerConnectWait() {
 }
 
 void SleepHelper::stateHandlerTimeValidWait() {
+    wakeProfiler.enterPhase(WakeCycleProfile::phaseTimeValidWait, millis());
+
     // Wait until we get a valid RTC clock time. This happens immediately after 
     // connecting to the cloud, and will likely already be set on wake from
     // sleep, so this will be instantaneous in many cases.
@@ -354,6 +432,8 @@ void SleepHelper::stateHandlerTimeValidWait() {
 
 
 void SleepHelper::stateHandlerConnectedStart() {
+    wakeProfiler.enterPhase(WakeCycleProfile::phaseConnectedStart, millis());
+
     connectedStartMillis = millis();
 
     SleepHelper::instance().persistentData.setValue_lastFullWake(Time.now());
@@ -361,6 +441,11 @@ void SleepHelper::stateHandlerConnectedStart() {
     system_tick_t elapsedMs = connectedStartMillis - connectAttemptStartMillis;
     appLog.info("connected to cloud in %lu ms", elapsedMs);
 
+    if (connectTimeoutPolicyAdded) {
+        persistentData.addValue_connectTime(persistentData.getValue_connectSignalClass(), elapsedMs, connectTimeoutPolicy.getDecayTotal());
+        persistentData.setValue_connectFailures(0);
+    }
+
     withWakeEventFlagOneTimeFunction(eventsEnabledTimeToConnect, [elapsedMs](JSONWriter &writer, int &priority) {
         writer.value((int)elapsedMs);
     });
@@ -374,13 +459,57 @@ void SleepHelper::stateHandlerConnectedStart() {
     });
 #endif // HAL_PLATFORM_POWER_MANAGEMENT
 
+    withWakeEventFlagOneTimeFunction(eventsEnabledWakeProfile, [this](JSONWriter &writer, int &priority) {
+        // Wake cycles completed since the last report, oldest first
+        uint32_t count = persistentData.getValue_wakeCycleCount();
+        size_t numCycles = count - persistentData.getValue_wakeCycleReported();
+        if (numCycles > PersistentData::WAKE_CYCLE_RING_SIZE) {
+            numCycles = PersistentData::WAKE_CYCLE_RING_SIZE;
+        }
+
+        writer.beginArray();
+        for(size_t ii = numCycles; ii-- > 0; ) {
+            WakeCycleProfile cycle;
+            if (persistentData.getValue_wakeCycle(ii, cycle)) {
+                cycle.toJson(writer);
+            }
+        }
+        writer.endArray();
+
+        persistentData.setValue_wakeCycleReported(count);
+    });
+
+    withWakeEventFlagOneTimeFunction(eventsEnabledEnergy, [this](JSONWriter &writer, int &priority) {
+        // Estimated charge since the last wake event, and the charge measured by the fuel gauge
+        float soc = 0;
+#if HAL_PLATFORM_POWER_MANAGEMENT
+        soc = System.batteryCharge();
+        if (soc < 0) {
+            soc = 0;
+        }
+#endif // HAL_PLATFORM_POWER_MANAGEMENT
+        time_t dayStart = localDayStart(Time.now());
+        float lastSoC = persistentData.getValue_energyReportSoC();
+
+        writer.beginObject();
+        writer.name("c").value(persistentData.getValue_energyReportUah() / 1000.0, 2);
+        writer.name("d").value(persistentData.getValue_energyDayUah(dayStart) / 1000.0, 2);
+        writer.name("pd").value(persistentData.getValue_energyPrevDayUah(dayStart) / 1000.0, 2);
+        if (soc > 0 && lastSoC > 0) {
+            // Positive values are discharge, negative values are net charging (such as from solar)
+            writer.name("m").value((lastSoC - soc) * energyModel.getBatteryCapacityMah() / 100.0, 2);
+        }
+        writer.endObject();
 
+        persistentData.resetValue_energyReport(soc);
+    });
 
     stateHandler = &SleepHelper::stateHandlerConnectedWakeEvents;
 }
 
 
 void SleepHelper::stateHandlerConnectedWakeEvents() {
+    wakeProfiler.enterPhase(WakeCycleProfile::phaseConnectedWakeEvents, millis());
 
     if (dataCaptureActive) {
         // Wait until data capture is complete before generating events
@@ -396,6 +525,8 @@ void SleepHelper::stateHandlerConnectedWakeEvents() {
 }
 
 void SleepHelper::stateHandlerConnected() {
+    wakeProfiler.enterPhase(WakeCycleProfile::phaseConnected, millis());
+
     if (!Particle.connected()) {
         reconnectAttemptStartMillis = millis();
         stateHandler = &SleepHelper::stateHandlerReconnectWait;
@@ -416,14 +547,43 @@ void SleepHelper::stateHandlerConnected() {
         }
     }
 
-    if (!publishData.empty()) {
-        PublishData event = publishData.front();
-
-        stateTime = millis();
-
-        // TODO: Pause PublishQueuePosixRK processing until our immediate events are finished
+    // Handle completed publishes, oldest first. BackgroundPublishRK calls the callbacks in order.
+    while(publishDataInFlight > 0) {
+        uint8_t result = publishDataResults[publishDataDoneSeq % PUBLISH_DATA_MAX_IN_FLIGHT];
+        if (result == publishResultPending) {
+            break;
+        }
+        publishDataResults[publishDataDoneSeq % PUBLISH_DATA_MAX_IN_FLIGHT] = publishResultPending;
+        wakeProfiler.addPublish(millis() - publishDataQueuedMillis[publishDataDoneSeq % PUBLISH_DATA_MAX_IN_FLIGHT]);
+        publishDataDoneSeq++;
+        publishDataInFlight--;
+
+        if (result == publishResultSucceeded) {
+            appLog.info("removing item from publishData");
+            publishData.erase(publishData.begin() + publishDataFailed);
+        }
+        else {
+            // Leave it at the front of publishData to try again
+            publishDataFailed++;
+        }
+    }
+    if (publishDataInFlight == 0) {
+        publishDataFailed = 0;
+    }
 
-        stateHandler = &SleepHelper::stateHandlerPublishWait;
+    // Queue as many events as BackgroundPublishRK will accept, leaving one of its slots for
+    // PublishQueuePosixRK. It handles the cloud rate limit, so there's no need to wait between
+    // publishes here. After a failure, wait for the publishes in flight to complete and start again
+    // from the first failed event; the ones queued after it still go out first.
+    // TODO: Pause PublishQueuePosixRK processing until our immediate events are finished
+    size_t maxInFlight = PUBLISH_DATA_MAX_IN_FLIGHT;
+    size_t backgroundQueueSize = BackgroundPublishRK::instance().getQueueSize();
+    if (backgroundQueueSize > 1 && backgroundQueueSize - 1 < maxInFlight) {
+        maxInFlight = backgroundQueueSize - 1;
+    }
+    while(publishDataFailed == 0 && publishDataInFlight < publishData.size() && publishDataInFlight < maxInFlight) {
+        const PublishData &event = publishData[publishDataInFlight];
+        publishDataQueuedMillis[publishDataSeq % PUBLISH_DATA_MAX_IN_FLIGHT] = millis();
 
         // 
         if (logEnableEnabled(logEnabledPublishData)) {
@@ -431,20 +591,24 @@ void SleepHelper::stateHandlerConnected() {
             appLog.write(LOG_LEVEL_TRACE, event.eventData.c_str(), event.eventData.length());
             appLog.write(LOG_LEVEL_TRACE, "\r\n", 2);
         }
-        
 
+        // The callback runs on the BackgroundPublishRK thread so it only records the result
+        // for this state handler to act on
         bool bResult = BackgroundPublishRK::instance().publish(event.eventName, event.eventData, event.flags, 
             [this](bool succeeded, const char *event_name, const char *event_data, const void *event_context) {
             // Callback
-            if (succeeded) {
-                appLog.info("removing item from publishData");
-                publishData.erase(publishData.begin());
-            }
-            stateHandler = &SleepHelper::stateHandlerPublishRateLimit;
-        });
+            size_t seq = (size_t)event_context;
+            publishDataResults[seq % PUBLISH_DATA_MAX_IN_FLIGHT] = succeeded ? publishResultSucceeded : publishResultFailed;
+        }, (const void *)(size_t)publishDataSeq);
         if (!bResult) {
-            stateHandler = &SleepHelper::stateHandlerConnected;
+            // Queue is full, try again later
+            break;
         }
+        publishDataSeq++;
+        publishDataInFlight++;
+    }
+
+    if (!publishData.empty()) {
         return;
     }
 
@@ -458,19 +622,9 @@ void SleepHelper::stateHandlerConnected() {
 
 }
 
-void SleepHelper::stateHandlerPublishWait() {
-    // Exiting this state happens from the background publish callback lambda, see stateHandlerConnected state
-}
-
-void SleepHelper::stateHandlerPublishRateLimit() {
-    if (millis() - stateTime > 1000) {
-        stateHandler = &SleepHelper::stateHandlerConnected;
-        return;
-    }
-}
-
-
 void SleepHelper::stateHandlerReconnectWait() {
+    wakeProfiler.enterPhase(WakeCycleProfile::phaseReconnectWait, millis());
+
     if (Particle.connected()) {
         stateHandler = &SleepHelper::stateHandlerConnected;
         return;
@@ -478,7 +632,7 @@ void SleepHelper::stateHandlerReconnectWait() {
 
     system_tick_t elapsedMs = millis() - reconnectAttemptStartMillis;
 
-    if (maximumTimeToConnectFunctions.whileAnyFalse(false, elapsedMs)) {
+    if (maximumTimeToConnectFunctions.whileAnyTrue(false, elapsedMs)) {
         appLog.info("timed out reconnecting to cloud");
         stateHandler = &SleepHelper::stateHandlerDisconnectBeforeSleep;
         return;
@@ -486,6 +640,8 @@ void SleepHelper::stateHandlerReconnectWait() {
 }
 
 void SleepHelper::stateHandlerNoConnection() {
+    wakeProfiler.enterPhase(WakeCycleProfile::phaseNoConnection, millis());
+
     // Prior state: stateHandlerStart
     // Next state: stateHandlerSleep
     // Trigger: data capture functions all return false and noConnectionFunctions all return false
@@ -511,6 +667,7 @@ void SleepHelper::stateHandlerNoConnection() {
 }
 
 void SleepHelper::stateHandlerDisconnectBeforeSleep() {
+    wakeProfiler.enterPhase(WakeCycleProfile::phaseDisconnectBeforeSleep, millis());
 
     calculateSleepSettings(true);
 #if Wiring_Cellular
@@ -530,6 +687,8 @@ void SleepHelper::stateHandlerDisconnectBeforeSleep() {
 }
 
 void SleepHelper::stateHandlerDisconnectWait() {
+    wakeProfiler.enterPhase(WakeCycleProfile::phaseDisconnectWait, millis());
+
     if (Particle.disconnected()) {
         appLog.info("Disconnecting cellular");
         network.disconnect();
@@ -539,6 +698,8 @@ void SleepHelper::stateHandlerDisconnectWait() {
 }
 
 void SleepHelper::stateHandlerWaitCellularDisconnected() {
+    wakeProfiler.enterPhase(WakeCycleProfile::phaseWaitCellularDisconnected, millis());
+
     // Call network.disconnect() before entering this state
     // Prior state: stateHandlerDisconnectWait (trigger: Particle disconnected)
     // Next state: stateHandlerWaitCellularOff (trigger: !network.ready())
@@ -552,6 +713,8 @@ void SleepHelper::stateHandlerWaitCellularDisconnected() {
 
 
 void SleepHelper::stateHandlerWaitCellularOff() {
+    wakeProfiler.enterPhase(WakeCycleProfile::phaseWaitCellularOff, millis());
+
     // Call network.off() before entering this state
     // Prior state: stateHandlerWaitCellularDisconnected (trigger: !network.ready())
     // Next state: stateHandlerSleep (trigger: network.isOff()
@@ -569,6 +732,15 @@ void SleepHelper::stateHandlerSleep() {
     // stateHandlerDisconnectBeforeSleep (trigger: not turning cellular off due to short sleep)
     appLog.info("stateHandlerSleep");
 
+    // The wake cycle ends before the sleep or reset functions so the persistent data flush saves it
+    WakeCycleProfile completedCycle;
+    time_t now = Time.isValid() ? Time.now() : 0;
+    if (wakeProfiler.endCycle(millis(), now, completedCycle)) {
+        completedCycle.chargeUah = energyModel.cycleChargeUah(completedCycle);
+        persistentData.addValue_wakeCycle(completedCycle);
+        persistentData.addValue_energy(completedCycle.chargeUah, localDayStart(now));
+    }
+
     sleepOrResetFunctions.forEach(false);
 
     // Especially in the cloud disconnect case it can take several seconds to disconnect, so
@@ -588,8 +760,16 @@ void SleepHelper::stateHandlerSleep() {
         appLog.info("sleeping for %d sec adjustmentMs=%d", (int)(sleepParams.sleepTimeMs / 1000), adjustmentMs);
 
         // Sleep!
+        time_t sleepStart = Time.isValid() ? Time.now() : 0;
         SystemSleepResult sleepResult = System.sleep(sleepConfig);
 
+        // Use the RTC for the time asleep in case of an early wake, otherwise the requested time
+        system_tick_t sleptMs = sleepParams.sleepTimeMs;
+        if (sleepStart != 0 && Time.isValid() && Time.now() >= sleepStart) {
+            sleptMs = (system_tick_t)(Time.now() - sleepStart) * 1000;
+        }
+        wakeProfiler.setSleepBefore(sleptMs, sleepParams.isConnected && !sleepParams.disconnectCellular);
+
         wakeFunctions.forEach(sleepResult);
 
         wakeReasonInt = (int) sleepResult.wakeupReason();
@@ -606,6 +786,8 @@ void SleepHelper::stateHandlerSleep() {
 }
 
 void SleepHelper::stateHandlerSleepDone() {
+    wakeProfiler.enterPhase(WakeCycleProfile::phaseSleepDone, millis());
+
     // Set wakeReasonInt before calling
 
     // Start over
@@ -621,6 +803,8 @@ void SleepHelper::stateHandlerSleepDone() {
 }
 
 void SleepHelper::stateHandlerSleepShort() {
+    wakeProfiler.enterPhase(WakeCycleProfile::phaseSleepShort, millis());
+
     if (millis() - stateTime >= sleepParams.sleepTimeMs) {
         stateHandler = &SleepHelper::stateHandlerSleepDone;
         return;
@@ -630,6 +814,242 @@ void SleepHelper::stateHandlerSleepShort() {
 
 #endif // UNITTEST
 
+//
+// WakeCycleProfile
+//
+
+// [static]
+const char *SleepHelper::WakeCycleProfile::phaseName(uint8_t phase) {
+    static const char *names[numPhases] = {
+        "start",
+        "connectWait",
+        "timeValidWait",
+        "connectedStart",
+        "connectedWakeEvents",
+        "connected",
+        "reconnectWait",
+        "noConnection",
+        "disconnectBeforeSleep",
+        "disconnectWait",
+        "waitCellularDisconnected",
+        "waitCellularOff",
+        "sleepShort",
+        "sleepDone",
+    };
+    if (phase < numPhases) {
+        return names[phase];
+    }
+    else {
+        return "";
+    }
+}
+
+void SleepHelper::WakeCycleProfile::toJson(JSONWriter &writer) const {
+    writer.beginObject();
+    writer.name("t").value((unsigned)startTime);
+    writer.name("a").value((unsigned)awakeMs);
+
+    writer.name("ph").beginArray();
+    for(size_t ii = 0; ii < numPhases; ii++) {
+        writer.value((unsigned)phaseMs[ii]);
+    }
+    writer.endArray();
+
+    if (dataCaptureMs) {
+        writer.name("dc").value((unsigned)dataCaptureMs);
+    }
+    if (publishCount) {
+        writer.name("pb").value((unsigned)publishCount);
+        writer.name("pbt").value((unsigned)publishMs);
+    }
+    if (sensorMs) {
+        writer.name("sn").value((unsigned)sensorMs);
+    }
+    if (sleepMs) {
+        writer.name("sl").value((unsigned)sleepMs);
+    }
+    if (flags & flagModemStandby) {
+        writer.name("ms").value(1);
+    }
+    writer.name("uah").value((unsigned)chargeUah);
+    writer.endObject();
+}
+
+//
+// EnergyModel
+//
+
+uint32_t SleepHelper::EnergyModel::cycleChargeUah(const WakeCycleProfile &cycle) const {
+    bool modemStandby = (cycle.flags & WakeCycleProfile::flagModemStandby) != 0;
+
+    // Sum of milliamps * milliseconds
+    double maMs = 0;
+    for(size_t ii = 0; ii < WakeCycleProfile::numPhases; ii++) {
+        float ma = cpuAwakeMa;
+        if (isModemPhase(ii)) {
+            ma += modemOnMa;
+        }
+        else
+        if (modemStandby) {
+            ma += modemStandbyMa;
+        }
+        maMs += (double)cycle.phaseMs[ii] * ma;
+    }
+    maMs += (double)cycle.sensorMs * sensorMa;
+    maMs += (double)cycle.sleepMs * (sleepMa + (modemStandby ? modemStandbyMa : 0));
+
+    // 1 microamp hour = 3600 milliamp milliseconds
+    return (uint32_t)(maMs / 3600.0 + 0.5);
+}
+
+// [static]
+bool SleepHelper::EnergyModel::isModemPhase(uint8_t phase) {
+    switch(phase) {
+        case WakeCycleProfile::phaseStart:
+        case WakeCycleProfile::phaseNoConnection:
+        case WakeCycleProfile::phaseSleepShort:
+        case WakeCycleProfile::phaseSleepDone:
+            return false;
+
+        default:
+            return phase < WakeCycleProfile::numPhases;
+    }
+}
+
+//
+// ConnectTimeoutPolicy
+//
+
+// Upper edge of each histogram bin, roughly logarithmic from 5 seconds to 11 minutes
+static const uint32_t connectBinUpperMs[SleepHelper::ConnectTimeoutPolicy::NUM_BINS] = {
+    5000, 7500, 10000, 15000, 20000, 30000, 45000, 60000,
+    90000, 120000, 180000, 240000, 300000, 420000, 540000, 660000
+};
+
+uint8_t SleepHelper::ConnectTimeoutPolicy::signalClass(float strength, float quality) const {
+    if (strength < 0 || quality < 0) {
+        return signalUnknown;
+    }
+    if (strength < poorStrength || quality < poorQuality) {
+        return signalPoor;
+    }
+    return signalGood;
+}
+
+uint32_t SleepHelper::ConnectTimeoutPolicy::deadlineMs(const uint16_t counts[NUM_SIGNAL_CLASSES][NUM_BINS], uint8_t signalClass, uint8_t failures) const {
+    uint32_t combined[NUM_BINS];
+    uint32_t total = 0;
+
+    // Use the histogram for the signal if it has enough samples, otherwise both
+    if (signalClass != signalUnknown) {
+        const uint16_t *classCounts = counts[histogramIndex(signalClass)];
+        for(size_t bin = 0; bin < NUM_BINS; bin++) {
+            combined[bin] = classCounts[bin];
+            total += classCounts[bin];
+        }
+    }
+    if (total < minimumSamples) {
+        total = 0;
+        for(size_t bin = 0; bin < NUM_BINS; bin++) {
+            combined[bin] = counts[0][bin] + counts[1][bin];
+            total += combined[bin];
+        }
+    }
+    if (total < minimumSamples || total == 0) {
+        return maximumTimeMs;
+    }
+
+    uint32_t target = (total * percentile + 99) / 100;
+    uint32_t sum = 0;
+    uint32_t result = maximumTimeMs;
+    for(size_t bin = 0; bin < NUM_BINS - 1; bin++) {
+        sum += combined[bin];
+        if (sum >= target) {
+            result = binUpperMs(bin);
+            break;
+        }
+    }
+
+    if (result < minimumTimeMs) {
+        result = minimumTimeMs;
+    }
+
+    // Allow twice as long for each consecutive attempt that timed out
+    for(uint8_t ii = 0; ii < failures && result < maximumTimeMs; ii++) {
+        result *= 2;
+    }
+    if (result > maximumTimeMs) {
+        result = maximumTimeMs;
+    }
+    return result;
+}
+
+// [static]
+size_t SleepHelper::ConnectTimeoutPolicy::binForMs(uint32_t ms) {
+    for(size_t bin = 0; bin < NUM_BINS - 1; bin++) {
+        if (ms <= connectBinUpperMs[bin]) {
+            return bin;
+        }
+    }
+    return NUM_BINS - 1;
+}
+
+// [static]
+uint32_t SleepHelper::ConnectTimeoutPolicy::binUpperMs(size_t bin) {
+    return connectBinUpperMs[(bin < NUM_BINS) ? bin : (NUM_BINS - 1)];
+}
+
+//
+// WakeProfiler
+//
+
+void SleepHelper::WakeProfiler::startCycle(uint8_t phase, system_tick_t ms) {
+    cycle = WakeCycleProfile();
+    active = true;
+    curPhase = phase;
+    cycleStartMs = phaseStartMs = ms;
+
+    cycle.sleepMs = sleepBeforeMs;
+    if (sleepBeforeModemStandby) {
+        cycle.flags |= WakeCycleProfile::flagModemStandby;
+    }
+    sleepBeforeMs = 0;
+    sleepBeforeModemStandby = false;
+
+    if (dataCaptureActive) {
+        // Data capture was still running when the last cycle ended
+        dataCaptureStartMs = ms;
+    }
+    if (sensorActive) {
+        sensorStartMs = ms;
+    }
+}
+
+bool SleepHelper::WakeProfiler::endCycle(system_tick_t ms, time_t now, WakeCycleProfile &completed) {
+    if (!active) {
+        return false;
+    }
+
+    addPhaseTime(ms);
+    cycle.awakeMs = ms - cycleStartMs;
+    if (now != 0) {
+        cycle.startTime = (uint32_t)(now - (time_t)(cycle.awakeMs / 1000));
+    }
+    if (dataCaptureActive) {
+        // Count the capture in progress in this cycle; the rest is counted in the next cycle
+        cycle.dataCaptureMs += ms - dataCaptureStartMs;
+    }
+    if (sensorActive) {
+        cycle.sensorMs += ms - sensorStartMs;
+    }
+
+    completed = cycle;
+    active = false;
+
+    return true;
+}
+
+
 //
 // SettingsFile
 //
@@ -1073,6 +1493,99 @@ void SleepHelper::PersistentDataFile::flush(bool force) {
     }
 }
 
+//
+// PersistentData
+//
+
+void SleepHelper::PersistentData::addValue_wakeCycle(const WakeCycleProfile &cycle) {
+    WITH_LOCK(*this) {
+        uint32_t count = sleepHelperData.wakeCycleCount;
+        sleepHelperData.wakeCycles[count % WAKE_CYCLE_RING_SIZE] = cycle;
+        sleepHelperData.wakeCycleCount = count + 1;
+        saveOrDefer();
+    }
+}
+
+void SleepHelper::PersistentData::addValue_energy(uint32_t chargeUah, time_t dayStart) {
+    WITH_LOCK(*this) {
+        if (dayStart != 0 && (uint32_t)dayStart != sleepHelperData.energyDayStart) {
+            // New day. Only keep the previous day total if it was the day before.
+            bool isPrevDay = dayStart > (time_t)sleepHelperData.energyDayStart && (dayStart - (time_t)sleepHelperData.energyDayStart) <= 25 * 3600;
+            sleepHelperData.energyPrevDayUah = isPrevDay ? sleepHelperData.energyDayUah : 0;
+            sleepHelperData.energyDayUah = 0;
+            sleepHelperData.energyDayStart = (uint32_t)dayStart;
+        }
+        sleepHelperData.energyDayUah += chargeUah;
+        sleepHelperData.energyReportUah += chargeUah;
+        saveOrDefer();
+    }
+}
+
+uint32_t SleepHelper::PersistentData::getValue_energyDayUah(time_t dayStart) const {
+    uint32_t result = 0;
+
+    WITH_LOCK(*this) {
+        if ((uint32_t)dayStart == sleepHelperData.energyDayStart) {
+            result = sleepHelperData.energyDayUah;
+        }
+    }
+    return result;
+}
+
+uint32_t SleepHelper::PersistentData::getValue_energyPrevDayUah(time_t dayStart) const {
+    uint32_t result = 0;
+
+    WITH_LOCK(*this) {
+        if ((uint32_t)dayStart == sleepHelperData.energyDayStart) {
+            result = sleepHelperData.energyPrevDayUah;
+        }
+        else 
+        if (dayStart > (time_t)sleepHelperData.energyDayStart && (dayStart - (time_t)sleepHelperData.energyDayStart) <= 25 * 3600) {
+            // No cycle has ended today yet, so the saved day is yesterday
+            result = sleepHelperData.energyDayUah;
+        }
+    }
+    return result;
+}
+
+void SleepHelper::PersistentData::addValue_connectTime(uint8_t signalClass, uint32_t ms, uint16_t decayTotal) {
+    WITH_LOCK(*this) {
+        uint16_t *counts = sleepHelperData.connectHistogram[ConnectTimeoutPolicy::histogramIndex(signalClass)];
+
+        uint32_t total = 0;
+        for(size_t bin = 0; bin < ConnectTimeoutPolicy::NUM_BINS; bin++) {
+            total += counts[bin];
+        }
+        if ((decayTotal != 0 && total >= decayTotal) || total >= 0xffff) {
+            // Halve the counts so recent connections count more. Round up so rare long connections aren't forgotten.
+            for(size_t bin = 0; bin < ConnectTimeoutPolicy::NUM_BINS; bin++) {
+                counts[bin] = counts[bin] - counts[bin] / 2;
+            }
+        }
+        counts[ConnectTimeoutPolicy::binForMs(ms)]++;
+        saveOrDefer();
+    }
+}
+
+void SleepHelper::PersistentData::getValue_connectHistogram(uint16_t counts[ConnectTimeoutPolicy::NUM_SIGNAL_CLASSES][ConnectTimeoutPolicy::NUM_BINS]) const {
+    WITH_LOCK(*this) {
+        memcpy(counts, sleepHelperData.connectHistogram, sizeof(sleepHelperData.connectHistogram));
+    }
+}
+
+bool SleepHelper::PersistentData::getValue_wakeCycle(size_t index, WakeCycleProfile &cycle) const {
+    bool result = false;
+
+    WITH_LOCK(*this) {
+        uint32_t count = sleepHelperData.wakeCycleCount;
+        if (index < WAKE_CYCLE_RING_SIZE && index < count) {
+            cycle = sleepHelperData.wakeCycles[(count - 1 - index) % WAKE_CYCLE_RING_SIZE];
+            result = true;
+        }
+    }
+    return result;
+}
+
 
 //
 // EventHistory
@@ -1113,31 +1626,107 @@ void SleepHelper::EventHistory::addEvent(std::function<void(JSONWriter &)>callba
     addEvent(buf);
 }
 
-
-bool SleepHelper::EventHistory::getEvents(JSONWriter &writer, size_t maxSize, bool bRemoveEvents) {
-    if (maxSize < 2 || !hasEvents) {
-        return false;
-    }
-    char *buf = (char *)malloc(maxSize);
-    if (!buf) {
-        return false;
+bool SleepHelper::EventHistory::addEvents(size_t count, std::function<void(size_t index, JSONWriter &)>callback) {
+    if (count == 0) {
+        return true;
     }
 
+    char buf[particle::protocol::MAX_EVENT_DATA_LENGTH + 1];
     bool bResult = false;
 
+    // Append to the file
     WITH_LOCK(*this) {
-        int fd = open(path, O_RDONLY);
+        int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0666);
         if (fd != -1) {
-            int dataSize = read(fd, buf, maxSize);
-            if (dataSize > 0) {
-                // Remove partial event
-                while(dataSize > 0 && buf[dataSize - 1] != '\n') {
-                    dataSize--;
-                }                    
-
-                if (dataSize > 0 && buf[dataSize - 1] == '\n') {
+            off_t startOffset = lseek(fd, 0, SEEK_END);
+            bResult = true;
+
+            for(size_t index = 0; index < count; index++) {
+                memset(buf, 0, sizeof(buf));
+                JSONBufferWriter writer(buf, sizeof(buf) - 2);
+
+                writer.beginObject();
+                callback(index, writer);
+                writer.endObject();
+
+                size_t len = strlen(buf);
+                if (SleepHelper::instance().logEnableEnabled(SleepHelper::logEnabledHistoryData)) {
+                    SleepHelper::instance().appLog.trace("EventHistory::addEvents %u", (unsigned)index);
+                    SleepHelper::instance().appLog.write(LOG_LEVEL_TRACE, buf, len);
+                    SleepHelper::instance().appLog.write(LOG_LEVEL_TRACE, "\r\n", 2);
+                }
+                buf[len++] = '\n';
+                if (write(fd, buf, len) != (ssize_t)len) {
+                    // Take back the events already written, the caller keeps all of them and tries again later
+                    SleepHelper::instance().appLog.error("EventHistory::addEvents write failed %s", path.c_str());
+                    if (startOffset >= 0) {
+                        ftruncate(fd, startOffset);
+                    }
+                    bResult = false;
+                    break;
+                }
+            }
+            close(fd);
+
+            if (bResult) {
+                hasEvents = true;
+            }
+        }
+        else {
+            SleepHelper::instance().appLog.error("EventHistory::addEvents could not open %s", path.c_str());
+        }
+    }    
+
+    return bResult;
+}
+
+
+bool SleepHelper::EventHistory::getEvents(JSONWriter &writer, size_t maxSize, bool bRemoveEvents, bool discardOversize) {
+    if (maxSize < 2 || !hasEvents) {
+        return false;
+    }
+
+    // CBOR and columns are much more compact than the JSON in the file, so read more of the file in that case
+    size_t readSize = (encoding != encodingJson) ? (4 * maxSize) : maxSize;
+
+    char *buf = (char *)malloc(readSize + 1);
+    if (!buf) {
+        return false;
+    }
+
+    bool bResult = false;
+
+    WITH_LOCK(*this) {
+        loadHeadOffset();
+        removeOffset = headOffset;
+
+        int fd = open(path, O_RDONLY);
+        if (fd != -1) {
+            if (headOffset) {
+                lseek(fd, headOffset, SEEK_SET);
+            }
+            int dataSize = read(fd, buf, readSize);
+            if (dataSize > 0) {
+                // Remove partial event
+                while(dataSize > 0 && buf[dataSize - 1] != '\n') {
+                    dataSize--;
+                }                    
+
+                if (dataSize == 0 && discardOversize) {
+                    // The first event is larger than the buffer, so it can never be sent
+                    skipLongEvent(fd, buf, readSize);
+                }
+
+                if (dataSize > 0 && buf[dataSize - 1] == '\n' && encoding == encodingCborZ85) {
+                    bResult = getEventsCborZ85(buf, dataSize, writer, maxSize, discardOversize);
+                }
+                else
+                if (dataSize > 0 && buf[dataSize - 1] == '\n' && encoding == encodingColumnar) {
+                    bResult = getEventsColumnar(buf, dataSize, writer, maxSize, discardOversize);
+                }
+                else
+                if (dataSize > 0 && buf[dataSize - 1] == '\n') {
                     // Have valid data
-                    bResult = true;
                     size_t bytesUsed = 2;
 
                     writer.beginArray();
@@ -1148,14 +1737,23 @@ bool SleepHelper::EventHistory::getEvents(JSONWriter &writer, size_t maxSize, bo
                         char *lf = strchr(cur, '\n');
                         *lf = 0;
 
+                        if (strlen(cur) + 2 > maxSize && discardOversize) {
+                            // Does not fit in an event even by itself
+                            SleepHelper::instance().appLog.info("discarding %u byte event history line, larger than an event", (unsigned)strlen(cur));
+                            cur = lf + 1;
+                            removeOffset = headOffset + (cur - buf);
+                            continue;
+                        }
+
                         bytesUsed += strlen(cur) + 1;
                         if (bytesUsed > maxSize) {
                             break;
                         }
                         SleepHelper::JSONCopy(cur, writer);                        
+                        bResult = true;
 
                         cur = lf + 1;
-                        removeOffset = (cur - buf);                        
+                        removeOffset = headOffset + (cur - buf);
                     }
 
                     writer.endArray();
@@ -1174,49 +1772,685 @@ bool SleepHelper::EventHistory::getEvents(JSONWriter &writer, size_t maxSize, bo
     return bResult;
 }
 
-void SleepHelper::EventHistory::removeEvents() {
+bool SleepHelper::EventHistory::removeEvents() {
     WITH_LOCK(*this) {
-        const size_t bufSize = 512;
-        char *buf = (char *)malloc(bufSize);
-        if (buf) {
-            int fdsrc = open(path, O_RDONLY);
-            if (fdsrc != -1) {
-                struct stat sb;
-                fstat(fdsrc, &sb);
-                size_t fileSize = sb.st_size;  
-                if (removeOffset < fileSize) {
-                    lseek(fdsrc, removeOffset, SEEK_SET);
-
-                    String tempPath = String(path) + ".tmp";
-                    int fddst = open(tempPath, O_RDWR | O_CREAT | O_TRUNC, 0666);
-                    if (fddst) {
-                        while(removeOffset < fileSize) {
-                            int count = read(fdsrc, buf, bufSize);
-                            if (count > 0) {
-                                write(fddst, buf, count);
-                                removeOffset += count;
-                            }
-                            else {
-                                break;
-                            }
+        loadHeadOffset();
+
+        struct stat sb;
+        if (stat(path, &sb) != 0) {
+            hasEvents = false;
+            removeOffset = headOffset = 0;
+            saveHeadOffset();
+            return true;
+        }
+        size_t fileSize = sb.st_size;  
+
+        if (removeOffset >= fileSize) {
+            // All events have been sent. Remove the head offset first, so a reset in between can't leave
+            // it on the next file.
+            removeOffset = headOffset = 0;
+            saveHeadOffset();
+            unlink(path);
+            hasEvents = false;
+        }
+        else
+        if (removeOffset <= headOffset) {
+            // Nothing was retrieved by getEvents()
+            return false;
+        }
+        else
+        if (useHeadOffset && (removeOffset < compactSize || removeOffset < fileSize - removeOffset)) {
+            // Just move the head past the sent events. The file is only copied once the sent events are
+            // larger than both compactSize and the unsent events, so draining a backlog copies each byte 
+            // at most a few times.
+            headOffset = removeOffset;
+            saveHeadOffset();
+        }
+        else {
+            copyRemainingEvents();
+        }
+    }
+    return true;
+}
+
+void SleepHelper::EventHistory::skipLongEvent(int fd, char *buf, size_t bufSize) {
+    size_t offset = lseek(fd, 0, SEEK_CUR);
+    while(true) {
+        int count = read(fd, buf, bufSize);
+        if (count <= 0) {
+            // No end of line yet, the event may still be being written
+            return;
+        }
+        char *lf = (char *)memchr(buf, '\n', count);
+        if (lf) {
+            offset += lf - buf + 1;
+            break;
+        }
+        offset += count;
+    }
+    SleepHelper::instance().appLog.info("discarding %u byte event history line, larger than an event", (unsigned)(offset - headOffset - 1));
+    removeOffset = offset;
+}
+
+void SleepHelper::EventHistory::copyRemainingEvents() {
+    const size_t bufSize = 512;
+    char *buf = (char *)malloc(bufSize);
+    if (buf) {
+        int fdsrc = open(path, O_RDONLY);
+        if (fdsrc != -1) {
+            lseek(fdsrc, removeOffset, SEEK_SET);
+
+            String tempPath = String(path) + ".tmp";
+            bool copied = false;
+            int fddst = open(tempPath, O_RDWR | O_CREAT | O_TRUNC, 0666);
+            if (fddst != -1) {
+                copied = true;
+                while(true) {
+                    int count = read(fdsrc, buf, bufSize);
+                    if (count > 0) {
+                        if (write(fddst, buf, count) != count) {
+                            copied = false;
+                            break;
                         }
-                        close(fddst);
                     }
-                    close(fdsrc);
+                    else {
+                        copied = (count == 0);
+                        break;
+                    }
+                }
+                close(fddst);
+            }
+            close(fdsrc);
+
+            if (copied) {
+                // Remove the head offset before the swap. A reset after the rename would otherwise leave
+                // the old offset on the compacted file and skip that many bytes of unsent events; this
+                // way a reset in between only sends some events again.
+                headOffset = 0;
+                saveHeadOffset();
+
+                // Swap src and dst files
+                unlink(path);
+                rename(tempPath, path);
+                removeOffset = 0;
+            }
+            else {
+                // Keep the history as it is and move the head instead, compaction is tried again next time
+                SleepHelper::instance().appLog.error("EventHistory could not copy to %s", tempPath.c_str());
+                unlink(tempPath);
+                if (useHeadOffset) {
+                    headOffset = removeOffset;
+                    saveHeadOffset();
+                }
+            }
+        }
+        free(buf);
+    }
+}
+
+bool SleepHelper::EventHistory::getEventsCborZ85(char *buf, size_t dataSize, JSONWriter &writer, size_t maxSize, bool discardOversize) {
+    // Z85 is 5 characters for every 4 bytes, plus the surrounding double quotes
+    if (maxSize < 7) {
+        return false;
+    }
+    size_t cborSize = (maxSize - 2) / 5 * 4;
 
-                    // Swap src and dst files
-                    unlink(path);
-                    rename(tempPath, path);
-                    removeOffset = 0;
+    uint8_t *cbor = (uint8_t *)malloc(cborSize);
+    if (!cbor) {
+        return false;
+    }
+    CborBufferWriter cborWriter(cbor, cborSize);
+
+    bool bResult = false;
+    JSONValue firstObj;
+
+    char *cur = buf;
+    char *end = &buf[dataSize];
+    while(cur < end) {
+        char *lf = strchr(cur, '\n');
+        *lf = 0;
+
+        JSONValue obj = JSONValue::parseCopy(cur);
+
+        size_t savedSize = cborWriter.dataSize();
+
+        if (!bResult) {
+            // The first event defines the keys
+            firstObj = obj;
+
+            cborWriter.beginMap(2);
+            cborWriter.value("k");
+
+            size_t numKeys = 0;
+            if (obj.isObject()) {
+                JSONObjectIterator iter(obj);
+                numKeys = iter.count();
+            }
+            cborWriter.beginArray(numKeys);
+            if (numKeys) {
+                JSONObjectIterator iter(obj);
+                while(iter.next()) {
+                    cborWriter.value(iter.name().data(), iter.name().size());
                 }
-                else {
-                    unlink(path);
-                    hasEvents = false;
+            }
+            cborWriter.value("r");
+            cborWriter.beginArray();
+        }
+
+        // Check if this event has the same keys as the first event
+        bool sameKeys = obj.isObject() && firstObj.isObject();
+        if (sameKeys) {
+            JSONObjectIterator iter(obj);
+            JSONObjectIterator firstIter(firstObj);
+            sameKeys = (iter.count() == firstIter.count());
+            while(sameKeys && iter.next() && firstIter.next()) {
+                sameKeys = (iter.name() == firstIter.name());
+            }
+        }
+
+        if (sameKeys) {
+            JSONObjectIterator iter(obj);
+            cborWriter.beginArray(iter.count());
+            while(iter.next()) {
+                SleepHelper::JSONToCbor(iter.value(), cborWriter);
+            }
+        }
+        else {
+            SleepHelper::JSONToCbor(obj, cborWriter);
+        }
+
+        // Leave room for the end of the indefinite length array
+        if (cborWriter.dataSize() + 1 > cborWriter.bufferSize()) {
+            if (!bResult && discardOversize) {
+                // Does not fit in an event even by itself (with the keys it defines)
+                SleepHelper::instance().appLog.info("discarding %u byte event history line, larger than an event", (unsigned)strlen(cur));
+                cborWriter.setDataSize(0);
+                cur = lf + 1;
+                removeOffset = headOffset + (cur - buf);
+                continue;
+            }
+            cborWriter.setDataSize(savedSize);
+            break;
+        }
+        bResult = true;
+
+        cur = lf + 1;
+        removeOffset = headOffset + (cur - buf);
+    }
+
+    if (bResult) {
+        cborWriter.endIndefinite();
+
+        // Z85 output is written over buf, which is at least 4 * maxSize bytes
+        if (Z85Encode(cbor, cborWriter.dataSize(), buf, 4 * maxSize + 1)) {
+            writer.value(buf);
+        }
+        else {
+            bResult = false;
+        }
+    }
+
+    free(cbor);
+
+    return bResult;
+}
+
+static const double _columnScale[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6 };
+static const int _columnMaxDecimalPlaces = 6;
+static const double _columnMaxValue = (double)0x3fffffff; // differences must still fit in an int
+
+/**
+ * @brief Returns true if an event can be stored in columns: an object of numbers, including timeKey
+ */
+static bool _isColumnarEvent(const JSONValue &obj, const String &timeKey) {
+    if (!obj.isObject()) {
+        return false;
+    }
+    bool hasTime = false;
+
+    JSONObjectIterator iter(obj);
+    while(iter.next()) {
+        if (!iter.value().isNumber()) {
+            return false;
+        }
+        if (iter.name() == timeKey) {
+            hasTime = true;
+        }
+    }
+    return hasTime;
+}
+
+/**
+ * @brief Number of decimal places in the JSON for a number, ignoring trailing zeros
+ */
+static int _columnDecimalPlaces(const JSONValue &val) {
+    JSONString str = val.toString();
+    const char *cp = str.data();
+    const char *end = cp + str.size();
+
+    const char *dot = (const char *)memchr(cp, '.', str.size());
+    if (!dot) {
+        return 0;
+    }
+    if (memchr(cp, 'e', str.size()) || memchr(cp, 'E', str.size())) {
+        return _columnMaxDecimalPlaces;
+    }
+    while(end > dot + 1 && end[-1] == '0') {
+        end--;
+    }
+    int decimalPlaces = end - dot - 1;
+    return (decimalPlaces < _columnMaxDecimalPlaces) ? decimalPlaces : _columnMaxDecimalPlaces;
+}
+
+SleepHelper::EventHistory &SleepHelper::EventHistory::withColumnPrecision(const char *key, int decimalPlaces) {
+    if (decimalPlaces < 0) {
+        decimalPlaces = 0;
+    }
+    if (decimalPlaces > _columnMaxDecimalPlaces) {
+        decimalPlaces = _columnMaxDecimalPlaces;
+    }
+    for(auto it = columnPrecision.begin(); it != columnPrecision.end(); ++it) {
+        if (it->key == key) {
+            it->decimalPlaces = decimalPlaces;
+            return *this;
+        }
+    }
+    ColumnPrecision cp;
+    cp.key = key;
+    cp.decimalPlaces = decimalPlaces;
+    columnPrecision.push_back(cp);
+    return *this;
+}
+
+int SleepHelper::EventHistory::getColumnPrecision(const char *key) const {
+    for(auto it = columnPrecision.begin(); it != columnPrecision.end(); ++it) {
+        if (it->key == key) {
+            return it->decimalPlaces;
+        }
+    }
+    return -1;
+}
+
+bool SleepHelper::EventHistory::getEventsColumnar(char *buf, size_t dataSize, JSONWriter &writer, size_t maxSize, bool discardOversize) {
+    std::vector<char *> lines;
+    std::vector<size_t> lineEnds;
+
+    char *cur = buf;
+    char *end = &buf[dataSize];
+    while(cur < end) {
+        char *lf = strchr(cur, '\n');
+        *lf = 0;
+        lines.push_back(cur);
+        cur = lf + 1;
+        lineEnds.push_back(cur - buf);
+    }
+
+    JSONValue obj = JSONValue::parseCopy(lines[0]);
+    if (!_isColumnarEvent(obj, timeKey)) {
+        // Events up to the next one that can be stored in columns go out as a JSON array
+        bool bResult = false;
+        size_t bytesUsed = 2;
+
+        writer.beginArray();
+        for(size_t ii = 0; ii < lines.size(); ii++) {
+            if (ii > 0 && _isColumnarEvent(JSONValue::parseCopy(lines[ii]), timeKey)) {
+                break;
+            }
+            if (strlen(lines[ii]) + 2 > maxSize && discardOversize) {
+                // Does not fit in an event even by itself
+                SleepHelper::instance().appLog.info("discarding %u byte event history line, larger than an event", (unsigned)strlen(lines[ii]));
+                removeOffset = headOffset + lineEnds[ii];
+                continue;
+            }
+            bytesUsed += strlen(lines[ii]) + 1;
+            if (bytesUsed > maxSize) {
+                break;
+            }
+            SleepHelper::JSONCopy(lines[ii], writer);
+            removeOffset = headOffset + lineEnds[ii];
+            bResult = true;
+        }
+        writer.endArray();
+        return bResult;
+    }
+
+    // Keys other than the time key, in order, from the first event
+    std::vector<String> keys;
+    {
+        JSONObjectIterator iter(obj);
+        while(iter.next()) {
+            if (iter.name() != timeKey) {
+                keys.push_back((const char *)iter.name());
+            }
+        }
+    }
+    size_t numKeys = keys.size();
+
+    std::vector<int> decimalPlaces(numKeys, 0);
+    std::vector<int> times;
+    std::vector<double> values;
+
+    // Collect the run of events with the same keys in the same order
+    size_t numEvents = 0;
+    for(; numEvents < lines.size(); numEvents++) {
+        if (numEvents > 0) {
+            obj = JSONValue::parseCopy(lines[numEvents]);
+            if (!_isColumnarEvent(obj, timeKey)) {
+                break;
+            }
+        }
+
+        size_t keyIndex = 0;
+        bool sameKeys = true;
+        int time = 0;
+        size_t valuesSize = values.size();
+
+        JSONObjectIterator iter(obj);
+        while(sameKeys && iter.next()) {
+            if (iter.name() == timeKey) {
+                time = iter.value().toInt();
+            }
+            else
+            if (keyIndex < numKeys && iter.name() == keys[keyIndex]) {
+                values.push_back(iter.value().toDouble());
+
+                int places = _columnDecimalPlaces(iter.value());
+                if (places > decimalPlaces[keyIndex]) {
+                    decimalPlaces[keyIndex] = places;
                 }
+                keyIndex++;
+            }
+            else {
+                sameKeys = false;
+            }
+        }
+        if (!sameKeys || keyIndex != numKeys) {
+            values.resize(valuesSize);
+            break;
+        }
+        times.push_back(time);
+    }
+
+    for(size_t keyIndex = 0; keyIndex < numKeys; keyIndex++) {
+        int places = getColumnPrecision(keys[keyIndex]);
+        if (places >= 0) {
+            decimalPlaces[keyIndex] = places;
+        }
+    }
+
+    // Quantize, stopping at an event with a value too large to store
+    std::vector<int> quantized(values.size());
+    for(size_t ii = 0; ii < values.size(); ii++) {
+        double scaled = values[ii] * _columnScale[decimalPlaces[ii % numKeys]];
+        if (scaled > _columnMaxValue || scaled < -_columnMaxValue) {
+            numEvents = ii / numKeys;
+            break;
+        }
+        quantized[ii] = (int) lround(scaled);
+    }
+    if (numEvents == 0) {
+        // Cannot be stored in columns, so send the first event as an array
+        size_t len = strlen(lines[0]);
+        if (len + 2 > maxSize) {
+            if (discardOversize) {
+                SleepHelper::instance().appLog.info("discarding %u byte event history line, larger than an event", (unsigned)len);
+                removeOffset = headOffset + lineEnds[0];
             }
-            free(buf);
+            return false;
         }
+        writer.beginArray();
+        SleepHelper::JSONCopy(lines[0], writer);
+        writer.endArray();
+        removeOffset = headOffset + lineEnds[0];
+        return true;
+    }
 
+    int dt = sampleInterval;
+    if (dt == 0 && numEvents >= 2) {
+        dt = times[1] - times[0];
+    }
+
+    auto writeColumns = [&](JSONWriter &writer, size_t count) {
+        writer.beginObject();
+        writer.name("tk").value(timeKey);
+        writer.name("t0").value(times[0]);
+        writer.name("dt").value(dt);
+
+        bool onInterval = true;
+        for(size_t ii = 1; ii < count; ii++) {
+            if (times[ii] - times[ii - 1] != dt) {
+                onInterval = false;
+                break;
+            }
+        }
+        if (!onInterval) {
+            writer.name("tr").beginArray();
+            for(size_t ii = 1; ii < count; ii++) {
+                writer.value(times[ii] - times[ii - 1] - dt);
+            }
+            writer.endArray();
+        }
+        writer.name("n").value((int)count);
+
+        writer.name("k").beginArray();
+        for(size_t keyIndex = 0; keyIndex < numKeys; keyIndex++) {
+            writer.value(keys[keyIndex]);
+        }
+        writer.endArray();
+
+        writer.name("p").beginArray();
+        for(size_t keyIndex = 0; keyIndex < numKeys; keyIndex++) {
+            writer.value(decimalPlaces[keyIndex]);
+        }
+        writer.endArray();
+
+        writer.name("v").beginArray();
+        for(size_t keyIndex = 0; keyIndex < numKeys; keyIndex++) {
+            writer.beginArray();
+            int prev = 0;
+            for(size_t ii = 0; ii < count; ii++) {
+                int value = quantized[ii * numKeys + keyIndex];
+                writer.value(value - prev);
+                prev = value;
+            }
+            writer.endArray();
+        }
+        writer.endArray();
+
+        writer.endObject();
+    };
+
+    // Find the largest number of events that fits in maxSize
+    char *sizeBuf = (char *)malloc(maxSize);
+    if (!sizeBuf) {
+        return false;
+    }
+    size_t low = 0, high = numEvents;
+    while(low < high) {
+        size_t count = (low + high + 1) / 2;
+
+        JSONBufferWriter sizeWriter(sizeBuf, maxSize);
+        writeColumns(sizeWriter, count);
+        if (sizeWriter.dataSize() <= maxSize) {
+            low = count;
+        }
+        else {
+            high = count - 1;
+        }
+    }
+    free(sizeBuf);
+
+    if (low == 0) {
+        // One event in columns is larger than maxSize, so send it as an array if it fits that way
+        size_t len = strlen(lines[0]);
+        if (len + 2 <= maxSize) {
+            writer.beginArray();
+            SleepHelper::JSONCopy(lines[0], writer);
+            writer.endArray();
+            removeOffset = headOffset + lineEnds[0];
+            return true;
+        }
+        if (discardOversize) {
+            SleepHelper::instance().appLog.info("discarding %u byte event history line, larger than an event", (unsigned)len);
+            removeOffset = headOffset + lineEnds[0];
+        }
+        return false;
+    }
+    writeColumns(writer, low);
+    removeOffset = headOffset + lineEnds[low - 1];
+
+    return true;
+}
+
+// [static]
+bool SleepHelper::EventHistory::columnarToJson(const JSONValue &src, JSONWriter &writer) {
+    if (src.isArray()) {
+        // Events that could not be stored in columns
+        JSONArrayIterator iter(src);
+        writer.beginArray();
+        while(iter.next()) {
+            SleepHelper::JSONCopy(iter.value(), writer);
+        }
+        writer.endArray();
+        return true;
+    }
+    if (!src.isObject()) {
+        return false;
+    }
+
+    JSONValue tk, tr, k, p, v;
+    int t0 = 0, dt = 0, n = 0;
+
+    JSONObjectIterator iter(src);
+    while(iter.next()) {
+        if (iter.name() == "tk") {
+            tk = iter.value();
+        }
+        else
+        if (iter.name() == "t0") {
+            t0 = iter.value().toInt();
+        }
+        else
+        if (iter.name() == "dt") {
+            dt = iter.value().toInt();
+        }
+        else
+        if (iter.name() == "tr") {
+            tr = iter.value();
+        }
+        else
+        if (iter.name() == "n") {
+            n = iter.value().toInt();
+        }
+        else
+        if (iter.name() == "k") {
+            k = iter.value();
+        }
+        else
+        if (iter.name() == "p") {
+            p = iter.value();
+        }
+        else
+        if (iter.name() == "v") {
+            v = iter.value();
+        }
+    }
+    if (!tk.isString() || !k.isArray() || !p.isArray() || !v.isArray()) {
+        return false;
+    }
+
+    std::vector<JSONString> keys;
+    std::vector<int> decimalPlaces;
+    std::vector<JSONArrayIterator> columns;
+    std::vector<int> values;
+    {
+        JSONArrayIterator keyIter(k), placesIter(p), columnIter(v);
+        while(keyIter.next() && placesIter.next() && columnIter.next()) {
+            if (!keyIter.value().isString() || !columnIter.value().isArray()) {
+                return false;
+            }
+            keys.push_back(keyIter.value().toString());
+
+            int places = placesIter.value().toInt();
+            decimalPlaces.push_back((places >= 0 && places <= _columnMaxDecimalPlaces) ? places : 0);
+            columns.push_back(JSONArrayIterator(columnIter.value()));
+            values.push_back(0);
+        }
+    }
+
+    JSONArrayIterator trIter(tr);
+    int time = t0;
+
+    writer.beginArray();
+    for(int ii = 0; ii < n; ii++) {
+        if (ii > 0) {
+            time += dt;
+            if (tr.isArray() && trIter.next()) {
+                time += trIter.value().toInt();
+            }
+        }
+
+        writer.beginObject();
+        writer.name(tk.toString().data()).value(time);
+        for(size_t keyIndex = 0; keyIndex < keys.size(); keyIndex++) {
+            if (columns[keyIndex].next()) {
+                values[keyIndex] += columns[keyIndex].value().toInt();
+            }
+            writer.name(keys[keyIndex].data());
+            if (decimalPlaces[keyIndex] == 0) {
+                writer.value(values[keyIndex]);
+            }
+            else {
+                writer.value(values[keyIndex] / _columnScale[decimalPlaces[keyIndex]], decimalPlaces[keyIndex]);
+            }
+        }
+        writer.endObject();
+    }
+    writer.endArray();
+
+    return true;
+}
+
+void SleepHelper::EventHistory::loadHeadOffset() {
+    if (!useHeadOffset || headOffsetLoaded) {
+        return;
+    }
+    headOffsetLoaded = true;
+    headOffset = 0;
+
+    // The file contains the offset and its complement, so a partially written file is detected
+    uint32_t data[2];
+    int fd = open(String(path) + ".head", O_RDONLY);
+    if (fd != -1) {
+        if (read(fd, data, sizeof(data)) == sizeof(data) && data[0] == ~data[1]) {
+            struct stat sb;
+            if (stat(path, &sb) == 0 && data[0] <= (uint32_t)sb.st_size) {
+                headOffset = data[0];
+            }
+        }
+        close(fd);
+    }
+}
+
+void SleepHelper::EventHistory::saveHeadOffset() {
+    if (!useHeadOffset) {
+        return;
+    }
+    String headPath = String(path) + ".head";
+
+    if (headOffset == 0) {
+        unlink(headPath);
+        return;
+    }
+
+    uint32_t data[2];
+    data[0] = headOffset;
+    data[1] = ~data[0];
+
+    int fd = open(headPath, O_RDWR | O_CREAT, 0666);
+    if (fd != -1) {
+        write(fd, data, sizeof(data));
+        close(fd);
     }
 }
 
@@ -1224,10 +2458,12 @@ bool SleepHelper::EventHistory::getHasEvents() {
     if (firstRun) {
         firstRun = false;
 
+        loadHeadOffset();
+
         struct stat sb;
         int res = stat(path, &sb);
 
-        hasEvents = (res == 0 && sb.st_size > 0);
+        hasEvents = (res == 0 && (size_t)sb.st_size > headOffset);
     }
     return hasEvents; 
 };
@@ -1248,139 +2484,169 @@ void SleepHelper::EventCombiner::generateEvents(std::vector<String> &events, siz
     
     events.clear();
 
+    if (maxSize < 3) {
+        clearOneTimeCallbacks();
+        return;
+    }
+
     std::vector<EventInfo> infoArray;
-    char *buf = (char *)malloc(maxSize + 1);
-    if (!buf) {
+    infoArray.reserve(callbacks.callbackFunctions.size() + oneTimeCallbacks.callbackFunctions.size() + 1);
+    keys.clear();
+    keys.reserve(2 * infoArray.capacity());
+
+    // The first maxSize + 1 bytes of the arena are used to assemble events. All of the JSON fragments
+    // from the callbacks follow it, so there is one allocation instead of one per callback.
+    arenaSize = 4 * (maxSize + 1);
+    arenaUsed = maxSize + 1;
+    arena = (char *)malloc(arenaSize);
+    if (!arena) {
+        clearOneTimeCallbacks();
         return;
     }
+    char *buf = arena;
 
     // Process one-time callbacks in reverse order (most recently added first) because keys added at the same 
     // priority level will use the first value set, and we want the latest value to be used.
     for(auto it = oneTimeCallbacks.callbackFunctions.rbegin(); it != oneTimeCallbacks.callbackFunctions.rend(); ++it) {
-        generateEventInternal(*it, buf, maxSize, infoArray);        
+        generateEventInternal(*it, maxSize, infoArray);        
     }
 
     for(auto it = callbacks.callbackFunctions.begin(); it != callbacks.callbackFunctions.end(); ++it) {
-        generateEventInternal(*it, buf, maxSize, infoArray);        
+        generateEventInternal(*it, maxSize, infoArray);        
+    }
+    buf = arena; // arena may have been reallocated
+
+    // Sort highest priority first. Insertion sort is stable (equal priority stays in callback order) 
+    // and does not allocate.
+    for(size_t ii = 1; ii < infoArray.size(); ii++) {
+        EventInfo info = infoArray[ii];
+        size_t jj = ii;
+        while(jj > 0 && infoArray[jj - 1].priority < info.priority) {
+            infoArray[jj] = infoArray[jj - 1];
+            jj--;
+        }
+        infoArray[jj] = info;
     }
 
-    bool doRemoveEvents = false;
-
-    if (eventHistory.getHasEvents()) {
-        memset(buf, 0, maxSize);
-        JSONBufferWriter writer(buf, maxSize);
-
-        writer.beginObject();
-        writer.name(eventHistoryKey);
-
-        // Overhead:
-        // { " (eventHistoryKey) " : [ (array data) ]  }
-        size_t overhead = eventHistoryKey.length() + 7;
+    // Dedupe keys in case a one-time callback is called more than once
+    keyTableSize = 16;
+    while(keyTableSize < 2 * keys.size() + 1) {
+        keyTableSize *= 2;
+    }
+    keyTable = (uint16_t *)calloc(keyTableSize, sizeof(uint16_t));
 
-        if (eventHistory.getEvents(writer, maxSize - overhead, false)) {
-            EventInfo eventInfo;
-            eventInfo.priority = 1;
-            eventInfo.keys.push_back(eventHistoryKey);
+    size_t numInfo = 0;
+    for(size_t ii = 0; ii < infoArray.size(); ii++) {
+        bool keyExists = false;
 
-            writer.endObject();
+        for(size_t kk = infoArray[ii].firstKey; kk < infoArray[ii].firstKey + infoArray[ii].numKeys; kk++) {
+            if (keyTableFindOrAdd(keys[kk])) {
+                keyExists = true;
+            }
+        }
+        if (!keyExists) {
+            infoArray[numInfo++] = infoArray[ii];
+        }
+    }
+    infoArray.resize(numInfo);
 
-            // Remove the } at the end of the object
-            buf[strlen(buf) - 1] = 0;
-            eventInfo.json = &buf[1];
+    free(keyTable);
+    keyTable = NULL;
 
-            infoArray.push_back(eventInfo);
+    // Pack the fragments into events. Each fragment goes into the first event that has room for it so
+    // smaller, later fragments fill in the space left at the end of earlier events. If there is no room,
+    // a new event is started, but only for priority 50 and higher (or if there are no events yet).
+    // binUsed is the size of each event including the surrounding {} and , separators.
+    std::vector<size_t> binUsed;
+    binUsed.reserve(4);
 
+    numInfo = 0;
+    for(size_t ii = 0; ii < infoArray.size(); ii++) {
+        EventInfo &info = infoArray[ii];
 
-            doRemoveEvents = true;
+        size_t bin;
+        for(bin = 0; bin < binUsed.size(); bin++) {
+            if (binUsed[bin] + 1 + info.length <= maxSize) {
+                break;
+            }
+        }
+        if (bin == binUsed.size()) {
+            if (!binUsed.empty() && info.priority < 50) {
+                continue;
+            }
+            binUsed.push_back(2);
         }
+        binUsed[bin] += ((binUsed[bin] > 2) ? 1 : 0) + info.length;
+        info.bin = bin;
+        infoArray[numInfo++] = info;
     }
+    infoArray.resize(numInfo);
 
-    if (!infoArray.empty()) {
-        // Sort highest priority first
-        std::sort(infoArray.begin(), infoArray.end(), [](EventInfo a, EventInfo b) {
-            return a.priority > b.priority;
-        });
+    // Add as much event history as fits in the event with the most free space
+    if (eventHistory.getHasEvents() && arenaReserve(maxSize + 1)) {
+        buf = arena;
 
-        // Dedupe keys in case a one-time callback is called more than once
-        std::vector<String> keysAdded;
-        for(auto it = infoArray.begin(); it != infoArray.end(); ) {
-            bool keyExists = false;
-
-            for(auto it2 = it->keys.begin(); it2 != it->keys.end(); ++it2) {
-                for(auto it3 = keysAdded.begin(); it3 != keysAdded.end(); ++it3) {
-                    if (*it3 == *it2) {
-                        keyExists = true;
-                        break;
-                    }
-                }
-                keysAdded.push_back(*it2);
+        size_t bin = 0;
+        for(size_t ii = 1; ii < binUsed.size(); ii++) {
+            if (binUsed[ii] < binUsed[bin]) {
+                bin = ii;
             }
+        }
+        if (binUsed.empty()) {
+            binUsed.push_back(2);
+        }
 
-            if (keyExists) {
-                it = infoArray.erase(it);
-            }
-            else {
-                ++it;
+        // Overhead:
+        // , " (eventHistoryKey) " : [ (array data) ]
+        size_t overhead = ((binUsed[bin] > 2) ? 1 : 0) + eventHistoryKey.length() + 3;
+        if (binUsed[bin] + overhead + 2 < maxSize) {
+            size_t available = maxSize - binUsed[bin] - overhead;
+
+            FragmentWriter writer(*this, arenaUsed, maxSize);
+            writer.beginObject();
+            writer.name(eventHistoryKey);
+
+            // Events that don't fit here may still fit in an event by themselves, so they are not discarded
+            if (eventHistory.getEvents(writer, available, false, false)) {
+                writer.endObject();
+
+                EventInfo eventInfo;
+                eventInfo.priority = 1;
+                eventInfo.offset = arenaUsed + 1;
+                eventInfo.length = writer.dataSize() - 2;
+                eventInfo.bin = bin;
+
+                // JSONCopy can change the formatting of numbers, so check it actually fits before removing the events
+                if (writer.dataSize() <= writer.bufferSize() && binUsed[bin] + ((binUsed[bin] > 2) ? 1 : 0) + eventInfo.length <= maxSize) {
+                    binUsed[bin] += ((binUsed[bin] > 2) ? 1 : 0) + eventInfo.length;
+                    arenaUsed += writer.dataSize();
+                    infoArray.push_back(eventInfo);
+                    eventHistory.removeEvents();
+                }
             }
         }
+    }
 
-        // 
+    // Assemble the events in the scratch buffer at the start of the arena
+    for(size_t bin = 0; bin < binUsed.size(); bin++) {
         char *cur = buf;
-        char *end = &buf[maxSize - 2]; // Room for leading , and trailing }
-
         *cur++ = '{';
-        bool firstEventBuffer = true;
 
         for(auto it = infoArray.begin(); it != infoArray.end(); ++it) {
-            
-            if (&cur[strlen(it->json)] >= end) {
-                // Buffer is full
-                if (cur > &buf[1]) {
-                    *cur++ = '}';
-                    *cur = 0;
-                    events.push_back(buf);
-                    cur = &buf[1];
-                }
-                firstEventBuffer = false;
+            if (it->bin != bin) {
+                continue;
             }
-
-            if (!firstEventBuffer && it->priority < 50) {
-                break;
-            }        
-
             if (cur != &buf[1]) {
                 *cur++ = ',';
             }
-
-            strcpy(cur, it->json);
-            cur += strlen(cur);
+            memcpy(cur, &arena[it->offset], it->length);
+            cur += it->length;
         }
 
         if (cur > &buf[1]) {
-            // Write out last object
             *cur++ = '}';
             *cur = 0;
-            events.push_back(buf);
-        }
-    }
-
-    if (doRemoveEvents) {
-        doRemoveEvents = false;
-
-        // Makes sure event was actually added
-        for(auto it = events.begin(); it != events.end(); ++it) {
-            JSONValue obj = JSONValue::parseCopy(*it);
-
-            JSONObjectIterator iter(obj);
-            while(iter.next()) {
-                String key = (const char *)iter.name();
-                if (key == eventHistoryKey) {
-                    doRemoveEvents = true;
-                }
-            }
-        }
-        if (doRemoveEvents) {
-            eventHistory.removeEvents();
+            events.push_back(String(buf, cur - buf));
         }
     }
 
@@ -1396,19 +2662,32 @@ void SleepHelper::EventCombiner::generateEvents(std::vector<String> &events, siz
             writer.endObject();
             
             events.push_back(buf);
-            eventHistory.removeEvents();
+        }
+
+        // Also removes events that were discarded because they can never fit in an event
+        if (!eventHistory.removeEvents()) {
+            // Nothing could be read (out of memory or a file system error), try again next time
+            break;
         }
     }
 
     clearOneTimeCallbacks();
 
-    free(buf);
+    free(arena);
+    arena = NULL;
+    arenaSize = arenaUsed = 0;
+    keys.clear();
 }
 
 
-void SleepHelper::EventCombiner::generateEventInternal(std::function<void(JSONWriter &, int &)> callback, char *buf, size_t maxSize, std::vector<EventInfo> &infoArray) {
-    memset(buf, 0, maxSize);
-    JSONBufferWriter writer(buf, maxSize);
+void SleepHelper::EventCombiner::generateEventInternal(const std::function<bool(JSONWriter &, int &)> &callback, size_t maxSize, std::vector<EventInfo> &infoArray) {
+    if (!arenaReserve(maxSize + 1)) {
+        return;
+    }
+
+    size_t firstKey = keys.size();
+
+    FragmentWriter writer(*this, arenaUsed, maxSize);
 
     int priority = 0;
 
@@ -1416,26 +2695,269 @@ void SleepHelper::EventCombiner::generateEventInternal(std::function<void(JSONWr
     callback(writer, priority);
     writer.endObject();
 
-    if (priority > 0 && strlen(buf) > 2) {
-        // Priority is set and not an empty object
-        if (writer.dataSize() <= writer.bufferSize()) {
-            // Callback data was not truncated 
+    if (priority > 0 && writer.dataSize() > 2 && writer.dataSize() <= writer.bufferSize()) {
+        // Priority is set, not an empty object, and callback data was not truncated 
+        EventInfo eventInfo;
+        eventInfo.priority = priority;
 
-            EventInfo eventInfo;
-            eventInfo.priority = priority;
+        // Leave off the surrounding {}
+        eventInfo.offset = arenaUsed + 1;
+        eventInfo.length = writer.dataSize() - 2;
+        eventInfo.firstKey = firstKey;
+        eventInfo.numKeys = keys.size() - firstKey;
 
-            // Gather keys used in this
-            JSONValue outerObj = JSONValue::parseCopy(buf);
-            JSONObjectIterator iter(outerObj);
-            while(iter.next()) {
-                eventInfo.keys.push_back((const char *)iter.name());
+        arenaUsed += writer.dataSize();
+        infoArray.push_back(eventInfo);
+    }
+    else {
+        // Discard the keys
+        keys.resize(firstKey);
+    }
+}
+
+bool SleepHelper::EventCombiner::arenaReserve(size_t size) {
+    if (arenaUsed + size <= arenaSize) {
+        return true;
+    }
+
+    size_t newSize = arenaSize * 2;
+    while(newSize < arenaUsed + size) {
+        newSize *= 2;
+    }
+
+    char *newArena = (char *)realloc(arena, newSize);
+    if (!newArena) {
+        return false;
+    }
+    arena = newArena;
+    arenaSize = newSize;
+    return true;
+}
+
+bool SleepHelper::EventCombiner::keyTableFindOrAdd(const KeyInfo &key) {
+    if (!keyTable) {
+        return false;
+    }
+
+    size_t mask = keyTableSize - 1;
+    for(size_t slot = key.hash & mask; ; slot = (slot + 1) & mask) {
+        if (keyTable[slot] == 0) {
+            keyTable[slot] = (uint16_t)(&key - &keys[0] + 1);
+            return false;
+        }
+
+        const KeyInfo &other = keys[keyTable[slot] - 1];
+        if (other.hash == key.hash && other.length == key.length && 
+            memcmp(&arena[other.offset], &arena[key.offset], key.length) == 0) {
+            return true;
+        }
+    }
+}
+
+void SleepHelper::EventCombiner::FragmentWriter::write(const char *data, size_t size) {
+    size_t pos = dataSize();
+
+    JSONBufferWriter::write(data, size);
+
+    for(size_t ii = 0; ii < size; ii++, pos++) {
+        char c = data[ii];
+
+        if (inString) {
+            if (escape) {
+                escape = false;
+            }
+            else
+            if (c == '\\') {
+                escape = true;
+            }
+            else
+            if (c == '"') {
+                inString = false;
+                stringEnd = pos;
+                stringAtDepth1 = (depth == 1);
+                continue;
             }
+            stringHash = (stringHash ^ (uint8_t)c) * FNV_PRIME;
+            continue;
+        }
+
+        switch(c) {
+        case '"':
+            inString = true;
+            stringStart = pos + 1;
+            stringHash = FNV_OFFSET_BASIS;
+            break;
+
+        case ':':
+            if (stringAtDepth1 && pos < bufferSize()) {
+                KeyInfo key;
+                key.hash = stringHash;
+                key.offset = arenaOffset + stringStart;
+                key.length = stringEnd - stringStart;
+                combiner.keys.push_back(key);
+            }
+            break;
+
+        case '{':
+        case '[':
+            depth++;
+            break;
+
+        case '}':
+        case ']':
+            depth--;
+            break;
+        }
+        stringAtDepth1 = false;
+    }
+}
+
+void SleepHelper::CborBufferWriter::writeHead(uint8_t majorType, uint64_t val) {
+    majorType <<= 5;
+
+    if (val < 24) {
+        writeByte(majorType | (uint8_t)val);
+    }
+    else
+    if (val <= 0xff) {
+        writeByte(majorType | 24);
+        writeByte((uint8_t)val);
+    }
+    else
+    if (val <= 0xffff) {
+        writeByte(majorType | 25);
+        writeByte((uint8_t)(val >> 8));
+        writeByte((uint8_t)val);
+    }
+    else
+    if (val <= 0xffffffff) {
+        writeByte(majorType | 26);
+        for(int shift = 24; shift >= 0; shift -= 8) {
+            writeByte((uint8_t)(val >> shift));
+        }
+    }
+    else {
+        writeByte(majorType | 27);
+        for(int shift = 56; shift >= 0; shift -= 8) {
+            writeByte((uint8_t)(val >> shift));
+        }
+    }
+}
+
+void SleepHelper::CborBufferWriter::writeBytes(const uint8_t *data, size_t len) {
+    if (offset < bufSize) {
+        memcpy(&buf[offset], data, (len <= bufSize - offset) ? len : (bufSize - offset));
+    }
+    offset += len;
+}
+
+SleepHelper::CborBufferWriter &SleepHelper::CborBufferWriter::value(int64_t val) {
+    if (val >= 0) {
+        writeHead(0, (uint64_t)val);
+    }
+    else {
+        writeHead(1, (uint64_t)(-1 - val));
+    }
+    return *this;
+}
+
+SleepHelper::CborBufferWriter &SleepHelper::CborBufferWriter::value(double val) {
+    float f = (float)val;
+
+    // Half precision if it's exact: sign, 5-bit exponent, 10-bit mantissa
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (f == 0.0f) {
+        writeByte(0xf9);
+        writeByte((uint8_t)(sign >> 8));
+        writeByte(0);
+    }
+    else
+    if (exponent > 0 && exponent < 31 && (mantissa & 0x1fff) == 0) {
+        uint16_t half = (uint16_t)(sign | (exponent << 10) | (mantissa >> 13));
+        writeByte(0xf9);
+        writeByte((uint8_t)(half >> 8));
+        writeByte((uint8_t)half);
+    }
+    else {
+        writeByte(0xfa);
+        for(int shift = 24; shift >= 0; shift -= 8) {
+            writeByte((uint8_t)(bits >> shift));
+        }
+    }
+    return *this;
+}
 
-            // Remove the } at the end of the object
-            buf[strlen(buf) - 1] = 0;
-            eventInfo.json = &buf[1];
+// [static]
+size_t SleepHelper::Z85Encode(const uint8_t *src, size_t srcLen, char *dst, size_t dstSize) {
+    static const char alphabet[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ.-:+=^!/*?&<>()[]{}@%$#";
 
-            infoArray.push_back(eventInfo);
+    size_t dstLen = (srcLen + 3) / 4 * 5;
+    if (dstSize < dstLen + 1) {
+        return 0;
+    }
+
+    // Work backwards so dst can overlap the end of src
+    char *out = &dst[dstLen];
+    *out = 0;
+    for(size_t ii = (srcLen + 3) / 4; ii-- > 0; ) {
+        uint32_t val = 0;
+        for(size_t jj = 0; jj < 4; jj++) {
+            size_t index = ii * 4 + jj;
+            val = (val << 8) | ((index < srcLen) ? src[index] : 0);
+        }
+        for(size_t jj = 0; jj < 5; jj++) {
+            *--out = alphabet[val % 85];
+            val /= 85;
+        }
+    }
+    return dstLen;
+}
+
+// [static]
+void SleepHelper::JSONToCbor(const JSONValue &src, CborBufferWriter &writer) {
+    if (src.isArray()) {
+        JSONArrayIterator iter(src);
+        writer.beginArray(iter.count());
+        while(iter.next()) {
+            JSONToCbor(iter.value(), writer);
+        }
+    }
+    else
+    if (src.isObject()) {
+        JSONObjectIterator iter(src);
+        writer.beginMap(iter.count());
+        while(iter.next()) {
+            writer.value(iter.name().data(), iter.name().size());
+            JSONToCbor(iter.value(), writer);
+        }
+    }
+    else
+    if (src.isString()) {
+        JSONString str = src.toString();
+        writer.value(str.data(), str.size());
+    }
+    else
+    if (src.isBool()) {
+        writer.value(src.toBool());
+    }
+    else
+    if (src.isNull()) {
+        writer.nullValue();
+    }
+    else {
+        // isNumber
+        double d = src.toDouble();
+        if (d == std::floor(d) && d >= -9007199254740992.0 && d <= 9007199254740992.0) {
+            // Is an integer
+            writer.value((int64_t)d);
+        }
+        else {
+            writer.value(d);
         }
     }
 }
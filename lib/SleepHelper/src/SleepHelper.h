@@ -458,8 +458,12 @@ public:
     public:
         /**
          * @brief Default constructor. Use withPath() to set the pathname if using this constructor
+         * 
+         * The settings are looked up by key for every get, set, and update, so the parser key index is enabled.
          */
-        SettingsFile() {};
+        SettingsFile() {
+            parser.enableKeyIndex();
+        };
 
         /**
          * @brief Destructor
@@ -1067,6 +1071,347 @@ public:
         String path; //!< Path to data file
     };
 
+    /**
+     * @brief Time spent in each phase of one wake cycle
+     * 
+     * A wake cycle starts when the state machine runs after sleep (or after boot) and ends when it is 
+     * about to sleep, before the sleep or reset functions are called. Each phase corresponds to one state of the connection state machine, so the phase times 
+     * always add up to awakeMs. Data capture and publish times overlap the phases and are kept separately.
+     * 
+     * This structure is stored in the persistent data file so it must not contain pointers or virtual methods.
+     */
+    class WakeCycleProfile {
+    public:
+        static const uint8_t phaseStart = 0; //!< stateHandlerStart
+        static const uint8_t phaseConnectWait = 1; //!< stateHandlerConnectWait, connecting to cellular and cloud
+        static const uint8_t phaseTimeValidWait = 2; //!< stateHandlerTimeValidWait
+        static const uint8_t phaseConnectedStart = 3; //!< stateHandlerConnectedStart
+        static const uint8_t phaseConnectedWakeEvents = 4; //!< stateHandlerConnectedWakeEvents, includes waiting for data capture
+        static const uint8_t phaseConnected = 5; //!< stateHandlerConnected, publishing and waiting for sleep ready functions
+        static const uint8_t phaseReconnectWait = 6; //!< stateHandlerReconnectWait
+        static const uint8_t phaseNoConnection = 7; //!< stateHandlerNoConnection, quick wake
+        static const uint8_t phaseDisconnectBeforeSleep = 8; //!< stateHandlerDisconnectBeforeSleep
+        static const uint8_t phaseDisconnectWait = 9; //!< stateHandlerDisconnectWait, cloud disconnecting
+        static const uint8_t phaseWaitCellularDisconnected = 10; //!< stateHandlerWaitCellularDisconnected
+        static const uint8_t phaseWaitCellularOff = 11; //!< stateHandlerWaitCellularOff, modem powering down
+        static const uint8_t phaseSleepShort = 12; //!< stateHandlerSleepShort, period too short to sleep
+        static const uint8_t phaseSleepDone = 13; //!< stateHandlerSleepDone, includes wake or boot functions
+        static const uint8_t numPhases = 14; //!< Number of phases
+
+        static const uint16_t flagModemStandby = 0x0001; //!< The modem was left on in standby during the sleep before this cycle
+
+        /**
+         * @brief Returns a short name for a phase, such as "connectWait", or an empty string if not a valid phase
+         * 
+         * @param phase Phase number, such as phaseConnectWait
+         */
+        static const char *phaseName(uint8_t phase);
+
+        /**
+         * @brief Write this cycle as a JSON object
+         * 
+         * @param writer The JSONWriter to write to
+         * 
+         * Keys:
+         * - t (integer) Unix time the cycle started, or 0 if the RTC was not valid
+         * - a (integer) milliseconds awake
+         * - ph (array) milliseconds spent in each phase, indexed by phase number
+         * - dc (integer) milliseconds data capture functions were running (omitted if 0)
+         * - pb (integer) number of publishes completed (omitted if 0)
+         * - pbt (integer) total milliseconds from queuing publishes to their completion (omitted if no publishes)
+         * - sn (integer) milliseconds the sensor power was on (omitted if 0)
+         * - sl (integer) milliseconds asleep before this cycle (omitted if 0)
+         * - ms (integer) 1 if the modem was in standby during that sleep (omitted if not)
+         * - uah (integer) estimated charge used by this cycle and the sleep before it, in microamp hours
+         */
+        void toJson(JSONWriter &writer) const;
+
+        uint32_t startTime; //!< Unix time (UTC) the cycle started, or 0 if the RTC was not valid
+        uint32_t awakeMs; //!< Milliseconds from the start of the cycle until sleep
+        uint32_t phaseMs[numPhases]; //!< Milliseconds spent in each phase
+        uint32_t dataCaptureMs; //!< Milliseconds data capture functions were running
+        uint32_t publishMs; //!< Sum of the milliseconds from queuing each publish until it completed
+        uint16_t publishCount; //!< Number of publishes completed, including failed publishes
+        uint16_t flags; //!< Flag bits such as flagModemStandby
+        uint32_t sensorMs; //!< Milliseconds the sensor power was on, see SleepHelper::setSensorPower()
+        uint32_t sleepMs; //!< Milliseconds asleep before this cycle
+        uint32_t chargeUah; //!< Estimated charge used by this cycle and the sleep before it in microamp hours, see EnergyModel
+    };
+
+    /**
+     * @brief Measures the phases of the current wake cycle
+     * 
+     * Times are passed in, instead of reading millis(), so the same code can be tested with a simulated clock.
+     */
+    class WakeProfiler {
+    public:
+        /**
+         * @brief Called from each state handler. Does nothing if already in that phase.
+         * 
+         * @param phase The phase, such as WakeCycleProfile::phaseConnectWait
+         * @param ms The millis() value
+         * 
+         * Starts a new cycle if there isn't one in progress.
+         */
+        void enterPhase(uint8_t phase, system_tick_t ms) {
+            if (!active) {
+                startCycle(phase, ms);
+            }
+            else if (phase != curPhase) {
+                addPhaseTime(ms);
+                curPhase = phase;
+            }
+        }
+
+        /**
+         * @brief Ends the cycle in progress. This is called right before going to sleep.
+         * 
+         * @param ms The millis() value
+         * @param now The Unix time (UTC), or 0 if the RTC is not valid
+         * @param completed Filled in with the completed cycle
+         * @return true if there was a cycle in progress
+         */
+        bool endCycle(system_tick_t ms, time_t now, WakeCycleProfile &completed);
+
+        /**
+         * @brief Called when the data capture functions start
+         * 
+         * @param ms The millis() value
+         */
+        void dataCaptureStart(system_tick_t ms) {
+            dataCaptureActive = true;
+            dataCaptureStartMs = ms;
+        }
+
+        /**
+         * @brief Called when the last data capture function returns false
+         * 
+         * @param ms The millis() value
+         */
+        void dataCaptureEnd(system_tick_t ms) {
+            if (dataCaptureActive) {
+                cycle.dataCaptureMs += ms - dataCaptureStartMs;
+                dataCaptureActive = false;
+            }
+        }
+
+        /**
+         * @brief Called when the sensor power is turned on or off
+         * 
+         * @param on true if the sensor power was turned on
+         * @param ms The millis() value
+         */
+        void sensorPower(bool on, system_tick_t ms) {
+            if (on && !sensorActive) {
+                sensorActive = true;
+                sensorStartMs = ms;
+            }
+            else if (!on && sensorActive) {
+                cycle.sensorMs += ms - sensorStartMs;
+                sensorActive = false;
+            }
+        }
+
+        /**
+         * @brief Called after waking from sleep. The values are saved in the next cycle.
+         * 
+         * @param sleepMs Milliseconds asleep
+         * @param modemStandby true if the modem was left on in standby during sleep
+         */
+        void setSleepBefore(system_tick_t sleepMs, bool modemStandby) {
+            sleepBeforeMs = sleepMs;
+            sleepBeforeModemStandby = modemStandby;
+        }
+
+        /**
+         * @brief Called when a publish completes, successfully or not
+         * 
+         * @param elapsedMs Milliseconds from queuing the publish until it completed
+         */
+        void addPublish(system_tick_t elapsedMs) {
+            cycle.publishMs += elapsedMs;
+            cycle.publishCount++;
+        }
+
+        /**
+         * @brief Returns true if a cycle is in progress
+         */
+        bool isActive() const { return active; };
+
+        /**
+         * @brief Returns the cycle in progress. Only the phases before the current phase are included.
+         */
+        const WakeCycleProfile &getCycle() const { return cycle; };
+
+    protected:
+        /**
+         * @brief Clears the cycle and starts a new one in phase
+         */
+        void startCycle(uint8_t phase, system_tick_t ms);
+
+        /**
+         * @brief Adds the time since the last phase change to the current phase
+         */
+        void addPhaseTime(system_tick_t ms) {
+            cycle.phaseMs[curPhase] += ms - phaseStartMs;
+            phaseStartMs = ms;
+        }
+
+        WakeCycleProfile cycle = {}; //!< The cycle in progress
+        bool active = false; //!< true if a cycle is in progress
+        uint8_t curPhase = 0; //!< The current phase
+        system_tick_t cycleStartMs = 0; //!< millis() when the cycle started
+        system_tick_t phaseStartMs = 0; //!< millis() when the current phase started
+        bool dataCaptureActive = false; //!< true between dataCaptureStart() and dataCaptureEnd()
+        system_tick_t dataCaptureStartMs = 0; //!< millis() at dataCaptureStart(), or the start of the cycle
+        bool sensorActive = false; //!< true while the sensor power is on
+        system_tick_t sensorStartMs = 0; //!< millis() when the sensor power was turned on, or the start of the cycle
+        system_tick_t sleepBeforeMs = 0; //!< Saved in the next cycle, see setSleepBefore()
+        bool sleepBeforeModemStandby = false; //!< Saved in the next cycle, see setSleepBefore()
+    };
+
+    /**
+     * @brief Estimates the battery charge used from the phase times of a wake cycle
+     * 
+     * The currents are rough defaults for a Boron on LTE Cat M1. Measure your own device and set them
+     * using the with methods for accurate results. Each current is in milliamps:
+     * 
+     * - CPU awake with the modem off (default: 5 mA)
+     * - Added while the modem is on and connecting, connected, or disconnecting (default: 40 mA)
+     * - Added while the modem is left on in standby, asleep or awake (default: 0.6 mA)
+     * - ULTRA_LOW_POWER sleep with the modem off (default: 0.6 mA)
+     * - Added while the sensor power is on, see SleepHelper::setSensorPower() (default: 0 mA)
+     */
+    class EnergyModel {
+    public:
+        EnergyModel &withCpuAwakeMa(float value) { cpuAwakeMa = value; return *this; }; //!< CPU awake with the modem off
+        EnergyModel &withModemOnMa(float value) { modemOnMa = value; return *this; }; //!< Added while the modem is on
+        EnergyModel &withModemStandbyMa(float value) { modemStandbyMa = value; return *this; }; //!< Added while the modem is in standby
+        EnergyModel &withSleepMa(float value) { sleepMa = value; return *this; }; //!< ULTRA_LOW_POWER sleep
+        EnergyModel &withSensorMa(float value) { sensorMa = value; return *this; }; //!< Added while the sensor power is on
+        EnergyModel &withBatteryCapacityMah(float value) { batteryCapacityMah = value; return *this; }; //!< Used to convert SoC changes into mAh (default: 1800 mAh)
+
+        float getBatteryCapacityMah() const { return batteryCapacityMah; }; //!< Battery capacity in mAh
+
+        /**
+         * @brief Returns the estimated charge used by a wake cycle and the sleep before it in microamp hours
+         * 
+         * @param cycle The completed cycle
+         */
+        uint32_t cycleChargeUah(const WakeCycleProfile &cycle) const;
+
+        /**
+         * @brief Returns true if the modem is on during a phase, from connecting until it is turned off
+         * 
+         * @param phase The phase number, such as WakeCycleProfile::phaseConnectWait
+         */
+        static bool isModemPhase(uint8_t phase);
+
+    protected:
+        float cpuAwakeMa = 5.0; //!< CPU awake with the modem off
+        float modemOnMa = 40.0; //!< Added while the modem is on
+        float modemStandbyMa = 0.6; //!< Added while the modem is in standby
+        float sleepMa = 0.6; //!< ULTRA_LOW_POWER sleep with the modem off
+        float sensorMa = 0.0; //!< Added while the sensor power is on
+        float batteryCapacityMah = 1800.0; //!< Battery capacity
+    };
+
+    /**
+     * @brief Adaptive limit on the time to connect, from the history of past times to connect
+     *
+     * withMaximumTimeToConnect() is a fixed ceiling, so when the network can't be reached the modem
+     * stays on for that long before giving up. With this policy, the time to connect of each successful
+     * connection is counted in a small histogram in the persistent data, one for a good signal and one
+     * for a poor signal. Each attempt is given up at a percentile of that history (default: 95th),
+     * doubled for each consecutive attempt that timed out, and kept between the minimum and maximum time.
+     * An attempt that times out is counted at the time it gave up, so if more attempts than the percentile
+     * allows are timing out, the time allowed goes up.
+     *
+     * Until there are enough samples (default: 8) the maximum time is used. Once a histogram has more
+     * than the decay total (default: 64) samples, its counts are halved so it follows changes in the network.
+     *
+     * The signal is reported using SleepHelper::setCellularSignal(), typically with the values from
+     * Cellular.RSSI(). The last reported signal is used for the next attempt; if a signal has never been
+     * reported both histograms are combined.
+     */
+    class ConnectTimeoutPolicy {
+    public:
+        static const size_t NUM_BINS = 16; //!< Number of histogram bins, from 5 seconds to 11 minutes
+        static const size_t NUM_SIGNAL_CLASSES = 2; //!< Number of histograms, good and poor signal
+
+        static const uint8_t signalUnknown = 0; //!< No signal has been reported
+        static const uint8_t signalGood = 1; //!< Signal strength and quality at or above the poor signal thresholds
+        static const uint8_t signalPoor = 2; //!< Signal strength or quality below the poor signal thresholds
+
+        ConnectTimeoutPolicy &withEnabled(bool value) { enabled = value; return *this; }; //!< Set to false to only keep the history (default: true)
+        ConnectTimeoutPolicy &withPercentile(uint8_t value) { percentile = value; return *this; }; //!< Percentile of the history to allow (1 - 100, default: 95)
+        ConnectTimeoutPolicy &withMinimumSamples(uint16_t value) { minimumSamples = value; return *this; }; //!< Samples required before the history is used (default: 8)
+        ConnectTimeoutPolicy &withDecayTotal(uint16_t value) { decayTotal = value; return *this; }; //!< Halve a histogram once it has more than this many samples (default: 64)
+        ConnectTimeoutPolicy &withMinimumTime(std::chrono::milliseconds value) { minimumTimeMs = (uint32_t)value.count(); return *this; }; //!< Shortest time allowed (default: 30s)
+        ConnectTimeoutPolicy &withMaximumTime(std::chrono::milliseconds value) { maximumTimeMs = (uint32_t)value.count(); return *this; }; //!< Longest time allowed (default: 11min)
+
+        /**
+         * @brief Sets the thresholds below which the signal is considered poor
+         *
+         * @param strength Signal strength percentage, as from CellularSignal::getStrength() (default: 50)
+         * @param quality Signal quality percentage, as from CellularSignal::getQuality() (default: 35)
+         */
+        ConnectTimeoutPolicy &withPoorSignal(float strength, float quality) { poorStrength = strength; poorQuality = quality; return *this; };
+
+        bool isEnabled() const { return enabled; }; //!< Returns true if the time to connect should be limited
+        uint16_t getDecayTotal() const { return decayTotal; }; //!< Histogram total above which the counts are halved
+
+        /**
+         * @brief Returns the signal class (signalGood or signalPoor) for a signal
+         *
+         * @param strength Signal strength percentage, or negative if not known
+         * @param quality Signal quality percentage, or negative if not known
+         *
+         * Returns signalUnknown if either value is negative.
+         */
+        uint8_t signalClass(float strength, float quality) const;
+
+        /**
+         * @brief Returns the time allowed for a connection attempt in milliseconds
+         *
+         * @param counts The histograms, from PersistentData::getValue_connectHistogram()
+         * @param signalClass The signal class of the last reported signal
+         * @param failures The number of consecutive attempts that timed out
+         */
+        uint32_t deadlineMs(const uint16_t counts[NUM_SIGNAL_CLASSES][NUM_BINS], uint8_t signalClass, uint8_t failures) const;
+
+        /**
+         * @brief Returns the histogram bin for a time to connect
+         *
+         * @param ms Time to connect in milliseconds. Times longer than the last bin are counted in the last bin.
+         */
+        static size_t binForMs(uint32_t ms);
+
+        /**
+         * @brief Returns the longest time to connect counted in a bin in milliseconds
+         *
+         * @param bin Bin number, 0 <= bin < NUM_BINS
+         */
+        static uint32_t binUpperMs(size_t bin);
+
+        /**
+         * @brief Returns the histogram that samples with a signal class are counted in
+         *
+         * Samples with an unknown signal are counted with a good signal.
+         */
+        static size_t histogramIndex(uint8_t signalClass) { return (signalClass == signalPoor) ? 1 : 0; };
+
+    protected:
+        bool enabled = true; //!< Limit the time to connect
+        uint8_t percentile = 95; //!< Percentile of the history to allow
+        uint16_t minimumSamples = 8; //!< Samples required before the history is used
+        uint16_t decayTotal = 64; //!< Halve a histogram once it has more than this many samples
+        uint32_t minimumTimeMs = 30000; //!< Shortest time allowed
+        uint32_t maximumTimeMs = 660000; //!< Longest time allowed
+        float poorStrength = 50.0; //!< Strength percentage below which the signal is poor
+        float poorQuality = 35.0; //!< Quality percentage below which the signal is poor
+    };
+
     /**
      * @brief Class for storing small data used by SleepHelper in the flash file system
      * 
@@ -1079,6 +1424,8 @@ public:
      */
     class PersistentData : public PersistentDataFile {
     public:
+        static const size_t WAKE_CYCLE_RING_SIZE = 8; //!< Number of wake cycles kept in the persistent data
+
         /**
          * @brief Structure saved to the persistent data file (binary)
          * 
@@ -1098,6 +1445,17 @@ public:
             uint32_t lastFullWake; //!< time_t last full wake (Unix time, UTC)
             uint32_t lastQuickWake; //!< time_t last quick wake (Unix time, UTC)
             uint32_t nextDataCapture; //!< time_t next data capture time (Unix time, UTC)
+            uint32_t wakeCycleCount; //!< Number of wake cycles ever added to wakeCycles
+            uint32_t wakeCycleReported; //!< wakeCycleCount when wake cycles were last added to a wake event
+            WakeCycleProfile wakeCycles[WAKE_CYCLE_RING_SIZE]; //!< Most recent wake cycles, indexed by count % WAKE_CYCLE_RING_SIZE
+            uint32_t energyDayStart; //!< time_t local midnight at the start of the day energyDayUah is for (Unix time, UTC)
+            uint32_t energyDayUah; //!< Estimated charge used so far that day in microamp hours
+            uint32_t energyPrevDayUah; //!< Estimated charge used the day before in microamp hours
+            uint32_t energyReportUah; //!< Estimated charge used since the last wake event in microamp hours
+            float energyReportSoC; //!< Battery SoC at the last wake event (0 = unknown)
+            uint16_t connectHistogram[ConnectTimeoutPolicy::NUM_SIGNAL_CLASSES][ConnectTimeoutPolicy::NUM_BINS]; //!< Time to connect counts for each signal class, see ConnectTimeoutPolicy
+            uint8_t connectFailures; //!< Consecutive connection attempts that timed out
+            uint8_t connectSignalClass; //!< Signal class of the last reported signal (ConnectTimeoutPolicy::signalUnknown if none)
             // OK to add more fields here later without incremeting version.
             // New fields will be zero-initialized.
         };
@@ -1192,6 +1550,141 @@ public:
             setValue<uint32_t>(offsetof(SleepHelperData, nextDataCapture), (uint32_t)value);
         }
 
+        /**
+         * @brief Adds a completed wake cycle, replacing the oldest if there are already WAKE_CYCLE_RING_SIZE
+         * 
+         * @param cycle The completed cycle
+         */
+        void addValue_wakeCycle(const WakeCycleProfile &cycle);
+
+        /**
+         * @brief Get a saved wake cycle
+         * 
+         * @param index 0 = the most recent cycle, 1 = the one before that, ... 
+         * @param cycle Filled in with the cycle
+         * @return true if there is a cycle at that index
+         */
+        bool getValue_wakeCycle(size_t index, WakeCycleProfile &cycle) const;
+
+        /**
+         * @brief Get the number of wake cycles ever saved. The number available is limited to WAKE_CYCLE_RING_SIZE.
+         */
+        uint32_t getValue_wakeCycleCount() const {
+            return getValue<uint32_t>(offsetof(SleepHelperData, wakeCycleCount));
+        }
+
+        /**
+         * @brief Adds the estimated charge used by a wake cycle to the daily and since last report totals
+         * 
+         * @param chargeUah Charge in microamp hours
+         * @param dayStart Local midnight at the start of the current day. If this changes, the day total becomes the previous day total.
+         */
+        void addValue_energy(uint32_t chargeUah, time_t dayStart);
+
+        /**
+         * @brief Get the estimated charge used so far in the day that started at dayStart, in microamp hours
+         * 
+         * @param dayStart Local midnight at the start of the current day
+         * 
+         * Returns 0 if no cycle has ended yet that day.
+         */
+        uint32_t getValue_energyDayUah(time_t dayStart) const;
+
+        /**
+         * @brief Get the estimated charge used the day before dayStart, in microamp hours
+         * 
+         * @param dayStart Local midnight at the start of the current day
+         */
+        uint32_t getValue_energyPrevDayUah(time_t dayStart) const;
+
+        /**
+         * @brief Get the estimated charge used since the last wake event, in microamp hours
+         */
+        uint32_t getValue_energyReportUah() const {
+            return getValue<uint32_t>(offsetof(SleepHelperData, energyReportUah));
+        }
+
+        /**
+         * @brief Get the battery SoC (0-100) at the last wake event, or 0 if not known
+         */
+        float getValue_energyReportSoC() const {
+            return getValue<float>(offsetof(SleepHelperData, energyReportSoC));
+        }
+
+        /**
+         * @brief Starts a new since last report period
+         * 
+         * @param soc The current battery SoC (0-100), or 0 if not known
+         */
+        void resetValue_energyReport(float soc) {
+            setValue<uint32_t>(offsetof(SleepHelperData, energyReportUah), 0);
+            setValue<float>(offsetof(SleepHelperData, energyReportSoC), soc);
+        }
+
+        /**
+         * @brief Get the wake cycle count when wake cycles were last added to a wake event
+         */
+        uint32_t getValue_wakeCycleReported() const {
+            return getValue<uint32_t>(offsetof(SleepHelperData, wakeCycleReported));
+        }
+
+        /**
+         * @brief Set the wake cycle count when wake cycles were last added to a wake event
+         * 
+         * @param value The value of getValue_wakeCycleCount() that was reported
+         */
+        void setValue_wakeCycleReported(uint32_t value) {
+            setValue<uint32_t>(offsetof(SleepHelperData, wakeCycleReported), value);
+        }
+
+        /**
+         * @brief Counts a connection attempt in the time to connect histogram
+         *
+         * @param signalClass The signal class, such as ConnectTimeoutPolicy::signalGood
+         * @param ms Time to connect in milliseconds, or the time it was given up after if it timed out
+         * @param decayTotal If the histogram has more than this many samples, the counts are halved (0 = never)
+         */
+        void addValue_connectTime(uint8_t signalClass, uint32_t ms, uint16_t decayTotal);
+
+        /**
+         * @brief Copies the time to connect histograms
+         *
+         * @param counts Filled in with the counts for each signal class and bin
+         */
+        void getValue_connectHistogram(uint16_t counts[ConnectTimeoutPolicy::NUM_SIGNAL_CLASSES][ConnectTimeoutPolicy::NUM_BINS]) const;
+
+        /**
+         * @brief Get the number of consecutive connection attempts that timed out
+         */
+        uint8_t getValue_connectFailures() const {
+            return getValue<uint8_t>(offsetof(SleepHelperData, connectFailures));
+        }
+
+        /**
+         * @brief Set the number of consecutive connection attempts that timed out
+         *
+         * @param value 0 after a successful connection
+         */
+        void setValue_connectFailures(uint8_t value) {
+            setValue<uint8_t>(offsetof(SleepHelperData, connectFailures), value);
+        }
+
+        /**
+         * @brief Get the signal class of the last reported signal, such as ConnectTimeoutPolicy::signalGood
+         */
+        uint8_t getValue_connectSignalClass() const {
+            return getValue<uint8_t>(offsetof(SleepHelperData, connectSignalClass));
+        }
+
+        /**
+         * @brief Set the signal class of the last reported signal
+         *
+         * @param value Signal class, such as ConnectTimeoutPolicy::signalGood
+         */
+        void setValue_connectSignalClass(uint8_t value) {
+            setValue<uint8_t>(offsetof(SleepHelperData, connectSignalClass), value);
+        }
+
     
         static const uint32_t SAVED_DATA_MAGIC = 0xd87cb6ce; //!< Magic bytes in the data structure
         static const uint16_t SAVED_DATA_VERSION = 1; //!< Version of the data structure
@@ -1202,6 +1695,51 @@ public:
     };
 
 
+    /**
+     * @brief Minimal CBOR (RFC 8949) encoder that writes into a fixed size buffer
+     * 
+     * Only the subset needed to encode JSON data is implemented: integers, floating point, 
+     * strings, booleans, null, arrays, and maps. Integers use the smallest encoding. Floating
+     * point values use a 16-bit half float when that is exact, otherwise a 32-bit float, so
+     * values with more than about 7 significant digits lose precision.
+     * 
+     * If the buffer fills, dataSize() continues to count and can be larger than bufferSize().
+     */
+    class CborBufferWriter {
+    public:
+        /**
+         * @brief Construct a writer for a buffer
+         * 
+         * @param buf Buffer to write to
+         * @param size Size of the buffer in bytes
+         */
+        CborBufferWriter(uint8_t *buf, size_t size) : buf(buf), bufSize(size) {};
+
+        CborBufferWriter &beginArray(size_t count) { writeHead(4, count); return *this; }; //!< Array of count items
+        CborBufferWriter &beginArray() { writeByte(0x9f); return *this; }; //!< Indefinite length array, end with endIndefinite()
+        CborBufferWriter &beginMap(size_t count) { writeHead(5, count); return *this; }; //!< Map of count key/value pairs
+        CborBufferWriter &endIndefinite() { writeByte(0xff); return *this; }; //!< End an indefinite length array
+        CborBufferWriter &value(int64_t val); //!< Integer
+        CborBufferWriter &value(double val); //!< Floating point (half or single precision)
+        CborBufferWriter &value(bool val) { writeByte(val ? 0xf5 : 0xf4); return *this; }; //!< Boolean
+        CborBufferWriter &value(const char *str, size_t len) { writeHead(3, len); writeBytes((const uint8_t *)str, len); return *this; }; //!< UTF-8 string
+        CborBufferWriter &value(const char *str) { return value(str, strlen(str)); }; //!< UTF-8 c-string
+        CborBufferWriter &nullValue() { writeByte(0xf6); return *this; }; //!< null
+
+        size_t dataSize() const { return offset; }; //!< Number of bytes written (may be larger than bufferSize)
+        size_t bufferSize() const { return bufSize; }; //!< Size of the buffer
+        void setDataSize(size_t size) { offset = size; }; //!< Discard data written after size
+
+    protected:
+        void writeHead(uint8_t majorType, uint64_t val); //!< Write an initial byte and argument
+        void writeByte(uint8_t b) { if (offset < bufSize) buf[offset] = b; offset++; }; //!< Write one byte
+        void writeBytes(const uint8_t *data, size_t len); //!< Write bytes
+
+        uint8_t *buf; //!< Buffer to write to
+        size_t bufSize; //!< Size of buf
+        size_t offset = 0; //!< Number of bytes written
+    };
+
     /**
      * @brief Class to manage small events, typically used for time-series data
      * 
@@ -1230,6 +1768,112 @@ public:
             return *this;
         }
 
+        /**
+         * @brief Sets how events are encoded when published (default: encodingJson)
+         * 
+         * @param encoding encodingJson, encodingCborZ85, or encodingColumnar
+         * @return EventHistory& 
+         * 
+         * With encodingJson, events are published as a JSON array of the JSON objects that were added.
+         * 
+         * With encodingCborZ85, the value is a string instead of an array. It contains the events encoded
+         * in CBOR, padded with 0 bytes to a multiple of 4 bytes, then encoded in Z85 (ZeroMQ Base85). The 
+         * CBOR data is a map with two keys:
+         * - "k" an array of the keys of the first event
+         * - "r" an indefinite length array with one item per event. Events that have exactly the same keys 
+         * in the same order as the first event are an array of values. Other events are a map.
+         * 
+         * The length is not sent. The map is the only CBOR data item and it ends with the break (0xff)
+         * of the "r" array, so a decoder stops after decoding one item and ignores the 0 to 3 zero bytes 
+         * of padding after it. Floating point values are sent as 16 or 32-bit floats (see CborBufferWriter), 
+         * so values with more than about 7 significant digits lose precision.
+         * 
+         * Storing the keys only once and binary numbers typically fits 2 to 3 times as many events in each
+         * publish. Events are still stored as JSON in the file system, so this can be changed at any time.
+         */
+        EventHistory &withEncoding(uint8_t encoding) {
+            this->encoding = encoding;
+            return *this;
+        }
+
+        static const uint8_t encodingJson = 0; //!< Publish events as a JSON array (default)
+        static const uint8_t encodingCborZ85 = 1; //!< Publish events as CBOR, Z85 encoded in a JSON string
+        static const uint8_t encodingColumnar = 2; //!< Publish time series samples as delta encoded columns (see withColumnar())
+
+        /**
+         * @brief Publish time series samples in columns instead of one object per event
+         * 
+         * @param sampleInterval The expected number of seconds between samples, or 0 to use the time between
+         * the first two samples in each batch.
+         * @param timeKey The key containing the Unix time of the sample. Default: "t".
+         * @return EventHistory& 
+         * 
+         * Sets the encoding to encodingColumnar. A batch is a run of events that have the same keys in the same 
+         * order, all of which are numbers, including a time key. The value is an object instead of an array:
+         * 
+         * - "tk" the time key
+         * - "t0" the time of the first sample
+         * - "dt" the sample interval in seconds
+         * - "tr" (only if not all samples are exactly on the interval) n - 1 values, the time between each sample
+         * and the previous one minus dt
+         * - "n" the number of samples
+         * - "k" an array of the other keys
+         * - "p" for each key, the number of decimal places the values were rounded to
+         * - "v" for each key, an array of the value of the first sample, then the difference from the previous 
+         * sample for the others. All of these values are integers, the value multiplied by 10 to the power p.
+         * 
+         * The number of decimal places is set with withColumnPrecision(). For other keys it's the largest number 
+         * of decimal places in the JSON for the batch, up to 6. If the first event cannot be stored in columns, 
+         * the value is a JSON array of events up to the next one that can. Use columnarToJson() to convert either 
+         * form back to a JSON array of events.
+         */
+        EventHistory &withColumnar(int sampleInterval = 0, const char *timeKey = "t") {
+            this->encoding = encodingColumnar;
+            this->sampleInterval = sampleInterval;
+            this->timeKey = timeKey;
+            return *this;
+        }
+
+        /**
+         * @brief Sets the number of decimal places to keep for a key in encodingColumnar mode
+         * 
+         * @param key The key in the event JSON object
+         * @param decimalPlaces Number of decimal places (0 - 6). For example, 1 stores a soil moisture of 41.26 as 41.3.
+         * @return EventHistory& 
+         */
+        EventHistory &withColumnPrecision(const char *key, int decimalPlaces);
+
+        /**
+         * @brief Converts a value published in encodingColumnar mode back into a JSON array of events
+         * 
+         * @param src The value of the event history key in the published event (object or array)
+         * @param writer The writer to write the array of event objects to
+         * @return true if src was valid
+         * 
+         * Events in a batch have the time key first, then the other keys. The values of keys with decimal
+         * places are written with that number of decimal places.
+         */
+        static bool columnarToJson(const JSONValue &src, JSONWriter &writer);
+
+        /**
+         * @brief Remove sent events by saving a head offset instead of rewriting the file
+         * 
+         * @param compactSize When the sent events at the beginning of the file reach this size, the unsent 
+         * events are copied to a new file. Default: 4096 bytes.
+         * @return EventHistory& 
+         * 
+         * By default, removeEvents() copies all of the unsent events to a new file every time, so draining 
+         * a large backlog rewrites the remaining data for every event published. In head offset mode, the
+         * offset of the first unsent event is saved in a small file (the event history path with ".head" 
+         * appended). The events file is removed when all events have been sent, and the unsent events are 
+         * only copied to a new file when the sent data is larger than both compactSize and the unsent data.
+         */
+        EventHistory &withHeadOffset(size_t compactSize = 4096) {
+            useHeadOffset = true;
+            this->compactSize = compactSize;
+            return *this;
+        }
+
         /**
          * @brief Adds an event to the event history
          * 
@@ -1263,19 +1907,39 @@ public:
          */;
         void addEvent(std::function<void(JSONWriter &)>callback);
 
+        /**
+         * @brief Adds several events to the event history with a single append to the file
+         * 
+         * @param count Number of events to add
+         * @param callback Called with index 0 to count - 1 to write each event
+         * 
+         * @return true if all of the events were added, false if the file could not be opened or written
+         * 
+         * Use this when events are buffered elsewhere (such as in FRAM) and moved to the event history
+         * in a batch, so the file is opened and written once instead of once per event. On false none
+         * of the events are in the file, so keep them where they are buffered and try again later.
+         */
+        bool addEvents(size_t count, std::function<void(size_t index, JSONWriter &)>callback);
+
         /**
          * @brief Get saved events and insert them as an array to writer
          * 
          * @param writer 
          * @param maxSize 
          * @param removeEvents 
+         * @param discardOversize Discard events that are larger than maxSize by themselves, so they 
+         * don't block the events after them. Pass false if maxSize is less than the space for event
+         * history in an event of its own.
          * @return true 
          * @return false 
          * 
          * If there are no events (getHasEvent() == false), this method returns quickly
          * so there is no need to preflight this call with a test for having events.
+         * 
+         * Returns false if no events were added to writer. Events that were discarded are removed
+         * by removeEvents() like the ones that were added.
          */
-        bool getEvents(JSONWriter &writer, size_t maxSize, bool removeEvents = true);
+        bool getEvents(JSONWriter &writer, size_t maxSize, bool removeEvents = true, bool discardOversize = true);
         
         /**
          * @brief Remove the events last retrieved using getEvents
@@ -1290,8 +1954,11 @@ public:
          * 
          * If the device resets between getEvents() and removeEvents(), the events
          * will be sent again later.
+         * 
+         * Returns false if getEvents() did not retrieve or discard anything, so there was nothing
+         * to remove.
          */
-        void removeEvents();
+        bool removeEvents();
 
         /**
          * @brief Returns true if there are events to get using getEvents
@@ -1320,10 +1987,78 @@ public:
          */
         EventHistory& operator=(const EventHistory&) = delete;
 
+        /**
+         * @brief Encode the events in buf as CBOR, Z85 encoded, and write them as a string value to writer
+         * 
+         * @param buf Buffer containing complete lines of JSON. The \n characters are replaced with null.
+         * @param dataSize Number of bytes of data in buf
+         * @param writer Writer to write the string value to
+         * @param maxSize Maximum size of the string value including the double quotes
+         * @param discardOversize Discard an event that does not fit in maxSize by itself
+         * 
+         * @return true if at least one event was written. removeOffset is updated.
+         */
+        bool getEventsCborZ85(char *buf, size_t dataSize, JSONWriter &writer, size_t maxSize, bool discardOversize);
+
+        /**
+         * @brief Write the events in buf in columns (encodingColumnar) to writer
+         * 
+         * @param buf Buffer containing complete lines of JSON. The \n characters are replaced with null.
+         * @param dataSize Number of bytes of data in buf
+         * @param writer Writer to write the object (or array) value to
+         * @param maxSize Maximum size of the value
+         * @param discardOversize Discard an event that does not fit in maxSize by itself
+         * 
+         * @return true if at least one event was written. removeOffset is updated.
+         */
+        bool getEventsColumnar(char *buf, size_t dataSize, JSONWriter &writer, size_t maxSize, bool discardOversize);
+
+        /**
+         * @brief Number of decimal places configured for a key using withColumnPrecision(), or -1 if not set
+         */
+        int getColumnPrecision(const char *key) const;
+
+        /**
+         * @brief Decimal places configured for a key in encodingColumnar mode
+         */
+        class ColumnPrecision {
+        public:
+            String key; //!< Key in the event JSON object
+            int decimalPlaces; //!< Number of decimal places to keep
+        };
+
+        /**
+         * @brief Loads headOffset from the head offset file, the first time only
+         */
+        void loadHeadOffset();
+
+        /**
+         * @brief Saves headOffset to the head offset file, or removes the file if headOffset is 0
+         */
+        void saveHeadOffset();
+
+        /**
+         * @brief Copies the events from removeOffset to the end of the file to a new file and replaces the event history file
+         */
+        void copyRemainingEvents();
+
+        /**
+         * @brief Sets removeOffset past an event that is larger than bufSize, reading from fd
+         */
+        void skipLongEvent(int fd, char *buf, size_t bufSize);
+
         String path; //!< path to the event history file
         bool firstRun = true; //!< Used to flag the first time the file has been accessed
         bool hasEvents = false; //!< True if there are events in the event history file
         size_t removeOffset = 0; //!< Where to remove events from
+        bool useHeadOffset = false; //!< Use head offset mode instead of rewriting the file on removeEvents()
+        bool headOffsetLoaded = false; //!< True if headOffset has been read from the file system
+        size_t compactSize = 4096; //!< Copy the unsent events to a new file when headOffset reaches this size
+        size_t headOffset = 0; //!< Offset of the first unsent event in the event history file (head offset mode)
+        uint8_t encoding = encodingJson; //!< How events are encoded when published
+        int sampleInterval = 0; //!< Seconds between samples in encodingColumnar mode, 0 = from the first two samples
+        String timeKey = "t"; //!< Key containing the sample time in encodingColumnar mode
+        std::vector<ColumnPrecision> columnPrecision; //!< Decimal places set using withColumnPrecision()
     };
 
     /**
@@ -1340,15 +2075,28 @@ public:
     class EventCombiner {
     public:
         /**
-         * @brief Container to hold a JSON fragment and a priority value 0 - 100.
+         * @brief Location of a JSON fragment in the arena and a priority value 0 - 100.
          * 
          * Note that this is only a fragment, basically an object without the surrounding {}!
          */
         class EventInfo {
         public:
-            String json; //!< JSON fragment, an object without the surrounding {}
+            size_t offset = 0; //!< Offset of the JSON fragment (an object without the surrounding {}) in the arena
+            size_t length = 0; //!< Length of the JSON fragment in bytes
             int priority = 0; //!< Priority 0 - 100 inclusive.
-            std::vector<String> keys; //!< Top level keys
+            size_t firstKey = 0; //!< Index of the first top level key in keys
+            size_t numKeys = 0; //!< Number of top level keys
+            size_t bin = 0; //!< Index of the event this fragment is packed into
+        };
+
+        /**
+         * @brief A top level key of a JSON fragment, captured as the fragment is written
+         */
+        class KeyInfo {
+        public:
+            uint32_t hash = 0; //!< FNV-1a hash of the key (as written, including escapes)
+            size_t offset = 0; //!< Offset of the key in the arena
+            size_t length = 0; //!< Length of the key in bytes
         };
 
         /**
@@ -1407,6 +2155,52 @@ public:
             return *this;
         }
 
+        /**
+         * @brief Use head offset mode for the event history. See EventHistory::withHeadOffset().
+         * 
+         * @param compactSize Size of sent events before the file is compacted
+         * @return EventCombiner& 
+         */
+        EventCombiner &withEventHistoryHeadOffset(size_t compactSize = 4096) {
+            eventHistory.withHeadOffset(compactSize);
+            return *this;
+        }
+
+        /**
+         * @brief Sets how the event history is encoded. See EventHistory::withEncoding().
+         * 
+         * @param encoding EventHistory::encodingJson, encodingCborZ85, or encodingColumnar
+         * @return EventCombiner& 
+         */
+        EventCombiner &withEventHistoryEncoding(uint8_t encoding) {
+            eventHistory.withEncoding(encoding);
+            return *this;
+        }
+
+        /**
+         * @brief Publish the event history as delta encoded columns. See EventHistory::withColumnar().
+         * 
+         * @param sampleInterval Expected seconds between samples, or 0 to use the time between the first two
+         * @param timeKey The key containing the sample time
+         * @return EventCombiner& 
+         */
+        EventCombiner &withEventHistoryColumnar(int sampleInterval = 0, const char *timeKey = "t") {
+            eventHistory.withColumnar(sampleInterval, timeKey);
+            return *this;
+        }
+
+        /**
+         * @brief Sets the number of decimal places to keep for a key in the event history columns
+         * 
+         * @param key The key in the event JSON object
+         * @param decimalPlaces Number of decimal places (0 - 6)
+         * @return EventCombiner& 
+         */
+        EventCombiner &withEventHistoryColumnPrecision(const char *key, int decimalPlaces) {
+            eventHistory.withColumnPrecision(key, decimalPlaces);
+            return *this;
+        }
+
         /**
          * @brief Adds an event to the event history (preformatted JSON)
          * 
@@ -1441,6 +2235,17 @@ public:
             return *this;
         }
 
+        /**
+         * @brief Adds several events to the event history with a single append to the file
+         * 
+         * @param count Number of events to add
+         * @param callback Called with index 0 to count - 1 to write each event
+         * @return true if all of the events were added, false if none were
+         */
+        bool addEvents(size_t count, std::function<void(size_t index, JSONWriter &)>callback) {
+            return eventHistory.addEvents(count, callback);
+        }
+
 
         /**
          * @brief Generate one or more events based on the maximum event size
@@ -1483,17 +2288,80 @@ public:
          */
         EventCombiner& operator=(const EventCombiner&) = delete;
 
+        /**
+         * @brief JSONBufferWriter that records the top level keys of the object as it's written
+         * 
+         * The writer produces the JSON in order, so a string at depth 1 followed by a : is a key.
+         * This avoids parsing the fragment again to find its keys.
+         */
+        class FragmentWriter : public JSONBufferWriter {
+        public:
+            /**
+             * @brief Write a fragment into the arena at arenaOffset
+             * 
+             * @param combiner The EventCombiner that owns the arena and keys
+             * @param arenaOffset Where to write
+             * @param size Maximum size to write
+             */
+            FragmentWriter(EventCombiner &combiner, size_t arenaOffset, size_t size) : 
+                JSONBufferWriter(&combiner.arena[arenaOffset], size), combiner(combiner), arenaOffset(arenaOffset) {};
+
+        protected:
+            /**
+             * @brief Writes data to the buffer and scans it for keys
+             */
+            virtual void write(const char *data, size_t size) override;
+
+            EventCombiner &combiner; //!< Owner of the arena and keys
+            size_t arenaOffset; //!< Offset of the start of the buffer in the arena
+            int depth = 0; //!< Object and array nesting depth
+            bool inString = false; //!< Inside a string
+            bool escape = false; //!< Previous character in the string was a backslash
+            bool stringAtDepth1 = false; //!< The last string ended at depth 1 and may be a key
+            size_t stringStart = 0; //!< Offset in the buffer of the first character of the current string
+            size_t stringEnd = 0; //!< Offset in the buffer of the closing quote of the last string
+            uint32_t stringHash = 0; //!< Hash of the current string so far
+        };
+
         /**
          * @brief Used internally to generate events based on priority
          * 
          * @param callback The callback to call
-         * @param buf The event buffer
-         * @param maxSize The size of the event buffer
+         * @param maxSize The maximum size of an event
          * @param infoArray Data to be added to the event
          * 
-         * A separate function is used because the process is run twice, once for the regular callbacks and once for the one-time callbacks.
+         * The JSON is written directly into the arena and the top level keys are recorded in keys.
+         */
+        void generateEventInternal(const std::function<bool(JSONWriter &, int &)> &callback, size_t maxSize, std::vector<EventInfo> &infoArray);
+
+        /**
+         * @brief Make sure the arena has at least size bytes free after arenaUsed
+         * 
+         * @return false if out of memory
          */
-        void generateEventInternal(std::function<void(JSONWriter &, int &)> callback, char *buf, size_t maxSize, std::vector<EventInfo> &infoArray);
+        bool arenaReserve(size_t size);
+
+        /**
+         * @brief Returns true if the key has been added to the hash table, otherwise adds it
+         */
+        bool keyTableFindOrAdd(const KeyInfo &key);
+
+        /**
+         * @brief Seed value for the 32-bit FNV-1a hash used for keys
+         */
+        static const uint32_t FNV_OFFSET_BASIS = 2166136261UL;
+
+        /**
+         * @brief Multiplier for the 32-bit FNV-1a hash used for keys
+         */
+        static const uint32_t FNV_PRIME = 16777619UL;
+
+        char *arena = NULL; //!< Buffer holding the event scratch buffer and all JSON fragments, only allocated during generateEvents
+        size_t arenaSize = 0; //!< Size of arena in bytes
+        size_t arenaUsed = 0; //!< Bytes of arena used
+        std::vector<KeyInfo> keys; //!< Top level keys of all fragments, only valid during generateEvents
+        uint16_t *keyTable = NULL; //!< Open addressing hash table of (index into keys + 1), only allocated during generateEvents
+        size_t keyTableSize = 0; //!< Number of entries in keyTable, a power of 2
 
         AppCallback<JSONWriter &, int &> callbacks; //!< Callback functions
         AppCallback<JSONWriter &, int &> oneTimeCallbacks; //!< One-time use callback functions 
@@ -1569,6 +2437,28 @@ public:
      */
     static void JSONCopy(const JSONValue &src, JSONWriter &writer);
 
+    /**
+     * @brief Encodes binary data in Z85 (ZeroMQ Base85)
+     * 
+     * @param src Data to encode
+     * @param srcLen Length of data. If not a multiple of 4, it's padded with 0 bytes.
+     * @param dst Buffer to write to. A null terminator is added.
+     * @param dstSize Size of dst. Must be at least (srcLen + 3) / 4 * 5 + 1 bytes.
+     * 
+     * @return Number of characters written, not including the null terminator, or 0 if dst is too small
+     * 
+     * The Z85 alphabet does not include double quote or backslash so it can be used in a JSON string.
+     */
+    static size_t Z85Encode(const uint8_t *src, size_t srcLen, char *dst, size_t dstSize);
+
+    /**
+     * @brief Encodes a JSON value as CBOR
+     * 
+     * @param src The JSON value to encode
+     * @param writer The CBOR writer
+     */
+    static void JSONToCbor(const JSONValue &src, CborBufferWriter &writer);
+
 
 #ifndef UNITTEST
     /**
@@ -1890,6 +2780,63 @@ public:
         return *this;
     }
 
+    /**
+     * @brief Remove sent event history by saving a head offset instead of rewriting the file
+     * 
+     * @param compactSize When this many bytes of sent events are at the start of the file, the unsent
+     * events are copied to a new file. Default: 4096.
+     * @return SleepHelper& 
+     * 
+     * This reduces flash writes when a large event history is published after being offline for a while.
+     * See EventHistory::withHeadOffset().
+     */
+    SleepHelper &withEventHistoryHeadOffset(size_t compactSize = 4096) {
+        wakeEventFunctions.withEventHistoryHeadOffset(compactSize);
+        return *this;
+    }
+
+    /**
+     * @brief Sets how the event history is encoded when published
+     * 
+     * @param encoding EventHistory::encodingJson (default), encodingCborZ85, or encodingColumnar
+     * @return SleepHelper& 
+     * 
+     * encodingCborZ85 publishes the event history as a compact binary (CBOR) string instead of a JSON array,
+     * which fits more events in each publish. See EventHistory::withEncoding() for the format.
+     */
+    SleepHelper &withEventHistoryEncoding(uint8_t encoding) {
+        wakeEventFunctions.withEventHistoryEncoding(encoding);
+        return *this;
+    }
+
+    /**
+     * @brief Publish the event history as delta encoded columns of time series samples
+     * 
+     * @param sampleInterval Expected seconds between samples, or 0 to use the time between the first two
+     * @param timeKey The key containing the sample time. Default: "t".
+     * @return SleepHelper& 
+     * 
+     * Samples taken on a fixed schedule are published as one base time and interval, then an array of
+     * differences for each key, which is much smaller than an object per sample. See EventHistory::withColumnar() 
+     * for the format and EventHistory::columnarToJson() to decode it.
+     */
+    SleepHelper &withEventHistoryColumnar(int sampleInterval = 0, const char *timeKey = "t") {
+        wakeEventFunctions.withEventHistoryColumnar(sampleInterval, timeKey);
+        return *this;
+    }
+
+    /**
+     * @brief Sets the number of decimal places to keep for a key in the event history columns
+     * 
+     * @param key The key in the event JSON object
+     * @param decimalPlaces Number of decimal places (0 - 6). For example, 1 for soil moisture to 0.1%.
+     * @return SleepHelper& 
+     */
+    SleepHelper &withEventHistoryColumnPrecision(const char *key, int decimalPlaces) {
+        wakeEventFunctions.withEventHistoryColumnPrecision(key, decimalPlaces);
+        return *this;
+    }
+
     /**
      * @brief Adds an event to the event history (preformatted JSON)
      * 
@@ -1924,6 +2871,29 @@ public:
         return *this;
     }
 
+    /**
+     * @brief Adds several events to the event history with a single append to the file
+     * 
+     * @param count Number of events to add
+     * @param callback Called with index 0 to count - 1 to write each event
+     * 
+     * The callback/lambda has this prototype:
+     * 
+     * void callback(size_t index, JSONWriter &writer)
+     * 
+     * Use this to move events that were buffered elsewhere (such as in FRAM) to the event history
+     * in a batch, so the file is opened and written once instead of once per event.
+     * 
+     * Unlike addEvent() this does not return the SleepHelper, so it can't be chained. Only remove the
+     * events from where they are buffered when it returns true.
+     * 
+     * @return true if all of the events were added, false if the event history file could not be opened
+     * or written, in which case none of them were added
+     */
+    bool addEvents(size_t count, std::function<void(size_t index, JSONWriter &)>callback) {
+        return wakeEventFunctions.addEvents(count, callback);
+    }
+
     /**
      * @brief Adds a function to be called right before sleep or reset.
      * 
@@ -2224,6 +3194,8 @@ public:
     static const uint64_t eventsEnabledTimeToConnect        = 0x0000000000000002ul;  //!< "ttc" time to connect event
     static const uint64_t eventsEnabledResetReason          = 0x0000000000000004ul;  //!< "rr" reset reason event
     static const uint64_t eventsEnabledBatterySoC           = 0x0000000000000008ul;  //!< "soc" report battery SoC on full wake
+    static const uint64_t eventsEnabledWakeProfile          = 0x0000000000000010ul;  //!< "wp" wake cycle phase times since the last full wake (off by default)
+    static const uint64_t eventsEnabledEnergy               = 0x0000000000000020ul;  //!< "en" estimated charge used and battery SoC change
 
     /**
      * @brief Enable an eventsEnable flag. These determine whether the add values to the wake event
@@ -2387,6 +3359,105 @@ public:
         return scheduleManager.getScheduleByName("data");
     }
 
+    /**
+     * @brief Get the phase times of a completed wake cycle
+     * 
+     * @param index 0 = the most recent cycle, 1 = the one before that, ... up to PersistentData::WAKE_CYCLE_RING_SIZE - 1
+     * @param cycle Filled in with the cycle
+     * @return true if there is a cycle at that index
+     * 
+     * The cycles are kept in the persistent data so they survive sleep and reset. To also add them 
+     * to the wake event, use withEventsEnabledEnable(eventsEnabledWakeProfile).
+     */
+    bool getWakeCycleProfile(size_t index, WakeCycleProfile &cycle) const {
+        return persistentData.getValue_wakeCycle(index, cycle);
+    }
+
+    /**
+     * @brief Sets the current draw for each phase, used to estimate the battery charge used
+     * 
+     * @param model The EnergyModel, for example SleepHelper::EnergyModel().withSensorMa(7.0)
+     * @return SleepHelper& 
+     */
+    SleepHelper &withEnergyModel(const EnergyModel &model) {
+        energyModel = model;
+        return *this;
+    }
+
+    /**
+     * @brief Call when turning external sensor power on or off so the energy model can include it
+     * 
+     * @param on true if the sensor power was turned on
+     * 
+     * This only measures the time; the current is set using EnergyModel::withSensorMa().
+     */
+    void setSensorPower(bool on) {
+        wakeProfiler.sensorPower(on, millis());
+    }
+
+    /**
+     * @brief Limits each connection attempt using the history of past times to connect
+     *
+     * @param policy The ConnectTimeoutPolicy, for example SleepHelper::ConnectTimeoutPolicy().withPercentile(90)
+     * @return SleepHelper&
+     *
+     * This adds a maximum time to connect function, so it works along with withMaximumTimeToConnect(), which
+     * remains the ceiling. Calling it again replaces the policy.
+     *
+     * @ingroup callbacks
+     */
+    SleepHelper &withConnectTimeoutPolicy(const ConnectTimeoutPolicy &policy) {
+        connectTimeoutPolicy = policy;
+        if (!connectTimeoutPolicyAdded) {
+            connectTimeoutPolicyAdded = true;
+            withMaximumTimeToConnectFunction([this](system_tick_t ms) {
+                return connectTimeoutPolicy.isEnabled() && connectDeadlineMs != 0 && ms > connectDeadlineMs;
+            });
+        }
+        return *this;
+    }
+
+    /**
+     * @brief Reports the cellular signal for the ConnectTimeoutPolicy
+     *
+     * @param strength Signal strength percentage, as from CellularSignal::getStrength(), or negative if not known
+     * @param quality Signal quality percentage, as from CellularSignal::getQuality(), or negative if not known
+     *
+     * The signal read while connecting is used to choose the time allowed for that attempt and is
+     * saved for the next one. Does nothing if withConnectTimeoutPolicy() has not been used.
+     */
+    void setCellularSignal(float strength, float quality);
+
+    /**
+     * @brief Returns the time allowed by the ConnectTimeoutPolicy for the current or last connection attempt in milliseconds
+     *
+     * Returns 0 if no attempt has been made or withConnectTimeoutPolicy() has not been used.
+     */
+    system_tick_t getConnectDeadlineMs() const {
+        return connectDeadlineMs;
+    }
+
+    /**
+     * @brief Get the estimated charge used so far today (local time), in mAh
+     * 
+     * Only completed wake cycles are included.
+     */
+    float getEnergyTodayMah() const;
+
+    /**
+     * @brief Get the estimated charge used yesterday (local time), in mAh
+     */
+    float getEnergyYesterdayMah() const;
+
+    /**
+     * @brief Get the phase times of the wake cycle in progress
+     * 
+     * The current phase is not included until the state changes.
+     */
+    const WakeCycleProfile &getCurrentWakeCycleProfile() const {
+        return wakeProfiler.getCycle();
+    }
+
     
     static const int WAKEUP_REASON_SETUP        = 0x10001; //!< Wakeup reason used on reset or cold boot, from setup()
     static const int WAKEUP_REASON_NO_SLEEP     = 0x10002; //!< Wakeup reason when we didn't actually sleep because the period was too short
@@ -2455,6 +3526,13 @@ protected:
      */
     void dataCaptureHandler();
 
+    /**
+     * @brief Sets connectDeadlineMs from the connectTimeoutPolicy and the saved history
+     *
+     * Called when a connection attempt starts and when the signal class changes during it.
+     */
+    void updateConnectDeadline();
+
     /**
      * @brief Initial state at boot or after sleep
      * 
@@ -2513,39 +3591,22 @@ protected:
     /**
      * @brief Handles things while connected to the cloud
      * 
-     * Attempts to publish all saved data. Once all data has been published, the sleep ready functions are 
-     * called to see if all callbacks agree it's time to sleep.
+     * Attempts to publish all saved data. Up to PUBLISH_DATA_MAX_IN_FLIGHT events are queued to
+     * BackgroundPublishRK at a time, which enforces the cloud rate limit. At least one of its slots is
+     * always left free for PublishQueuePosixRK. Once all data has been published, the sleep ready 
+     * functions are called to see if all callbacks agree it's time to sleep.
+     * 
+     * After a failure no more events are queued until the ones in flight complete, then publishing 
+     * starts again from the failed event. Events that were already queued behind the failed one are 
+     * still sent, so a retried event can reach the cloud after events that were added later.
      * 
      * Next state:
-     * - stateHandlerPublishWait if a publish is in progress
-     * - stateHandlerPublishRateLimit if a publish was successful and we need to wait before publishing more data 
-     * - stateHandlerConnected stays in state if a publish failed
+     * - stateHandlerConnected stays in state while publishes are queued or in flight, or if a publish failed
      * - stateHandlerDisconnectBeforeSleep all data has been published and sleep ready function indicate time to sleep
      * - stateHandlerReconnectWait if the cloud connection is lost
      */
     void stateHandlerConnected();
 
-    /**
-     * @brief Wait for a publish to complete
-     * 
-     * The state transition occurs from the background publish lambda implemented in stateHandlerConnected.
-     *
-     * Previous state:
-     * - stateHandlerConnected
-     * 
-     * Next state:
-     * - stateHandlerPublishRateLimit
-     */
-    void stateHandlerPublishWait();
-
-    /**
-     * @brief Waits so publishes only occur once per second
-     * 
-     * Next state: 
-     * - stateHandlerConnected
-     */
-    void stateHandlerPublishRateLimit();
-
     /**
      * @brief If the cloud connection is lost, waits here
      * 
@@ -2688,11 +3749,11 @@ protected:
     std::vector<PublishData> publishData; //!< Wake event data to publish (JSON strings)
 
     /**
-     * @brief Which event history events are enabled (default: all)
+     * @brief Which event history events are enabled (default: all except eventsEnabledWakeProfile)
      * 
      * See constants such as eventsEnabledWakeReason, eventsEnabledTimeToConnect for flag values
      */
-    uint64_t eventsEnabled = 0xfffffffffffffffful;
+    uint64_t eventsEnabled = ~eventsEnabledWakeProfile;
 
     /**
      * @brief Which logging messages to enable
@@ -2701,6 +3762,12 @@ protected:
      */
     uint64_t logEnabled = logEnabledNormal;
 
+    WakeProfiler wakeProfiler; //!< Phase times of the wake cycle in progress
+    EnergyModel energyModel; //!< Current draw for each phase
+    ConnectTimeoutPolicy connectTimeoutPolicy; //!< Time allowed to connect, used if connectTimeoutPolicyAdded
+    bool connectTimeoutPolicyAdded = false; //!< True if withConnectTimeoutPolicy() added its maximum time to connect function
+    system_tick_t connectDeadlineMs = 0; //!< Time allowed for the current connection attempt by connectTimeoutPolicy
+
 #ifndef UNITTEST
     system_tick_t minimumCellularOffTimeMs = std::chrono::duration_cast<std::chrono::milliseconds>(13min).count(); //!< Default value for the minimum time to turn cellular off
     system_tick_t minimumSleepTimeMs = std::chrono::duration_cast<std::chrono::milliseconds>(10s).count(); //!< Default value for the minimum time to sleep
@@ -2708,6 +3775,17 @@ protected:
     std::function<void(SleepHelper&)> stateHandler = &SleepHelper::stateHandlerStart; //!< state handler function
     system_tick_t stateTime = 0; //!< millis counter used in certain state handlers
 
+    static const size_t PUBLISH_DATA_MAX_IN_FLIGHT = 3; //!< Maximum publishData events queued to BackgroundPublishRK at once, leaving a slot of its default 4 for PublishQueuePosixRK
+    static const uint8_t publishResultPending = 0; //!< publishDataResults value, no result yet
+    static const uint8_t publishResultSucceeded = 1; //!< publishDataResults value, publish succeeded
+    static const uint8_t publishResultFailed = 2; //!< publishDataResults value, publish failed
+    volatile uint8_t publishDataResults[PUBLISH_DATA_MAX_IN_FLIGHT] = {0}; //!< Results set from the publish callback, by sequence number
+    system_tick_t publishDataQueuedMillis[PUBLISH_DATA_MAX_IN_FLIGHT] = {0}; //!< millis() when each event was queued, by sequence number
+    size_t publishDataSeq = 0; //!< Sequence number of the next publishData event to be queued
+    size_t publishDataDoneSeq = 0; //!< Sequence number of the oldest publishData event in flight
+    size_t publishDataInFlight = 0; //!< Number of publishData events queued to BackgroundPublishRK without a result
+    size_t publishDataFailed = 0; //!< Number of events at the front of publishData that failed and will be retried
+
     system_tick_t connectAttemptStartMillis = 0; //!< millis value when Particle.connect was called
     system_tick_t reconnectAttemptStartMillis = 0; //!< millis value when Particle.connected returned false after being connected
     system_tick_t networkConnectedMillis = 0; //!< mills value when Cellular.connected returned true
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Compares the fixed maximum time to connect with the adaptive ConnectTimeoutPolicy.
+#
+# Runs the simulator with --connect-timeout=fixed and --connect-timeout=adaptive for each seed, on
+# a synthetic network where some days have a bad signal, and prints the charge used, the modem on
+# time and the time spent in attempts that were given up, per day.
+#
+#   ./connect-timeout.sh [simulator options]
+#
+# The options default to --bad-day-rate=0.2. SEEDS sets the seeds (default: 1 2 3 4 5).
+
+SIM="$(dirname "$0")/build/sleephelper-sim"
+SEEDS="${SEEDS:-1 2 3 4 5}"
+if [ $# -eq 0 ]; then
+    set -- --bad-day-rate=0.2
+fi
+
+field() {
+    echo "$1" | sed -n "s/.*\"$2\":\([0-9.]*\).*/\1/p"
+}
+
+printf "%-6s %-9s %9s %9s %9s %9s %9s %8s\n" seed mode mAh/day modem/day gaveup/day attempts connects baddays
+for seed in $SEEDS; do
+    for mode in fixed adaptive; do
+        json="$("$SIM" --json --seed="$seed" --connect-timeout="$mode" "$@")"
+        printf "%-6s %-9s %9s %9s %9s %9s %9s %8s\n" "$seed" "$mode" \
+            "$(field "$json" mAhPerDay)" "$(field "$json" modemOnSecPerDay)" "$(field "$json" connectGiveUpSecPerDay)" \
+            "$(field "$json" connectAttempts)" "$(field "$json" cloudConnects)" "$(field "$json" badDays)"
+        echo "$mode $(field "$json" mAhPerDay) $(field "$json" modemOnSecPerDay) $(field "$json" cloudConnects)"
+    done
+done | awk '
+    NF == 4 { mah[$1] += $2; modem[$1] += $3; connects[$1] += $4; runs[$1]++; next }
+    { print }
+    END {
+        if (runs["fixed"] && runs["adaptive"]) {
+            f = mah["fixed"] / runs["fixed"]; a = mah["adaptive"] / runs["adaptive"]
+            printf "\nmean mAh/day: fixed %.2f, adaptive %.2f, saved %.2f (%.1f%%)\n", f, a, f - a, 100 * (f - a) / f
+            printf "mean modem on sec/day: fixed %.1f, adaptive %.1f\n", modem["fixed"] / runs["fixed"], modem["adaptive"] / runs["adaptive"]
+            printf "cloud connections: fixed %d, adaptive %d\n", connects["fixed"], connects["adaptive"]
+        }
+    }'
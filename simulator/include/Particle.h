@@ -0,0 +1,762 @@
+/**
+ * @file Particle.h
+ * @brief Device OS API for the host simulator
+ *
+ * @details This is the subset of the Device OS 2.x API used by SleepHelper-Garden and its libraries,
+ * declared so the application and library sources compile unmodified with a native gcc. String, Print,
+ * JSON and the Time declarations come from UnitTestLib (lib/LocalTimeRK/automated-test/UnitTestLib).
+ *
+ * Everything with behavior (the clock, threads, the cloud connection, sleep, I2C and the file system)
+ * is implemented in ../src against a virtual clock, so a run is deterministic for a given seed. See
+ * ../README.md.
+ */
+#ifndef __PARTICLE_H
+#define __PARTICLE_H
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#include "spark_wiring_string.h"
+#include "spark_wiring_print.h"
+#include "spark_wiring_stream.h"
+#include "spark_wiring_json.h"
+#include "spark_wiring_time.h"
+#include "system_tick_hal.h"
+#include "rng_hal.h"
+#include "protocol_defs.h"
+
+using namespace spark;
+using namespace std::chrono_literals;
+
+//
+// Platform
+//
+#define PLATFORM_BORON 13
+#define PLATFORM_ID PLATFORM_BORON
+#define Wiring_Cellular 1
+#define Wiring_WiFi 0
+#define HAL_PLATFORM_POWER_MANAGEMENT 1
+#define SYSTEM_VERSION_v230 0x02030000
+#define SYSTEM_VERSION SYSTEM_VERSION_v230
+
+#define SYSTEM_THREAD(state)
+
+namespace spark {
+namespace feature {
+enum State {
+    DISABLED,
+    ENABLED
+};
+}
+}
+
+// The application is always built with SYSTEM_THREAD(ENABLED)
+inline spark::feature::State system_thread_get_state(void *reserved) {
+    return spark::feature::ENABLED;
+}
+#define SYSTEM_MODE(mode)
+#define PRODUCT_ID(id)
+#define PRODUCT_VERSION(version)
+
+#define __SIM_CONCAT2(a, b) a##b
+#define __SIM_CONCAT(a, b) __SIM_CONCAT2(a, b)
+// Runs the expression during global construction, as Device OS does before setup()
+#define STARTUP(code) static struct { int dummy = ((code), 0); } __SIM_CONCAT(__startup_, __LINE__);
+
+#define FEATURE_RESET_INFO 1
+
+typedef enum {
+    RESET_REASON_NONE = 0,
+    RESET_REASON_UNKNOWN = 10,
+    RESET_REASON_PIN_RESET = 20,
+    RESET_REASON_POWER_MANAGEMENT = 30,
+    RESET_REASON_POWER_DOWN = 40,
+    RESET_REASON_POWER_BROWNOUT = 50,
+    RESET_REASON_WATCHDOG = 60,
+    RESET_REASON_UPDATE = 70,
+    RESET_REASON_UPDATE_ERROR = 80,
+    RESET_REASON_UPDATE_TIMEOUT = 90,
+    RESET_REASON_FACTORY_RESET = 100,
+    RESET_REASON_SAFE_MODE = 110,
+    RESET_REASON_DFU_MODE = 120,
+    RESET_REASON_PANIC = 130,
+    RESET_REASON_USER = 140
+} System_Reset_Reason;
+
+//
+// Timing and GPIO
+//
+system_tick_t millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+typedef uint16_t pin_t;
+const pin_t PIN_INVALID = 0xff;
+const pin_t D0 = 0, D1 = 1, D2 = 2, D3 = 3, D4 = 4, D5 = 5, D6 = 6, D7 = 7, D8 = 8;
+const pin_t A0 = 19, A1 = 18, A2 = 17, A3 = 16, A4 = 15, A5 = 14;
+
+typedef enum PinMode {
+    INPUT,
+    OUTPUT,
+    INPUT_PULLUP,
+    INPUT_PULLDOWN
+} PinMode;
+
+#define HIGH 1
+#define LOW 0
+
+typedef uint8_t byte;
+
+void pinMode(pin_t pin, PinMode mode);
+void digitalWrite(pin_t pin, uint8_t value);
+int32_t digitalRead(pin_t pin);
+int32_t analogRead(pin_t pin);
+
+inline int map(int value, int fromStart, int fromEnd, int toStart, int toEnd) {
+    if (fromEnd == fromStart) {
+        return toStart;
+    }
+    return (value - fromStart) * (toEnd - toStart) / (fromEnd - fromStart) + toStart;
+}
+
+inline double map(double value, double fromStart, double fromEnd, double toStart, double toEnd) {
+    if (fromEnd == fromStart) {
+        return toStart;
+    }
+    return (value - fromStart) * (toEnd - toStart) / (fromEnd - fromStart) + toStart;
+}
+
+//
+// Logging
+//
+typedef enum LogLevel {
+    LOG_LEVEL_ALL = 1,
+    LOG_LEVEL_TRACE = 1,
+    LOG_LEVEL_INFO = 30,
+    LOG_LEVEL_WARN = 40,
+    LOG_LEVEL_ERROR = 50,
+    LOG_LEVEL_PANIC = 60,
+    LOG_LEVEL_NONE = 70
+} LogLevel;
+
+class Logger {
+public:
+    explicit Logger(const char *name = "app") : name_(name) {}
+
+    void trace(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
+    void info(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
+    void warn(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
+    void error(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
+    void log(LogLevel level, const char *fmt, ...) const __attribute__((format(printf, 3, 4)));
+    void vlog(LogLevel level, const char *fmt, va_list ap) const;
+
+    void write(LogLevel level, const char *data, size_t size) const;
+    void write(const char *data, size_t size) const { write(LOG_LEVEL_INFO, data, size); }
+    void print(const char *str) const { write(str, strlen(str)); }
+    void dump(const void *data, size_t size) const;
+
+    bool isTraceEnabled() const { return isLevelEnabled(LOG_LEVEL_TRACE); }
+    bool isInfoEnabled() const { return isLevelEnabled(LOG_LEVEL_INFO); }
+    bool isLevelEnabled(LogLevel level) const;
+
+    const char *name() const { return name_; }
+
+private:
+    const char *name_;
+};
+
+extern const Logger Log;
+
+class LogHandler {
+public:
+    explicit LogHandler(LogLevel level = LOG_LEVEL_INFO);
+};
+
+class SerialLogHandler : public LogHandler {
+public:
+    explicit SerialLogHandler(LogLevel level = LOG_LEVEL_INFO) : LogHandler(level) {}
+    SerialLogHandler(int baud, LogLevel level) : LogHandler(level) {}
+};
+
+class USBSerial : public Stream {
+public:
+    void begin(long speed = 9600) {}
+    bool isConnected() { return false; }
+    virtual int available() override { return 0; }
+    virtual int read() override { return -1; }
+    virtual int peek() override { return -1; }
+    virtual void flush() override {}
+    virtual size_t write(uint8_t c) override;
+    using Print::write;
+};
+extern USBSerial Serial;
+
+//
+// Locking and threads. Threads are cooperative coroutines scheduled on the virtual clock, so only
+// a blocking call (os_queue_take, delay) switches threads and the locks never contend.
+//
+typedef void *os_mutex_t;
+typedef void *os_mutex_recursive_t;
+typedef void *os_queue_t;
+typedef uint8_t os_thread_prio_t;
+
+const os_thread_prio_t OS_THREAD_PRIORITY_DEFAULT = 2;
+const size_t OS_THREAD_STACK_SIZE_DEFAULT = 3 * 1024;
+const system_tick_t CONCURRENT_WAIT_FOREVER = (system_tick_t)-1;
+
+int os_mutex_create(os_mutex_t *mutex);
+int os_mutex_destroy(os_mutex_t mutex);
+int os_mutex_lock(os_mutex_t mutex);
+int os_mutex_trylock(os_mutex_t mutex);
+int os_mutex_unlock(os_mutex_t mutex);
+
+int os_mutex_recursive_create(os_mutex_recursive_t *mutex);
+int os_mutex_recursive_destroy(os_mutex_recursive_t mutex);
+int os_mutex_recursive_lock(os_mutex_recursive_t mutex);
+int os_mutex_recursive_trylock(os_mutex_recursive_t mutex);
+int os_mutex_recursive_unlock(os_mutex_recursive_t mutex);
+
+int os_queue_create(os_queue_t *queue, size_t itemSize, size_t itemCount, void *reserved);
+int os_queue_destroy(os_queue_t queue, void *reserved);
+int os_queue_put(os_queue_t queue, const void *item, system_tick_t delay, void *reserved);
+int os_queue_take(os_queue_t queue, void *item, system_tick_t delay, void *reserved);
+
+class Mutex {
+public:
+    void lock() {}
+    bool trylock() { return true; }
+    bool try_lock() { return true; }
+    void unlock() {}
+};
+
+class RecursiveMutex : public Mutex {
+};
+
+class Thread {
+public:
+    Thread(const char *name, std::function<void()> function, os_thread_prio_t priority = OS_THREAD_PRIORITY_DEFAULT, size_t stackSize = OS_THREAD_STACK_SIZE_DEFAULT);
+    ~Thread();
+
+    void dispose();
+    bool isValid() const { return handle != nullptr; }
+
+private:
+    void *handle = nullptr;
+};
+
+#define WITH_LOCK(lock) for (bool __todo = true; __todo;) for (std::lock_guard<typename std::remove_reference<decltype(lock)>::type> __lock((lock)); __todo; __todo = false)
+#define TRY_LOCK(lock) WITH_LOCK(lock)
+#define SINGLE_THREADED_BLOCK()
+#define ATOMIC_BLOCK()
+
+//
+// Cloud
+//
+namespace particle {
+
+class Error {
+public:
+    enum Type {
+        NONE = 0,
+        UNKNOWN = -100,
+        INVALID_STATE = -210,
+        LIMIT_EXCEEDED = -160,
+        TIMEOUT = -160,
+        NETWORK = -1000,
+        CANCELLED = -270
+    };
+
+    Error(Type type = NONE) : type_(type) {}
+
+    Type type() const { return type_; }
+    const char *message() const { return "error"; }
+
+private:
+    Type type_;
+};
+
+/**
+ * @brief Result of an asynchronous operation, such as a publish
+ *
+ * Callbacks added after the operation completes run immediately. Callbacks added before are run
+ * by the simulator when the fake cloud completes the operation.
+ */
+template <typename ResultT>
+class Future {
+public:
+    struct State {
+        bool done = false;
+        bool succeeded = false;
+        ResultT result = ResultT();
+        Error error;
+        std::vector<std::function<void(const ResultT &)>> successCallbacks;
+        std::vector<std::function<void(const Error &)>> errorCallbacks;
+    };
+
+    Future() : state(std::make_shared<State>()) {}
+    explicit Future(std::shared_ptr<State> state) : state(state) {}
+
+    bool isDone() const { return state->done; }
+    bool isSucceeded() const { return state->done && state->succeeded; }
+    bool isFailed() const { return state->done && !state->succeeded; }
+    ResultT result() const { return state->result; }
+    Error error() const { return state->error; }
+    operator ResultT() const { return state->result; }
+
+    Future &onSuccess(std::function<void(const ResultT &)> fn) {
+        if (state->done) {
+            if (state->succeeded) {
+                fn(state->result);
+            }
+        }
+        else {
+            state->successCallbacks.push_back(fn);
+        }
+        return *this;
+    }
+
+    Future &onError(std::function<void(const Error &)> fn) {
+        if (state->done) {
+            if (!state->succeeded) {
+                fn(state->error);
+            }
+        }
+        else {
+            state->errorCallbacks.push_back(fn);
+        }
+        return *this;
+    }
+
+    static void complete(std::shared_ptr<State> state, bool succeeded, ResultT result, Error error = Error()) {
+        if (state->done) {
+            return;
+        }
+        state->done = true;
+        state->succeeded = succeeded;
+        state->result = result;
+        state->error = error;
+        if (succeeded) {
+            for(auto &fn : state->successCallbacks) {
+                fn(result);
+            }
+        }
+        else {
+            for(auto &fn : state->errorCallbacks) {
+                fn(error);
+            }
+        }
+        state->successCallbacks.clear();
+        state->errorCallbacks.clear();
+    }
+
+private:
+    std::shared_ptr<State> state;
+};
+
+} // namespace particle
+
+using particle::Future;
+
+class PublishFlags {
+public:
+    constexpr PublishFlags() : value_(0) {}
+    explicit constexpr PublishFlags(uint8_t value) : value_(value) {}
+
+    constexpr uint8_t value() const { return value_; }
+
+    constexpr PublishFlags operator|(PublishFlags other) const { return PublishFlags(value_ | other.value_); }
+    constexpr PublishFlags operator&(PublishFlags other) const { return PublishFlags(value_ & other.value_); }
+    PublishFlags &operator|=(PublishFlags other) { value_ |= other.value_; return *this; }
+    constexpr bool operator==(PublishFlags other) const { return value_ == other.value_; }
+    constexpr bool operator!=(PublishFlags other) const { return value_ != other.value_; }
+    explicit constexpr operator bool() const { return value_ != 0; }
+
+private:
+    uint8_t value_;
+};
+
+const PublishFlags PUBLIC(0x00);
+const PublishFlags PRIVATE(0x01);
+const PublishFlags NO_ACK(0x02);
+const PublishFlags WITH_ACK(0x08);
+
+class CloudDisconnectOptions {
+public:
+    CloudDisconnectOptions &graceful(bool enabled) { graceful_ = enabled; return *this; }
+    bool graceful() const { return graceful_; }
+    CloudDisconnectOptions &timeout(system_tick_t timeout) { timeout_ = timeout; return *this; }
+    system_tick_t timeout() const { return timeout_; }
+    CloudDisconnectOptions &clearSession(bool enabled) { return *this; }
+
+private:
+    bool graceful_ = false;
+    system_tick_t timeout_ = 0;
+};
+
+class CloudClass {
+public:
+    void connect();
+    void disconnect(const CloudDisconnectOptions &options = CloudDisconnectOptions());
+    bool connected();
+    bool connecting();
+    bool disconnected() { return !connected(); }
+    void process() {}
+    void syncTime() {}
+    system_tick_t timeSyncedLast();
+    int maxEventDataSize() { return (int)particle::protocol::MAX_EVENT_DATA_LENGTH; }
+
+    Future<bool> publish(const char *eventName, const char *eventData, PublishFlags flags1 = PublishFlags(), PublishFlags flags2 = PublishFlags());
+    Future<bool> publish(const char *eventName, const char *eventData, int ttl, PublishFlags flags1, PublishFlags flags2 = PublishFlags()) {
+        return publish(eventName, eventData, flags1, flags2);
+    }
+    Future<bool> publish(const char *eventName, PublishFlags flags1 = PublishFlags(), PublishFlags flags2 = PublishFlags()) {
+        return publish(eventName, nullptr, flags1, flags2);
+    }
+    Future<bool> publish(const String &eventName, const String &eventData, PublishFlags flags1 = PublishFlags(), PublishFlags flags2 = PublishFlags()) {
+        return publish(eventName.c_str(), eventData.c_str(), flags1, flags2);
+    }
+
+    // Cloud variables and functions are registered but there is nothing to call them
+    template <typename T>
+    bool variable(const char *name, const T &value) { return true; }
+    template <typename T>
+    bool variable(const char *name, T (*fn)()) { return true; }
+    bool function(const char *name, int (*fn)(String)) { return true; }
+    bool function(const char *name, std::function<int(String)> fn) { return true; }
+};
+extern CloudClass Particle;
+
+//
+// Network
+//
+typedef enum {
+    NET_ACCESS_TECHNOLOGY_UNKNOWN = 0,
+    NET_ACCESS_TECHNOLOGY_NONE = 1,
+    NET_ACCESS_TECHNOLOGY_WIFI = 2,
+    NET_ACCESS_TECHNOLOGY_GSM = 3,
+    NET_ACCESS_TECHNOLOGY_UMTS = 4,
+    NET_ACCESS_TECHNOLOGY_CDMA = 5,
+    NET_ACCESS_TECHNOLOGY_LTE = 6,
+    NET_ACCESS_TECHNOLOGY_IEEE802154 = 7,
+    NET_ACCESS_TECHNOLOGY_LTE_CAT_M1 = 8,
+    NET_ACCESS_TECHNOLOGY_LTE_CAT_NB1 = 9
+} hal_net_access_tech_t;
+
+class CellularSignal {
+public:
+    CellularSignal() {}
+    CellularSignal(hal_net_access_tech_t rat, float strength, float quality) : rat_(rat), strength_(strength), quality_(quality) {}
+
+    hal_net_access_tech_t getAccessTechnology() const { return rat_; }
+    float getStrength() const { return strength_; }
+    float getQuality() const { return quality_; }
+    float getStrengthValue() const { return -140.0f + strength_ * 0.96f; }   // RSRP, dBm
+    float getQualityValue() const { return -19.5f + quality_ * 0.165f; }     // RSRQ, dB
+
+private:
+    hal_net_access_tech_t rat_ = NET_ACCESS_TECHNOLOGY_NONE;
+    float strength_ = -1.0f;
+    float quality_ = -1.0f;
+};
+
+typedef int network_interface_t;
+const network_interface_t NETWORK_INTERFACE_ALL = 0;
+const network_interface_t NETWORK_INTERFACE_CELLULAR = 2;
+
+class NetworkClass {
+public:
+    virtual ~NetworkClass() {}
+    virtual void on() = 0;
+    virtual void off() = 0;
+    virtual void connect() = 0;
+    virtual void disconnect() = 0;
+    virtual bool connecting() = 0;
+    virtual bool ready() = 0;
+    virtual bool isOn() = 0;
+    virtual bool isOff() = 0;
+    virtual bool listening() { return false; }
+};
+
+class CellularClass : public NetworkClass {
+public:
+    virtual void on() override;
+    virtual void off() override;
+    virtual void connect() override;
+    virtual void disconnect() override;
+    virtual bool connecting() override;
+    virtual bool ready() override;
+    virtual bool isOn() override;
+    virtual bool isOff() override;
+    bool connected() { return ready(); }
+
+    CellularSignal RSSI();
+};
+extern CellularClass Cellular;
+
+//
+// System
+//
+typedef uint64_t system_event_t;
+typedef void (system_event_handler_t)(system_event_t event, int param);
+
+enum SystemEvents : system_event_t {
+    setup_begin = 0x0001,
+    setup_update = 0x0002,
+    setup_end = 0x0004,
+    network_credentials = 0x0008,
+    network_status = 0x0010,
+    cloud_status = 0x0020,
+    button_status = 0x0040,
+    firmware_update = 0x0080,
+    firmware_update_pending = 0x0100,
+    reset_pending = 0x0200,
+    reset = 0x0400,
+    button_click = 0x0800,
+    button_final_click = 0x1000,
+    time_changed = 0x2000,
+    low_battery = 0x4000,
+    battery_state = 0x8000,
+    power_source = 0x10000,
+    out_of_memory = 0x20000,
+    ble_prov_mode = 0x40000,
+    all_events = 0xffffffffffffffffull
+};
+
+enum SystemEventsParam {
+    firmware_update_failed = -1,
+    firmware_update_begin = 0,
+    firmware_update_complete = 1,
+    firmware_update_progress = 2,
+
+    cloud_status_disconnected = 0,
+    cloud_status_connecting = 1,
+    cloud_status_handshake = 2,
+    cloud_status_session_resume = 3,
+    cloud_status_connected = 8,
+    cloud_status_disconnecting = 9,
+
+    network_status_off = 0,
+    network_status_connected = 8
+};
+
+typedef enum {
+    BATTERY_STATE_UNKNOWN = 0,
+    BATTERY_STATE_NOT_CHARGING = 1,
+    BATTERY_STATE_CHARGING = 2,
+    BATTERY_STATE_CHARGED = 3,
+    BATTERY_STATE_DISCHARGING = 4,
+    BATTERY_STATE_FAULT = 5,
+    BATTERY_STATE_DISCONNECTED = 6
+} battery_state_t;
+
+enum class SystemPowerFeature : uint32_t {
+    NONE = 0,
+    PMIC_DETECTION = 1,
+    USE_VIN_SETTINGS_WITH_USB_HOST = 2,
+    DISABLE = 4
+};
+
+class SystemPowerConfiguration {
+public:
+    SystemPowerConfiguration &powerSourceMaxCurrent(uint16_t current) { return *this; }
+    SystemPowerConfiguration &powerSourceMinVoltage(uint16_t voltage) { return *this; }
+    SystemPowerConfiguration &batteryChargeCurrent(uint16_t current) { return *this; }
+    SystemPowerConfiguration &batteryChargeVoltage(uint16_t voltage) { return *this; }
+    SystemPowerConfiguration &feature(SystemPowerFeature feature) { return *this; }
+};
+
+enum class SystemSleepMode : uint8_t {
+    NONE = 0,
+    STOP = 1,
+    ULTRA_LOW_POWER = 2,
+    HIBERNATE = 3
+};
+
+enum class SystemSleepWakeupReason : uint16_t {
+    UNKNOWN = 0,
+    BY_GPIO = 1,
+    BY_ADC = 2,
+    BY_DAC = 3,
+    BY_RTC = 4,
+    BY_LPCOMP = 5,
+    BY_USART = 6,
+    BY_CAN = 7,
+    BY_BLE = 8,
+    BY_NFC = 9,
+    BY_NETWORK = 10
+};
+
+enum class SystemSleepNetworkFlag : uint8_t {
+    NONE = 0,
+    INACTIVE_STANDBY = 1
+};
+
+enum class SystemSleepFlag : uint32_t {
+    NONE = 0,
+    WAIT_CLOUD = 1
+};
+
+typedef enum InterruptMode {
+    CHANGE,
+    RISING,
+    FALLING
+} InterruptMode;
+
+class SystemSleepConfiguration {
+public:
+    SystemSleepConfiguration &mode(SystemSleepMode mode) { mode_ = mode; return *this; }
+    SystemSleepConfiguration &duration(system_tick_t ms) { durationMs_ = ms; return *this; }
+    SystemSleepConfiguration &duration(std::chrono::milliseconds ms) { durationMs_ = (system_tick_t)ms.count(); return *this; }
+    SystemSleepConfiguration &gpio(pin_t pin, InterruptMode mode) { return *this; }
+    SystemSleepConfiguration &network(network_interface_t netif, SystemSleepNetworkFlag flag = SystemSleepNetworkFlag::NONE) {
+        if (netif == NETWORK_INTERFACE_CELLULAR && flag != SystemSleepNetworkFlag::INACTIVE_STANDBY) {
+            cellularWake_ = true;
+        }
+        return *this;
+    }
+    SystemSleepConfiguration &flag(SystemSleepFlag flag) { return *this; }
+    SystemSleepConfiguration &ble() { return *this; }
+    SystemSleepConfiguration &analog(pin_t pin, uint16_t voltage, int trig) { return *this; }
+
+    SystemSleepMode sleepMode() const { return mode_; }
+    system_tick_t durationMs() const { return durationMs_; }
+    bool cellularWake() const { return cellularWake_; }
+
+private:
+    SystemSleepMode mode_ = SystemSleepMode::NONE;
+    system_tick_t durationMs_ = 0;
+    bool cellularWake_ = false;
+};
+
+class SystemSleepResult {
+public:
+    SystemSleepResult() {}
+    explicit SystemSleepResult(SystemSleepWakeupReason reason) : reason_(reason) {}
+
+    SystemSleepWakeupReason wakeupReason() const { return reason_; }
+    pin_t wakeupPin() const { return PIN_INVALID; }
+    int error() const { return 0; }
+
+private:
+    SystemSleepWakeupReason reason_ = SystemSleepWakeupReason::UNKNOWN;
+};
+
+class SystemClass {
+public:
+    uint64_t millis();
+    unsigned uptime() { return (unsigned)(millis() / 1000); }
+    int resetReason();
+    bool on(system_event_t events, void (*handler)(system_event_t, int));
+    bool on(system_event_t events, void (*handler)(system_event_t, int, void *)) { return true; }
+    int enableFeature(int feature) { return 0; }
+    float batteryCharge();
+    int batteryState();
+    int setPowerConfiguration(const SystemPowerConfiguration &conf) { return 0; }
+    SystemSleepResult sleep(const SystemSleepConfiguration &config);
+    void reset();
+    uint32_t freeMemory() { return 80 * 1024; }
+};
+extern SystemClass System;
+
+class FuelGauge {
+public:
+    FuelGauge(bool lock = false) {}
+    float getSoC();
+    float getNormalizedSoC() { return getSoC(); }
+    float getVCell();
+    int quickStart();
+    int sleep() { return 0; }
+    int wakeup() { return 0; }
+};
+
+class PMIC {
+public:
+    PMIC(bool lock = false) {}
+    bool begin() { return true; }
+    bool enableCharging();
+    bool disableCharging();
+    bool isCharging() { return false; }
+};
+
+//
+// I2C
+//
+typedef enum {
+    HAL_I2C_CONFIG_VERSION_1 = 0
+} hal_i2c_config_version_t;
+
+typedef struct {
+    uint16_t size;
+    uint16_t version;
+    uint8_t *rx_buffer;
+    uint32_t rx_buffer_size;
+    uint8_t *tx_buffer;
+    uint32_t tx_buffer_size;
+} hal_i2c_config_t;
+
+// Defined by the application to enlarge the Wire buffers, as on Gen3 devices
+hal_i2c_config_t acquireWireBuffer() __attribute__((weak));
+
+class TwoWire : public Stream {
+public:
+    void begin();
+    void end() { enabled = false; }
+    bool isEnabled() const { return enabled; }
+    void setSpeed(uint32_t speed) {}
+    void reset() {}
+
+    void beginTransmission(uint8_t address);
+    void beginTransmission(int address) { beginTransmission((uint8_t)address); }
+    uint8_t endTransmission(uint8_t stop = true);
+    size_t requestFrom(uint8_t address, size_t quantity, uint8_t stop = true);
+
+    virtual size_t write(uint8_t data) override;
+    virtual size_t write(const uint8_t *data, size_t quantity) override;
+    inline size_t write(unsigned long n) { return write((uint8_t)n); }
+    inline size_t write(long n) { return write((uint8_t)n); }
+    inline size_t write(unsigned int n) { return write((uint8_t)n); }
+    inline size_t write(int n) { return write((uint8_t)n); }
+    virtual int available() override { return (int)(rxLength - rxIndex); }
+    virtual int read() override { return (rxIndex < rxLength) ? rxBuffer[rxIndex++] : -1; }
+    virtual int peek() override { return (rxIndex < rxLength) ? rxBuffer[rxIndex] : -1; }
+    virtual void flush() override {}
+    using Print::write;
+
+    bool lock() { return true; }
+    bool unlock() { return true; }
+    bool try_lock() { return true; }
+
+private:
+    bool enabled = false;
+    uint8_t txAddress = 0;
+    std::vector<uint8_t> txBuffer;
+    std::vector<uint8_t> rxBuffer;
+    size_t txCapacity = 32;
+    size_t rxCapacity = 32;
+    size_t rxIndex = 0;
+    size_t rxLength = 0;
+};
+extern TwoWire Wire;
+
+#endif /* __PARTICLE_H */
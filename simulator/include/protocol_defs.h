@@ -0,0 +1,23 @@
+/**
+ * @file protocol_defs.h
+ * @brief Cloud protocol limits for the host simulator (Device OS 2.x values)
+ */
+#ifndef __PROTOCOL_DEFS_H
+#define __PROTOCOL_DEFS_H
+
+#include <stddef.h>
+
+namespace particle {
+namespace protocol {
+
+const size_t MAX_EVENT_NAME_LENGTH = 64;
+const size_t MAX_EVENT_DATA_LENGTH = 622;
+const size_t MAX_FUNCTION_KEY_LENGTH = 64;
+const size_t MAX_VARIABLE_KEY_LENGTH = 64;
+const size_t MAX_FUNCTION_ARG_LENGTH = 622;
+const size_t MAX_VARIABLE_VALUE_LENGTH = 622;
+
+} // namespace protocol
+} // namespace particle
+
+#endif /* __PROTOCOL_DEFS_H */
@@ -0,0 +1,384 @@
+#include "Simulator.h"
+
+// Fake modem and cloud.
+//
+// The modem is off, powered but idle, searching for a network, or ready (registered with a data
+// connection). Particle.connect() powers the modem and searches; each attempt draws the time to get
+// a network from a lognormal distribution, and some attempts never get one. On a bad signal day
+// (--bad-day-rate) the whole distribution is slower and more attempts fail. The cloud handshake
+// follows, after which the system clock is synchronized. Publishes are acknowledged or fail after a
+// delay, and all publishes in flight fail when the cloud connection drops.
+
+namespace {
+
+enum class ModemState {
+    OFF,
+    IDLE,
+    SEARCHING,
+    READY,
+    POWERING_DOWN
+};
+
+ModemState modemState = ModemState::OFF;
+bool cloudWanted = false;
+bool cloudConnecting = false;
+bool cloudConnected = false;
+
+// Scheduled modem and cloud transitions check this so a later request cancels them
+uint32_t generation = 0;
+
+uint64_t connectStartMs = 0;
+bool searchGivenUp = false;
+system_tick_t timeSyncedMillis = 0;
+
+// Signal for the current network attempt, drawn with its connect time
+CellularSignal signal;
+
+// Last UTC day counted in metrics().badDays
+int64_t lastBadDay = -1;
+
+// Cloud rate limit, 1 per second with a burst of 4. Kept in milliseconds of credit so a publish exactly
+// on the 1 second boundary isn't counted over the limit by rounding.
+uint64_t rateCreditMs = 4000;
+uint64_t rateCreditTimeMs = 0;
+
+typedef std::shared_ptr<particle::Future<bool>::State> PublishState;
+std::vector<PublishState> inFlight;
+
+void completePublish(PublishState state, bool succeeded) {
+    auto it = std::find(inFlight.begin(), inFlight.end(), state);
+    if (it == inFlight.end()) {
+        // Already failed by a disconnect
+        return;
+    }
+    inFlight.erase(it);
+    if (succeeded) {
+        sim::metrics().publishes++;
+        particle::Future<bool>::complete(state, true, true);
+    }
+    else {
+        sim::metrics().publishFailures++;
+        particle::Future<bool>::complete(state, false, false, particle::Error::NETWORK);
+    }
+}
+
+void dropCloud() {
+    bool wasConnected = cloudConnected;
+    cloudConnected = false;
+    cloudConnecting = false;
+
+    std::vector<PublishState> failed;
+    failed.swap(inFlight);
+    for(auto &state : failed) {
+        sim::metrics().publishFailures++;
+        particle::Future<bool>::complete(state, false, false, particle::Error::NETWORK);
+    }
+    if (wasConnected) {
+        sim::systemEvent(cloud_status, cloud_status_disconnected);
+    }
+}
+
+void startHandshake() {
+    if (cloudConnecting || cloudConnected) {
+        return;
+    }
+    cloudConnecting = true;
+    sim::systemEvent(cloud_status, cloud_status_connecting);
+
+    uint32_t gen = generation;
+    sim::at(sim::now() + sim::config().handshakeMs, [gen]() {
+        if (gen != generation || !cloudConnecting) {
+            return;
+        }
+        cloudConnecting = false;
+        cloudConnected = true;
+        timeSyncedMillis = millis();
+        sim::syncTime();
+
+        sim::Metrics &metrics = sim::metrics();
+        uint32_t elapsedMs = (uint32_t)(sim::now() - connectStartMs);
+        metrics.cloudConnects++;
+        metrics.connectMs += elapsedMs;
+        if (elapsedMs > metrics.connectMaxMs) {
+            metrics.connectMaxMs = elapsedMs;
+        }
+        sim::systemEvent(cloud_status, cloud_status_connected);
+    });
+}
+
+/**
+ * @brief True if the current UTC day has a bad signal (--bad-day-rate)
+ *
+ * Drawn from its own generator seeded with the day, so turning bad days on doesn't change the
+ * other random draws and a day is bad or not no matter how many attempts are made.
+ */
+bool isBadDay() {
+    sim::Config &config = sim::config();
+    if (config.badDayRate <= 0) {
+        return false;
+    }
+    int64_t day = (int64_t)sim::trueTime() / 86400;
+    std::mt19937_64 dayRng(config.seed * 1000003 + (uint64_t)day);
+    bool bad = std::uniform_real_distribution<double>(0.0, 1.0)(dayRng) < config.badDayRate;
+    if (bad && day != lastBadDay) {
+        lastBadDay = day;
+        sim::metrics().badDays++;
+    }
+    return bad;
+}
+
+void startSearch() {
+    sim::Config &config = sim::config();
+
+    modemState = ModemState::SEARCHING;
+    connectStartMs = sim::now();
+    searchGivenUp = false;
+    sim::metrics().connectAttempts++;
+
+    // A long connect time goes with a weak signal. On a bad day both are shifted worse.
+    bool badDay = isBadDay();
+    double z = sim::normal() + (badDay ? config.badDayShift : 0);
+    bool fails = sim::uniform() < (badDay ? config.badDayFailRate : config.connectFailRate);
+    if (fails && z < 2.0) {
+        z = 2.0 + sim::uniform();
+    }
+    float strength = (float)std::min(100.0, std::max(0.0, 60.0 - 18.0 * z + 5.0 * sim::normal()));
+    float quality = (float)std::min(100.0, std::max(0.0, strength - 10.0 + 8.0 * sim::normal()));
+    signal = CellularSignal(NET_ACCESS_TECHNOLOGY_LTE_CAT_M1, strength, quality);
+
+    if (fails) {
+        // Keeps searching until disconnected or powered down
+        return;
+    }
+
+    uint64_t searchMs = (uint64_t)(config.connectMedianMs * exp(config.connectSigma * z));
+    uint32_t gen = generation;
+    sim::at(sim::now() + searchMs, [gen]() {
+        if (gen != generation || modemState != ModemState::SEARCHING) {
+            return;
+        }
+        modemState = ModemState::READY;
+        sim::systemEvent(network_status, network_status_connected);
+        if (cloudWanted) {
+            startHandshake();
+        }
+    });
+}
+
+/**
+ * @brief Counts a search for a network that is stopped before it gets one
+ */
+void giveUpSearch() {
+    if (modemState == ModemState::SEARCHING && !searchGivenUp) {
+        searchGivenUp = true;
+        sim::metrics().connectGiveUps++;
+        sim::metrics().connectGiveUpMs += sim::now() - connectStartMs;
+    }
+}
+
+bool takeRateToken() {
+    uint64_t nowMs = sim::now();
+    rateCreditMs = std::min((uint64_t)4000, rateCreditMs + (nowMs - rateCreditTimeMs));
+    rateCreditTimeMs = nowMs;
+    if (rateCreditMs >= 1000) {
+        rateCreditMs -= 1000;
+        return true;
+    }
+    return false;
+}
+
+} // namespace
+
+namespace sim {
+
+void cloudSleep(bool keepModem) {
+    if (keepModem && modemState == ModemState::READY) {
+        // Network standby keeps the registration and the cloud session
+        return;
+    }
+    giveUpSearch();
+    generation++;
+    cloudWanted = false;
+    dropCloud();
+    modemState = ModemState::OFF;
+}
+
+bool modemOn() {
+    return modemState != ModemState::OFF;
+}
+
+bool modemReady() {
+    return modemState == ModemState::READY;
+}
+
+} // namespace sim
+
+//
+// Particle
+//
+
+CloudClass Particle;
+
+void CloudClass::connect() {
+    cloudWanted = true;
+    switch(modemState) {
+        case ModemState::OFF:
+        case ModemState::IDLE:
+        case ModemState::POWERING_DOWN:
+            generation++;
+            startSearch();
+            break;
+
+        case ModemState::SEARCHING:
+            break;
+
+        case ModemState::READY:
+            if (!cloudConnected) {
+                connectStartMs = sim::now();
+                startHandshake();
+            }
+            break;
+    }
+}
+
+void CloudClass::disconnect(const CloudDisconnectOptions &options) {
+    cloudWanted = false;
+    if (cloudConnected) {
+        uint32_t gen = ++generation;
+        sim::systemEvent(cloud_status, cloud_status_disconnecting);
+        sim::at(sim::now() + sim::config().disconnectMs, [gen]() {
+            if (gen == generation) {
+                dropCloud();
+            }
+        });
+    }
+    else if (cloudConnecting) {
+        generation++;
+        dropCloud();
+    }
+}
+
+bool CloudClass::connected() {
+    return cloudConnected;
+}
+
+bool CloudClass::connecting() {
+    return cloudWanted && !cloudConnected;
+}
+
+system_tick_t CloudClass::timeSyncedLast() {
+    return timeSyncedMillis;
+}
+
+Future<bool> CloudClass::publish(const char *eventName, const char *eventData, PublishFlags flags1, PublishFlags flags2) {
+    sim::Config &config = sim::config();
+    sim::Metrics &metrics = sim::metrics();
+
+    auto state = std::make_shared<particle::Future<bool>::State>();
+    Future<bool> result(state);
+
+    if (!cloudConnected) {
+        metrics.publishFailures++;
+        particle::Future<bool>::complete(state, false, false, particle::Error::INVALID_STATE);
+        return result;
+    }
+
+    size_t dataLen = eventData ? strlen(eventData) : 0;
+    if (dataLen > particle::protocol::MAX_EVENT_DATA_LENGTH) {
+        metrics.publishOversize++;
+        metrics.publishFailures++;
+        particle::Future<bool>::complete(state, false, false, particle::Error::LIMIT_EXCEEDED);
+        return result;
+    }
+
+    metrics.publishBytes += strlen(eventName) + dataLen;
+    if (!takeRateToken()) {
+        metrics.publishRateLimited++;
+    }
+    if (config.printEvents) {
+        printf("%s %s %s\n", sim::formatTime(sim::trueTime()).c_str(), eventName, eventData ? eventData : "");
+    }
+
+    bool succeeded = sim::uniform() >= config.publishFailRate;
+    uint64_t ackMs = (uint64_t)(config.publishMs * (0.5 + sim::uniform()));
+    inFlight.push_back(state);
+    sim::at(sim::now() + ackMs, [state, succeeded]() {
+        completePublish(state, succeeded);
+    });
+
+    return result;
+}
+
+//
+// Cellular
+//
+
+CellularClass Cellular;
+
+void CellularClass::on() {
+    if (modemState == ModemState::OFF || modemState == ModemState::POWERING_DOWN) {
+        generation++;
+        modemState = ModemState::IDLE;
+    }
+}
+
+void CellularClass::off() {
+    if (modemState == ModemState::OFF || modemState == ModemState::POWERING_DOWN) {
+        return;
+    }
+    giveUpSearch();
+    uint32_t gen = ++generation;
+    cloudWanted = false;
+    dropCloud();
+    modemState = ModemState::POWERING_DOWN;
+    sim::at(sim::now() + sim::config().cellularOffMs, [gen]() {
+        if (gen == generation) {
+            modemState = ModemState::OFF;
+            sim::systemEvent(network_status, network_status_off);
+        }
+    });
+}
+
+void CellularClass::connect() {
+    if (modemState != ModemState::SEARCHING && modemState != ModemState::READY) {
+        generation++;
+        startSearch();
+    }
+}
+
+void CellularClass::disconnect() {
+    if (modemState != ModemState::SEARCHING && modemState != ModemState::READY) {
+        return;
+    }
+    giveUpSearch();
+    uint32_t gen = ++generation;
+    dropCloud();
+    sim::at(sim::now() + sim::config().cellularDisconnectMs, [gen]() {
+        if (gen == generation) {
+            modemState = ModemState::IDLE;
+        }
+    });
+}
+
+bool CellularClass::connecting() {
+    return modemState == ModemState::SEARCHING;
+}
+
+bool CellularClass::ready() {
+    return modemState == ModemState::READY;
+}
+
+bool CellularClass::isOn() {
+    return modemState != ModemState::OFF;
+}
+
+bool CellularClass::isOff() {
+    return modemState == ModemState::OFF;
+}
+
+CellularSignal CellularClass::RSSI() {
+    if (modemState == ModemState::SEARCHING || modemState == ModemState::READY) {
+        return signal;
+    }
+    return CellularSignal();
+}
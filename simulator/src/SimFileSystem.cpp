@@ -0,0 +1,128 @@
+#include "Simulator.h"
+
+#include <filesystem>
+#include <set>
+
+// POSIX file system for /usr.
+//
+// The device file system is the flash file system mounted at /. Application and library code only
+// uses /usr, so the POSIX calls are wrapped at link time (-Wl,--wrap=open etc., see the Makefile) and
+// paths under /usr are redirected to the host directory config().fsDir. Writes to files there are
+// counted, which is what matters for flash wear and time spent in the file system.
+
+namespace {
+
+std::set<int> usrFds;
+std::function<void(const char *call, const char *path)> hook;
+
+bool isUsrPath(const char *path) {
+    return path && strncmp(path, "/usr", 4) == 0 && (path[4] == 0 || path[4] == '/');
+}
+
+std::string mapPath(const char *path) {
+    if (isUsrPath(path)) {
+        return sim::config().fsDir + path;
+    }
+    return path;
+}
+
+} // namespace
+
+namespace sim {
+
+void resetFileSystem() {
+    std::filesystem::path dir(config().fsDir);
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir / "usr");
+}
+
+void fileSystemHook(std::function<void(const char *call, const char *path)> fn) {
+    hook = fn;
+}
+
+} // namespace sim
+
+extern "C" {
+
+int __real_open(const char *path, int flags, ...);
+int __real_close(int fd);
+ssize_t __real_write(int fd, const void *buf, size_t count);
+int __real_stat(const char *path, struct stat *statbuf);
+int __real_unlink(const char *path);
+int __real_rename(const char *oldPath, const char *newPath);
+int __real_mkdir(const char *path, mode_t mode);
+int __real_rmdir(const char *path);
+DIR *__real_opendir(const char *path);
+
+int __wrap_open(const char *path, int flags, ...) {
+    mode_t mode = 0;
+    if (flags & O_CREAT) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = (mode_t)va_arg(ap, int);
+        va_end(ap);
+    }
+    int fd = __real_open(mapPath(path).c_str(), flags, mode);
+    if (fd >= 0 && isUsrPath(path)) {
+        usrFds.insert(fd);
+        sim::metrics().fsOpens++;
+        if (hook) {
+            hook("open", path);
+        }
+    }
+    return fd;
+}
+
+int __wrap_close(int fd) {
+    usrFds.erase(fd);
+    return __real_close(fd);
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t count) {
+    ssize_t result = __real_write(fd, buf, count);
+    if (result > 0 && usrFds.count(fd)) {
+        sim::metrics().fsWrites++;
+        sim::metrics().fsBytesWritten += result;
+    }
+    return result;
+}
+
+int __wrap_stat(const char *path, struct stat *statbuf) {
+    return __real_stat(mapPath(path).c_str(), statbuf);
+}
+
+int __wrap_unlink(const char *path) {
+    int result = __real_unlink(mapPath(path).c_str());
+    if (result == 0 && isUsrPath(path)) {
+        sim::metrics().fsUnlinks++;
+        if (hook) {
+            hook("unlink", path);
+        }
+    }
+    return result;
+}
+
+int __wrap_rename(const char *oldPath, const char *newPath) {
+    int result = __real_rename(mapPath(oldPath).c_str(), mapPath(newPath).c_str());
+    if (result == 0 && isUsrPath(newPath)) {
+        sim::metrics().fsRenames++;
+        if (hook) {
+            hook("rename", newPath);
+        }
+    }
+    return result;
+}
+
+int __wrap_mkdir(const char *path, mode_t mode) {
+    return __real_mkdir(mapPath(path).c_str(), mode);
+}
+
+int __wrap_rmdir(const char *path) {
+    return __real_rmdir(mapPath(path).c_str());
+}
+
+DIR *__wrap_opendir(const char *path) {
+    return __real_opendir(mapPath(path).c_str());
+}
+
+} // extern "C"
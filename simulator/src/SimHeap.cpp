@@ -0,0 +1,91 @@
+#include "Simulator.h"
+
+#include <new>
+
+// Heap allocations and memory copies.
+//
+// malloc, calloc, realloc, memcpy, memmove and strcpy are wrapped at link time (see the Makefile) and
+// operator new and delete are replaced with versions that use malloc and free, so every allocation
+// made by the application, the libraries and the fake Device OS is counted in metrics(). Only calls
+// are counted: copies the compiler inlines (small copies of a known size) and allocations made inside
+// the host C and C++ libraries are not.
+
+extern "C" {
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__real_memcpy(void *dst, const void *src, size_t size);
+void *__real_memmove(void *dst, const void *src, size_t size);
+char *__real_strcpy(char *dst, const char *src);
+
+void *__wrap_malloc(size_t size) {
+    sim::metrics().heapAllocations++;
+    sim::metrics().heapBytes += size;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    sim::metrics().heapAllocations++;
+    sim::metrics().heapBytes += count * size;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    sim::metrics().heapAllocations++;
+    sim::metrics().heapBytes += size;
+    return __real_realloc(ptr, size);
+}
+
+void *__wrap_memcpy(void *dst, const void *src, size_t size) {
+    sim::metrics().bytesCopied += size;
+    return __real_memcpy(dst, src, size);
+}
+
+void *__wrap_memmove(void *dst, const void *src, size_t size) {
+    sim::metrics().bytesCopied += size;
+    return __real_memmove(dst, src, size);
+}
+
+char *__wrap_strcpy(char *dst, const char *src) {
+    sim::metrics().bytesCopied += strlen(src) + 1;
+    return __real_strcpy(dst, src);
+}
+
+} // extern "C"
+
+void *operator new(size_t size) {
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+    return malloc(size ? size : 1);
+}
+
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept {
+    free(ptr);
+}
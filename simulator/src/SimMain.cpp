@@ -0,0 +1,333 @@
+#include "Simulator.h"
+#include "SleepHelper.h"
+
+#include <getopt.h>
+
+// Command line, the setup()/loop() driver, the garden sensors and the report.
+
+void setup();
+void loop();
+
+namespace {
+
+sim::Config &simConfig = sim::config();
+sim::Metrics &simMetrics = sim::metrics();
+
+const double dayMs = 24.0 * 3600.0 * 1000.0;
+
+/**
+ * @brief Air temperature in C: 14 C at 3:00 AM rising to 30 C at 3:00 PM local time (EDT)
+ */
+double airTemperatureC() {
+    double hours = fmod((double)(sim::trueTime() - 4 * 3600) / 3600.0, 24.0);
+    return 22.0 - 8.0 * cos(2.0 * M_PI * (hours - 3.0) / 24.0);
+}
+
+/**
+ * @brief Soil temperature lags the air and swings less
+ */
+double soilTemperatureC() {
+    double hours = fmod((double)(sim::trueTime() - 4 * 3600) / 3600.0, 24.0);
+    return 21.0 - 3.0 * cos(2.0 * M_PI * (hours - 6.0) / 24.0);
+}
+
+/**
+ * @brief Soil moisture in percent: dries through the day and is reset by the watering at 6:00 AM
+ */
+double soilMoisturePct() {
+    double hours = fmod((double)(sim::trueTime() - 4 * 3600 - 6 * 3600) / 3600.0, 24.0);
+    return 55.0 - 1.0 * hours;
+}
+
+int32_t adcNoise() {
+    return (int32_t)lround(3.0 * sim::normal());
+}
+
+int32_t millivoltsToAdc(double mv) {
+    return (int32_t)lround(mv * 4095.0 / 3300.0);
+}
+
+/**
+ * @brief TMP36: 500 mV offset, 10 mV/C
+ */
+int32_t tmp36Adc() {
+    return millivoltsToAdc(500.0 + 10.0 * airTemperatureC()) + adcNoise();
+}
+
+/**
+ * @brief Murata NCP18XH103F03RB in a divider with 10K, thermistor next to ground, 2500 mV excitation
+ */
+int32_t thermistorAdc() {
+    const double c1 = 0.901747748E-03, c2 = 2.489190310E-04, c3 = 2.043213857E-07;
+    const double r = 10000.0, vex = 2500.0;
+
+    // Invert Steinhart-Hart for ln(Rt) with Newton's method
+    double inverseT = 1.0 / (soilTemperatureC() + 273.15);
+    double x = log(r);
+    for(int ii = 0; ii < 20; ii++) {
+        double f = c1 + c2 * x + c3 * x * x * x - inverseT;
+        x -= f / (c2 + 3.0 * c3 * x * x);
+    }
+    double rt = exp(x);
+    return millivoltsToAdc(vex * rt / (r + rt)) + adcNoise();
+}
+
+/**
+ * @brief Soil moisture sensor, 0 - 3 V for 0 - 100%
+ */
+int32_t soilMoistureAdc() {
+    return (int32_t)lround(soilMoisturePct() * 3722.0 / 100.0) + adcNoise();
+}
+
+void usage() {
+    printf("usage: sleephelper-sim [options]\n"
+        "  --seed=N                 random seed (default 1)\n"
+        "  --days=N                 days to simulate (default 14)\n"
+        "  --start-time=T           UTC time at power-up, seconds since 1970 (default 1657857600)\n"
+        "  --loop-ms=N              virtual time per loop() call (default 10)\n"
+        "  --log[=trace|info|warn]  print log messages (default info)\n"
+        "  --events                 print each publish\n"
+        "  --json                   print the report as JSON\n"
+        "  --fs-dir=DIR             host directory for /usr (default build/fs)\n"
+        "  --connect-median-ms=N    median time to get a network (default 20000)\n"
+        "  --connect-sigma=X        spread of the network connect time, sigma of ln (default 0.6)\n"
+        "  --connect-fail-rate=X    fraction of attempts that never get a network (default 0.02)\n"
+        "  --bad-day-rate=X         fraction of days with a bad signal (default 0)\n"
+        "  --bad-day-shift=X        how much worse connect times and signal are on a bad day, in sigma (default 1.5)\n"
+        "  --bad-day-fail-rate=X    fraction of attempts that never get a network on a bad day (default 0.15)\n"
+        "  --connect-timeout=M      fixed or adaptive: turn the ConnectTimeoutPolicy off or leave it on (default adaptive)\n"
+        "  --publish-ms=N           time for a publish to be acknowledged (default 400)\n"
+        "  --publish-fail-rate=X    fraction of publishes that fail (default 0.01)\n");
+}
+
+bool parseOptions(int argc, char *argv[]) {
+    enum {
+        OPT_SEED = 1000,
+        OPT_DAYS,
+        OPT_START_TIME,
+        OPT_LOOP_MS,
+        OPT_LOG,
+        OPT_EVENTS,
+        OPT_JSON,
+        OPT_FS_DIR,
+        OPT_CONNECT_MEDIAN_MS,
+        OPT_CONNECT_SIGMA,
+        OPT_CONNECT_FAIL_RATE,
+        OPT_BAD_DAY_RATE,
+        OPT_BAD_DAY_SHIFT,
+        OPT_BAD_DAY_FAIL_RATE,
+        OPT_CONNECT_TIMEOUT,
+        OPT_PUBLISH_MS,
+        OPT_PUBLISH_FAIL_RATE,
+        OPT_HELP
+    };
+    static const struct option options[] = {
+        { "seed", required_argument, nullptr, OPT_SEED },
+        { "days", required_argument, nullptr, OPT_DAYS },
+        { "start-time", required_argument, nullptr, OPT_START_TIME },
+        { "loop-ms", required_argument, nullptr, OPT_LOOP_MS },
+        { "log", optional_argument, nullptr, OPT_LOG },
+        { "events", no_argument, nullptr, OPT_EVENTS },
+        { "json", no_argument, nullptr, OPT_JSON },
+        { "fs-dir", required_argument, nullptr, OPT_FS_DIR },
+        { "connect-median-ms", required_argument, nullptr, OPT_CONNECT_MEDIAN_MS },
+        { "connect-sigma", required_argument, nullptr, OPT_CONNECT_SIGMA },
+        { "connect-fail-rate", required_argument, nullptr, OPT_CONNECT_FAIL_RATE },
+        { "bad-day-rate", required_argument, nullptr, OPT_BAD_DAY_RATE },
+        { "bad-day-shift", required_argument, nullptr, OPT_BAD_DAY_SHIFT },
+        { "bad-day-fail-rate", required_argument, nullptr, OPT_BAD_DAY_FAIL_RATE },
+        { "connect-timeout", required_argument, nullptr, OPT_CONNECT_TIMEOUT },
+        { "publish-ms", required_argument, nullptr, OPT_PUBLISH_MS },
+        { "publish-fail-rate", required_argument, nullptr, OPT_PUBLISH_FAIL_RATE },
+        { "help", no_argument, nullptr, OPT_HELP },
+        { nullptr, 0, nullptr, 0 }
+    };
+
+    int opt;
+    while((opt = getopt_long(argc, argv, "", options, nullptr)) != -1) {
+        switch(opt) {
+            case OPT_SEED:
+                simConfig.seed = strtoull(optarg, nullptr, 0);
+                break;
+            case OPT_DAYS:
+                simConfig.days = atof(optarg);
+                break;
+            case OPT_START_TIME:
+                simConfig.startTime = (time_t)strtoll(optarg, nullptr, 0);
+                break;
+            case OPT_LOOP_MS:
+                simConfig.loopMs = (system_tick_t)std::max(1, atoi(optarg));
+                break;
+            case OPT_LOG:
+                if (!optarg || !strcmp(optarg, "info")) {
+                    simConfig.logLevel = LOG_LEVEL_INFO;
+                }
+                else if (!strcmp(optarg, "trace")) {
+                    simConfig.logLevel = LOG_LEVEL_TRACE;
+                }
+                else if (!strcmp(optarg, "warn")) {
+                    simConfig.logLevel = LOG_LEVEL_WARN;
+                }
+                else {
+                    return false;
+                }
+                break;
+            case OPT_EVENTS:
+                simConfig.printEvents = true;
+                break;
+            case OPT_JSON:
+                simConfig.json = true;
+                break;
+            case OPT_FS_DIR:
+                simConfig.fsDir = optarg;
+                break;
+            case OPT_CONNECT_MEDIAN_MS:
+                simConfig.connectMedianMs = atof(optarg);
+                break;
+            case OPT_CONNECT_SIGMA:
+                simConfig.connectSigma = atof(optarg);
+                break;
+            case OPT_CONNECT_FAIL_RATE:
+                simConfig.connectFailRate = atof(optarg);
+                break;
+            case OPT_BAD_DAY_RATE:
+                simConfig.badDayRate = atof(optarg);
+                break;
+            case OPT_BAD_DAY_SHIFT:
+                simConfig.badDayShift = atof(optarg);
+                break;
+            case OPT_BAD_DAY_FAIL_RATE:
+                simConfig.badDayFailRate = atof(optarg);
+                break;
+            case OPT_CONNECT_TIMEOUT:
+                if (!strcmp(optarg, "fixed")) {
+                    simConfig.adaptiveConnectTimeout = false;
+                }
+                else if (!strcmp(optarg, "adaptive")) {
+                    simConfig.adaptiveConnectTimeout = true;
+                }
+                else {
+                    return false;
+                }
+                break;
+            case OPT_PUBLISH_MS:
+                simConfig.publishMs = (system_tick_t)atoi(optarg);
+                break;
+            case OPT_PUBLISH_FAIL_RATE:
+                simConfig.publishFailRate = atof(optarg);
+                break;
+            default:
+                return false;
+        }
+    }
+    return optind == argc;
+}
+
+void printReport(const char *resetReason) {
+    const sim::Metrics &m = simMetrics;
+    double days = (double)sim::now() / dayMs;
+    double perDay = (days > 0) ? 1.0 / days : 0;
+    double avgConnectSec = m.cloudConnects ? (double)m.connectMs / m.cloudConnects / 1000.0 : 0;
+
+    if (simConfig.json) {
+        printf("{\"seed\":%llu,\"days\":%.3f,\"reset\":%s%s%s,"
+            "\"awakeSecPerDay\":%.1f,\"sleepSecPerDay\":%.1f,\"modemOnSecPerDay\":%.1f,\"standbySecPerDay\":%.1f,\"sleeps\":%u,"
+            "\"connectAttempts\":%u,\"cloudConnects\":%u,\"connectAvgSec\":%.1f,\"connectMaxSec\":%.1f,"
+            "\"connectGiveUps\":%u,\"connectGiveUpSecPerDay\":%.1f,\"badDays\":%u,"
+            "\"publishes\":%u,\"publishFailures\":%u,\"publishBytes\":%llu,\"publishOversize\":%u,\"publishRateLimited\":%u,"
+            "\"fsWrites\":%llu,\"fsBytesWritten\":%llu,\"fsOpens\":%llu,\"fsUnlinks\":%llu,\"fsRenames\":%llu,"
+            "\"i2cTransactions\":%llu,\"i2cBytes\":%llu,\"framWrites\":%llu,\"framBytesWritten\":%llu,"
+            "\"mAhPerDay\":%.2f,\"batterySoC\":%.1f}\n",
+            (unsigned long long)simConfig.seed, days,
+            resetReason ? "\"" : "", resetReason ? resetReason : "null", resetReason ? "\"" : "",
+            m.awakeMs * perDay / 1000.0, m.sleepMs * perDay / 1000.0, m.modemOnMs * perDay / 1000.0, m.standbyMs * perDay / 1000.0, m.sleeps,
+            m.connectAttempts, m.cloudConnects, avgConnectSec, m.connectMaxMs / 1000.0,
+            m.connectGiveUps, m.connectGiveUpMs * perDay / 1000.0, m.badDays,
+            m.publishes, m.publishFailures, (unsigned long long)m.publishBytes, m.publishOversize, m.publishRateLimited,
+            (unsigned long long)m.fsWrites, (unsigned long long)m.fsBytesWritten, (unsigned long long)m.fsOpens,
+            (unsigned long long)m.fsUnlinks, (unsigned long long)m.fsRenames,
+            (unsigned long long)m.i2cTransactions, (unsigned long long)m.i2cBytes, (unsigned long long)m.framWrites, (unsigned long long)m.framBytesWritten,
+            m.chargeUah / 1000.0 * perDay, sim::batterySoC());
+        return;
+    }
+
+    printf("Simulated %.3f days from %s UTC, seed %llu\n", days, sim::formatTime(simConfig.startTime).c_str(), (unsigned long long)simConfig.seed);
+    if (resetReason) {
+        printf("  stopped by reset: %s\n", resetReason);
+    }
+    printf("Per day:\n");
+    printf("  awake            %10.1f sec\n", m.awakeMs * perDay / 1000.0);
+    printf("  asleep           %10.1f sec\n", m.sleepMs * perDay / 1000.0);
+    printf("  modem on awake   %10.1f sec\n", m.modemOnMs * perDay / 1000.0);
+    printf("  modem standby    %10.1f sec\n", m.standbyMs * perDay / 1000.0);
+    printf("  charge used      %10.2f mAh\n", m.chargeUah / 1000.0 * perDay);
+    printf("Sleep:\n");
+    printf("  sleeps           %10u\n", m.sleeps);
+    printf("Cloud:\n");
+    printf("  connect attempts %10u\n", m.connectAttempts);
+    printf("  connected        %10u\n", m.cloudConnects);
+    printf("  connect avg      %10.1f sec\n", avgConnectSec);
+    printf("  connect max      %10.1f sec\n", m.connectMaxMs / 1000.0);
+    printf("  given up         %10u\n", m.connectGiveUps);
+    printf("  given up per day %10.1f sec\n", m.connectGiveUpMs * perDay / 1000.0);
+    printf("  bad signal days  %10u\n", m.badDays);
+    printf("  publishes        %10u\n", m.publishes);
+    printf("  publish failures %10u\n", m.publishFailures);
+    printf("  publish bytes    %10llu\n", (unsigned long long)m.publishBytes);
+    printf("  oversize         %10u\n", m.publishOversize);
+    printf("  over rate limit  %10u\n", m.publishRateLimited);
+    printf("File system (/usr):\n");
+    printf("  writes           %10llu\n", (unsigned long long)m.fsWrites);
+    printf("  bytes written    %10llu\n", (unsigned long long)m.fsBytesWritten);
+    printf("  opens            %10llu\n", (unsigned long long)m.fsOpens);
+    printf("  unlinks          %10llu\n", (unsigned long long)m.fsUnlinks);
+    printf("  renames          %10llu\n", (unsigned long long)m.fsRenames);
+    printf("I2C:\n");
+    printf("  transactions     %10llu\n", (unsigned long long)m.i2cTransactions);
+    printf("  bus bytes        %10llu\n", (unsigned long long)m.i2cBytes);
+    printf("  FRAM writes      %10llu\n", (unsigned long long)m.framWrites);
+    printf("  FRAM bytes       %10llu\n", (unsigned long long)m.framBytesWritten);
+    printf("Battery:\n");
+    printf("  state of charge  %10.1f %%\n", sim::batterySoC());
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    if (!parseOptions(argc, argv)) {
+        usage();
+        return 2;
+    }
+
+    sim::begin();
+    sim::analogSource(A4, tmp36Adc);
+    sim::analogSource(A1, thermistorAdc);
+    sim::analogSource(A0, soilMoistureAdc);
+
+    const char *resetReason = nullptr;
+    uint64_t endMs = (uint64_t)(simConfig.days * dayMs);
+    try {
+        setup();
+        if (!simConfig.adaptiveConnectTimeout) {
+            // Keep the history, but only the withMaximumTimeToConnect() ceiling stops an attempt
+            SleepHelper::instance().withConnectTimeoutPolicy(SleepHelper::ConnectTimeoutPolicy().withEnabled(false));
+        }
+        sim::runThreads();
+
+        while(sim::now() < endMs) {
+            loop();
+            sim::runThreads();
+            sim::advance(simConfig.loopMs);
+            sim::checkWatchdog();
+        }
+    }
+    catch(const sim::ResetException &e) {
+        simMetrics.resets++;
+        resetReason = e.reason;
+    }
+
+    fflush(stdout);
+    printReport(resetReason);
+
+    return resetReason ? 1 : 0;
+}
@@ -0,0 +1,414 @@
+#include "Simulator.h"
+
+#include <queue>
+#include <ucontext.h>
+
+// Virtual clock, event queue and cooperative threads.
+//
+// Device OS threads are run as coroutines (ucontext) on the main host thread. A thread runs until
+// it blocks in os_queue_take or delay, then control returns to the scheduler, so a run is the same
+// every time for a given seed. The application thread (setup and loop) is the host main thread.
+
+namespace {
+
+struct Event {
+    uint64_t time;
+    uint64_t seq;
+    std::function<void()> fn;
+
+    bool operator>(const Event &other) const {
+        return (time != other.time) ? (time > other.time) : (seq > other.seq);
+    }
+};
+
+struct SimQueue {
+    size_t itemSize;
+    size_t itemCount;
+    std::deque<std::vector<uint8_t>> items;
+};
+
+struct SimThread {
+    ucontext_t context;
+    std::unique_ptr<char[]> stack;
+    std::function<void()> fn;
+    bool ready = true;
+    bool done = false;
+    SimQueue *waitQueue = nullptr;      //!< Queue being waited on, or nullptr
+    uint64_t wakeAt = UINT64_MAX;       //!< Timeout while blocked
+    bool timedOut = false;
+};
+
+// Coroutine stacks are much larger than on the device because host code (printf in particular) uses more
+const size_t threadStackSize = 256 * 1024;
+
+const uint64_t forever = UINT64_MAX;
+
+uint64_t clockMs = 0;
+uint64_t eventSeq = 0;
+std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+
+std::vector<SimThread *> threads;
+SimThread *currentThread = nullptr;
+ucontext_t schedulerContext;
+
+std::mt19937_64 randomGenerator;
+
+// Time passes while the clock moves. Everything that depends on the state of the device during an
+// interval (the charge used, awake and modem time) is accounted here before the state changes.
+void accountTime(uint64_t ms) {
+    if (ms == 0) {
+        return;
+    }
+    sim::Config &config = sim::config();
+    sim::Metrics &metrics = sim::metrics();
+
+    double ma;
+    if (sim::sleeping()) {
+        metrics.sleepMs += ms;
+        if (sim::modemOn()) {
+            metrics.standbyMs += ms;
+            ma = config.standbyMa;
+        }
+        else {
+            ma = config.sleepMa;
+        }
+    }
+    else {
+        metrics.awakeMs += ms;
+        ma = config.cpuMa;
+        if (sim::modemOn()) {
+            metrics.modemOnMs += ms;
+            ma += config.modemMa;
+        }
+    }
+    // mA * ms = uAh * 3.6
+    metrics.chargeUah += ma * (double)ms / 3600.0;
+}
+
+void setClock(uint64_t timeMs) {
+    if (timeMs > clockMs) {
+        accountTime(timeMs - clockMs);
+        clockMs = timeMs;
+    }
+}
+
+void threadEntry() {
+    currentThread->fn();
+    currentThread->done = true;
+    // uc_link returns to the scheduler
+}
+
+// Called on a thread to give up the CPU until woken by a queue or the timeout
+bool blockThread(SimQueue *queue, system_tick_t timeoutMs) {
+    SimThread *thread = currentThread;
+    thread->waitQueue = queue;
+    thread->wakeAt = (timeoutMs == CONCURRENT_WAIT_FOREVER) ? forever : clockMs + timeoutMs;
+    thread->timedOut = false;
+    thread->ready = false;
+
+    swapcontext(&thread->context, &schedulerContext);
+
+    return !thread->timedOut;
+}
+
+void wakeWaiters(SimQueue *queue) {
+    for(SimThread *thread : threads) {
+        if (thread->waitQueue == queue && !thread->done) {
+            thread->waitQueue = nullptr;
+            thread->wakeAt = forever;
+            thread->ready = true;
+        }
+    }
+}
+
+// Earliest time a blocked thread times out
+uint64_t nextThreadTimeout() {
+    uint64_t result = forever;
+    for(SimThread *thread : threads) {
+        if (!thread->done && !thread->ready && thread->wakeAt < result) {
+            result = thread->wakeAt;
+        }
+    }
+    return result;
+}
+
+void timeoutThreads() {
+    for(SimThread *thread : threads) {
+        if (!thread->done && !thread->ready && thread->wakeAt <= clockMs) {
+            thread->waitQueue = nullptr;
+            thread->wakeAt = forever;
+            thread->timedOut = true;
+            thread->ready = true;
+        }
+    }
+}
+
+} // namespace
+
+namespace sim {
+
+uint64_t now() {
+    return clockMs;
+}
+
+void at(uint64_t timeMs, std::function<void()> fn) {
+    events.push(Event{ std::max(timeMs, clockMs), eventSeq++, fn });
+}
+
+void advance(uint64_t ms, bool runReady) {
+    uint64_t target = clockMs + ms;
+
+    while(true) {
+        uint64_t next = nextThreadTimeout();
+        if (!events.empty() && events.top().time < next) {
+            next = events.top().time;
+        }
+        if (next > target) {
+            break;
+        }
+        setClock(next);
+
+        if (!events.empty() && events.top().time <= clockMs) {
+            Event event = events.top();
+            events.pop();
+            event.fn();
+        }
+        timeoutThreads();
+
+        if (runReady) {
+            runThreads();
+        }
+    }
+    setClock(target);
+    if (runReady) {
+        runThreads();
+    }
+}
+
+void runThreads() {
+    if (currentThread) {
+        // Threads only switch when they block
+        return;
+    }
+    bool ranThread;
+    do {
+        ranThread = false;
+        for(size_t ii = 0; ii < threads.size(); ii++) {
+            SimThread *thread = threads[ii];
+            if (thread->ready && !thread->done) {
+                thread->ready = false;
+                currentThread = thread;
+                swapcontext(&schedulerContext, &thread->context);
+                currentThread = nullptr;
+                ranThread = true;
+            }
+        }
+    } while(ranThread);
+}
+
+Config &config() {
+    static Config simConfig;
+    return simConfig;
+}
+
+Metrics &metrics() {
+    static Metrics simMetrics;
+    return simMetrics;
+}
+
+std::mt19937_64 &rng() {
+    return randomGenerator;
+}
+
+double uniform() {
+    return std::uniform_real_distribution<double>(0.0, 1.0)(randomGenerator);
+}
+
+double normal() {
+    return std::normal_distribution<double>(0.0, 1.0)(randomGenerator);
+}
+
+} // namespace sim
+
+//
+// Device OS timing
+//
+
+system_tick_t millis() {
+    // Code that busy waits on millis() without calling delay() would never see time pass, so after
+    // many calls at the same time move the clock forward by a millisecond. Events aren't run here
+    // because this may be called with locks held.
+    static uint64_t lastClock = 0;
+    static uint32_t sameCount = 0;
+    if (clockMs == lastClock) {
+        if (++sameCount >= 100000) {
+            setClock(clockMs + 1);
+            sameCount = 0;
+        }
+    }
+    else {
+        sameCount = 0;
+    }
+    lastClock = clockMs;
+    return (system_tick_t)clockMs;
+}
+
+unsigned long micros() {
+    return (unsigned long)(clockMs * 1000);
+}
+
+void delay(unsigned long ms) {
+    if (currentThread) {
+        blockThread(nullptr, (system_tick_t)ms);
+    }
+    else {
+        sim::advance(ms);
+    }
+}
+
+extern "C" uint32_t HAL_RNG_GetRandomNumber(void) {
+    return (uint32_t)randomGenerator();
+}
+
+//
+// Threads
+//
+
+Thread::Thread(const char *name, std::function<void()> function, os_thread_prio_t priority, size_t stackSize) {
+    SimThread *thread = new SimThread();
+    thread->fn = function;
+    thread->stack.reset(new char[threadStackSize]);
+
+    getcontext(&thread->context);
+    thread->context.uc_stack.ss_sp = thread->stack.get();
+    thread->context.uc_stack.ss_size = threadStackSize;
+    thread->context.uc_link = &schedulerContext;
+    makecontext(&thread->context, threadEntry, 0);
+
+    threads.push_back(thread);
+    handle = thread;
+}
+
+Thread::~Thread() {
+    dispose();
+}
+
+void Thread::dispose() {
+    if (handle) {
+        // A thread blocked in the middle of its function is simply never resumed
+        SimThread *thread = (SimThread *)handle;
+        thread->done = true;
+        handle = nullptr;
+    }
+}
+
+//
+// Mutexes. Threads only switch when blocked, so the locks are only checked for balance.
+//
+
+namespace {
+struct SimMutex {
+    int count = 0;
+};
+}
+
+int os_mutex_create(os_mutex_t *mutex) {
+    *mutex = new SimMutex();
+    return 0;
+}
+
+int os_mutex_destroy(os_mutex_t mutex) {
+    delete (SimMutex *)mutex;
+    return 0;
+}
+
+int os_mutex_lock(os_mutex_t mutex) {
+    ((SimMutex *)mutex)->count++;
+    return 0;
+}
+
+int os_mutex_trylock(os_mutex_t mutex) {
+    ((SimMutex *)mutex)->count++;
+    return 0;
+}
+
+int os_mutex_unlock(os_mutex_t mutex) {
+    ((SimMutex *)mutex)->count--;
+    return 0;
+}
+
+int os_mutex_recursive_create(os_mutex_recursive_t *mutex) {
+    return os_mutex_create(mutex);
+}
+
+int os_mutex_recursive_destroy(os_mutex_recursive_t mutex) {
+    return os_mutex_destroy(mutex);
+}
+
+int os_mutex_recursive_lock(os_mutex_recursive_t mutex) {
+    return os_mutex_lock(mutex);
+}
+
+int os_mutex_recursive_trylock(os_mutex_recursive_t mutex) {
+    return os_mutex_trylock(mutex);
+}
+
+int os_mutex_recursive_unlock(os_mutex_recursive_t mutex) {
+    return os_mutex_unlock(mutex);
+}
+
+//
+// Queues
+//
+
+int os_queue_create(os_queue_t *queue, size_t itemSize, size_t itemCount, void *reserved) {
+    SimQueue *q = new SimQueue();
+    q->itemSize = itemSize;
+    q->itemCount = itemCount;
+    *queue = q;
+    return 0;
+}
+
+int os_queue_destroy(os_queue_t queue, void *reserved) {
+    delete (SimQueue *)queue;
+    return 0;
+}
+
+int os_queue_put(os_queue_t queue, const void *item, system_tick_t delay, void *reserved) {
+    SimQueue *q = (SimQueue *)queue;
+    if (q->items.size() >= q->itemCount) {
+        return -1;
+    }
+    const uint8_t *p = (const uint8_t *)item;
+    q->items.push_back(std::vector<uint8_t>(p, p + q->itemSize));
+    wakeWaiters(q);
+    return 0;
+}
+
+int os_queue_take(os_queue_t queue, void *item, system_tick_t delay, void *reserved) {
+    SimQueue *q = (SimQueue *)queue;
+    uint64_t deadline = (delay == CONCURRENT_WAIT_FOREVER) ? forever : clockMs + delay;
+
+    while(q->items.empty()) {
+        if (clockMs >= deadline) {
+            if (currentThread) {
+                sim::metrics().threadQueueTakes++;
+                sim::metrics().threadQueueTimeouts++;
+            }
+            return -1;
+        }
+        if (currentThread) {
+            blockThread(q, (deadline == forever) ? CONCURRENT_WAIT_FOREVER : (system_tick_t)(deadline - clockMs));
+        }
+        else {
+            // The application thread waits by running the clock
+            sim::advance(1);
+        }
+    }
+    memcpy(item, q->items.front().data(), q->itemSize);
+    q->items.pop_front();
+    if (currentThread) {
+        sim::metrics().threadQueueTakes++;
+    }
+    return 0;
+}
@@ -0,0 +1,471 @@
+#include "Simulator.h"
+
+#include <map>
+
+#include "string_convert.h"
+
+// System, sleep, Time, the battery, GPIO and logging.
+
+namespace {
+
+bool isSleeping = false;
+
+// Device clock. Not valid at power-up until set from the cloud or the RTC.
+bool timeValid = false;
+int64_t timeOffset = 0;         //!< Device time minus seconds since power-up
+
+LogLevel handlerLevel = LOG_LEVEL_NONE;
+
+std::vector<std::pair<system_event_t, void (*)(system_event_t, int)>> eventHandlers;
+
+std::map<pin_t, uint8_t> digitalValues;
+std::map<pin_t, PinMode> pinModes;
+std::map<pin_t, std::function<int32_t()>> analogSources;
+
+} // namespace
+
+namespace sim {
+
+void begin() {
+    // The C library runs in UTC on the device; the AB1805 library relies on it for mktime
+    setenv("TZ", "UTC", 1);
+    tzset();
+
+    rng().seed(config().seed);
+    resetFileSystem();
+    attachCarrierDevices();
+}
+
+void syncTime() {
+    Time.setTime(trueTime());
+}
+
+void systemEvent(system_event_t event, int param) {
+    for(auto &handler : eventHandlers) {
+        if (handler.first & event) {
+            handler.second(event, param);
+        }
+    }
+}
+
+bool sleeping() {
+    return isSleeping;
+}
+
+void analogSource(pin_t pin, std::function<int32_t()> fn) {
+    analogSources[pin] = fn;
+}
+
+float batterySoC() {
+    Config &config = sim::config();
+    double mah = config.batteryMah * config.batteryStartSoC / 100.0 - metrics().chargeUah / 1000.0;
+    return (float)std::max(0.0, 100.0 * mah / config.batteryMah);
+}
+
+time_t trueTime() {
+    return config().startTime + (time_t)(now() / 1000);
+}
+
+std::string formatTime(time_t t) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char buf[32];
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+    return buf;
+}
+
+} // namespace sim
+
+//
+// System
+//
+
+SystemClass System;
+
+uint64_t SystemClass::millis() {
+    return sim::now();
+}
+
+int SystemClass::resetReason() {
+    return RESET_REASON_POWER_DOWN;
+}
+
+bool SystemClass::on(system_event_t events, void (*handler)(system_event_t, int)) {
+    eventHandlers.push_back(std::make_pair(events, handler));
+    return true;
+}
+
+float SystemClass::batteryCharge() {
+    return sim::batterySoC();
+}
+
+int SystemClass::batteryState() {
+    return BATTERY_STATE_DISCHARGING;
+}
+
+SystemSleepResult SystemClass::sleep(const SystemSleepConfiguration &config) {
+    sim::checkWatchdog();
+
+    if (config.sleepMode() == SystemSleepMode::HIBERNATE) {
+        // Wakes through reset, which the simulator can't continue from
+        reset();
+    }
+
+    // With a cellular network wake source the modem stays registered in standby
+    sim::cloudSleep(config.cellularWake());
+
+    sim::metrics().sleeps++;
+    isSleeping = true;
+    sim::advance(config.durationMs(), false);
+    isSleeping = false;
+
+    sim::checkWatchdog();
+
+    return SystemSleepResult(SystemSleepWakeupReason::BY_RTC);
+}
+
+void SystemClass::reset() {
+    sim::systemEvent(SystemEvents::reset, 0);
+    throw sim::ResetException{ "System.reset" };
+}
+
+//
+// Time
+//
+
+const char* TIME_FORMAT_DEFAULT = "asctime";
+const char* TIME_FORMAT_ISO8601_FULL = "%Y-%m-%dT%H:%M:%S%z";
+
+const char *TimeClass::format_spec = TIME_FORMAT_DEFAULT;
+
+static time_t timeZoneSec = 0;
+static time_t dstSec = 3600;
+static time_t dstCurrentSec = 0;
+
+static struct tm timeToTm(time_t t) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    return tm;
+}
+
+int TimeClass::hour() { return hour(now()); }
+int TimeClass::hour(time_t t) { return timeToTm(t + timeZoneSec + dstCurrentSec).tm_hour; }
+int TimeClass::hourFormat12() { return hourFormat12(now()); }
+int TimeClass::hourFormat12(time_t t) {
+    int h = hour(t) % 12;
+    return h ? h : 12;
+}
+uint8_t TimeClass::isAM() { return !isPM(now()); }
+uint8_t TimeClass::isAM(time_t t) { return !isPM(t); }
+uint8_t TimeClass::isPM() { return isPM(now()); }
+uint8_t TimeClass::isPM(time_t t) { return hour(t) >= 12; }
+int TimeClass::minute() { return minute(now()); }
+int TimeClass::minute(time_t t) { return timeToTm(t + timeZoneSec + dstCurrentSec).tm_min; }
+int TimeClass::second() { return second(now()); }
+int TimeClass::second(time_t t) { return timeToTm(t + timeZoneSec + dstCurrentSec).tm_sec; }
+int TimeClass::day() { return day(now()); }
+int TimeClass::day(time_t t) { return timeToTm(t + timeZoneSec + dstCurrentSec).tm_mday; }
+int TimeClass::weekday() { return weekday(now()); }
+int TimeClass::weekday(time_t t) { return timeToTm(t + timeZoneSec + dstCurrentSec).tm_wday + 1; }
+int TimeClass::month() { return month(now()); }
+int TimeClass::month(time_t t) { return timeToTm(t + timeZoneSec + dstCurrentSec).tm_mon + 1; }
+int TimeClass::year() { return year(now()); }
+int TimeClass::year(time_t t) { return timeToTm(t + timeZoneSec + dstCurrentSec).tm_year + 1900; }
+
+time32_t TimeClass::now() {
+    return (time32_t)(timeOffset + (int64_t)(sim::now() / 1000));
+}
+
+time32_t TimeClass::local() {
+    return now() + timeZoneSec + dstCurrentSec;
+}
+
+void TimeClass::zone(float GMT_Offset) {
+    if (GMT_Offset >= -12 && GMT_Offset <= 14) {
+        timeZoneSec = (time_t)(GMT_Offset * 3600);
+    }
+}
+
+float TimeClass::zone() {
+    return timeZoneSec / 3600.0f;
+}
+
+void TimeClass::setTime(time_t t) {
+    timeOffset = (int64_t)t - (int64_t)(sim::now() / 1000);
+    timeValid = true;
+}
+
+bool TimeClass::isValid() {
+    return timeValid;
+}
+
+TimeClass::operator bool() const {
+    return isValid();
+}
+
+float TimeClass::getDSTOffset() {
+    return dstSec / 3600.0f;
+}
+
+void TimeClass::setDSTOffset(float offset) {
+    if (offset >= 0 && offset <= 2) {
+        dstSec = (time_t)(offset * 3600);
+    }
+}
+
+void TimeClass::beginDST() {
+    dstCurrentSec = dstSec;
+}
+
+void TimeClass::endDST() {
+    dstCurrentSec = 0;
+}
+
+uint8_t TimeClass::isDST() {
+    return dstCurrentSec != 0;
+}
+
+String TimeClass::timeStr(time_t t) {
+    struct tm tm = timeToTm(t + timeZoneSec + dstCurrentSec);
+    char buf[32];
+    asctime_r(&tm, buf);
+    buf[strlen(buf) - 1] = 0;
+    return String(buf);
+}
+
+String TimeClass::format(time_t t, const char *spec) {
+    if (!spec) {
+        spec = format_spec;
+    }
+    if (!spec || !strcmp(spec, TIME_FORMAT_DEFAULT)) {
+        return timeStr(t);
+    }
+    struct tm tm = timeToTm(t + timeZoneSec + dstCurrentSec);
+    return timeFormatImpl(&tm, spec, (int)(timeZoneSec + dstCurrentSec));
+}
+
+String TimeClass::timeFormatImpl(tm *calendar_time, const char *format, int time_zone) {
+    // Replace %z with the time zone, as Device OS does
+    char zoneStr[16];
+    if (!time_zone) {
+        strcpy(zoneStr, "Z");
+    }
+    else {
+        snprintf(zoneStr, sizeof(zoneStr), "%+03d:%02u", time_zone / 3600, abs(time_zone / 60) % 60);
+    }
+    std::string spec(format);
+    for(size_t pos = spec.find("%z"); pos != std::string::npos; pos = spec.find("%z", pos)) {
+        spec.replace(pos, 2, zoneStr);
+    }
+    char buf[64] = {};
+    strftime(buf, sizeof(buf), spec.c_str(), calendar_time);
+    return String(buf);
+}
+
+TimeClass Time;
+
+// newlib ignores tm_isdst when the time zone has no DST, as on the device (UTC). glibc doesn't, and
+// AB1805::getRtcAsTime passes a struct tm with tm_isdst uninitialized.
+extern "C" time_t __wrap_mktime(struct tm *tm) {
+    tm->tm_isdst = 0;
+    return timegm(tm);
+}
+
+//
+// Battery
+//
+
+float FuelGauge::getSoC() {
+    return sim::batterySoC();
+}
+
+float FuelGauge::getVCell() {
+    // Roughly linear over the useful range of a LiPo
+    return 3.5f + 0.7f * sim::batterySoC() / 100.0f;
+}
+
+int FuelGauge::quickStart() {
+    return 0;
+}
+
+bool PMIC::enableCharging() {
+    return true;
+}
+
+bool PMIC::disableCharging() {
+    return true;
+}
+
+//
+// GPIO
+//
+
+void pinMode(pin_t pin, PinMode mode) {
+    pinModes[pin] = mode;
+}
+
+void digitalWrite(pin_t pin, uint8_t value) {
+    digitalValues[pin] = value ? HIGH : LOW;
+}
+
+int32_t digitalRead(pin_t pin) {
+    if (pin == D8) {
+        // AB1805 FOUT/nIRQ, high when the chip is ready and there is no interrupt
+        return HIGH;
+    }
+    auto mode = pinModes.find(pin);
+    if (mode != pinModes.end() && mode->second == OUTPUT) {
+        return digitalValues[pin];
+    }
+    return (mode != pinModes.end() && mode->second == INPUT_PULLUP) ? HIGH : LOW;
+}
+
+int32_t analogRead(pin_t pin) {
+    auto it = analogSources.find(pin);
+    if (it == analogSources.end()) {
+        return 0;
+    }
+    return std::min(4095, std::max(0, (int)it->second()));
+}
+
+//
+// Logging
+//
+
+const Logger Log("app");
+USBSerial Serial;
+
+LogHandler::LogHandler(LogLevel level) {
+    handlerLevel = level;
+}
+
+bool Logger::isLevelEnabled(LogLevel level) const {
+    return level >= handlerLevel && level >= sim::config().logLevel;
+}
+
+void Logger::vlog(LogLevel level, const char *fmt, va_list ap) const {
+    if (!isLevelEnabled(level)) {
+        return;
+    }
+    const char *levelStr;
+    switch(level) {
+        case LOG_LEVEL_TRACE:
+            levelStr = "TRACE";
+            break;
+        case LOG_LEVEL_INFO:
+            levelStr = "INFO";
+            break;
+        case LOG_LEVEL_WARN:
+            levelStr = "WARN";
+            break;
+        case LOG_LEVEL_ERROR:
+            levelStr = "ERROR";
+            break;
+        default:
+            levelStr = "PANIC";
+            break;
+    }
+    char buf[1024];
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    printf("%010lu %s [%s] %s: %s\n", (unsigned long)millis(), sim::formatTime(sim::trueTime()).c_str(), name_, levelStr, buf);
+}
+
+void Logger::trace(const char *fmt, ...) const {
+    va_list ap;
+    va_start(ap, fmt);
+    vlog(LOG_LEVEL_TRACE, fmt, ap);
+    va_end(ap);
+}
+
+void Logger::info(const char *fmt, ...) const {
+    va_list ap;
+    va_start(ap, fmt);
+    vlog(LOG_LEVEL_INFO, fmt, ap);
+    va_end(ap);
+}
+
+void Logger::warn(const char *fmt, ...) const {
+    va_list ap;
+    va_start(ap, fmt);
+    vlog(LOG_LEVEL_WARN, fmt, ap);
+    va_end(ap);
+}
+
+void Logger::error(const char *fmt, ...) const {
+    va_list ap;
+    va_start(ap, fmt);
+    vlog(LOG_LEVEL_ERROR, fmt, ap);
+    va_end(ap);
+}
+
+void Logger::log(LogLevel level, const char *fmt, ...) const {
+    va_list ap;
+    va_start(ap, fmt);
+    vlog(level, fmt, ap);
+    va_end(ap);
+}
+
+void Logger::write(LogLevel level, const char *data, size_t size) const {
+    if (isLevelEnabled(level)) {
+        fwrite(data, 1, size, stdout);
+    }
+}
+
+void Logger::dump(const void *data, size_t size) const {
+    if (isLevelEnabled(LOG_LEVEL_INFO)) {
+        for(size_t ii = 0; ii < size; ii++) {
+            printf("%02x", ((const uint8_t *)data)[ii]);
+        }
+    }
+}
+
+size_t USBSerial::write(uint8_t c) {
+    if (sim::config().logLevel != LOG_LEVEL_NONE) {
+        putchar(c);
+    }
+    return 1;
+}
+
+//
+// Number conversion used by String (declared in UnitTestLib string_convert.h)
+//
+
+extern "C" char *ultoa(unsigned long value, char *buffer, int radix, char pad) {
+    char digits[sizeof(unsigned long) * 8 + 1];
+    int len = 0;
+    do {
+        int digit = (int)(value % radix);
+        digits[len++] = (char)((digit < 10) ? ('0' + digit) : ('a' + digit - 10));
+        value /= radix;
+    } while(value);
+
+    char *p = buffer;
+    for(int ii = len; ii < pad; ii++) {
+        *p++ = '0';
+    }
+    while(len > 0) {
+        *p++ = digits[--len];
+    }
+    *p = 0;
+    return buffer;
+}
+
+extern "C" char *ltoa(long value, char *buffer, int radix) {
+    if (value < 0 && radix == 10) {
+        buffer[0] = '-';
+        ultoa((unsigned long)(-(value + 1)) + 1, &buffer[1], radix, 1);
+        return buffer;
+    }
+    return ultoa((unsigned long)value, buffer, radix, 1);
+}
+
+extern "C" char *utoa(unsigned value, char *buffer, int radix) {
+    return ultoa(value, buffer, radix, 1);
+}
+
+extern "C" char *itoa(int value, char *buffer, int radix) {
+    if (radix != 10) {
+        return ultoa((unsigned)value, buffer, radix, 1);
+    }
+    return ltoa(value, buffer, radix);
+}
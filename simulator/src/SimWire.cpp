@@ -0,0 +1,253 @@
+#include "Simulator.h"
+
+#include <map>
+
+// I2C bus and the devices on the SleepHelper-Garden carrier.
+
+namespace {
+
+std::map<uint8_t, sim::I2CDevice *> devices;
+
+/**
+ * @brief MB85RC64 8 Kbyte FRAM. Each transaction starts with a 2-byte address; reads continue
+ * from the last address written.
+ */
+class FramDevice : public sim::I2CDevice {
+public:
+    static const size_t SIZE = 8 * 1024;
+
+    FramDevice() : memory(SIZE, 0) {}
+
+    virtual void write(const uint8_t *data, size_t size) override {
+        if (size < 2) {
+            return;
+        }
+        addr = (((size_t)data[0] << 8) | data[1]) % SIZE;
+        if (size > 2) {
+            sim::metrics().framWrites++;
+            sim::metrics().framBytesWritten += size - 2;
+            for(size_t ii = 2; ii < size; ii++) {
+                memory[addr] = data[ii];
+                addr = (addr + 1) % SIZE;
+            }
+        }
+    }
+
+    virtual void read(uint8_t *data, size_t size) override {
+        for(size_t ii = 0; ii < size; ii++) {
+            data[ii] = memory[addr];
+            addr = (addr + 1) % SIZE;
+        }
+    }
+
+private:
+    std::vector<uint8_t> memory;
+    size_t addr = 0;
+};
+
+/**
+ * @brief AB1805 RTC and watchdog, as registers
+ *
+ * The time registers are computed from the virtual clock, offset by whatever was last written
+ * while WRTC was set. The watchdog counts down from the last write to the watchdog register.
+ */
+class AB1805Device : public sim::I2CDevice {
+public:
+    static const uint8_t REG_HUNDREDTH = 0x00;
+    static const uint8_t REG_WEEKDAY = 0x07;
+    static const uint8_t REG_CTRL_1 = 0x10;
+    static const uint8_t REG_CTRL_1_WRTC = 0x01;
+    static const uint8_t REG_WDT = 0x1b;
+    static const uint8_t REG_SLEEP_CTRL = 0x17;
+    static const uint8_t REG_SLEEP_CTRL_SLP = 0x80;
+
+    AB1805Device() {
+        memset(regs, 0, sizeof(regs));
+        regs[0x28] = 0x18;      // ID0, AB18xx
+        regs[0x29] = 0x05;      // ID1, ABxx05
+        regs[REG_CTRL_1] = 0x13; // WRTC is set at power-up, so the RTC has not been set
+        regs[0x11] = 0x3c;      // CTRL_2
+        regs[0x12] = 0xe0;      // INT_MASK
+        regs[0x13] = 0x26;      // SQW
+    }
+
+    virtual void write(const uint8_t *data, size_t size) override {
+        if (size < 1) {
+            return;
+        }
+        reg = data[0];
+        for(size_t ii = 1; ii < size; ii++, reg++) {
+            writeRegister(reg, data[ii]);
+        }
+        if (size > 1 && timeWritten) {
+            // The whole time is written in one transaction starting at REG_HUNDREDTH
+            struct tm tm = {};
+            tm.tm_sec = bcdToValue(regs[0x01]);
+            tm.tm_min = bcdToValue(regs[0x02]);
+            tm.tm_hour = bcdToValue(regs[0x03]);
+            tm.tm_mday = bcdToValue(regs[0x04]);
+            tm.tm_mon = bcdToValue(regs[0x05]) - 1;
+            tm.tm_year = bcdToValue(regs[0x06]) + 100;
+            rtcOffset = (int64_t)timegm(&tm) - (int64_t)(sim::now() / 1000);
+            timeWritten = false;
+        }
+    }
+
+    virtual void read(uint8_t *data, size_t size) override {
+        updateTimeRegisters();
+        for(size_t ii = 0; ii < size; ii++, reg++) {
+            data[ii] = regs[reg];
+        }
+    }
+
+    void checkWatchdog() {
+        if (watchdogMs && sim::now() - watchdogKickMs > watchdogMs) {
+            watchdogMs = 0;
+            throw sim::ResetException{ "AB1805 watchdog" };
+        }
+    }
+
+private:
+    void writeRegister(uint8_t r, uint8_t value) {
+        if (r <= REG_WEEKDAY) {
+            // The time can only be set with WRTC set
+            if (regs[REG_CTRL_1] & REG_CTRL_1_WRTC) {
+                regs[r] = value;
+                timeWritten = true;
+            }
+            return;
+        }
+        regs[r] = value;
+
+        if (r == REG_WDT) {
+            // Only the 1/4 Hz clock is used: the count is in 4 second units
+            watchdogMs = ((value >> 2) & 0x1f) * 4000;
+            watchdogKickMs = sim::now();
+        }
+        else if (r == REG_SLEEP_CTRL && (value & REG_SLEEP_CTRL_SLP)) {
+            // Powers off the MCU until the countdown timer; the run can't continue past a power cycle
+            throw sim::ResetException{ "AB1805 deep power down" };
+        }
+    }
+
+    void updateTimeRegisters() {
+        time_t t = (time_t)(rtcOffset + (int64_t)(sim::now() / 1000));
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        regs[0x00] = 0;
+        regs[0x01] = valueToBcd(tm.tm_sec);
+        regs[0x02] = valueToBcd(tm.tm_min);
+        regs[0x03] = valueToBcd(tm.tm_hour);
+        regs[0x04] = valueToBcd(tm.tm_mday);
+        regs[0x05] = valueToBcd(tm.tm_mon + 1);
+        regs[0x06] = valueToBcd(tm.tm_year % 100);
+        regs[0x07] = valueToBcd(tm.tm_wday);
+    }
+
+    static int bcdToValue(uint8_t bcd) {
+        return (bcd >> 4) * 10 + (bcd & 0x0f);
+    }
+
+    static uint8_t valueToBcd(int value) {
+        return (uint8_t)((((value / 10) % 10) << 4) | (value % 10));
+    }
+
+    uint8_t regs[256];
+    uint8_t reg = 0;
+    bool timeWritten = false;
+    int64_t rtcOffset = 0;          //!< RTC time minus seconds since power-up
+    uint64_t watchdogMs = 0;        //!< 0 if the watchdog is disabled
+    uint64_t watchdogKickMs = 0;
+};
+
+FramDevice fram;
+AB1805Device ab1805;
+
+} // namespace
+
+namespace sim {
+
+void attachI2C(uint8_t address, I2CDevice *device) {
+    devices[address] = device;
+}
+
+void attachCarrierDevices() {
+    attachI2C(0x50, &fram);
+    attachI2C(0x69, &ab1805);
+}
+
+void checkWatchdog() {
+    ab1805.checkWatchdog();
+}
+
+} // namespace sim
+
+//
+// Wire
+//
+
+TwoWire Wire;
+
+void TwoWire::begin() {
+    if (enabled) {
+        return;
+    }
+    enabled = true;
+    if (acquireWireBuffer) {
+        // Only the sizes matter here
+        hal_i2c_config_t config = acquireWireBuffer();
+        txCapacity = config.tx_buffer_size;
+        rxCapacity = config.rx_buffer_size;
+        delete[] config.tx_buffer;
+        delete[] config.rx_buffer;
+    }
+}
+
+void TwoWire::beginTransmission(uint8_t address) {
+    txAddress = address;
+    txBuffer.clear();
+}
+
+uint8_t TwoWire::endTransmission(uint8_t stop) {
+    auto it = devices.find(txAddress);
+    if (it == devices.end()) {
+        // Address NACK
+        return 2;
+    }
+    sim::metrics().i2cTransactions++;
+    sim::metrics().i2cBytes += 1 + txBuffer.size();
+    it->second->write(txBuffer.data(), txBuffer.size());
+    txBuffer.clear();
+    return 0;
+}
+
+size_t TwoWire::requestFrom(uint8_t address, size_t quantity, uint8_t stop) {
+    rxIndex = rxLength = 0;
+    auto it = devices.find(address);
+    if (it == devices.end()) {
+        return 0;
+    }
+    quantity = std::min(quantity, rxCapacity);
+    rxBuffer.resize(quantity);
+    sim::metrics().i2cTransactions++;
+    sim::metrics().i2cBytes += 1 + quantity;
+    it->second->read(rxBuffer.data(), quantity);
+    rxLength = quantity;
+    return quantity;
+}
+
+size_t TwoWire::write(uint8_t data) {
+    if (txBuffer.size() >= txCapacity) {
+        return 0;
+    }
+    txBuffer.push_back(data);
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t quantity) {
+    size_t count = 0;
+    while(count < quantity && write(data[count])) {
+        count++;
+    }
+    return count;
+}
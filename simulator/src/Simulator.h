@@ -0,0 +1,279 @@
+/**
+ * @file Simulator.h
+ * @brief Internal interface between the parts of the host simulator
+ *
+ * @details The fake Device OS API in ../include/Particle.h is implemented on top of these:
+ *
+ * - SimScheduler.cpp: the virtual clock, the event queue and cooperative threads
+ * - SimCloud.cpp: the modem and cloud connection, and publishes
+ * - SimSystem.cpp: sleep, reset, Time, the battery, GPIO and logging
+ * - SimWire.cpp: the I2C bus with the MB85RC64 FRAM and AB1805 RTC/watchdog
+ * - SimFileSystem.cpp: the POSIX file calls for /usr, backed by a host directory
+ * - SimHeap.cpp: counts heap allocations and memory copies
+ * - SimMain.cpp: the command line, the setup()/loop() driver and the report
+ */
+#ifndef __SIMULATOR_H
+#define __SIMULATOR_H
+
+#include "Particle.h"
+
+#include <random>
+#include <string>
+
+namespace sim {
+
+/**
+ * @brief Simulation parameters, set from the command line
+ */
+struct Config {
+    uint64_t seed = 1;                      //!< Seed for every random draw in the run
+    double days = 14;                       //!< Simulated time to run
+    time_t startTime = 1657857600;          //!< UTC time at power-up (2022-07-15 00:00:00 EDT)
+    system_tick_t loopMs = 10;              //!< Virtual time taken by each loop() call
+    LogLevel logLevel = LOG_LEVEL_NONE;     //!< Log messages at this level and above are printed
+    bool printEvents = false;               //!< Print each publish
+    bool json = false;                      //!< Print the report as JSON
+    std::string fsDir = "build/fs";         //!< Host directory that holds /usr
+
+    // Cellular and cloud
+    double connectMedianMs = 20000;         //!< Median time for the modem to get a network (lognormal)
+    double connectSigma = 0.6;              //!< Spread of the network connect time (sigma of ln)
+    double connectFailRate = 0.02;          //!< Probability a connection attempt never gets a network
+    double badDayRate = 0;                  //!< Probability a day (UTC) has a bad signal
+    double badDayShift = 1.5;               //!< On a bad day, connect times and signal are drawn this many sigma worse
+    double badDayFailRate = 0.15;           //!< Probability a connection attempt never gets a network on a bad day
+    bool adaptiveConnectTimeout = true;     //!< false to turn off the application's ConnectTimeoutPolicy after setup()
+    system_tick_t handshakeMs = 1500;       //!< Cloud handshake after the network is up
+    system_tick_t publishMs = 400;          //!< Time for a publish to be acknowledged
+    double publishFailRate = 0.01;          //!< Probability a publish fails
+    system_tick_t disconnectMs = 1000;      //!< Graceful cloud disconnect
+    system_tick_t cellularDisconnectMs = 500; //!< Network disconnect
+    system_tick_t cellularOffMs = 3000;     //!< Modem power down
+
+    // Battery, the "true" currents the simulator charges against the battery
+    double batteryMah = 1800;
+    double batteryStartSoC = 80;
+    double cpuMa = 6.0;                     //!< Awake, modem off
+    double modemMa = 45.0;                  //!< Modem on, in addition to the CPU
+    double standbyMa = 0.8;                 //!< Asleep with the modem in network standby
+    double sleepMa = 0.12;                  //!< Asleep with the modem off
+};
+
+Config &config();
+
+/**
+ * @brief Everything the simulator measures during a run
+ */
+struct Metrics {
+    uint64_t awakeMs = 0;                   //!< Time not in System.sleep
+    uint64_t sleepMs = 0;                   //!< Time in System.sleep
+    uint64_t modemOnMs = 0;                 //!< Time awake with the modem powered
+    uint64_t standbyMs = 0;                 //!< Time asleep with the modem in standby
+    uint32_t sleeps = 0;                    //!< Calls to System.sleep
+
+    uint32_t connectAttempts = 0;           //!< Modem power up or network connect requests
+    uint32_t cloudConnects = 0;             //!< Cloud connections completed
+    uint64_t connectMs = 0;                 //!< Sum of the connect times (request to cloud connected)
+    uint32_t connectMaxMs = 0;              //!< Longest connect time
+    uint32_t connectGiveUps = 0;            //!< Attempts stopped by powering down the modem before getting a network
+    uint64_t connectGiveUpMs = 0;           //!< Modem time spent in attempts that were given up
+    uint32_t badDays = 0;                   //!< Days with a bad signal that had a connection attempt
+
+    uint32_t publishes = 0;                 //!< Publishes acknowledged by the cloud
+    uint32_t publishFailures = 0;           //!< Publishes that failed
+    uint64_t publishBytes = 0;              //!< Event name and data bytes of every publish sent to the cloud
+    uint32_t publishOversize = 0;           //!< Publishes rejected for exceeding the event data limit
+    uint32_t publishRateLimited = 0;        //!< Publishes over the cloud rate limit (1/sec, burst of 4)
+
+    uint64_t fsWrites = 0;                  //!< write() calls to files in /usr
+    uint64_t fsBytesWritten = 0;            //!< Bytes written to files in /usr
+    uint64_t fsOpens = 0;                   //!< Files in /usr opened
+    uint64_t fsUnlinks = 0;                 //!< Files in /usr removed
+    uint64_t fsRenames = 0;                 //!< Files in /usr renamed
+
+    uint64_t i2cTransactions = 0;           //!< I2C transactions to any device
+    uint64_t i2cBytes = 0;                  //!< Bytes on the I2C bus, including the device address byte of each transaction
+    uint64_t framWrites = 0;                //!< FRAM write transactions
+    uint64_t framBytesWritten = 0;          //!< Bytes written to FRAM
+
+    uint64_t heapAllocations = 0;           //!< malloc, calloc, realloc and operator new calls
+    uint64_t heapBytes = 0;                 //!< Bytes requested by those calls
+    uint64_t bytesCopied = 0;               //!< Bytes copied by memcpy, memmove and strcpy calls (copies the compiler inlines are not counted)
+
+    uint64_t threadQueueTakes = 0;          //!< os_queue_take calls on a Thread that returned, with an item or on the timeout
+    uint64_t threadQueueTimeouts = 0;       //!< os_queue_take calls on a Thread that returned on the timeout
+
+    double chargeUah = 0;                   //!< Battery charge used, from the "true" currents in Config
+    uint32_t resets = 0;                    //!< System.reset() or watchdog resets (the run stops)
+};
+
+Metrics &metrics();
+
+/**
+ * @brief Thrown by System.reset() and the AB1805 watchdog to end the run
+ */
+struct ResetException {
+    const char *reason;
+};
+
+//
+// SimScheduler.cpp
+//
+
+/**
+ * @brief Virtual milliseconds since power-up
+ */
+uint64_t now();
+
+/**
+ * @brief Calls fn at a virtual time. Events at the same time run in the order they were added.
+ */
+void at(uint64_t timeMs, std::function<void()> fn);
+
+/**
+ * @brief Moves the clock forward, running the events that come due and any threads they wake
+ *
+ * @param runThreads Pass false while asleep so application threads don't run
+ */
+void advance(uint64_t ms, bool runThreads = true);
+
+/**
+ * @brief Runs threads that are ready until they all block again
+ */
+void runThreads();
+
+/**
+ * @brief Random number generator for the run
+ */
+std::mt19937_64 &rng();
+
+/**
+ * @brief Uniform random number in [0, 1)
+ */
+double uniform();
+
+/**
+ * @brief Standard normal random number
+ */
+double normal();
+
+//
+// SimCloud.cpp
+//
+
+/**
+ * @brief Called by System.sleep. Drops the cloud connection and powers down the modem unless it's kept in standby.
+ */
+void cloudSleep(bool keepModem);
+
+/**
+ * @brief True if the modem is powered
+ */
+bool modemOn();
+
+/**
+ * @brief True if the modem is registered to the network (sleeping in standby keeps it registered)
+ */
+bool modemReady();
+
+//
+// SimSystem.cpp
+//
+
+/**
+ * @brief Prepares for a run using config(): sets the C library to UTC, seeds the random generator,
+ * empties /usr and attaches the carrier I2C devices. Call before setup() or a test.
+ */
+void begin();
+
+/**
+ * @brief Sets the system clock from the cloud, as on connection
+ */
+void syncTime();
+
+/**
+ * @brief Sends a system event to the handlers registered with System.on
+ */
+void systemEvent(system_event_t event, int param);
+
+/**
+ * @brief True while in System.sleep
+ */
+bool sleeping();
+
+/**
+ * @brief Supplies the voltage on an analog pin, as an ADC value (0 - 4095).
+ */
+void analogSource(pin_t pin, std::function<int32_t()> fn);
+
+/**
+ * @brief Battery state of charge in percent
+ */
+float batterySoC();
+
+/**
+ * @brief Virtual UTC time, whether or not the device clock has been set
+ */
+time_t trueTime();
+
+/**
+ * @brief Formats a UTC time as YYYY-MM-DD HH:MM:SS
+ */
+std::string formatTime(time_t t);
+
+//
+// SimWire.cpp
+//
+
+/**
+ * @brief A device on the simulated I2C bus
+ */
+class I2CDevice {
+public:
+    virtual ~I2CDevice() {}
+
+    /**
+     * @brief Handle a write transaction (beginTransmission to endTransmission)
+     */
+    virtual void write(const uint8_t *data, size_t size) = 0;
+
+    /**
+     * @brief Handle a read transaction (requestFrom)
+     */
+    virtual void read(uint8_t *data, size_t size) = 0;
+};
+
+/**
+ * @brief Adds a device to the bus at a 7-bit address
+ */
+void attachI2C(uint8_t address, I2CDevice *device);
+
+/**
+ * @brief Attaches the devices on the SleepHelper-Garden carrier: an MB85RC64 FRAM and an AB1805
+ */
+void attachCarrierDevices();
+
+/**
+ * @brief Throws ResetException if the AB1805 watchdog has expired
+ */
+void checkWatchdog();
+
+//
+// SimFileSystem.cpp
+//
+
+/**
+ * @brief Empties the host directory that holds /usr
+ */
+void resetFileSystem();
+
+/**
+ * @brief Called after each open, unlink and rename of a path in /usr that succeeds, with the name of the
+ * call and the path (the new path for rename). A test throws ResetException from it to stop the code
+ * under test as a reset right after that call would. Pass an empty function to remove it.
+ */
+void fileSystemHook(std::function<void(const char *call, const char *path)> fn);
+
+} // namespace sim
+
+#endif /* __SIMULATOR_H */
@@ -0,0 +1,107 @@
+#include "SimTest.h"
+#include "adc_sampler.h"
+
+// adc_sampler.h: checks the median and trimmed mean on known inputs, then measures host samples per
+// millisecond and the noise variance of a single analogRead() and of each reduction against a
+// synthetic signal with gaussian noise and occasional large spikes.
+
+namespace {
+
+const int32_t trueValue = 2000;                     // ADC counts
+const double noiseSigma = 8.0;                      // ADC counts
+const double spikeRate = 0.02;                      // Fraction of conversions that are a spike
+const int32_t spikeSize = 800;                      // ADC counts, either direction
+
+int32_t noisySignal() {
+    int32_t value = trueValue + (int32_t)lround(noiseSigma * sim::normal());
+    if (sim::uniform() < spikeRate) value += (sim::uniform() < 0.5) ? -spikeSize : spikeSize;
+    return std::min(std::max(value, (int32_t)0), (int32_t)4095);
+}
+
+/**
+ * @brief Mean squared error against trueValue over many readings of one channel
+ */
+template <size_t NUM_SAMPLES>
+double reducedVariance(ADC::Reduction reduction, int readings) {
+    const pin_t pins[3] = {A4, A1, A0};
+    int results[3];
+    double sum = 0;
+    for (int ii = 0; ii < readings; ii++) {
+        sampleAnalogPins<3, NUM_SAMPLES>(pins, results, reduction);
+        double error = results[0] - trueValue;
+        sum += error * error;
+    }
+    return sum / readings;
+}
+
+double singleReadVariance(int readings) {
+    double sum = 0;
+    for (int ii = 0; ii < readings; ii++) {
+        double error = analogRead(A4) - trueValue;
+        sum += error * error;
+    }
+    return sum / readings;
+}
+
+template <size_t NUM_SAMPLES>
+double samplesPerMs(int readings) {
+    const pin_t pins[3] = {A4, A1, A0};
+    int results[3];
+    double start = simtest::hostSeconds();
+    for (int ii = 0; ii < readings; ii++) {
+        sampleAnalogPins<3, NUM_SAMPLES>(pins, results, ADC::trimmedMean);
+    }
+    double elapsedMs = (simtest::hostSeconds() - start) * 1000.0;
+    return (double)readings * 3 * NUM_SAMPLES / elapsedMs;
+}
+
+} // namespace
+
+int main() {
+    simtest::begin("AdcSamplerTest");
+
+    uint16_t odd[5] = {5, 1, 4, 2, 3};
+    CHECK_INT(reduceAdcSamples(odd, 5, ADC::median), 3);
+
+    uint16_t even[4] = {10, 40, 20, 30};
+    CHECK_INT(reduceAdcSamples(even, 4, ADC::median), 25);
+
+    uint16_t spiked[8] = {100, 101, 4095, 99, 100, 0, 102, 98};     // Two spikes are trimmed away
+    CHECK_INT(reduceAdcSamples(spiked, 8, ADC::trimmedMean), 100);
+
+    // Channels are interleaved: each pin gets its own samples
+    sim::analogSource(A4, []() { return (int32_t)1000; });
+    sim::analogSource(A1, []() { return (int32_t)2000; });
+    sim::analogSource(A0, []() { return (int32_t)3000; });
+    const pin_t pins[3] = {A4, A1, A0};
+    int results[3];
+    sampleAnalogPins<3, 16>(pins, results);
+    CHECK_INT(results[0], 1000);
+    CHECK_INT(results[1], 2000);
+    CHECK_INT(results[2], 3000);
+
+    for (pin_t pin : pins) sim::analogSource(pin, noisySignal);
+
+    const int readings = 20000;
+    double single = singleReadVariance(readings * 16);
+    double median16 = reducedVariance<16>(ADC::median, readings);
+    double trimmed16 = reducedVariance<16>(ADC::trimmedMean, readings);
+    double median64 = reducedVariance<64>(ADC::median, readings / 4);
+    double trimmed64 = reducedVariance<64>(ADC::trimmedMean, readings / 4);
+
+    printf("noise variance (counts^2), sigma %.0f with %.0f%% spikes of %d counts\n", noiseSigma, spikeRate * 100, spikeSize);
+    printf("  single analogRead      %8.2f\n", single);
+    printf("  16 samples, median     %8.2f\n", median16);
+    printf("  16 samples, trimmed    %8.2f\n", trimmed16);
+    printf("  64 samples, median     %8.2f\n", median64);
+    printf("  64 samples, trimmed    %8.2f\n", trimmed64);
+    printf("host samples/ms: 16 samples %.0f, 64 samples %.0f\n", samplesPerMs<16>(readings), samplesPerMs<64>(readings / 4));
+
+    // The spikes dominate a single read; both reductions reject them and average down the noise
+    CHECK(single > 100 * trimmed16);
+    CHECK(trimmed16 < noiseSigma * noiseSigma / 4);
+    CHECK(median16 < noiseSigma * noiseSigma / 4);
+    CHECK(trimmed64 < trimmed16);
+
+    return simtest::end("AdcSamplerTest");
+}
@@ -0,0 +1,219 @@
+#include "SimTest.h"
+#include "BackgroundPublishRK.h"
+
+#include <vector>
+
+// BackgroundPublishRK against the simulator's cloud, which acknowledges each publish after
+// config().publishMs (0.5 to 1.5 times, so publishes in flight complete out of order): completion
+// callbacks are called in publish() order with several publishes in flight, publish() returns
+// false when every slot is in use and never calls the callback for that event, and the token
+// bucket keeps to the cloud rate limit of 1 per second with a burst of 4. Then the connected time
+// to drain 20 events at several publish latencies, the way SleepHelper queues them (up to 3 at a
+// time, leaving a slot free), against one publish at a time with a 1 second wait after each, as
+// before the queue. Last, the thread's wakeups: none while idle, and the 1 second safety net
+// timeout only while a publish is in flight.
+
+namespace {
+
+const size_t numEvents = 20;
+
+std::vector<size_t> completed;
+size_t failed = 0;
+uint64_t lastCompletedMs = 0;
+
+bool publish(size_t index) {
+    return BackgroundPublishRK::instance().publish("test", "x", PRIVATE | WITH_ACK,
+        [](bool succeeded, const char *event_name, const char *event_data, const void *event_context) {
+            completed.push_back((size_t)event_context);
+            failed += !succeeded;
+            lastCompletedMs = sim::now();
+        }, (const void *)index);
+}
+
+void waitForPending(size_t pending) {
+    for (int ii = 0; ii < 100000 && BackgroundPublishRK::instance().getNumPending() > pending; ii++) {
+        sim::advance(10);
+    }
+}
+
+/**
+ * @brief Callbacks were called once for each of numEvents, in order
+ */
+bool inOrder(size_t count) {
+    if (completed.size() != count) {
+        return false;
+    }
+    for (size_t ii = 0; ii < count; ii++) {
+        if (completed[ii] != ii) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct DrainResult {
+    double seconds;
+    bool inOrder;
+    uint32_t rateLimited;
+};
+
+/**
+ * @brief Publishes numEvents from a 10 ms loop, keeping up to producerLimit queued. With waitAfterEach,
+ * one at a time with a 1 second wait after each completes. Seconds are from the first publish() to
+ * the last callback.
+ */
+DrainResult drain(size_t producerLimit, bool waitAfterEach) {
+    BackgroundPublishRK &bp = BackgroundPublishRK::instance();
+
+    // Idle long enough to fill the token bucket
+    sim::advance(5000);
+    completed.clear();
+    failed = 0;
+    uint32_t rateLimited = sim::metrics().publishRateLimited;
+
+    uint64_t startMs = sim::now();
+    size_t queued = 0;
+    while (completed.size() < numEvents && sim::now() - startMs < 600000) {
+        while (queued < numEvents && bp.getNumPending() < producerLimit) {
+            if (waitAfterEach && (bp.getNumPending() != 0 || (queued && sim::now() - lastCompletedMs < 1000))) {
+                break;
+            }
+            if (!publish(queued)) {
+                break;
+            }
+            queued++;
+        }
+        sim::advance(10);
+    }
+
+    DrainResult result;
+    result.seconds = (lastCompletedMs - startMs) / 1000.0;
+    result.inOrder = inOrder(numEvents) && failed == 0;
+    result.rateLimited = sim::metrics().publishRateLimited - rateLimited;
+    return result;
+}
+
+} // namespace
+
+int main() {
+    simtest::begin("BackgroundPublishTest");
+
+    sim::Config &config = sim::config();
+    config.connectFailRate = 0;
+    config.publishFailRate = 0;
+
+    BackgroundPublishRK &bp = BackgroundPublishRK::instance();
+    bp.start();
+    CHECK_INT(bp.getQueueSize(), 4);
+
+    Particle.connect();
+    for (int ii = 0; ii < 10000 && !Particle.connected(); ii++) {
+        sim::advance(100);
+    }
+    CHECK(Particle.connected());
+
+    // A full queue: the thread only runs when the clock moves, so nothing completes in between
+    sim::advance(5000);
+    completed.clear();
+    for (size_t ii = 0; ii < 4; ii++) {
+        CHECK(publish(ii));
+    }
+    CHECK(!publish(4));
+    CHECK_INT(bp.getNumPending(), 4);
+    waitForPending(0);
+    CHECK(inOrder(4));
+    CHECK(publish(4));
+    waitForPending(0);
+    CHECK(inOrder(5));
+
+    // In order with 4 in flight, acknowledged in a random order
+    config.publishMs = 2000;
+    bp.withMaxInFlight(4);
+    sim::advance(5000);
+    completed.clear();
+    for (size_t ii = 0; ii < 4; ii++) {
+        CHECK(publish(ii));
+    }
+    waitForPending(0);
+    CHECK(inOrder(4));
+
+    // The token bucket: no publishes over the cloud limit, and 20 events take at least 16 seconds
+    // after the burst of 4. Without it the cloud sees publishes over its limit.
+    config.publishMs = 100;
+    DrainResult limited = drain(4, false);
+    CHECK(limited.inOrder);
+    CHECK_INT(limited.rateLimited, 0);
+    CHECK(limited.seconds >= 15.9);
+    bp.withRateLimit(0, 1);
+    DrainResult unlimited = drain(4, false);
+    CHECK(unlimited.inOrder);
+    CHECK(unlimited.rateLimited > 0);
+    CHECK(unlimited.seconds < 5);
+    printf("%u events at 100 ms: %.1f s with the rate limit (%u over the cloud limit), %.1f s without (%u over)\n",
+           (unsigned)numEvents, limited.seconds, (unsigned)limited.rateLimited, unlimited.seconds, (unsigned)unlimited.rateLimited);
+    bp.withRateLimit(1000, 4);
+
+    // Connected time to drain 20 events
+    printf("connected time to drain %u events\n", (unsigned)numEvents);
+    printf("  latency  %-25s%-25s%-25s%s\n", "  1 at a time + 1 s wait", "  1 in flight", "  2 in flight (default)", "  3 in flight");
+    for (system_tick_t latencyMs : {100, 400, 1000, 2000}) {
+        config.publishMs = latencyMs;
+
+        bp.withMaxInFlight(1);
+        DrainResult before = drain(1, true);
+        DrainResult results[3];
+        for (size_t maxInFlight = 1; maxInFlight <= 3; maxInFlight++) {
+            bp.withMaxInFlight(maxInFlight);
+            results[maxInFlight - 1] = drain(3, false);
+        }
+        printf("  %4u ms", (unsigned)latencyMs);
+        for (const DrainResult *result : {&before, &results[0], &results[1], &results[2]}) {
+            printf("  %6.1f s %5.2f events/s", result->seconds, numEvents / result->seconds);
+            CHECK(result->inOrder);
+            CHECK_INT(result->rateLimited, 0);
+        }
+        printf("\n");
+
+        CHECK(results[1].seconds < before.seconds);
+        if (latencyMs >= 2000) {
+            CHECK(results[1].seconds < 0.75 * results[0].seconds);
+        }
+    }
+    bp.withMaxInFlight(2);
+
+    // Thread wakeups. Each pass of the thread's loop ends in one os_queue_take, so the returns count
+    // the passes. Idle, it blocks until publish(); the COMPLETION_CHECK_MS timeout only fires while
+    // a publish is in flight.
+    config.publishMs = 3000;
+    sim::advance(5000);
+    const sim::Metrics &metrics = sim::metrics();
+    uint64_t takes = metrics.threadQueueTakes, timeouts = metrics.threadQueueTimeouts;
+    sim::advance(60000);
+    uint64_t idleTakes = metrics.threadQueueTakes - takes, idleTimeouts = metrics.threadQueueTimeouts - timeouts;
+    CHECK_INT(idleTakes, 0);
+    CHECK_INT(idleTimeouts, 0);
+
+    completed.clear();
+    takes = metrics.threadQueueTakes;
+    timeouts = metrics.threadQueueTimeouts;
+    uint64_t startMs = sim::now();
+    CHECK(publish(0));
+    waitForPending(0);
+    CHECK(inOrder(1));
+    uint64_t inFlightMs = lastCompletedMs - startMs;
+    uint64_t publishTakes = metrics.threadQueueTakes - takes, publishTimeouts = metrics.threadQueueTimeouts - timeouts;
+    CHECK(publishTimeouts >= 1 && publishTimeouts <= inFlightMs / 1000 + 1);
+    CHECK(publishTakes <= publishTimeouts + 3);
+
+    takes = metrics.threadQueueTakes;
+    timeouts = metrics.threadQueueTimeouts;
+    sim::advance(60000);
+    CHECK_INT(metrics.threadQueueTakes - takes, 0);
+    CHECK_INT(metrics.threadQueueTimeouts - timeouts, 0);
+
+    // The loop this replaced polled with delay(1) while idle and while waiting for a publish
+    printf("thread wakeups: idle %.2f/s (polling with delay(1): 1000/s); one publish in flight for %.1f s: %u wakeups, %u on the %u ms timeout\n",
+           idleTakes / 60.0, inFlightMs / 1000.0, (unsigned)publishTakes, (unsigned)publishTimeouts, 1000);
+
+    return simtest::end("BackgroundPublishTest");
+}
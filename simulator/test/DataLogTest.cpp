@@ -0,0 +1,158 @@
+#include "SimTest.h"
+#include "data_log.h"
+
+#include <filesystem>
+
+// data_log.cpp: the FRAM ring log keeps its records through wrap around, removal and a restart,
+// drops records that fail their CRC, and moves its records to the event history in batches, keeping
+// them in FRAM when the event history file can't be opened. Then compares appending a measurement
+// to the data log with appending it to the SleepHelper event history on flash: host appends/s and
+// what each append costs in FRAM and file system operations.
+
+namespace {
+
+dataLogRecord makeRecord(uint32_t ii) {
+    dataLogRecord record = {};
+    record.time = 1657857600 + ii * 900;
+    record.internalTempC100 = (int16_t)(2000 + ii % 500);
+    record.soilTempC100 = (int16_t)(1800 + ii % 300);
+    record.soilMoisture10 = (uint16_t)(500 - ii % 100);
+    record.stateOfCharge = (uint8_t)(ii % 100);
+    return record;
+}
+
+size_t eventHistoryLines() {
+    FILE *fp = fopen((sim::config().fsDir + "/usr/events.txt").c_str(), "r");
+    if (!fp) {
+        return 0;
+    }
+    size_t lines = 0;
+    int ch;
+    while ((ch = fgetc(fp)) != EOF) {
+        if (ch == '\n') lines++;
+    }
+    fclose(fp);
+    return lines;
+}
+
+void printCost(const char *what, int appends, double seconds, const sim::Metrics &before) {
+    const sim::Metrics &after = sim::metrics();
+    printf("  %-14s %9.0f appends/s  per append: %4.2f fs opens %4.2f fs writes %6.1f fs bytes %4.2f I2C transactions %5.1f FRAM bytes\n",
+           what, appends / seconds, (double)(after.fsOpens - before.fsOpens) / appends, (double)(after.fsWrites - before.fsWrites) / appends,
+           (double)(after.fsBytesWritten - before.fsBytesWritten) / appends, (double)(after.i2cTransactions - before.i2cTransactions) / appends,
+           (double)(after.framBytesWritten - before.framBytesWritten) / appends);
+}
+
+} // namespace
+
+int main() {
+    simtest::begin("DataLogTest");
+
+    Wire.begin();
+    CHECK(storageObjectStart());
+    SleepHelper::instance().withEventHistory("/usr/events.txt", "eh");
+
+    size_t capacity = dataLogCapacity();
+    CHECK_INT(capacity, (8192 - FRAM::dataLogAddr - sizeof(dataLogHeader)) / sizeof(dataLogRecord));
+    CHECK_INT(dataLogCount(), 0);
+
+    // Wrap around: the oldest records are overwritten
+    for (uint32_t ii = 0; ii < capacity + 10; ii++) {
+        CHECK(dataLogAppend(makeRecord(ii)));
+    }
+    CHECK_INT(dataLogCount(), capacity);
+    dataLogRecord records[32];
+    CHECK_INT(dataLogRead(0, records, 32), 32);
+    CHECK_INT(records[0].time, makeRecord(10).time);
+    CHECK_INT(records[31].soilMoisture10, makeRecord(41).soilMoisture10);
+
+    // A range that wraps around the end of the region
+    CHECK_INT(dataLogRead(capacity - 16, records, 32), 16);
+    CHECK_INT(records[15].time, makeRecord(capacity + 9).time);
+
+    CHECK(dataLogRemove(capacity - 5));
+    CHECK_INT(dataLogCount(), 5);
+    CHECK_INT(dataLogRead(0, records, 32), 5);
+    CHECK_INT(records[0].time, makeRecord(capacity + 5).time);
+
+    // The header is kept in FRAM: the log is the same after a restart
+    fram.flush();
+    fram.invalidate();
+    CHECK(dataLogStart(FRAM::dataLogAddr, fram.length() - FRAM::dataLogAddr));
+    CHECK_INT(dataLogCount(), 5);
+    CHECK_INT(dataLogRead(0, records, 32), 5);
+    CHECK_INT(records[4].time, makeRecord(capacity + 9).time);
+
+    // A corrupt record is dropped
+    CHECK(dataLogRemove(5));
+    CHECK(dataLogAppend(makeRecord(1)));
+    CHECK(dataLogAppend(makeRecord(2)));
+    CHECK(dataLogRead(0, records, 1) == 1);
+    records[0].soilTempC100 ^= 0x10;
+    size_t slot = (capacity + 10) % capacity;       // Where makeRecord(1) went
+    fram.writeData(FRAM::dataLogAddr + sizeof(dataLogHeader) + slot * sizeof(dataLogRecord), (const uint8_t *)&records[0], sizeof(dataLogRecord));
+    CHECK_INT(dataLogRead(0, records, 32), 1);
+    CHECK_INT(records[0].time, makeRecord(2).time);
+
+    // Moving to the event history is one file open per batch of 32 records
+    CHECK(dataLogRemove(2));
+    for (uint32_t ii = 0; ii < 100; ii++) {
+        dataLogAppend(makeRecord(ii));
+    }
+    sim::Metrics before = sim::metrics();
+    CHECK_INT(dataLogMoveToEventHistory(), 100);
+    CHECK_INT(dataLogCount(), 0);
+    CHECK_INT(sim::metrics().fsOpens - before.fsOpens, 4);
+    CHECK_INT(eventHistoryLines(), 100);
+
+    // The event history file can't be opened (a directory in its place): the records stay in FRAM
+    std::string historyPath = sim::config().fsDir + "/usr/events.txt";
+    std::filesystem::rename(historyPath, historyPath + ".save");
+    std::filesystem::create_directory(historyPath);
+    for (uint32_t ii = 0; ii < 40; ii++) {
+        dataLogAppend(makeRecord(ii));
+    }
+    CHECK_INT(dataLogMoveToEventHistory(), 0);
+    CHECK_INT(dataLogCount(), 40);
+    std::filesystem::remove(historyPath);
+    std::filesystem::rename(historyPath + ".save", historyPath);
+    CHECK_INT(dataLogMoveToEventHistory(), 40);
+    CHECK_INT(dataLogCount(), 0);
+    CHECK_INT(eventHistoryLines(), 140);
+
+    // Appends per second: 15 minute samples, so 1000 is about 10 days
+    printf("appending a measurement\n");
+    const int appends = 1000;
+    memset(&current, 0, sizeof(current));
+
+    before = sim::metrics();
+    double start = simtest::hostSeconds();
+    for (int ii = 0; ii < appends; ii++) {
+        current.soilMoisture = 50.0 - ii % 20;
+        dataLogAppendCurrent();
+    }
+    printCost("FRAM data log", appends, simtest::hostSeconds() - start, before);
+
+    before = sim::metrics();
+    start = simtest::hostSeconds();
+    for (int ii = 0; ii < appends; ii++) {
+        current.soilMoisture = 50.0 - ii % 20;
+        SleepHelper::instance().addEvent([](JSONWriter &writer) {
+            writer.name("t").value((int) Time.now());
+            writer.name("bs").value(current.batteryState);
+            writer.name("c").value(current.internalTempC);
+            writer.name("sm").value(current.soilMoisture);
+            writer.name("st").value(current.soilTempC);
+            writer.name("ws").value(current.wateringState);
+        });
+    }
+    printCost("event history", appends, simtest::hostSeconds() - start, before);
+
+    // Host rates only show the CPU side. On the device an append to FRAM is one I2C transaction (the
+    // header is in the FRAM cache and goes out with the next flush); an append to the event history
+    // is an open, two writes and a close of a file on flash.
+    double busMs = (1 + 2 + sizeof(dataLogRecord)) * 9 * 1000.0 / 400000.0;
+    printf("  FRAM bus time per append at 400 kHz: %.2f ms\n", busMs);
+
+    return simtest::end("DataLogTest");
+}
@@ -0,0 +1,207 @@
+#include "SimTest.h"
+#include "SleepHelper.h"
+
+#include <cmath>
+#include <vector>
+
+// SleepHelper::EnergyModel: the charge arithmetic of cycleChargeUah() for a cycle with modem,
+// CPU-only, standby, sensor and sleep time, and the day rollover of the daily totals in
+// PersistentData. Then replays a day of the application's schedules on the simulator's clock,
+// recomputes every saved wake cycle with the model calibrated to the simulator's currents, and
+// checks that it matches the charge the simulator integrated. Prints the estimated energy budget
+// by phase, with the application's default model and with the calibrated one.
+
+#include "sleep_helper_config.h"
+
+void setup();
+void loop();
+
+namespace {
+
+typedef SleepHelper::WakeCycleProfile Cycle;
+
+void testCharge() {
+    SleepHelper::EnergyModel model;
+    model.withCpuAwakeMa(5.0).withModemOnMa(40.0).withModemStandbyMa(0.5).withSleepMa(0.1).withSensorMa(10.0);
+
+    Cycle cycle = {};
+    cycle.phaseMs[Cycle::phaseConnectWait] = 36000;         // 45 mA
+    cycle.phaseMs[Cycle::phaseSleepDone] = 7200;            // 5 mA, modem off
+    cycle.sensorMs = 3600;                                  // 10 mA
+    cycle.sleepMs = 3600000;                                // 0.1 mA
+    // (36000 * 45 + 7200 * 5 + 3600 * 10 + 3600000 * 0.1) / 3600 = 450 + 10 + 10 + 100 uAh
+    CHECK_INT(model.cycleChargeUah(cycle), 570);
+
+    // The modem in standby during the sleep before the cycle, and after it until it is used
+    cycle.flags = Cycle::flagModemStandby;
+    // 7200 * 0.5 / 3600 + 3600000 * 0.5 / 3600 = 1 + 500 uAh more
+    CHECK_INT(model.cycleChargeUah(cycle), 1071);
+
+    CHECK(SleepHelper::EnergyModel::isModemPhase(Cycle::phaseConnected));
+    CHECK(!SleepHelper::EnergyModel::isModemPhase(Cycle::phaseNoConnection));
+    CHECK(!SleepHelper::EnergyModel::isModemPhase(Cycle::numPhases));
+}
+
+void testDayTotals() {
+    SleepHelper::PersistentData data;
+    data.withPath("/usr/energy.dat").withSaveDelayMs(0);
+    data.load();                                            // Not setup(), which adds loop functions for this object
+
+    const time_t day1 = 1657857600 - 20 * 3600 + 4 * 3600;  // Local midnight, EDT
+    data.addValue_energy(1000, day1);
+    data.addValue_energy(500, day1);
+    CHECK_INT(data.getValue_energyDayUah(day1), 1500);
+    CHECK_INT(data.getValue_energyPrevDayUah(day1), 0);
+
+    const time_t day2 = day1 + 86400;
+    data.addValue_energy(200, day2);
+    CHECK_INT(data.getValue_energyDayUah(day2), 200);
+    CHECK_INT(data.getValue_energyPrevDayUah(day2), 1500);
+
+    // A day with no cycles in between, so the previous day total is 0
+    const time_t day4 = day2 + 2 * 86400;
+    data.addValue_energy(300, day4);
+    CHECK_INT(data.getValue_energyDayUah(day4), 300);
+    CHECK_INT(data.getValue_energyPrevDayUah(day4), 0);
+    CHECK_INT(data.getValue_energyReportUah(), 2000);           // Every cycle since the last report
+}
+
+uint32_t lastCount = 0;
+double startUah = 0, endUah = 0;
+uint64_t startMs = 0, endMs = 0;
+bool done = false;
+std::vector<Cycle> cycles;
+
+/**
+ * @brief Runs every second of virtual time. Starts at the first sleep, saves each cycle the application
+ * completes after that, and ends at the first sleep a day later.
+ */
+void saveNewCycles() {
+    SleepHelper &sleepHelper = SleepHelper::instance();
+    uint32_t count = sleepHelper.persistentData.getValue_wakeCycleCount();
+    if (startMs == 0) {
+        if (sim::sleeping()) {
+            // The charge of each cycle includes the sleep before it, so counting starts asleep
+            lastCount = count;
+            startUah = sim::metrics().chargeUah;
+            startMs = sim::now();
+        }
+    }
+    else {
+        for (; lastCount < count; lastCount++) {
+            Cycle cycle;
+            if (sleepHelper.getWakeCycleProfile(count - 1 - lastCount, cycle)) {
+                cycles.push_back(cycle);
+            }
+        }
+        if (sim::sleeping() && sim::now() >= startMs + 24ULL * 3600 * 1000) {
+            endUah = sim::metrics().chargeUah;
+            endMs = sim::now();
+            done = true;
+            return;
+        }
+    }
+    sim::at(sim::now() + 1000, saveNewCycles);
+}
+
+/**
+ * @brief Estimated mAh for each phase, the sensor and sleep over the saved cycles
+ */
+void printBudget(const char *name, const SleepHelper::EnergyModel &model, double days) {
+    double phaseUah[Cycle::numPhases] = {}, sensorUah = 0, sleepUah = 0, totalUah = 0;
+
+    for (const Cycle &cycle : cycles) {
+        // The model is linear, so each part is the charge of a cycle with only that part
+        for (size_t ii = 0; ii < Cycle::numPhases; ii++) {
+            Cycle part = {};
+            part.flags = cycle.flags;
+            part.phaseMs[ii] = cycle.phaseMs[ii];
+            phaseUah[ii] += model.cycleChargeUah(part);
+        }
+        Cycle part = {};
+        part.sensorMs = cycle.sensorMs;
+        sensorUah += model.cycleChargeUah(part);
+        part = {};
+        part.flags = cycle.flags;
+        part.sleepMs = cycle.sleepMs;
+        sleepUah += model.cycleChargeUah(part);
+        totalUah += model.cycleChargeUah(cycle);
+    }
+
+    printf("  %s: %.2f mAh/day\n", name, totalUah / 1000.0 / days);
+    for (size_t ii = 0; ii < Cycle::numPhases; ii++) {
+        if (phaseUah[ii] > 0) {
+            printf("    %-28s %6.2f mAh/day\n", Cycle::phaseName(ii), phaseUah[ii] / 1000.0 / days);
+        }
+    }
+    printf("    %-28s %6.2f mAh/day\n", "sensor", sensorUah / 1000.0 / days);
+    printf("    %-28s %6.2f mAh/day\n", "sleep", sleepUah / 1000.0 / days);
+}
+
+double totalUah(const SleepHelper::EnergyModel &model) {
+    double total = 0;
+    for (const Cycle &cycle : cycles) {
+        total += model.cycleChargeUah(cycle);
+    }
+    return total;
+}
+
+} // namespace
+
+int main() {
+    simtest::begin("EnergyModelTest");
+
+    testCharge();
+    testDayTotals();
+
+    sim::analogSource(A4, []() { return (int32_t)931; });
+    sim::analogSource(A1, []() { return (int32_t)1551; });
+    sim::analogSource(A0, []() { return (int32_t)1861; });
+
+    try {
+        setup();
+        sim::runThreads();
+        sim::at(sim::now() + 1000, saveNewCycles);
+
+        while (!done) {
+            loop();
+            sim::runThreads();
+            sim::advance(10);
+            sim::checkWatchdog();
+        }
+    }
+    catch (const sim::ResetException &e) {
+        simtest::checkFailed(__FILE__, __LINE__, e.reason);
+    }
+
+    double simUah = endUah - startUah;
+    double days = (endMs - startMs) / (24.0 * 3600 * 1000);
+
+    // The simulator's currents. Its standby current replaces the sleep current instead of adding to it.
+    const sim::Config &config = sim::config();
+    SleepHelper::EnergyModel calibrated;
+    calibrated.withCpuAwakeMa(config.cpuMa).withModemOnMa(config.modemMa).withModemStandbyMa(config.standbyMa - config.sleepMa)
+        .withSleepMa(config.sleepMa).withSensorMa(0);
+
+    SleepHelper::EnergyModel appModel;
+    appModel.withSensorMa(10.0);                            // sleep_helper_config.cpp
+
+    printf("day replay: %u cycles over %.2f days, simulator %.2f mAh/day\n", (unsigned)cycles.size(), days, simUah / 1000.0 / days);
+    printBudget("application model", appModel, days);
+    printBudget("calibrated to the simulator", calibrated, days);
+
+    // The charge the application saved with each cycle is its model's
+    double savedUah = 0;
+    for (const Cycle &cycle : cycles) {
+        savedUah += cycle.chargeUah;
+    }
+    CHECK(cycles.size() > 50);
+    CHECK(std::fabs(savedUah - totalUah(appModel)) < 1.0);
+
+    double calibratedUah = totalUah(calibrated);
+    printf("calibrated model %.2f mAh against simulator %.2f mAh (%+.1f%%)\n", calibratedUah / 1000.0, simUah / 1000.0,
+           (calibratedUah - simUah) / simUah * 100.0);
+    CHECK(std::fabs(calibratedUah - simUah) < simUah * 0.03);
+
+    return simtest::end("EnergyModelTest");
+}
@@ -0,0 +1,440 @@
+#include "SimTest.h"
+#include "SleepHelper.h"
+
+#include <algorithm>
+#include <sys/stat.h>
+
+// SleepHelper::EventCombiner::generateEvents(): an event history line that can never fit in an
+// event (one larger than the read buffer, and one that fits in the buffer but not in an event) is
+// discarded instead of stopping every later event from being sent, and generateEvents() returns.
+// With JSON, CBOR/Z85 and columnar encoding. Columnar also gets an event of numbers that is too
+// large in columns and as JSON. Then heap allocations, bytes copied and events for 50 callbacks
+// and 500 event history records, against the generateEvents() this replaced (kept here as
+// legacyGenerateEvents()).
+
+namespace {
+
+String bigEvent(size_t length) {
+    // {"s":"xxx"} is 10 bytes plus the string
+    String str = "{\"s\":\"";
+    while(str.length() < length - 2) {
+        str += 'x';
+    }
+    return str + "\"}";
+}
+
+String wideEvent(size_t length) {
+    // Numbers only, so it can be stored in columns
+    String str = "{\"t\":1657858600";
+    for (int ii = 0; str.length() < length - 1; ii++) {
+        str += String::format(",\"w%d\":1", ii);
+    }
+    return str + "}";
+}
+
+bool fileExists(const char *path) {
+    struct stat sb;
+    return stat((sim::config().fsDir + path).c_str(), &sb) == 0;
+}
+
+void testOversized(const char *path, uint8_t encoding) {
+    SleepHelper::EventCombiner combiner;
+    combiner.withEventHistory(path, "eh").withEventHistoryEncoding(encoding);
+    if (encoding == SleepHelper::EventHistory::encodingColumnar) {
+        combiner.withEventHistoryColumnar(900);
+    }
+    combiner.withCallback([](JSONWriter &writer, int &priority) {
+        writer.name("a").value(1);
+        return false;
+    });
+
+    const size_t maxSize = particle::protocol::MAX_EVENT_DATA_LENGTH;
+
+    combiner.addEvent("{\"t\":1657857600,\"v\":1}");
+    combiner.addEvent(bigEvent(1500));                          // Larger than the read buffer
+    combiner.addEvent("{\"t\":1657858500,\"v\":2}");
+    combiner.addEvent(bigEvent(maxSize - 2 - 6 - 1));          // Fits in the buffer but not in an event
+    combiner.addEvent("{\"t\":1657859400,\"v\":3}");
+    combiner.addEvent(wideEvent(maxSize));                     // Too large in columns and as JSON
+    combiner.addEvent("{\"t\":1657860300,\"v\":4}");
+
+    std::vector<String> events;
+    combiner.generateEvents(events, maxSize);
+
+    String all;
+    for (const String &event : events) {
+        CHECK(event.length() <= maxSize);
+        all += event;
+    }
+    CHECK(all.indexOf("xxxx") < 0);
+    CHECK(!fileExists(path));
+
+    if (encoding == SleepHelper::EventHistory::encodingJson) {
+        CHECK(all.indexOf("\"v\":1") >= 0);
+        CHECK(all.indexOf("\"v\":2") >= 0);
+        CHECK(all.indexOf("\"v\":3") >= 0);
+        CHECK(all.indexOf("\"v\":4") >= 0);
+    }
+    if (encoding != SleepHelper::EventHistory::encodingCborZ85) {
+        CHECK(all.indexOf("\"w1\"") < 0);
+    }
+    if (encoding == SleepHelper::EventHistory::encodingColumnar) {
+        // Each of the small events is sent in columns
+        int columns = 0;
+        for (int index = all.indexOf("\"k\":[\"v\"]"); index >= 0; index = all.indexOf("\"k\":[\"v\"]", index + 1)) {
+            columns++;
+        }
+        CHECK(columns >= 1);
+        CHECK(all.indexOf("\"t0\":1657857600") >= 0);
+        CHECK(all.indexOf("1657860300") >= 0);
+    }
+    printf("  encoding %d: %u events\n", (int)encoding, (unsigned)events.size());
+}
+
+typedef std::function<bool(JSONWriter &, int &)> Callback;
+
+/**
+ * @brief generateEvents() as it was before the arena and bin packing, for comparison
+ *
+ * @details Each callback is written to a scratch buffer, parsed again for its keys and copied to a String;
+ * the fragments are sorted and deduplicated with vectors of Strings and concatenated into events in
+ * priority order, stopping at the first fragment below priority 50 that doesn't fit. Every event that
+ * has event history is parsed again to check it was added.
+ */
+class LegacyEventInfo {
+public:
+    String json;
+    int priority = 0;
+    std::vector<String> keys;
+};
+
+void legacyGenerateEventInternal(Callback callback, char *buf, size_t maxSize, std::vector<LegacyEventInfo> &infoArray) {
+    memset(buf, 0, maxSize);
+    JSONBufferWriter writer(buf, maxSize);
+
+    int priority = 0;
+
+    writer.beginObject();
+    callback(writer, priority);
+    writer.endObject();
+
+    if (priority > 0 && strlen(buf) > 2) {
+        if (writer.dataSize() <= writer.bufferSize()) {
+            LegacyEventInfo eventInfo;
+            eventInfo.priority = priority;
+
+            JSONValue outerObj = JSONValue::parseCopy(buf);
+            JSONObjectIterator iter(outerObj);
+            while(iter.next()) {
+                eventInfo.keys.push_back((const char *)iter.name());
+            }
+
+            buf[strlen(buf) - 1] = 0;
+            eventInfo.json = &buf[1];
+
+            infoArray.push_back(eventInfo);
+        }
+    }
+}
+
+void legacyGenerateEvents(const std::vector<Callback> &callbacks, SleepHelper::EventHistory &eventHistory, const String &eventHistoryKey,
+                          std::vector<String> &events, size_t maxSize) {
+    events.clear();
+
+    std::vector<LegacyEventInfo> infoArray;
+    char *buf = (char *)malloc(maxSize + 1);
+    if (!buf) {
+        return;
+    }
+
+    for(auto it = callbacks.begin(); it != callbacks.end(); ++it) {
+        legacyGenerateEventInternal(*it, buf, maxSize, infoArray);
+    }
+
+    bool doRemoveEvents = false;
+
+    if (eventHistory.getHasEvents()) {
+        memset(buf, 0, maxSize);
+        JSONBufferWriter writer(buf, maxSize);
+
+        writer.beginObject();
+        writer.name(eventHistoryKey);
+
+        size_t overhead = eventHistoryKey.length() + 7;
+
+        if (eventHistory.getEvents(writer, maxSize - overhead, false)) {
+            LegacyEventInfo eventInfo;
+            eventInfo.priority = 1;
+            eventInfo.keys.push_back(eventHistoryKey);
+
+            writer.endObject();
+
+            buf[strlen(buf) - 1] = 0;
+            eventInfo.json = &buf[1];
+
+            infoArray.push_back(eventInfo);
+
+            doRemoveEvents = true;
+        }
+    }
+
+    if (!infoArray.empty()) {
+        std::sort(infoArray.begin(), infoArray.end(), [](LegacyEventInfo a, LegacyEventInfo b) {
+            return a.priority > b.priority;
+        });
+
+        std::vector<String> keysAdded;
+        for(auto it = infoArray.begin(); it != infoArray.end(); ) {
+            bool keyExists = false;
+
+            for(auto it2 = it->keys.begin(); it2 != it->keys.end(); ++it2) {
+                for(auto it3 = keysAdded.begin(); it3 != keysAdded.end(); ++it3) {
+                    if (*it3 == *it2) {
+                        keyExists = true;
+                        break;
+                    }
+                }
+                keysAdded.push_back(*it2);
+            }
+
+            if (keyExists) {
+                it = infoArray.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+
+        char *cur = buf;
+        char *end = &buf[maxSize - 2];
+
+        *cur++ = '{';
+        bool firstEventBuffer = true;
+
+        for(auto it = infoArray.begin(); it != infoArray.end(); ++it) {
+            if (&cur[strlen(it->json)] >= end) {
+                if (cur > &buf[1]) {
+                    *cur++ = '}';
+                    *cur = 0;
+                    events.push_back(buf);
+                    cur = &buf[1];
+                }
+                firstEventBuffer = false;
+            }
+
+            if (!firstEventBuffer && it->priority < 50) {
+                break;
+            }
+
+            if (cur != &buf[1]) {
+                *cur++ = ',';
+            }
+
+            strcpy(cur, it->json);
+            cur += strlen(cur);
+        }
+
+        if (cur > &buf[1]) {
+            *cur++ = '}';
+            *cur = 0;
+            events.push_back(buf);
+        }
+    }
+
+    if (doRemoveEvents) {
+        doRemoveEvents = false;
+
+        for(auto it = events.begin(); it != events.end(); ++it) {
+            JSONValue obj = JSONValue::parseCopy(*it);
+
+            JSONObjectIterator iter(obj);
+            while(iter.next()) {
+                String key = (const char *)iter.name();
+                if (key == eventHistoryKey) {
+                    doRemoveEvents = true;
+                }
+            }
+        }
+        if (doRemoveEvents) {
+            eventHistory.removeEvents();
+        }
+    }
+
+    while(eventHistory.getHasEvents()) {
+        memset(buf, 0, maxSize);
+        JSONBufferWriter writer(buf, maxSize);
+
+        writer.beginObject();
+        writer.name(eventHistoryKey);
+
+        if (eventHistory.getEvents(writer, maxSize - eventHistoryKey.length() - 6, false)) {
+            writer.endObject();
+
+            events.push_back(buf);
+            eventHistory.removeEvents();
+        }
+    }
+
+    free(buf);
+}
+
+const size_t numCallbacks = 50;
+const size_t numHistory = 500;
+
+/**
+ * @brief 50 callbacks of 1 to 3 keys at priorities from 1 to 100. The last 10 repeat a key of an earlier
+ * one, so they are dropped as duplicates.
+ */
+std::vector<Callback> makeCallbacks() {
+    std::vector<Callback> callbacks;
+    for (size_t ii = 0; ii < numCallbacks; ii++) {
+        callbacks.push_back([ii](JSONWriter &writer, int &priority) {
+            size_t keyIndex = (ii < numCallbacks - 10) ? ii : (ii - (numCallbacks - 10)) * 3;
+            priority = 1 + (int)((ii * 37) % 100);
+            writer.name(String::format("key%02u", (unsigned)keyIndex)).value((int)(ii * 1000 + 7));
+            if (ii % 3 == 0) {
+                writer.name(String::format("str%02u", (unsigned)ii)).value("sensor reading");
+            }
+            if (ii % 4 == 1) {
+                writer.name(String::format("flt%02u", (unsigned)ii)).value(12.5 + ii);
+            }
+            return true;
+        });
+    }
+    return callbacks;
+}
+
+void writeHistory(size_t index, JSONWriter &writer) {
+    writer.name("t").value((int)(1657857600 + index * 900));
+    writer.name("bs").value(2);
+    writer.name("c").value(21.5 + (index % 20) * 0.25);
+    writer.name("sm").value(40.0 + (index % 30));
+    writer.name("st").value(18.25);
+    writer.name("ws").value((int)(index % 2));
+}
+
+struct CombineResult {
+    uint64_t allocations;
+    uint64_t heapBytes;
+    uint64_t bytesCopied;
+    size_t events;
+    size_t callbackEvents;          //!< Events with callback data
+    size_t callbackBytes;           //!< Size of those events
+    size_t callbackKeys;            //!< Distinct callback keys sent
+    size_t historyRecords;
+};
+
+CombineResult measure(std::function<void(std::vector<String> &)> generate) {
+    std::vector<String> events;
+    events.reserve(64);
+
+    sim::Metrics before = sim::metrics();
+    generate(events);
+    const sim::Metrics &after = sim::metrics();
+
+    CombineResult result = {};
+    result.allocations = after.heapAllocations - before.heapAllocations;
+    result.heapBytes = after.heapBytes - before.heapBytes;
+    result.bytesCopied = after.bytesCopied - before.bytesCopied;
+    result.events = events.size();
+
+    std::vector<String> keysSeen;
+    for (const String &event : events) {
+        CHECK(event.length() <= particle::protocol::MAX_EVENT_DATA_LENGTH);
+        bool hasCallbackData = false;
+        JSONValue obj = JSONValue::parseCopy(event);
+        JSONObjectIterator iter(obj);
+        while(iter.next()) {
+            String key = (const char *)iter.name();
+            if (key == "eh") {
+                JSONArrayIterator records(iter.value());
+                while(records.next()) {
+                    result.historyRecords++;
+                }
+                continue;
+            }
+            hasCallbackData = true;
+            if (key.startsWith("key") && std::find(keysSeen.begin(), keysSeen.end(), key) == keysSeen.end()) {
+                keysSeen.push_back(key);
+            }
+        }
+        if (hasCallbackData) {
+            result.callbackEvents++;
+            result.callbackBytes += event.length();
+        }
+    }
+    result.callbackKeys = keysSeen.size();
+    return result;
+}
+
+/**
+ * @brief Heap allocations, bytes copied and events for 50 callbacks and 500 event history records, against
+ * the generateEvents() this replaced
+ */
+void testBenchmark() {
+    const size_t maxSize = particle::protocol::MAX_EVENT_DATA_LENGTH;
+    std::vector<Callback> callbacks = makeCallbacks();
+
+    SleepHelper::EventCombiner combiner;
+    combiner.withEventHistory("/usr/eh-bench.txt", "eh");
+    for (const Callback &callback : callbacks) {
+        combiner.withCallback(callback);
+    }
+    SleepHelper::EventHistory legacyHistory;
+    legacyHistory.withPath("/usr/eh-bench-legacy.txt");
+
+    printf("%u callbacks (10 duplicate keys) and %u event history records, %u byte events\n", (unsigned)numCallbacks,
+           (unsigned)numHistory, (unsigned)maxSize);
+    printf("  %-26s %12s %12s %12s %7s %22s %9s\n", "", "allocations", "heap bytes", "bytes copied", "events",
+           "callback events / fill", "keys sent");
+
+    CombineResult results[2][2];
+    for (int withHistory = 0; withHistory < 2; withHistory++) {
+        if (withHistory) {
+            CHECK(combiner.addEvents(numHistory, writeHistory));
+            CHECK(legacyHistory.addEvents(numHistory, writeHistory));
+        }
+        results[withHistory][0] = measure([&](std::vector<String> &events) {
+            legacyGenerateEvents(callbacks, legacyHistory, "eh", events, maxSize);
+        });
+        results[withHistory][1] = measure([&](std::vector<String> &events) {
+            combiner.generateEvents(events, maxSize);
+        });
+        for (int version = 0; version < 2; version++) {
+            const CombineResult &result = results[withHistory][version];
+            String name = String(version ? "arena, bin packing" : "before") + (withHistory ? ", history" : "");
+            printf("  %-26s %12llu %12llu %12llu %7u %15u / %4.1f%% %9u\n", name.c_str(), (unsigned long long)result.allocations,
+                   (unsigned long long)result.heapBytes, (unsigned long long)result.bytesCopied, (unsigned)result.events,
+                   (unsigned)result.callbackEvents, 100.0 * result.callbackBytes / (result.callbackEvents * maxSize),
+                   (unsigned)result.callbackKeys);
+            CHECK_INT(result.historyRecords, withHistory ? numHistory : 0);
+        }
+    }
+
+    // Reading the history file dominates once there is history, so the callbacks alone have the larger saving
+    CHECK(results[0][1].allocations * 10 < results[0][0].allocations);
+    for (const CombineResult *result : results) {
+        const CombineResult &before = result[0], &after = result[1];
+        CHECK(after.allocations < before.allocations);
+        CHECK(after.heapBytes < before.heapBytes);
+        CHECK(after.bytesCopied < before.bytesCopied);
+        CHECK(after.callbackEvents <= before.callbackEvents);
+        CHECK(after.callbackKeys >= before.callbackKeys);
+        CHECK(after.events <= before.events);
+    }
+}
+
+} // namespace
+
+int main() {
+    simtest::begin("EventCombinerTest");
+
+    printf("oversized event history lines\n");
+    testOversized("/usr/eh-json.txt", SleepHelper::EventHistory::encodingJson);
+    testOversized("/usr/eh-cbor.txt", SleepHelper::EventHistory::encodingCborZ85);
+    testOversized("/usr/eh-columnar.txt", SleepHelper::EventHistory::encodingColumnar);
+
+    testBenchmark();
+
+    return simtest::end("EventCombinerTest");
+}
@@ -0,0 +1,183 @@
+#include "SimTest.h"
+#include "SleepHelper.h"
+
+#include <filesystem>
+#include <sys/stat.h>
+
+// SleepHelper::EventHistory::withHeadOffset(): drains a backlog of 5,000 measurement events in
+// publish-sized pieces, as the event combiner does after a long time offline, once with the
+// default mode (the unsent events are copied to a new file after every publish) and once with
+// the head offset saved in <path>.head. Reports the file system bytes written against the size
+// of the history, and checks that both send every event once, in order, and remove their files.
+// Then a reset right after the compacted file is renamed into place, which must not skip unsent
+// events on the next boot, and a compacted copy that can't be created.
+
+namespace {
+
+const size_t numEvents = 5000;
+
+struct DrainResult {
+    size_t publishes = 0;
+    size_t events = 0;
+    bool inOrder = true;
+    uint64_t bytesWritten = 0;
+    uint64_t opens = 0;
+};
+
+off_t fileSize(const char *path) {
+    struct stat sb;
+    return stat((sim::config().fsDir + path).c_str(), &sb) == 0 ? sb.st_size : -1;
+}
+
+void fill(SleepHelper::EventHistory &history) {
+    history.addEvents(numEvents, [](size_t index, JSONWriter &writer) {
+        writer.name("t").value((int)(1657857600 + index * 900));
+        writer.name("bs").value(2);
+        writer.name("c").value(21.5 + (index % 20) * 0.25);
+        writer.name("sm").value(40.0 + (index % 30));
+        writer.name("st").value(18.25);
+        writer.name("ws").value((int)(index % 2));
+    });
+}
+
+DrainResult drain(SleepHelper::EventHistory &history) {
+    DrainResult result;
+    int lastTime = 0;
+
+    sim::Metrics before = sim::metrics();
+    while(history.getHasEvents()) {
+        char buf[particle::protocol::MAX_EVENT_DATA_LENGTH + 1];
+        JSONBufferWriter writer(buf, sizeof(buf) - 1);
+        writer.beginObject();
+        writer.name("eh");
+        if (!history.getEvents(writer, particle::protocol::MAX_EVENT_DATA_LENGTH - 8)) {
+            break;
+        }
+        writer.endObject();
+        writer.buffer()[std::min(writer.bufferSize(), writer.dataSize())] = 0;
+        result.publishes++;
+
+        for (const char *cur = strstr(buf, "\"t\":"); cur; cur = strstr(cur + 1, "\"t\":")) {
+            int time = atoi(cur + 4);
+            if (time <= lastTime) {
+                result.inOrder = false;
+            }
+            lastTime = time;
+            result.events++;
+        }
+    }
+    result.bytesWritten = sim::metrics().fsBytesWritten - before.fsBytesWritten;
+    result.opens = sim::metrics().fsOpens - before.fsOpens;
+    return result;
+}
+
+/**
+ * @brief First "t" and number of lines of an event history file
+ */
+size_t fileEvents(const char *path, int &firstTime) {
+    FILE *fp = fopen((sim::config().fsDir + path).c_str(), "r");
+    size_t lines = 0;
+    firstTime = 0;
+    if (fp) {
+        char line[256];
+        while (fgets(line, sizeof(line), fp)) {
+            const char *t = strstr(line, "\"t\":");
+            if (lines++ == 0 && t) {
+                firstTime = atoi(t + 4);
+            }
+        }
+        fclose(fp);
+    }
+    return lines;
+}
+
+} // namespace
+
+int main() {
+    simtest::begin("EventHistoryDrainTest");
+
+    SleepHelper::EventHistory copyHistory, headHistory;
+    copyHistory.withPath("/usr/eh-copy.txt");
+    headHistory.withPath("/usr/eh-head.txt").withHeadOffset();
+
+    fill(copyHistory);
+    fill(headHistory);
+    off_t historySize = fileSize("/usr/eh-copy.txt");
+    CHECK_INT(fileSize("/usr/eh-head.txt"), historySize);
+
+    printf("draining %u events, %ld bytes of history\n", (unsigned)numEvents, (long)historySize);
+
+    DrainResult copyResult = drain(copyHistory);
+    DrainResult headResult = drain(headHistory);
+
+    for (const DrainResult *result : {&copyResult, &headResult}) {
+        printf("  %-16s %4u publishes %10.2f MB written (%6.1fx the history) %5u opens\n",
+               (result == &copyResult) ? "copy per publish" : "head offset", (unsigned)result->publishes,
+               result->bytesWritten / 1e6, (double)result->bytesWritten / historySize, (unsigned)result->opens);
+        CHECK_INT(result->events, numEvents);
+        CHECK(result->inOrder);
+    }
+    CHECK_INT(headResult.publishes, copyResult.publishes);
+    CHECK(headResult.bytesWritten < 2 * (uint64_t)historySize);
+    CHECK(copyResult.bytesWritten > 10 * headResult.bytesWritten);
+
+    // Everything was sent, so the events and head files are gone
+    CHECK_INT(fileSize("/usr/eh-copy.txt"), -1);
+    CHECK_INT(fileSize("/usr/eh-head.txt"), -1);
+    CHECK_INT(fileSize("/usr/eh-head.txt.head"), -1);
+
+    // A reset right after the compacted file is renamed into place: the head offset of the old file was
+    // already removed, so the next boot sends every event in the compacted file
+    {
+        SleepHelper::EventHistory history;
+        history.withPath("/usr/eh-reset.txt").withHeadOffset();
+        fill(history);
+        bool reset = false;
+        sim::fileSystemHook([](const char *call, const char *path) {
+            if (strcmp(call, "rename") == 0 && strcmp(path, "/usr/eh-reset.txt") == 0) {
+                throw sim::ResetException{"reset after compaction"};
+            }
+        });
+        try {
+            drain(history);
+        }
+        catch (const sim::ResetException &e) {
+            reset = true;
+        }
+        sim::fileSystemHook(nullptr);
+        CHECK(reset);
+        CHECK_INT(fileSize("/usr/eh-reset.txt.head"), -1);
+
+        int firstTime;
+        size_t remaining = fileEvents("/usr/eh-reset.txt", firstTime);
+        CHECK(remaining > 0 && remaining < numEvents);
+
+        SleepHelper::EventHistory rebooted;
+        rebooted.withPath("/usr/eh-reset.txt").withHeadOffset();
+        char buf[particle::protocol::MAX_EVENT_DATA_LENGTH + 1];
+        JSONBufferWriter writer(buf, sizeof(buf) - 1);
+        CHECK(rebooted.getHasEvents());
+        CHECK(rebooted.getEvents(writer, particle::protocol::MAX_EVENT_DATA_LENGTH - 8, false));
+        writer.buffer()[std::min(writer.bufferSize(), writer.dataSize())] = 0;
+        const char *t = strstr(buf, "\"t\":");
+        CHECK(t && atoi(t + 4) == firstTime);
+        CHECK_INT(drain(rebooted).events, remaining);
+        printf("reset after compaction: %u unsent events sent after the reset\n", (unsigned)remaining);
+    }
+
+    // The compacted copy can't be created (a directory in the way of <path>.tmp): the history is kept and
+    // every event is still sent once
+    {
+        std::filesystem::create_directory(sim::config().fsDir + "/usr/eh-tmp.txt.tmp");
+        SleepHelper::EventHistory history;
+        history.withPath("/usr/eh-tmp.txt").withHeadOffset();
+        fill(history);
+        DrainResult result = drain(history);
+        CHECK_INT(result.events, numEvents);
+        CHECK(result.inOrder);
+        CHECK_INT(fileSize("/usr/eh-tmp.txt"), -1);
+        CHECK_INT(fileSize("/usr/eh-tmp.txt.head"), -1);
+    }
+
+    return simtest::end("EventHistoryDrainTest");
+}
@@ -0,0 +1,450 @@
+#include "SimTest.h"
+#include "SleepHelper.h"
+
+#include <cmath>
+#include <map>
+
+// SleepHelper::EventHistory encodings: decodes what getEvents() publishes and compares it with the
+// events that were added. encodingCborZ85: Z85Encode() against the Z85 specification's test
+// vector, then a Z85 and CBOR decode of a publish with integers, floats, strings, booleans and an
+// event with different keys; the padding after the CBOR map is zero bytes. encodingColumnar:
+// drains samples with jitter in the times, an event that is not numbers, and a key rounded with
+// withColumnPrecision(), converts every publish back with columnarToJson() and compares it with
+// the events that were added. Reports events per publish for the three encodings.
+
+namespace {
+
+//
+// Z85 and CBOR decoders, as a receiving server would have
+//
+
+bool z85Decode(const char *src, std::vector<uint8_t> &dst) {
+    static const char alphabet[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ.-:+=^!/*?&<>()[]{}@%$#";
+    size_t len = strlen(src);
+    if (len % 5) {
+        return false;
+    }
+    dst.clear();
+    for (size_t ii = 0; ii < len; ii += 5) {
+        uint32_t val = 0;
+        for (size_t jj = 0; jj < 5; jj++) {
+            const char *cp = strchr(alphabet, src[ii + jj]);
+            if (!cp || !*cp) {
+                return false;
+            }
+            val = val * 85 + (uint32_t)(cp - alphabet);
+        }
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            dst.push_back((uint8_t)(val >> shift));
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Decoded CBOR item (only what CborBufferWriter writes)
+ */
+struct CborItem {
+    enum Type { typeInt, typeFloat, typeString, typeBool, typeNull, typeArray, typeMap };
+    Type type = typeNull;
+    int64_t intValue = 0;
+    double floatValue = 0;
+    std::string str;
+    std::vector<CborItem> items;                    // Array items, or map keys and values alternating
+};
+
+double halfToDouble(uint16_t half) {
+    int exponent = (half >> 10) & 0x1f;
+    double mantissa = half & 0x3ff;
+    double val = (exponent == 0) ? std::ldexp(mantissa, -24) : std::ldexp(mantissa + 1024, exponent - 25);
+    return (half & 0x8000) ? -val : val;
+}
+
+bool cborDecode(const uint8_t *&cur, const uint8_t *end, CborItem &item) {
+    if (cur >= end) {
+        return false;
+    }
+    uint8_t initial = *cur++;
+    uint8_t majorType = initial >> 5;
+    uint8_t info = initial & 0x1f;
+
+    if (majorType == 7) {
+        if (info == 20 || info == 21) {
+            item.type = CborItem::typeBool;
+            item.intValue = (info == 21);
+        }
+        else
+        if (info == 22) {
+            item.type = CborItem::typeNull;
+        }
+        else
+        if (info == 25 && end - cur >= 2) {
+            item.type = CborItem::typeFloat;
+            item.floatValue = halfToDouble((uint16_t)((cur[0] << 8) | cur[1]));
+            cur += 2;
+        }
+        else
+        if (info == 26 && end - cur >= 4) {
+            uint32_t bits = ((uint32_t)cur[0] << 24) | ((uint32_t)cur[1] << 16) | ((uint32_t)cur[2] << 8) | cur[3];
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            item.type = CborItem::typeFloat;
+            item.floatValue = f;
+            cur += 4;
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t arg = info;
+    bool indefinite = false;
+    if (info >= 24 && info <= 27) {
+        size_t bytes = (size_t)1 << (info - 24);
+        if ((size_t)(end - cur) < bytes) {
+            return false;
+        }
+        arg = 0;
+        for (size_t ii = 0; ii < bytes; ii++) {
+            arg = (arg << 8) | *cur++;
+        }
+    }
+    else
+    if (info == 31 && majorType == 4) {
+        indefinite = true;
+    }
+    else
+    if (info > 23) {
+        return false;
+    }
+
+    switch(majorType) {
+        case 0:
+            item.type = CborItem::typeInt;
+            item.intValue = (int64_t)arg;
+            return true;
+
+        case 1:
+            item.type = CborItem::typeInt;
+            item.intValue = -1 - (int64_t)arg;
+            return true;
+
+        case 3:
+            if ((uint64_t)(end - cur) < arg) {
+                return false;
+            }
+            item.type = CborItem::typeString;
+            item.str.assign((const char *)cur, arg);
+            cur += arg;
+            return true;
+
+        case 4:
+        case 5:
+            item.type = (majorType == 4) ? CborItem::typeArray : CborItem::typeMap;
+            for (uint64_t ii = 0; indefinite || ii < ((majorType == 5) ? 2 * arg : arg); ii++) {
+                if (indefinite && cur < end && *cur == 0xff) {
+                    cur++;
+                    return true;
+                }
+                item.items.emplace_back();
+                if (!cborDecode(cur, end, item.items.back())) {
+                    return false;
+                }
+            }
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Checks a decoded value against the JSON value that was added
+ */
+bool sameValue(const CborItem &item, const JSONValue &value) {
+    if (value.isString()) {
+        return item.type == CborItem::typeString && item.str == (const char *)value.toString().data();
+    }
+    if (value.isBool()) {
+        return item.type == CborItem::typeBool && item.intValue == (value.toBool() ? 1 : 0);
+    }
+    if (value.isNull()) {
+        return item.type == CborItem::typeNull;
+    }
+    double d = value.toDouble();
+    if (item.type == CborItem::typeInt) {
+        return (double)item.intValue == d;
+    }
+    // 32-bit float: 24 bit mantissa
+    return item.type == CborItem::typeFloat && std::fabs(item.floatValue - d) <= std::fabs(d) * 6e-8;
+}
+
+String publish(SleepHelper::EventHistory &history) {
+    char buf[particle::protocol::MAX_EVENT_DATA_LENGTH + 1];
+    JSONBufferWriter writer(buf, sizeof(buf) - 1);
+    writer.beginObject();
+    writer.name("eh");
+    history.getEvents(writer, particle::protocol::MAX_EVENT_DATA_LENGTH - 8, false);
+    writer.endObject();
+    writer.buffer()[std::min(writer.bufferSize(), writer.dataSize())] = 0;
+    return String(buf);
+}
+
+/**
+ * @brief Publishes all of the events. Returns the number of publishes.
+ */
+size_t drain(SleepHelper::EventHistory &history) {
+    size_t publishes = 0;
+    while(history.getHasEvents()) {
+        publish(history);
+        if (!history.removeEvents()) {
+            break;
+        }
+        publishes++;
+    }
+    return publishes;
+}
+
+const char *testEvents[] = {
+    "{\"t\":1657857600,\"bs\":2,\"c\":21.5,\"sm\":43.7,\"st\":18.25,\"ws\":0}",
+    "{\"t\":1657858500,\"bs\":2,\"c\":21.75,\"sm\":43.1,\"st\":18.125,\"ws\":1}",
+    "{\"t\":1657859400,\"bs\":-3,\"c\":-4.0625,\"sm\":0,\"st\":123456.789,\"ws\":0}",
+    "{\"msg\":\"watering on\",\"ok\":true,\"n\":null,\"big\":4294967296}",
+    "{\"t\":1657860300,\"bs\":1,\"c\":3.14159265,\"sm\":99.9,\"st\":-0.5,\"ws\":0}",
+};
+
+const size_t numSamples = 200;
+
+/**
+ * @brief A 15 minute sample, as take_measurements.cpp adds to the event history
+ */
+String sampleEvent(size_t ii) {
+    return String::format("{\"t\":%lu,\"bs\":2,\"c\":%.2f,\"sm\":%.1f,\"st\":%.2f,\"ws\":%d}", (unsigned long)(1657857600 + ii * 900),
+                          20.0 + (ii % 40) * 0.25, 40.0 + (ii % 30) * 0.5, 18.0 + (ii % 20) * 0.25, (int)(ii % 2));
+}
+
+void testZ85() {
+    // Test vector from the Z85 specification (https://rfc.zeromq.org/spec/32/)
+    const uint8_t hello[8] = { 0x86, 0x4F, 0xD2, 0x6F, 0xB5, 0x59, 0xF7, 0x5B };
+    char out[16];
+    CHECK_INT(SleepHelper::Z85Encode(hello, sizeof(hello), out, sizeof(out)), 10);
+    CHECK(strcmp(out, "HelloWorld") == 0);
+
+    // Padded to a multiple of 4 with zeros, and too small a buffer
+    const uint8_t odd[5] = { 1, 2, 3, 4, 5 };
+    CHECK_INT(SleepHelper::Z85Encode(odd, sizeof(odd), out, sizeof(out)), 10);
+    std::vector<uint8_t> decoded;
+    CHECK(z85Decode(out, decoded));
+    CHECK_INT(decoded.size(), 8);
+    CHECK(memcmp(decoded.data(), odd, sizeof(odd)) == 0 && decoded[5] == 0 && decoded[6] == 0 && decoded[7] == 0);
+    CHECK_INT(SleepHelper::Z85Encode(odd, sizeof(odd), out, 10), 0);
+}
+
+void testCborZ85() {
+    SleepHelper::EventHistory history;
+    history.withPath("/usr/eh-cbor.txt").withEncoding(SleepHelper::EventHistory::encodingCborZ85);
+    for (const char *event : testEvents) {
+        history.addEvent(event);
+    }
+
+    String published = publish(history);
+    JSONValue outer = JSONValue::parseCopy(published);
+    JSONObjectIterator iter(outer);
+    CHECK(iter.next() && iter.name() == "eh" && iter.value().isString());
+
+    std::vector<uint8_t> cbor;
+    CHECK(z85Decode(iter.value().toString().data(), cbor));
+
+    const uint8_t *cur = cbor.data(), *end = cbor.data() + cbor.size();
+    CborItem root;
+    CHECK(cborDecode(cur, end, root));
+
+    // Padding: 0 to 3 zero bytes after the map
+    CHECK(end - cur < 4);
+    while(cur < end) {
+        CHECK_INT(*cur++, 0);
+    }
+
+    CHECK(root.type == CborItem::typeMap && root.items.size() == 4);
+    if (root.type != CborItem::typeMap || root.items.size() != 4) {
+        return;
+    }
+    CHECK(root.items[0].str == "k" && root.items[2].str == "r");
+    const CborItem &keys = root.items[1];
+    const CborItem &records = root.items[3];
+    CHECK_INT(keys.items.size(), 6);
+    CHECK_INT(records.items.size(), sizeof(testEvents) / sizeof(testEvents[0]));
+
+    int mismatches = 0;
+    for (size_t ii = 0; ii < records.items.size() && ii < sizeof(testEvents) / sizeof(testEvents[0]); ii++) {
+        JSONValue obj = JSONValue::parseCopy(testEvents[ii]);
+        const CborItem &record = records.items[ii];
+
+        JSONObjectIterator objIter(obj);
+        size_t index = 0;
+        while(objIter.next()) {
+            if (record.type == CborItem::typeArray) {
+                // Same keys as the first event, values only
+                if (index >= record.items.size() || keys.items[index].str != (const char *)objIter.name().data() || !sameValue(record.items[index], objIter.value())) {
+                    mismatches++;
+                }
+            }
+            else {
+                if (2 * index + 1 >= record.items.size() || record.items[2 * index].str != (const char *)objIter.name().data() || !sameValue(record.items[2 * index + 1], objIter.value())) {
+                    mismatches++;
+                }
+            }
+            index++;
+        }
+    }
+    CHECK_INT(mismatches, 0);
+    CHECK(records.items[3].type == CborItem::typeMap);           // Different keys
+
+    // Events per publish against JSON, for 15 minute samples
+    history.removeEvents();
+    CHECK(!history.getHasEvents());
+
+    SleepHelper::EventHistory jsonHistory, columnarHistory;
+    jsonHistory.withPath("/usr/eh-json.txt");
+    columnarHistory.withPath("/usr/eh-columnar.txt").withColumnar(900);
+    for (size_t ii = 0; ii < numSamples; ii++) {
+        String event = sampleEvent(ii);
+        history.addEvent(event);
+        jsonHistory.addEvent(event);
+        columnarHistory.addEvent(event);
+    }
+    size_t jsonPublishes = drain(jsonHistory);
+    size_t cborPublishes = drain(history);
+    size_t columnarPublishes = drain(columnarHistory);
+    printf("%u samples: JSON %u publishes (%.1f events each), CBOR/Z85 %u publishes (%.1f events each), columnar %u publishes (%.1f events each)\n",
+           (unsigned)numSamples, (unsigned)jsonPublishes, (double)numSamples / jsonPublishes, (unsigned)cborPublishes, (double)numSamples / cborPublishes,
+           (unsigned)columnarPublishes, (double)numSamples / columnarPublishes);
+    CHECK(cborPublishes * 2 <= jsonPublishes);
+    CHECK(columnarPublishes * 3 <= jsonPublishes);
+}
+
+/**
+ * @brief Checks a value converted back from columns against the JSON value that was added
+ */
+bool sameColumnValue(const JSONValue &value, const JSONValue &expected, int decimalPlaces) {
+    if (!value.isNumber()) {
+        return false;
+    }
+    // Rounded to decimalPlaces, so within half of the last place
+    return std::fabs(value.toDouble() - expected.toDouble()) <= 0.5 * std::pow(10.0, -decimalPlaces) + 1e-9;
+}
+
+void testColumnar() {
+    SleepHelper::EventHistory history;
+    history.withPath("/usr/eh-columnar.txt").withColumnar(900).withColumnPrecision("st", 1);
+
+    // Samples a few seconds off the interval, with an event that is not all numbers in the middle
+    std::vector<String> events;
+    for (size_t ii = 0; ii < numSamples; ii++) {
+        String event = sampleEvent(ii);
+        if (ii % 7 == 3) {
+            event.replace("00,", String::format("%02d,", (int)(ii % 5)));
+        }
+        events.push_back(event);
+        if (ii == numSamples / 2) {
+            events.push_back("{\"msg\":\"watering on\",\"ok\":true}");
+        }
+    }
+    for (const String &event : events) {
+        history.addEvent(event);
+    }
+
+    size_t publishes = 0, received = 0, mismatches = 0, publishedBytes = 0, jitter = 0;
+    std::vector<char> jsonBuf(64 * 1024);
+    while(history.getHasEvents()) {
+        String published = publish(history);
+        CHECK(published.length() <= particle::protocol::MAX_EVENT_DATA_LENGTH);
+        publishedBytes += published.length();
+        if (!history.removeEvents()) {
+            break;
+        }
+        publishes++;
+
+        JSONValue outer = JSONValue::parseCopy(published);
+        JSONObjectIterator iter(outer);
+        CHECK(iter.next() && iter.name() == "eh");
+        JSONValue src = iter.value();
+        if (src.isObject() && published.indexOf("\"tr\"") >= 0) {
+            jitter++;
+        }
+
+        // Decimal places for each key, from the columns
+        std::map<String, int> decimalPlaces;
+        if (src.isObject()) {
+            JSONValue k, p;
+            JSONObjectIterator srcIter(src);
+            while(srcIter.next()) {
+                if (srcIter.name() == "k") k = srcIter.value();
+                if (srcIter.name() == "p") p = srcIter.value();
+            }
+            JSONArrayIterator kIter(k), pIter(p);
+            while(kIter.next() && pIter.next()) {
+                decimalPlaces[(const char *)kIter.value().toString().data()] = pIter.value().toInt();
+            }
+        }
+
+        JSONBufferWriter writer(jsonBuf.data(), jsonBuf.size() - 1);
+        CHECK(SleepHelper::EventHistory::columnarToJson(src, writer));
+        writer.buffer()[std::min(writer.bufferSize(), writer.dataSize())] = 0;
+
+        JSONValue array = JSONValue::parseCopy(jsonBuf.data());
+        CHECK(array.isArray());
+        JSONArrayIterator arrayIter(array);
+        while(arrayIter.next()) {
+            if (received >= events.size()) {
+                mismatches++;
+                break;
+            }
+            JSONValue expected = JSONValue::parseCopy(events[received++]);
+            JSONObjectIterator eventIter(arrayIter.value()), expectedIter(expected);
+            while(expectedIter.next()) {
+                if (!eventIter.next() || eventIter.name() != expectedIter.name()) {
+                    mismatches++;
+                    break;
+                }
+                bool same;
+                if (src.isObject()) {
+                    same = sameColumnValue(eventIter.value(), expectedIter.value(), decimalPlaces[(const char *)expectedIter.name()]);
+                }
+                else {
+                    same = (eventIter.value().toString() == expectedIter.value().toString());
+                }
+                if (!same) {
+                    mismatches++;
+                }
+            }
+            if (eventIter.next()) {
+                mismatches++;
+            }
+        }
+    }
+
+    size_t historyBytes = 0;
+    for (const String &event : events) {
+        historyBytes += event.length() + 1;
+    }
+    printf("columnar round trip: %u events in %u publishes (%u with time jitter), %u bytes published for %u bytes of JSON\n",
+           (unsigned)received, (unsigned)publishes, (unsigned)jitter, (unsigned)publishedBytes, (unsigned)historyBytes);
+    CHECK_INT(received, events.size());
+    CHECK_INT(mismatches, 0);
+    CHECK(jitter > 0);
+    CHECK(!history.getHasEvents());
+}
+
+} // namespace
+
+int main() {
+    simtest::begin("EventHistoryEncodingTest");
+
+    testZ85();
+    testCborZ85();
+    testColumnar();
+
+    return simtest::end("EventHistoryEncodingTest");
+}
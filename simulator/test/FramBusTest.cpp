@@ -0,0 +1,87 @@
+#include "SimTest.h"
+#include "storage_objects.h"
+
+// MB85RC::withBufferSize(): I2C transactions, bus bytes and bus time at 400 kHz for fram.put() of
+// the storage objects, a read back and fram.erase() with the default 32 byte Wire buffer and with
+// the 128 byte buffer the application acquires in acquireWireBuffer().
+
+namespace {
+
+struct Cost {
+    uint64_t transactions;
+    uint64_t bytes;
+
+    double busMs() const {
+        return simtest::i2cBusMs(transactions, bytes);
+    }
+};
+
+template <class Fn>
+Cost measure(Fn fn) {
+    sim::Metrics before = sim::metrics();
+    fn();
+    return Cost{sim::metrics().i2cTransactions - before.i2cTransactions, sim::metrics().i2cBytes - before.i2cBytes};
+}
+
+void printCost(const char *what, size_t bufferSize, const Cost &cost) {
+    printf("  %-22s %3u byte buffer %5llu transactions %6llu bus bytes %7.2f ms\n", what, (unsigned)bufferSize,
+           (unsigned long long)cost.transactions, (unsigned long long)cost.bytes, cost.busMs());
+}
+
+} // namespace
+
+int main() {
+    simtest::begin("FramBusTest");
+
+    Wire.begin();                                   // Wire buffers are I2C_BUFFER_SIZE, from acquireWireBuffer()
+    MB85RC64 chip(Wire, 0);
+    chip.begin();
+
+    systemStatus_structure status = {};
+    status.currentConnectionLimit = 600;
+    status.wakeTime = 6;
+    status.sleepTime = 22;
+    current_structure values = {};
+    values.soilMoisture = 42.5;
+    values.lastSampleTime = 1657857600;
+
+    printf("MB85RC64 (%u bytes), sysStatus %u bytes, current %u bytes\n", (unsigned)chip.length(), (unsigned)sizeof(status), (unsigned)sizeof(values));
+
+    Cost costs[2][4];
+    const size_t bufferSizes[2] = {32, I2C_BUFFER_SIZE};
+    for (int ii = 0; ii < 2; ii++) {
+        chip.withBufferSize(bufferSizes[ii]);
+
+        costs[ii][0] = measure([&]() { chip.put(FRAM::systemStatusAddr, status); });
+        printCost("fram.put(sysStatus)", bufferSizes[ii], costs[ii][0]);
+
+        costs[ii][1] = measure([&]() { chip.put(FRAM::currentStatusAddr, values); });
+        printCost("fram.put(current)", bufferSizes[ii], costs[ii][1]);
+
+        current_structure readBack;
+        costs[ii][2] = measure([&]() { chip.get(FRAM::currentStatusAddr, readBack); });
+        printCost("fram.get(current)", bufferSizes[ii], costs[ii][2]);
+        CHECK(memcmp(&readBack, &values, sizeof(values)) == 0);
+
+        costs[ii][3] = measure([&]() { CHECK(chip.erase()); });
+        printCost("fram.erase()", bufferSizes[ii], costs[ii][3]);
+
+        uint8_t erased[256];
+        bool allZero = true;
+        for (size_t addr = 0; addr < chip.length(); addr += sizeof(erased)) {
+            chip.readData(addr, erased, sizeof(erased));
+            for (uint8_t byte : erased) allZero = allZero && byte == 0;
+        }
+        CHECK(allZero);
+    }
+
+    // Each struct goes out in a single transaction with the larger buffer
+    CHECK_INT(costs[1][0].transactions, 1);
+    CHECK_INT(costs[1][1].transactions, 1);
+    CHECK_INT(costs[0][1].transactions, 2);
+    CHECK_INT(costs[1][2].transactions, 2);                     // Set the address, then one read
+    CHECK_INT(costs[1][3].transactions, (8192 + 125) / 126);
+    CHECK(costs[1][3].bytes < costs[0][3].bytes);
+
+    return simtest::end("FramBusTest");
+}
@@ -0,0 +1,139 @@
+#include "SimTest.h"
+#include "storage_objects.h"
+
+// MB85RCWriteCache: erase() and erase(framAddr, numBytes) keep the unflushed changes outside the
+// range. Then runs the application for a day and checks, every time it is asleep, that nothing is
+// left in the FRAM cache: the chip holds the storage objects and the data log header exactly as
+// the application sees them. The loop leaves out the storageObjectLoop() call at the end of the
+// application's loop(), so only the sleep or reset function writes the storage objects and
+// flushes the cache.
+
+#include "sleep_helper_config.h"
+
+void setup();
+
+/**
+ * @brief The application's loop() without the storageObjectLoop() at the end
+ */
+void loopWithoutStore() {
+    SleepHelper::instance().loop();
+    ab1805.loop();
+    PublishQueuePosix::instance().loop();
+}
+
+namespace {
+
+MB85RC64 rawFram(Wire, 0);                          // The carrier FRAM without a cache
+
+uint8_t rawByte(size_t framAddr) {
+    uint8_t value = 0xff;
+    rawFram.readData(framAddr, &value, 1);
+    return value;
+}
+
+void testErase() {
+    MB85RCWriteCache<MB85RC64, 0x40, 16> cache(Wire, 0);
+    uint8_t value = 0x5a;
+
+    // Dirty pages on both sides of an erased page survive the erase
+    CHECK(cache.erase());
+    cache.writeData(0x02, &value, 1);
+    cache.writeData(0x30, &value, 1);
+    cache.writeData(0x18, &value, 1);
+    CHECK(cache.erase(0x10, 0x10));
+    CHECK(cache.flush());
+    CHECK_INT(rawByte(0x02), value);
+    CHECK_INT(rawByte(0x30), value);
+    CHECK_INT(rawByte(0x18), 0);
+
+    // A partly erased page stays dirty for the bytes outside the range
+    cache.writeData(0x14, &value, 1);
+    cache.writeData(0x11, &value, 1);
+    CHECK(cache.erase(0x10, 2));
+    CHECK(cache.isDirty());
+    uint8_t readBack = 0xff;
+    cache.readData(0x11, &readBack, 1);
+    CHECK_INT(readBack, 0);
+    CHECK(cache.flush());
+    CHECK_INT(rawByte(0x11), 0);
+    CHECK_INT(rawByte(0x14), value);
+
+    // A range that starts in the cache and ends past it
+    cache.writeData(0x3f, &value, 1);
+    value = 0x77;
+    rawFram.writeData(0x40, &value, 1);
+    CHECK(cache.erase(0x3e, 4));
+    CHECK(cache.flush());
+    CHECK_INT(rawByte(0x3f), 0);
+    CHECK_INT(rawByte(0x40), 0);
+    CHECK_INT(rawByte(0x30), 0x5a);
+
+    // A full erase leaves nothing to flush
+    cache.writeData(0x20, &value, 1);
+    CHECK(cache.erase());
+    CHECK(!cache.isDirty());
+    CHECK_INT(rawByte(0x20), 0);
+    CHECK_INT(rawByte(0x02), 0);
+}
+
+int sleepsChecked = 0;
+int sleepsDirty = 0;
+uint32_t lastSleepChecked = 0;
+
+/**
+ * @brief Runs every 10 seconds of virtual time and checks the FRAM the first time it finds the device asleep
+ */
+void checkWhileAsleep() {
+    if (sim::sleeping() && sim::metrics().sleeps != lastSleepChecked) {
+        lastSleepChecked = sim::metrics().sleeps;
+        sleepsChecked++;
+
+        uint8_t cached[FRAM_CACHE_SIZE], stored[FRAM_CACHE_SIZE];
+        fram.readData(0, cached, sizeof(cached));
+        rawFram.readData(0, stored, sizeof(stored));
+
+        current_structure storedCurrent;
+        rawFram.get(FRAM::currentStatusAddr, storedCurrent);
+
+        if (fram.isDirty() || memcmp(cached, stored, sizeof(cached)) != 0 || memcmp(&storedCurrent, &current, sizeof(current)) != 0) {
+            sleepsDirty++;
+        }
+    }
+    sim::at(sim::now() + 10000, checkWhileAsleep);
+}
+
+} // namespace
+
+int main() {
+    simtest::begin("FramCacheTest");
+
+    Wire.begin();
+    rawFram.withBufferSize(I2C_BUFFER_SIZE).begin();
+    testErase();
+
+    sim::analogSource(A4, []() { return (int32_t)931; });
+    sim::analogSource(A1, []() { return (int32_t)1551; });
+    sim::analogSource(A0, []() { return (int32_t)1861; });
+
+    try {
+        setup();
+        sim::runThreads();
+        sim::at(sim::now() + 10000, checkWhileAsleep);
+
+        while (sim::now() < 24ULL * 3600 * 1000) {
+            loopWithoutStore();
+            sim::runThreads();
+            sim::advance(10);
+            sim::checkWatchdog();
+        }
+    }
+    catch (const sim::ResetException &e) {
+        simtest::checkFailed(__FILE__, __LINE__, e.reason);
+    }
+
+    printf("%d sleeps checked, %d with FRAM changes not written\n", sleepsChecked, sleepsDirty);
+    CHECK(sleepsChecked > 50);
+    CHECK_INT(sleepsDirty, 0);
+
+    return simtest::end("FramCacheTest");
+}
@@ -0,0 +1,115 @@
+#include "SimTest.h"
+#include "MB85RC256V-FRAM-RK.h"
+
+// MB85RC::erase(): bus time at 400 kHz of a full erase of an 8 KB (MB85RC64), a 32 KB (MB85RC256V,
+// 256 Kbit) and a 128 KB (MB85RC1M) part, with the default 32 byte and a 128 byte Wire buffer,
+// against the region-scoped erase(0, 0x100) that storageObjectStart() does when the FRAM map
+// version changes. Checks that erase(framAddr, numBytes) clears exactly its range.
+
+namespace {
+
+/**
+ * @brief FRAM of any size. Parts over 64 KB use the low bit of the device address as address bit 16,
+ * so they are attached as two banks that share the memory.
+ */
+class FramChip : public sim::I2CDevice {
+public:
+    FramChip(std::vector<uint8_t> &memory, size_t bank) : memory(memory), bankOffset(bank * 65536) {}
+
+    virtual void write(const uint8_t *data, size_t size) override {
+        if (size < 2) {
+            return;
+        }
+        addr = bankOffset + (((size_t)data[0] << 8) | data[1]);
+        for (size_t ii = 2; ii < size; ii++) {
+            memory[addr++ % memory.size()] = data[ii];
+        }
+    }
+
+    virtual void read(uint8_t *data, size_t size) override {
+        for (size_t ii = 0; ii < size; ii++) {
+            data[ii] = memory[addr++ % memory.size()];
+        }
+    }
+
+private:
+    std::vector<uint8_t> &memory;
+    size_t bankOffset;
+    size_t addr = 0;
+};
+
+size_t nonZero(const std::vector<uint8_t> &memory, size_t start, size_t end) {
+    size_t count = 0;
+    for (size_t ii = start; ii < end; ii++) {
+        if (memory[ii]) count++;
+    }
+    return count;
+}
+
+double eraseMs(MB85RC &chip, size_t framAddr, size_t numBytes) {
+    sim::Metrics before = sim::metrics();
+    CHECK(chip.erase(framAddr, numBytes));
+    return simtest::i2cBusMs(sim::metrics().i2cTransactions - before.i2cTransactions, sim::metrics().i2cBytes - before.i2cBytes);
+}
+
+void benchmark(const char *name, MB85RC &chip, std::vector<uint8_t> &memory) {
+    for (size_t bufferSize : {(size_t)32, (size_t)128}) {
+        chip.withBufferSize(bufferSize);
+
+        std::fill(memory.begin(), memory.end(), 0xa5);
+        double fullMs = eraseMs(chip, 0, chip.length());
+        CHECK_INT(nonZero(memory, 0, memory.size()), 0);
+
+        std::fill(memory.begin(), memory.end(), 0xa5);
+        double regionMs = eraseMs(chip, 0, 0x100);
+        CHECK_INT(nonZero(memory, 0, 0x100), 0);
+        CHECK_INT(nonZero(memory, 0x100, memory.size()), memory.size() - 0x100);
+
+        printf("  %-10s %6u bytes %3u byte buffer: erase() %8.1f ms, erase(0, 0x100) %5.2f ms\n", name, (unsigned)chip.length(),
+               (unsigned)bufferSize, fullMs, regionMs);
+    }
+}
+
+} // namespace
+
+int main() {
+    simtest::begin("FramEraseTest");
+
+    Wire.begin();                                   // 128 byte Wire buffers, from the application's acquireWireBuffer()
+
+    std::vector<uint8_t> memory64(8192), memory256(32768), memory1M(131072);
+    FramChip chip64(memory64, 0), chip256(memory256, 0), chip1MLow(memory1M, 0), chip1MHigh(memory1M, 1);
+    sim::attachI2C(0x51, &chip64);                  // The carrier FRAM is at 0x50
+    sim::attachI2C(0x54, &chip256);
+    sim::attachI2C(0x56, &chip1MLow);
+    sim::attachI2C(0x57, &chip1MHigh);
+
+    MB85RC64 fram64(Wire, 1);
+    MB85RC256V fram256(Wire, 4);
+    MB85RC1M fram1M(Wire, 6);
+
+    // A range in the middle, one across the 64 KB boundary of the MB85RC1M, and one past the end
+    std::fill(memory256.begin(), memory256.end(), 0xa5);
+    CHECK(fram256.erase(1000, 3000));
+    CHECK_INT(nonZero(memory256, 0, 1000), 1000);
+    CHECK_INT(nonZero(memory256, 1000, 4000), 0);
+    CHECK_INT(nonZero(memory256, 4000, memory256.size()), memory256.size() - 4000);
+
+    std::fill(memory1M.begin(), memory1M.end(), 0xa5);
+    CHECK(fram1M.erase(65000, 1000));
+    CHECK_INT(nonZero(memory1M, 65000, 66000), 0);
+    CHECK_INT(nonZero(memory1M, 0, 65000) + nonZero(memory1M, 66000, memory1M.size()), memory1M.size() - 1000);
+
+    std::fill(memory64.begin(), memory64.end(), 0xa5);
+    CHECK(fram64.erase(8000, 1000));
+    CHECK_INT(nonZero(memory64, 0, 8000), 8000);
+    CHECK_INT(nonZero(memory64, 8000, 8192), 0);
+    CHECK(!fram64.erase(8192, 1));
+
+    printf("erase bus time at 400 kHz\n");
+    benchmark("MB85RC64", fram64, memory64);
+    benchmark("MB85RC256V", fram256, memory256);
+    benchmark("MB85RC1M", fram1M, memory1M);
+
+    return simtest::end("FramEraseTest");
+}
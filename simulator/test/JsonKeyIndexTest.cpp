@@ -0,0 +1,142 @@
+#include "SimTest.h"
+#include "JsonParserGeneratorRK.h"
+
+// JsonParser::enableKeyIndex(): looks up every key of a 50-key object, as SettingsFile does, with
+// and without the index and compares the results, including a nested object, a duplicate key, a
+// missing key, a key that is a prefix of another and an escaped key (the linear search is used).
+// Lookups made after JsonModifier changes use the rebuilt index. Reports lookups/s for both.
+
+namespace {
+
+const int numKeys = 50;
+
+String makeSettings() {
+    String json = "{";
+    for (int ii = 0; ii < numKeys; ii++) {
+        json += String::format("\"setting%02d\":%d,", ii, ii * 10);
+    }
+    json += "\"nested\":{\"setting00\":-1,\"inner\":2},\"dup\":1,\"dup\":2,\"pre\":3,\"prefix\":4}";
+    return json;
+}
+
+/**
+ * @brief Looks up key in container with the index, then without it, and checks they agree
+ */
+bool sameLookup(JsonParser &indexed, JsonParser &linear, const char *key, bool nested = false) {
+    const JsonParserGeneratorRK::jsmntok_t *indexedContainer = indexed.getOuterObject();
+    const JsonParserGeneratorRK::jsmntok_t *linearContainer = linear.getOuterObject();
+    if (nested) {
+        indexed.getValueTokenByKey(indexedContainer, "nested", indexedContainer);
+        linear.getValueTokenByKey(linearContainer, "nested", linearContainer);
+    }
+
+    const JsonParserGeneratorRK::jsmntok_t *indexedValue = NULL, *linearValue = NULL;
+    bool indexedFound = indexed.getValueTokenByKey(indexedContainer, key, indexedValue);
+    bool linearFound = linear.getValueTokenByKey(linearContainer, key, linearValue);
+    if (indexedFound != linearFound) {
+        return false;
+    }
+    if (!indexedFound) {
+        return true;
+    }
+    String indexedStr, linearStr;
+    indexed.getTokenValue(indexedValue, indexedStr);
+    linear.getTokenValue(linearValue, linearStr);
+    return indexedStr == linearStr;
+}
+
+/**
+ * @brief Looks up all of the settings keys repeatedly. Returns lookups/s.
+ */
+double lookupsPerSecond(JsonParser &parser, int &sum) {
+    const int passes = 2000;
+    char keys[numKeys][12];
+    for (int ii = 0; ii < numKeys; ii++) {
+        snprintf(keys[ii], sizeof(keys[ii]), "setting%02d", ii);
+    }
+
+    double start = simtest::hostSeconds();
+    for (int pass = 0; pass < passes; pass++) {
+        for (int ii = 0; ii < numKeys; ii++) {
+            int value = 0;
+            parser.getOuterValueByKey(keys[ii], value);
+            sum += value;
+        }
+    }
+    return (double)passes * numKeys / (simtest::hostSeconds() - start);
+}
+
+} // namespace
+
+int main() {
+    simtest::begin("JsonKeyIndexTest");
+
+    String json = makeSettings();
+    JsonParserStatic<2048, 256> indexed, linear;
+    indexed.enableKeyIndex();
+    indexed.addString(json);
+    linear.addString(json);
+    CHECK(indexed.parse());
+    CHECK(linear.parse());
+
+    for (int ii = 0; ii < numKeys; ii++) {
+        char key[12];
+        snprintf(key, sizeof(key), "setting%02d", ii);
+        int value = -1;
+        CHECK(indexed.getOuterValueByKey(key, value));
+        CHECK_INT(value, ii * 10);
+        CHECK(sameLookup(indexed, linear, key));
+    }
+    int value = 0;
+    CHECK(indexed.getOuterValueByKey("dup", value));
+    CHECK_INT(value, 1);                                        // The first one, as the linear search finds
+    for (const char *key : {"dup", "pre", "prefix", "pref", "missing", "", "inner"}) {
+        CHECK(sameLookup(indexed, linear, key));
+    }
+    CHECK(sameLookup(indexed, linear, "setting00", true));
+    CHECK(sameLookup(indexed, linear, "inner", true));
+    CHECK(sameLookup(indexed, linear, "setting01", true));
+
+    // Changes through JsonModifier invalidate the index
+    for (JsonParser *parser : {(JsonParser *)&indexed, (JsonParser *)&linear}) {
+        JsonModifier mod(*parser);
+        mod.insertOrUpdateKeyValue(parser->getOuterObject(), "setting10", 12345);
+        mod.insertOrUpdateKeyValue(parser->getOuterObject(), "added", 7);
+        mod.removeKeyValue(parser->getOuterObject(), "setting20");
+    }
+    CHECK(indexed.getOuterValueByKey("setting10", value));
+    CHECK_INT(value, 12345);
+    CHECK(indexed.getOuterValueByKey("added", value));
+    CHECK_INT(value, 7);
+    CHECK(!indexed.getOuterValueByKey("setting20", value));
+    for (const char *key : {"setting10", "setting19", "setting20", "setting21", "added", "setting49", "nested"}) {
+        CHECK(sameLookup(indexed, linear, key));
+    }
+
+    // An escaped key uses the linear search
+    JsonParserStatic<256, 16> escaped;
+    escaped.enableKeyIndex();
+    escaped.addString("{\"a\\\"b\":1,\"c\":2}");
+    CHECK(escaped.parse());
+    CHECK(escaped.getOuterValueByKey("a\"b", value));
+    CHECK_INT(value, 1);
+    CHECK(escaped.getOuterValueByKey("c", value));
+    CHECK_INT(value, 2);
+
+    // Lookups/s for every key of the 50-key object
+    indexed.clear();
+    indexed.addString(json);
+    linear.clear();
+    linear.addString(json);
+    CHECK(indexed.parse());
+    CHECK(linear.parse());
+    int indexedSum = 0, linearSum = 0;
+    double linearRate = lookupsPerSecond(linear, linearSum);
+    double indexedRate = lookupsPerSecond(indexed, indexedSum);
+    printf("%d-key object: linear %.0fk lookups/s, indexed %.0fk lookups/s (%.1fx)\n", numKeys, linearRate / 1000,
+           indexedRate / 1000, indexedRate / linearRate);
+    CHECK_INT(indexedSum, linearSum);
+    CHECK(indexedRate > 2 * linearRate);
+
+    return simtest::end("JsonKeyIndexTest");
+}
@@ -0,0 +1,240 @@
+#include "SimTest.h"
+#include "JsonParserGeneratorRK.h"
+
+#include <string>
+#include <vector>
+
+// JsonStreamParser: parses a 16 KB document with nested objects and arrays, every value type and
+// string escapes in 512-byte chunks (and 1 byte, 7 bytes and all at once) with a 512 byte
+// JsonStreamParserStatic<128, 8>, and compares the events with a walk of the same document parsed
+// by the Device OS JSONValue parser. \u escapes, which the host JSONValue leaves as they are, are
+// checked against their UTF-8 separately. Then valid and invalid edge cases, including finish() on data
+// that ends in the middle of a string, literal or number (ERROR_INCOMPLETE), multipart webhook
+// responses in and out of order, and host MB/s.
+
+namespace {
+
+const char *valueTypeName[] = { "s", "n", "b", "z" };
+
+/**
+ * @brief Position of an event, as getDepth(), getKey() and getIndex() report it
+ */
+std::string position(size_t depth, const std::string &key, size_t index) {
+    return std::to_string(depth) + ":" + key + ":" + std::to_string(index);
+}
+
+/**
+ * @brief Event strings from the Device OS parser, in document order
+ */
+void walk(const JSONValue &value, size_t depth, const std::string &key, size_t index, std::vector<std::string> &events) {
+    std::string pos = position(depth, key, index);
+    if (value.isObject() || value.isArray()) {
+        bool isArray = value.isArray();
+        events.push_back((isArray ? "[ " : "{ ") + pos);
+        size_t childIndex = 0;
+        if (isArray) {
+            JSONArrayIterator iter(value);
+            while(iter.next()) {
+                walk(iter.value(), depth + 1, "", childIndex++, events);
+            }
+        }
+        else {
+            JSONObjectIterator iter(value);
+            while(iter.next()) {
+                walk(iter.value(), depth + 1, std::string(iter.name().data(), iter.name().size()), childIndex++, events);
+            }
+        }
+        events.push_back((isArray ? "] " : "} ") + pos);
+        return;
+    }
+
+    const char *type = value.isString() ? "s" : value.isNumber() ? "n" : value.isBool() ? "b" : "z";
+    JSONString str = value.toString();
+    std::string text(str.data(), str.size());
+    if (value.isNull()) {
+        text = "null";
+    }
+    events.push_back(std::string(type) + " " + pos + " " + text);
+}
+
+/**
+ * @brief Collects the events from a JsonStreamParser
+ */
+void collect(JsonStreamParser &parser, std::vector<std::string> &events) {
+    parser.setCallback([&events](JsonStreamParser &sp, JsonStreamParser::EventType event) {
+        std::string pos = position(sp.getDepth(), sp.getKey(), sp.getIndex());
+        switch(event) {
+            case JsonStreamParser::EVENT_OBJECT_START: events.push_back("{ " + pos); break;
+            case JsonStreamParser::EVENT_OBJECT_END: events.push_back("} " + pos); break;
+            case JsonStreamParser::EVENT_ARRAY_START: events.push_back("[ " + pos); break;
+            case JsonStreamParser::EVENT_ARRAY_END: events.push_back("] " + pos); break;
+            case JsonStreamParser::EVENT_VALUE:
+                events.push_back(std::string(valueTypeName[sp.getValueType()]) + " " + pos + " " + std::string(sp.getValue(), sp.getValueLen()));
+                break;
+        }
+        return true;
+    });
+}
+
+/**
+ * @brief About 16 KB of hook response: zones with schedules, every value type and escapes
+ */
+String makeDocument() {
+    String doc = "{\"version\":3,\"name\":\"garden \\\"north\\\"\\n\",\"zones\":[";
+    for (int ii = 0; doc.length() < 16 * 1024 - 200; ii++) {
+        if (ii) {
+            doc += ",";
+        }
+        doc += String::format("{\"id\":%d,\"name\":\"zone\\t%d\\/a\\\\b\",\"minutes\":%d.5,\"rate\":-%de-2,\"on\":%s,\"last\":null,"
+                              "\"days\":[1,2,[3,[]],{}],\"window\":{\"start\":\"06:%02d\",\"len\":0,\"big\":1.25E+3}}",
+                              ii, ii, ii, ii + 1, (ii % 2) ? "true" : "false", ii % 60);
+    }
+    doc += "],\"done\":true}";
+    return doc;
+}
+
+/**
+ * @brief Parses doc in chunks of chunkSize bytes. Returns the events, or an empty vector on error.
+ */
+std::vector<std::string> parseChunks(const String &doc, size_t chunkSize) {
+    JsonStreamParserStatic<128, 8> parser;
+    std::vector<std::string> events;
+    collect(parser, events);
+
+    for (size_t offset = 0; offset < doc.length(); offset += chunkSize) {
+        size_t len = (doc.length() - offset < chunkSize) ? (doc.length() - offset) : chunkSize;
+        if (!parser.addData(doc.c_str() + offset, len)) {
+            events.clear();
+            return events;
+        }
+    }
+    if (!parser.finish()) {
+        events.clear();
+    }
+    return events;
+}
+
+/**
+ * @brief Parses a complete document in one piece. Returns getError() after finish().
+ */
+int parseError(const char *doc) {
+    JsonStreamParserStatic<32, 4> parser;
+    std::vector<std::string> events;
+    collect(parser, events);
+    if (parser.addString(doc)) {
+        parser.finish();
+    }
+    return parser.getError();
+}
+
+} // namespace
+
+int main() {
+    simtest::begin("JsonStreamParserTest");
+
+    String doc = makeDocument();
+    std::vector<std::string> expected;
+    walk(JSONValue::parseCopy(doc), 0, "", 0, expected);
+    printf("%u byte document, %u events\n", (unsigned)doc.length(), (unsigned)expected.size());
+    CHECK(doc.length() >= 16000);
+
+    for (size_t chunkSize : {(size_t)1, (size_t)7, (size_t)512, (size_t)doc.length()}) {
+        std::vector<std::string> events = parseChunks(doc, chunkSize);
+        size_t mismatches = (events.size() == expected.size()) ? 0 : 1;
+        for (size_t ii = 0; ii < events.size() && ii < expected.size(); ii++) {
+            if (events[ii] != expected[ii]) {
+                if (!mismatches) {
+                    printf("  first difference at %u: %s | %s\n", (unsigned)ii, events[ii].c_str(), expected[ii].c_str());
+                }
+                mismatches++;
+            }
+        }
+        printf("  %5u byte chunks: %u events, %u mismatches\n", (unsigned)chunkSize, (unsigned)events.size(), (unsigned)mismatches);
+        CHECK_INT(mismatches, 0);
+    }
+
+    // \u escapes, including a surrogate pair
+    {
+        JsonStreamParserStatic<32, 4> parser;
+        std::vector<std::string> events;
+        collect(parser, events);
+        CHECK(parser.addString("[\"\\u0041\\u00e9\\u20ac\\ud83c\\udf31\"]"));
+        CHECK(parser.finish());
+        CHECK(events.size() == 3 && events[1] == "s 1::0 A\xc3\xa9\xe2\x82\xac\xf0\x9f\x8c\xb1");
+    }
+
+    // Edge cases
+    CHECK_INT(parseError("123"), JsonStreamParser::ERROR_NONE);
+    CHECK_INT(parseError(" [ ] "), JsonStreamParser::ERROR_NONE);
+    CHECK_INT(parseError("\"a\\u0041\""), JsonStreamParser::ERROR_NONE);
+    CHECK_INT(parseError("{\"a\":1,}"), JsonStreamParser::ERROR_INVALID);
+    CHECK_INT(parseError("[1,]"), JsonStreamParser::ERROR_INVALID);
+    CHECK_INT(parseError("[01]"), JsonStreamParser::ERROR_INVALID);
+    CHECK_INT(parseError("[1.]"), JsonStreamParser::ERROR_INVALID);
+    CHECK_INT(parseError("[tru]"), JsonStreamParser::ERROR_INVALID);
+    CHECK_INT(parseError("\"a\tb\""), JsonStreamParser::ERROR_INVALID);
+    CHECK_INT(parseError("{} x"), JsonStreamParser::ERROR_INVALID);
+    CHECK_INT(parseError("trux"), JsonStreamParser::ERROR_INVALID);
+    CHECK_INT(parseError("\"0123456789012345678901234567890123456789\""), JsonStreamParser::ERROR_TOO_LONG);
+    CHECK_INT(parseError("[[[[[1]]]]]"), JsonStreamParser::ERROR_TOO_DEEP);
+
+    // Data that ends early: in a string, a literal, a number, or a container
+    for (const char *doc : {"\"abc", "tru", "fals", "n", "-", "1.", "1e", "2E+", "[1,2", "{\"a\":tr", "{\"a\""}) {
+        CHECK_INT(parseError(doc), JsonStreamParser::ERROR_INCOMPLETE);
+    }
+
+    // The callback can stop parsing
+    {
+        JsonStreamParserStatic<32, 4> parser;
+        int values = 0;
+        parser.setCallback([&values](JsonStreamParser &sp, JsonStreamParser::EventType event) {
+            return event != JsonStreamParser::EVENT_VALUE || ++values < 2;
+        });
+        CHECK(!parser.addString("[1,2,3]"));
+        CHECK_INT(parser.getError(), JsonStreamParser::ERROR_CANCELED);
+        CHECK_INT(values, 2);
+    }
+
+    // Multipart webhook response
+    {
+        JsonStreamParserStatic<128, 8> parser;
+        std::vector<std::string> events;
+        collect(parser, events);
+        CHECK(parser.addChunkedData("hook-response/config/0", "{\"zones\":[{\"id\":1,"));
+        CHECK(parser.addChunkedData("hook-response/config/1", "\"minutes\":5}],\"done\""));
+        CHECK(parser.addChunkedData("hook-response/config/2", ":true}"));
+        CHECK(parser.isDone());
+        CHECK(parser.finish());
+        CHECK(!events.empty() && events.back() == "} 0::0");
+
+        parser.reset();
+        CHECK(parser.addChunkedData("hook-response/config/0", "{\"zones\":"));
+        CHECK(!parser.addChunkedData("hook-response/config/2", "[]}"));
+        CHECK_INT(parser.getError(), JsonStreamParser::ERROR_CHUNK_ORDER);
+    }
+
+    // Host throughput in 512-byte chunks
+    {
+        JsonStreamParserStatic<128, 8> parser;
+        size_t values = 0;
+        parser.setCallback([&values](JsonStreamParser &sp, JsonStreamParser::EventType event) {
+            values += (event == JsonStreamParser::EVENT_VALUE);
+            return true;
+        });
+        const int passes = 200;
+        double start = simtest::hostSeconds();
+        for (int pass = 0; pass < passes; pass++) {
+            parser.reset();
+            for (size_t offset = 0; offset < doc.length(); offset += 512) {
+                size_t len = (doc.length() - offset < 512) ? (doc.length() - offset) : 512;
+                parser.addData(doc.c_str() + offset, len);
+            }
+            parser.finish();
+        }
+        double seconds = simtest::hostSeconds() - start;
+        printf("512 byte chunks: %.1f MB/s, %.0fk values/s\n", passes * doc.length() / seconds / 1e6, values / seconds / 1000);
+        CHECK(parser.isDone());
+    }
+
+    return simtest::end("JsonStreamParserTest");
+}
@@ -0,0 +1,218 @@
+#include "SimTest.h"
+#include "JsonParserGeneratorRK.h"
+
+#include <climits>
+#include <cmath>
+
+// JsonWriter numbers without snprintf: every int, unsigned, long and unsigned long value written
+// by insertValue() matches snprintf with the format JsonWriter used before, for every int in
+// +/-2^20, a stride through the 32-bit range and the edge values. Floats and doubles match "%.*f"
+// at setFloatPlaces() 0 to 9 and the default, for a stride through the floats with |x| in
+// [2^-10, 2^8), exact ties k/2^n, random doubles of every magnitude, and NaN, infinity, -0 and
+// values too large for the integer path (snprintf is still used). Reports records/s for a
+// telemetry record against the same record written with insertsprintf().
+
+namespace {
+
+JsonWriterStatic<512> writer;
+char expected[512];
+size_t checked = 0;
+size_t mismatches = 0;
+
+void compare(const char *what) {
+    checked++;
+    if (writer.getOffset() != strlen(expected) || memcmp(writer.getBuffer(), expected, writer.getOffset()) != 0) {
+        if (mismatches++ < 10) {
+            printf("  %s: \"%.*s\" expected \"%s\"\n", what, (int)writer.getOffset(), writer.getBuffer(), expected);
+        }
+    }
+}
+
+template <class T>
+void checkInt(T value, const char *format) {
+    writer.init();
+    writer.insertValue(value);
+    snprintf(expected, sizeof(expected), format, value);
+    compare(format);
+}
+
+void checkAllInts(int64_t value) {
+    checkInt((int)value, "%d");
+    checkInt((unsigned int)value, "%u");
+    checkInt((long)value, "%ld");
+    checkInt((unsigned long)value, "%lu");
+}
+
+void checkDouble(double value, int places) {
+    writer.init();
+    writer.setFloatPlaces(places);
+    writer.insertValue(value);
+    if (places >= 0) {
+        snprintf(expected, sizeof(expected), "%.*lf", places, value);
+    }
+    else {
+        snprintf(expected, sizeof(expected), "%lf", value);
+    }
+    compare("double");
+}
+
+void checkFloat(float value, int places) {
+    writer.init();
+    writer.setFloatPlaces(places);
+    writer.insertValue(value);
+    if (places >= 0) {
+        snprintf(expected, sizeof(expected), "%.*f", places, value);
+    }
+    else {
+        snprintf(expected, sizeof(expected), "%f", value);
+    }
+    compare("float");
+}
+
+uint64_t randomState = 0x853c49e6748fea9bULL;
+
+uint64_t random64() {
+    // xorshift64*
+    randomState ^= randomState >> 12;
+    randomState ^= randomState << 25;
+    randomState ^= randomState >> 27;
+    return randomState * 2685821657736338717ULL;
+}
+
+/**
+ * @brief The telemetry record that take_measurements.cpp builds
+ */
+void writeRecord(JsonWriter &jw, size_t ii, bool withSprintf) {
+    jw.init();
+    jw.startObject();
+    if (withSprintf) {
+        // What JsonWriter did before
+        jw.insertCheckSeparator();
+        jw.insertValue("t");
+        jw.insertChar(':');
+        jw.insertsprintf("%lu", (unsigned long)(1657857600 + ii * 900));
+        jw.insertCheckSeparator();
+        jw.insertValue("bs");
+        jw.insertChar(':');
+        jw.insertsprintf("%d", 2);
+        const char *keys[] = { "c", "sm", "st" };
+        double values[] = { 20.0 + (ii % 40) * 0.25, 40.0 + (ii % 30) * 0.5, 18.0 + (ii % 20) * 0.125 };
+        for (size_t jj = 0; jj < 3; jj++) {
+            jw.insertCheckSeparator();
+            jw.insertValue(keys[jj]);
+            jw.insertChar(':');
+            jw.insertsprintf("%.*lf", 2, values[jj]);
+        }
+        jw.insertCheckSeparator();
+        jw.insertValue("ws");
+        jw.insertChar(':');
+        jw.insertsprintf("%d", (int)(ii % 2));
+    }
+    else {
+        jw.insertKeyValue("t", (unsigned long)(1657857600 + ii * 900));
+        jw.insertKeyValue("bs", 2);
+        jw.insertKeyValue("c", 20.0 + (ii % 40) * 0.25);
+        jw.insertKeyValue("sm", 40.0 + (ii % 30) * 0.5);
+        jw.insertKeyValue("st", 18.0 + (ii % 20) * 0.125);
+        jw.insertKeyValue("ws", (int)(ii % 2));
+    }
+    jw.finishObjectOrArray();
+}
+
+} // namespace
+
+int main() {
+    simtest::begin("JsonWriterNumberTest");
+
+    // Integers
+    for (int64_t value = -(1 << 20); value <= (1 << 20); value++) {
+        checkAllInts(value);
+    }
+    for (int64_t value = INT_MIN; value <= (int64_t)UINT_MAX; value += 65521) {
+        checkAllInts(value);
+    }
+    for (int64_t value : {(int64_t)INT_MIN, (int64_t)INT_MAX, (int64_t)UINT_MAX, (int64_t)-1, (int64_t)0, (int64_t)9, (int64_t)10, (int64_t)-10}) {
+        checkAllInts(value);
+    }
+    checkInt(LONG_MIN, "%ld");
+    checkInt(LONG_MAX, "%ld");
+    checkInt(ULONG_MAX, "%lu");
+    printf("%u integers, %u mismatches\n", (unsigned)checked, (unsigned)mismatches);
+    size_t intMismatches = mismatches;
+
+    // Floats with |x| in [2^-10, 2^8), both signs, at 1 and 2 places and the default
+    checked = mismatches = 0;
+    uint32_t first, last;
+    float f = std::ldexp(1.0f, -10);
+    memcpy(&first, &f, sizeof(first));
+    f = std::ldexp(1.0f, 8);
+    memcpy(&last, &f, sizeof(last));
+    for (uint32_t bits = first; bits < last; bits += 251) {
+        memcpy(&f, &bits, sizeof(f));
+        for (int places : {1, 2, -1}) {
+            checkFloat(f, places);
+            checkFloat(-f, places);
+        }
+    }
+
+    // Exact ties k/2^n at every number of places, where rounding to even matters
+    for (int places = 0; places <= 9; places++) {
+        for (int n = 1; n <= 12; n++) {
+            for (int k = -300; k <= 300; k++) {
+                checkDouble(std::ldexp((double)k, -n), places);
+            }
+        }
+    }
+
+    // Random doubles of every magnitude the integer path handles and past it
+    for (int ii = 0; ii < 300000; ii++) {
+        uint64_t r = random64();
+        double value = std::ldexp((double)(r >> 11), (int)(r % 100) - 90);
+        if (r & 1) {
+            value = -value;
+        }
+        checkDouble(value, (int)((r >> 8) % 11) - 1);
+    }
+
+    // Special values and the snprintf fallback
+    for (double value : {0.0, -0.0, 0.5, 1.5, 2.5, -0.5, 0.05, 0.005, 1e17, 1e18, 1e19, 1e300, -1e300, 4.9e-324, (double)NAN, (double)INFINITY, -(double)INFINITY}) {
+        for (int places = -1; places <= 12; places++) {
+            checkDouble(value, places);
+        }
+    }
+    printf("%u floating point values, %u mismatches\n", (unsigned)checked, (unsigned)mismatches);
+    CHECK_INT(intMismatches, 0);
+    CHECK_INT(mismatches, 0);
+
+    // Records/s
+    JsonWriterStatic<128> jw, sprintfJw;
+    jw.setFloatPlaces(2);
+    sprintfJw.setFloatPlaces(2);
+    const size_t numRecords = 200000;
+    size_t different = 0, bytes = 0;
+    double start = simtest::hostSeconds();
+    for (size_t ii = 0; ii < numRecords; ii++) {
+        writeRecord(sprintfJw, ii, true);
+        bytes += sprintfJw.getOffset();
+    }
+    double sprintfSeconds = simtest::hostSeconds() - start;
+    start = simtest::hostSeconds();
+    for (size_t ii = 0; ii < numRecords; ii++) {
+        writeRecord(jw, ii, false);
+        bytes -= jw.getOffset();
+    }
+    double seconds = simtest::hostSeconds() - start;
+    for (size_t ii = 0; ii < 1000; ii++) {
+        writeRecord(sprintfJw, ii, true);
+        writeRecord(jw, ii, false);
+        if (jw.getOffset() != sprintfJw.getOffset() || memcmp(jw.getBuffer(), sprintfJw.getBuffer(), jw.getOffset()) != 0) {
+            different++;
+        }
+    }
+    printf("6 field record: insertsprintf %.2fM records/s, JsonWriter %.2fM records/s (%.1fx)\n", numRecords / sprintfSeconds / 1e6,
+           numRecords / seconds / 1e6, sprintfSeconds / seconds);
+    CHECK_INT(different, 0);
+    CHECK_INT(bytes, 0);
+
+    return simtest::end("JsonWriterNumberTest");
+}
@@ -0,0 +1,273 @@
+#include "SimTest.h"
+#include "PublishQueuePosixRK.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// PublishQueueSegmentLog (PublishQueuePosix::withSegmentedLog()): a reset in the middle of sending
+// keeps exactly the unsent events, the newest segment is kept for appends after everything has
+// been sent, and a partially written record is dropped at boot. Then compares it with the default
+// one file per event queue for 100, 1,000 and 10,000 events in a directory on the host: enqueue
+// and dequeue events/s, boot-time scan, and file system operations per event.
+//
+// The one file per event queue is the sequence of SequentialFile and file operations that
+// PublishQueuePosix::writeQueueToFiles(), readQueueFile() and the publish success path do.
+
+namespace {
+
+PublishQueueEvent *makeEvent(uint32_t ii) {
+    char data[64];
+    snprintf(data, sizeof(data), "{\"t\":%lu,\"sm\":%lu,\"st\":21.5}", (unsigned long)(1657857600 + ii * 900), (unsigned long)(ii % 100));
+
+    PublishQueueEvent *event = (PublishQueueEvent *)new char[sizeof(PublishQueueEvent) + strlen(data)];
+    event->flags = PRIVATE | WITH_ACK;
+    strcpy(event->eventName, "eh");
+    strcpy(event->eventData, data);
+    return event;
+}
+
+/**
+ * @brief The default file queue: one file per event
+ */
+class FileQueue {
+public:
+    explicit FileQueue(const char *dirPath) {
+        files.withDirPath(dirPath);
+    }
+
+    bool scan() {
+        return files.scanDir();
+    }
+
+    bool append(const PublishQueueEvent *event) {
+        int fileNum = files.reserveFile();
+        int fd = open(files.getPathForFileNum(fileNum), O_RDWR | O_CREAT);
+        if (fd == -1) {
+            return false;
+        }
+        PublishQueueFileHeader hdr;
+        hdr.magic = 0x31b67663;                     // PublishQueuePosix::FILE_MAGIC
+        hdr.version = 1;
+        hdr.headerSize = sizeof(PublishQueueFileHeader);
+        hdr.nameLen = sizeof(PublishQueueEvent::eventName);
+        write(fd, &hdr, sizeof(hdr));
+        write(fd, event, sizeof(PublishQueueEvent) + strlen(event->eventData));
+        close(fd);
+        files.addFileToQueue(fileNum);
+        return true;
+    }
+
+    PublishQueueEvent *readHead() {
+        int fileNum = files.getFileFromQueue(false);
+        if (!fileNum) {
+            return NULL;
+        }
+        PublishQueueEvent *result = NULL;
+        int fd = open(files.getPathForFileNum(fileNum), O_RDONLY);
+        if (fd != -1) {
+            struct stat sb;
+            fstat(fd, &sb);
+            PublishQueueFileHeader hdr;
+            read(fd, &hdr, sizeof(hdr));
+            size_t eventSize = sb.st_size - sizeof(hdr);
+            result = (PublishQueueEvent *)new char[eventSize];
+            read(fd, result, eventSize);
+            close(fd);
+        }
+        return result;
+    }
+
+    bool removeHead() {
+        int fileNum = files.getFileFromQueue(true);
+        if (!fileNum) {
+            return false;
+        }
+        files.removeFileNum(fileNum, false);
+        return true;
+    }
+
+    size_t getQueueLen() {
+        return files.getQueueLen();
+    }
+
+    void removeAll() {
+        files.removeAll(false);
+    }
+
+private:
+    SequentialFile files;
+};
+
+size_t countFiles(const char *dirPath) {
+    size_t count = 0;
+    DIR *dir = opendir((sim::config().fsDir + dirPath).c_str());
+    if (dir) {
+        while(struct dirent *ent = readdir(dir)) {
+            if (ent->d_type == DT_REG) count++;
+        }
+        closedir(dir);
+    }
+    return count;
+}
+
+bool sameEvent(const PublishQueueEvent *a, const PublishQueueEvent *b) {
+    return a && b && strcmp(a->eventName, b->eventName) == 0 && strcmp(a->eventData, b->eventData) == 0;
+}
+
+void testRecovery() {
+    const char *dirPath = "/usr/pqseg";
+    const size_t maxSegmentSize = 1024;             // 10 events per segment
+    const uint32_t numEvents = 45;                  // The newest segment is half full
+
+    PublishQueueSegmentLog log;
+    log.withDirPath(dirPath).withMaxSegmentSize(maxSegmentSize);
+    CHECK(log.scan());
+    log.removeAll();
+
+    for (uint32_t ii = 0; ii < numEvents; ii++) {
+        PublishQueueEvent *event = makeEvent(ii);
+        CHECK(log.append(event));
+        delete[] (char *)event;
+    }
+    CHECK_INT(log.getQueueLen(), numEvents);
+    CHECK(log.getTailFileNum() > log.getHeadFileNum());
+
+    // Send 20 events, then reset: the others are still there, in order
+    for (int ii = 0; ii < 20; ii++) {
+        CHECK(log.removeHead());
+    }
+    PublishQueueSegmentLog afterReset;
+    afterReset.withDirPath(dirPath).withMaxSegmentSize(maxSegmentSize);
+    CHECK(afterReset.scan());
+    CHECK_INT(afterReset.getQueueLen(), numEvents - 20);
+    CHECK_INT(afterReset.getHeadFileNum(), log.getHeadFileNum());
+    CHECK_INT(afterReset.getHeadOffset(), log.getHeadOffset());
+    for (uint32_t ii = 20; ii < numEvents; ii++) {
+        PublishQueueEvent *expected = makeEvent(ii);
+        PublishQueueEvent *event = afterReset.readHead();
+        CHECK(sameEvent(event, expected));
+        delete[] (char *)event;
+        delete[] (char *)expected;
+        CHECK(afterReset.removeHead());
+    }
+    CHECK_INT(afterReset.getQueueLen(), 0);
+    CHECK(afterReset.readHead() == NULL);
+    CHECK(!afterReset.removeHead());
+
+    // The newest segment was not full, so it is kept and the next event goes into it
+    int tailFileNum = afterReset.getTailFileNum();
+    CHECK(tailFileNum != 0);
+    CHECK_INT(countFiles(dirPath), 2);              // The segment and the head file
+    PublishQueueEvent *event = makeEvent(numEvents);
+    CHECK(afterReset.append(event));
+    delete[] (char *)event;
+    CHECK_INT(afterReset.getHeadFileNum(), tailFileNum);
+
+    // A record cut short by a reset is dropped at boot
+    event = makeEvent(numEvents + 1);
+    CHECK(afterReset.append(event));
+    delete[] (char *)event;
+    SequentialFile segmentFiles;
+    segmentFiles.withDirPath(dirPath).withFilenameExtension("seg");
+    std::string segPath = sim::config().fsDir + (const char *)segmentFiles.getPathForFileNum(tailFileNum);
+    struct stat sb;
+    CHECK(stat(segPath.c_str(), &sb) == 0);
+    CHECK(truncate(segPath.c_str(), sb.st_size - 10) == 0);
+
+    PublishQueueSegmentLog afterPartialWrite;
+    afterPartialWrite.withDirPath(dirPath).withMaxSegmentSize(maxSegmentSize);
+    CHECK(afterPartialWrite.scan());
+    CHECK_INT(afterPartialWrite.getQueueLen(), 1);
+    PublishQueueEvent *expected = makeEvent(numEvents);
+    event = afterPartialWrite.readHead();
+    CHECK(sameEvent(event, expected));
+    delete[] (char *)event;
+    delete[] (char *)expected;
+
+    // The next append overwrites the partial record
+    event = makeEvent(numEvents + 2);
+    CHECK(afterPartialWrite.append(event));
+    delete[] (char *)event;
+    afterReset.removeAll();
+    CHECK(afterReset.scan());
+    CHECK_INT(afterReset.getQueueLen(), 0);
+}
+
+void printCost(const char *what, size_t events, double seconds, const sim::Metrics &before) {
+    const sim::Metrics &after = sim::metrics();
+    printf("    %-8s %9.0f events/s  per event: %5.2f opens %5.2f writes %6.1f bytes %5.3f unlinks\n", what, events / seconds,
+           (double)(after.fsOpens - before.fsOpens) / events, (double)(after.fsWrites - before.fsWrites) / events,
+           (double)(after.fsBytesWritten - before.fsBytesWritten) / events, (double)(after.fsUnlinks - before.fsUnlinks) / events);
+}
+
+/**
+ * @brief Enqueue, boot scan and dequeue of numEvents events. Returns the fs unlinks per event.
+ */
+template <class Queue, class MakeQueue>
+double benchmark(const char *name, size_t numEvents, MakeQueue makeQueue) {
+    printf("  %s, %u events\n", name, (unsigned)numEvents);
+
+    Queue *queue = makeQueue();
+    queue->scan();
+    queue->removeAll();
+
+    sim::Metrics before = sim::metrics();
+    double start = simtest::hostSeconds();
+    for (size_t ii = 0; ii < numEvents; ii++) {
+        PublishQueueEvent *event = makeEvent(ii);
+        queue->append(event);
+        delete[] (char *)event;
+    }
+    printCost("enqueue", numEvents, simtest::hostSeconds() - start, before);
+    delete queue;
+
+    // What setup() does after a reset
+    before = sim::metrics();
+    start = simtest::hostSeconds();
+    queue = makeQueue();
+    CHECK(queue->scan());
+    double bootMs = (simtest::hostSeconds() - start) * 1000.0;
+    CHECK_INT(queue->getQueueLen(), numEvents);
+    printf("    boot     %9.2f ms scan, %llu opens\n", bootMs, (unsigned long long)(sim::metrics().fsOpens - before.fsOpens));
+
+    before = sim::metrics();
+    start = simtest::hostSeconds();
+    size_t read = 0;
+    while(PublishQueueEvent *event = queue->readHead()) {
+        read++;
+        delete[] (char *)event;
+        queue->removeHead();
+    }
+    printCost("dequeue", numEvents, simtest::hostSeconds() - start, before);
+    double unlinks = (double)(sim::metrics().fsUnlinks - before.fsUnlinks) / numEvents;
+    CHECK_INT(read, numEvents);
+    CHECK_INT(queue->getQueueLen(), 0);
+
+    queue->removeAll();
+    delete queue;
+    return unlinks;
+}
+
+} // namespace
+
+int main() {
+    simtest::begin("PublishQueueSegmentTest");
+
+    testRecovery();
+
+    printf("file queue in a host directory\n");
+    for (size_t numEvents : {(size_t)100, (size_t)1000, (size_t)10000}) {
+        double fileUnlinks = benchmark<FileQueue>("one file per event", numEvents, []() {
+            return new FileQueue("/usr/pqfiles");
+        });
+        double segmentUnlinks = benchmark<PublishQueueSegmentLog>("segmented log", numEvents, []() {
+            PublishQueueSegmentLog *log = new PublishQueueSegmentLog();
+            log->withDirPath("/usr/pqsegments");
+            return log;
+        });
+        CHECK(fileUnlinks == 1.0);
+        CHECK(segmentUnlinks < 0.05);
+    }
+
+    return simtest::end("PublishQueueSegmentTest");
+}
@@ -0,0 +1,31 @@
+#include "SimTest.h"
+
+namespace simtest {
+
+int failures = 0;
+
+void begin(const char *testName) {
+    sim::config().fsDir = std::string("build/test/") + testName + "-fs";
+    sim::begin();
+}
+
+int end(const char *testName) {
+    if (failures) {
+        printf("%s: %d check(s) FAILED\n", testName, failures);
+        return 1;
+    }
+    printf("%s: passed\n", testName);
+    return 0;
+}
+
+void checkFailed(const char *file, int line, const char *expr) {
+    printf("%s:%d: check failed: %s\n", file, line, expr);
+    failures++;
+}
+
+void checkIntFailed(const char *file, int line, const char *expr, long long got, long long expected) {
+    printf("%s:%d: check failed: %s is %lld, expected %lld\n", file, line, expr, got, expected);
+    failures++;
+}
+
+} // namespace simtest
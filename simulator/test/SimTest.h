@@ -0,0 +1,53 @@
+/**
+ * @file SimTest.h
+ * @brief Helpers for the host tests in this directory
+ *
+ * @details Each test is a program with its own main() that is linked with the simulator, the
+ * application and the libraries (everything but src/SimMain.cpp), so it can call application and
+ * library code directly on the virtual clock. Checks print the failure and the test keeps going;
+ * simtest::end() returns the exit status. Build and run them all with make test.
+ */
+#ifndef __SIMTEST_H
+#define __SIMTEST_H
+
+#include "Simulator.h"
+
+#include <chrono>
+
+namespace simtest {
+
+extern int failures; //!< Number of failed checks
+
+/**
+ * @brief Prepares the simulator for a test. Each test uses its own /usr directory under build/test.
+ */
+void begin(const char *testName);
+
+/**
+ * @brief Prints the summary. Returns the exit status for main().
+ */
+int end(const char *testName);
+
+void checkFailed(const char *file, int line, const char *expr);
+void checkIntFailed(const char *file, int line, const char *expr, long long got, long long expected);
+
+/**
+ * @brief Host (wall clock) seconds since an arbitrary point, for benchmarks
+ */
+inline double hostSeconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Time on a 400 kHz I2C bus: 9 clocks per byte (8 bits and the ack) plus about 2 for the start and stop of each transaction
+ */
+inline double i2cBusMs(uint64_t transactions, uint64_t bytes) {
+    return (bytes * 9 + transactions * 2) * 1000.0 / 400000.0;
+}
+
+} // namespace simtest
+
+#define CHECK(expr) do { if (!(expr)) { simtest::checkFailed(__FILE__, __LINE__, #expr); } } while(0)
+#define CHECK_INT(got, expected) do { long long _g = (long long)(got), _e = (long long)(expected); if (_g != _e) { simtest::checkIntFailed(__FILE__, __LINE__, #got, _g, _e); } } while(0)
+
+#endif /* __SIMTEST_H */
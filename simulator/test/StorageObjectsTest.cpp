@@ -0,0 +1,108 @@
+#include "SimTest.h"
+#include "storage_objects.h"
+
+// storageObjectLoop() writes only the bytes of sysStatus and current that changed. Counts the FRAM
+// bytes and I2C transactions for typical changes against writing the whole object with fram.put()
+// on an uncached driver (what a detected change used to cost), and checks that every single byte
+// change reaches the FRAM - including a swap of two fields that a sum of hashes cannot see.
+
+namespace {
+
+MB85RC64 rawFram(Wire, 0);                          // Same chip without the cache, to read back what is really stored
+
+struct Cost {
+    uint64_t transactions;
+    uint64_t writes;
+    uint64_t bytes;
+};
+
+template <class Fn>
+Cost measure(Fn fn) {
+    sim::Metrics before = sim::metrics();
+    fn();
+    return Cost{sim::metrics().i2cTransactions - before.i2cTransactions, sim::metrics().framWrites - before.framWrites,
+                sim::metrics().framBytesWritten - before.framBytesWritten};
+}
+
+void printCost(const char *what, const Cost &cost) {
+    printf("  %-36s %3llu transactions %3llu writes %4llu bytes\n", what, (unsigned long long)cost.transactions,
+           (unsigned long long)cost.writes, (unsigned long long)cost.bytes);
+}
+
+bool storedMatches() {
+    struct systemStatus_structure storedStatus;
+    struct current_structure storedCurrent;
+    rawFram.get(FRAM::systemStatusAddr, storedStatus);
+    rawFram.get(FRAM::currentStatusAddr, storedCurrent);
+    return memcmp(&storedStatus, &sysStatus, sizeof(sysStatus)) == 0 && memcmp(&storedCurrent, &current, sizeof(current)) == 0;
+}
+
+} // namespace
+
+int main() {
+    simtest::begin("StorageObjectsTest");
+
+    Wire.begin();
+    rawFram.withBufferSize(I2C_BUFFER_SIZE).begin();
+    CHECK(storageObjectStart());
+    storageObjectLoop();
+    CHECK(storedMatches());
+
+    printf("FRAM cost per change (sysStatus %u bytes, current %u bytes)\n", (unsigned)sizeof(sysStatus), (unsigned)sizeof(current));
+
+    Cost nothing = measure([]() { storageObjectLoop(); });
+    printCost("no change", nothing);
+    CHECK_INT(nothing.transactions, 0);
+
+    Cost soc = measure([]() { current.stateOfCharge++; storageObjectLoop(); });
+    printCost("current.stateOfCharge", soc);
+    Cost socPut = measure([]() { rawFram.put(FRAM::currentStatusAddr, current); });
+    printCost("  fram.put(current), uncached", socPut);
+    CHECK(storedMatches());
+    CHECK_INT(soc.writes, 1);
+    CHECK(soc.bytes <= socPut.bytes);
+
+    Cost sample = measure([]() {
+        current.internalTempC += 0.25;
+        current.soilTempC += 0.25;
+        current.soilMoisture -= 1.0;
+        current.lastSampleTime += 600;
+        storageObjectLoop();
+    });
+    printCost("new sample (4 fields of current)", sample);
+    CHECK(storedMatches());
+    CHECK(sample.transactions <= socPut.transactions);
+
+    Cost verbose = measure([]() { sysStatus.verboseMode = !sysStatus.verboseMode; storageObjectLoop(); });
+    printCost("sysStatus.verboseMode", verbose);
+    Cost verbosePut = measure([]() { rawFram.put(FRAM::systemStatusAddr, sysStatus); });
+    printCost("  fram.put(sysStatus), uncached", verbosePut);
+    CHECK(storedMatches());
+    CHECK_INT(verbose.writes, 1);
+
+    // Swapping two values of the same type leaves a sum of their hashes unchanged
+    current.batteryState = 2;
+    current.wateringState = 0;
+    storageObjectLoop();
+    std::swap(current.batteryState, current.wateringState);
+    CHECK(storageObjectLoop());
+    CHECK(storedMatches());
+
+    // Every single byte change is stored
+    int missed = 0;
+    uint8_t *bytes = (uint8_t *)&current;
+    for (size_t ii = 0; ii < sizeof(current); ii++) {
+        bytes[ii] ^= 0x01;
+        storageObjectLoop();
+        if (!storedMatches()) missed++;
+    }
+    bytes = (uint8_t *)&sysStatus;
+    for (size_t ii = 0; ii < sizeof(sysStatus); ii++) {
+        bytes[ii] ^= 0x80;
+        storageObjectLoop();
+        if (!storedMatches()) missed++;
+    }
+    CHECK_INT(missed, 0);
+
+    return simtest::end("StorageObjectsTest");
+}
@@ -0,0 +1,76 @@
+#include "SimTest.h"
+#include "take_measurements.h"
+
+// takeMeasurements(state) is the SleepHelper data capture callback. It must never block: each call
+// returns right away and the settle windows are waited out across calls to loop(). Drives it the
+// way SleepHelper::loop() does, one call per loop tick, and checks that no call moves the virtual
+// clock and that the capture takes the number of ticks the settle windows add up to.
+
+namespace {
+
+const uint64_t loopMs = 10;
+
+/**
+ * @brief Runs one capture. Returns the number of calls; maxCallMs is the most virtual time any one call took.
+ */
+int runCapture(uint64_t &maxCallMs, bool &powerDuringRead) {
+    SleepHelper::AppCallbackState state;
+    state.callbackState = SleepHelper::AppCallbackState::CALLBACK_STATE_START;
+
+    maxCallMs = 0;
+    powerDuringRead = false;
+    int calls = 0;
+    bool inProgress = true;
+    while (inProgress && calls < 10000) {
+        uint64_t start = sim::now();
+        inProgress = takeMeasurements(state);
+        calls++;
+        maxCallMs = std::max(maxCallMs, sim::now() - start);
+        if (digitalRead(SOIL_POWER_PIN) == HIGH) powerDuringRead = true;
+        if (inProgress) sim::advance(loopMs);
+    }
+    return calls;
+}
+
+} // namespace
+
+int main() {
+    simtest::begin("TakeMeasurementsTest");
+
+    sim::analogSource(TMP36_SENSE_PIN, []() { return (int32_t)931; });      // 750 mV, 25 C
+    sim::analogSource(SOIL_TEMP_PIN, []() { return (int32_t)1551; });       // 1250 mV, thermistor at 10K, 25 C
+    sim::analogSource(SOIL_MOISTURE_PIN, []() { return (int32_t)1861; });   // 50%
+
+    uint64_t maxCallMs;
+    bool powerDuringRead;
+
+    pinMode(SOIL_POWER_PIN, OUTPUT);                // As setup() does
+
+    // warmUpMs (2000) and soilPowerMs (100) in 10 ms ticks, plus the start and complete calls.
+    // The 500 ms fuel gauge settle overlaps the warm up so it adds nothing.
+    sysStatus.enableSleep = true;
+    memset(&current, 0, sizeof(current));
+    int calls = runCapture(maxCallMs, powerDuringRead);
+    CHECK_INT(maxCallMs, 0);
+    CHECK_INT(calls, 2000 / loopMs + 100 / loopMs + 2);
+    CHECK(powerDuringRead);
+    CHECK_INT(digitalRead(SOIL_POWER_PIN), LOW);
+    CHECK(fabs(current.internalTempC - 25.0) < 0.1);
+    CHECK(fabs(current.soilTempC - 25.0) < 0.1);
+    CHECK(fabs(current.soilMoisture - 50.0) < 0.1);
+    CHECK(current.stateOfCharge > 0);
+
+    // Without sleep there is no fuel gauge quickStart, so the same number of ticks
+    sysStatus.enableSleep = false;
+    calls = runCapture(maxCallMs, powerDuringRead);
+    CHECK_INT(maxCallMs, 0);
+    CHECK_INT(calls, 2000 / loopMs + 100 / loopMs + 2);
+
+    // The blocking version used in setup() runs the same steps on delay(1)
+    uint64_t start = sim::now();
+    CHECK(takeMeasurements());
+    uint64_t elapsed = sim::now() - start;
+    CHECK(elapsed >= 2100 && elapsed < 2110);
+
+    return simtest::end("TakeMeasurementsTest");
+}
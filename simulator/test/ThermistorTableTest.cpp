@@ -0,0 +1,58 @@
+#include "SimTest.h"
+#include "take_measurements.h"
+#include "thermistor_table.h"
+
+// thermistor_table.h: compares soilTemperatureTableC() with the float soilTemperarureC() over all
+// 4096 ADC codes and reports the maximum error and the host conversions per second of each.
+
+namespace {
+
+volatile float sink;                                // Keeps the benchmark loops from being optimized away
+
+template <class Fn>
+double conversionsPerSecond(Fn fn, int passes) {
+    double start = simtest::hostSeconds();
+    for (int pass = 0; pass < passes; pass++) {
+        for (int code = 0; code < 4096; code++) sink = fn(code);
+    }
+    return passes * 4096.0 / (simtest::hostSeconds() - start);
+}
+
+} // namespace
+
+int main() {
+    simtest::begin("ThermistorTableTest");
+
+    typedef ThermistorTable<MurataNCP18XH103F03RB> Table;
+
+    double maxError = 0, maxErrorInRange = 0;       // Over all codes, and over -40 to 80 C
+    int maxErrorCode = 0, validCodes = 0;
+    for (int code = 0; code < 4096; code++) {
+        float exact = soilTemperarureC(code);
+        float table = soilTemperatureTableC(code);
+        if (exact == Table::invalidReading || std::isnan(exact) || std::isinf(exact)) {
+            CHECK(table == Table::invalidReading);
+            continue;
+        }
+        validCodes++;
+        double error = fabs(table - exact);
+        if (error > maxError) {
+            maxError = error;
+            maxErrorCode = code;
+        }
+        if (exact >= -40 && exact <= 80) maxErrorInRange = std::max(maxErrorInRange, error);
+    }
+    printf("%d valid codes, max error %.4f C at code %d, max error -40 to 80 C %.4f C\n", validCodes, maxError, maxErrorCode, maxErrorInRange);
+    CHECK(maxError <= Table::maxInterpolationError + 0.001);    // Plus float rounding
+
+    CHECK(soilTemperatureTableC(-1) == Table::invalidReading);
+    CHECK(soilTemperatureTableC(4096) == Table::invalidReading);
+
+    double floatRate = conversionsPerSecond(soilTemperarureC, 50);
+    double tableRate = conversionsPerSecond(soilTemperatureTableC, 500);
+    double tmp36Rate = conversionsPerSecond(tmp36TemperatureC, 500);
+    printf("host conversions/s: float %.3g, table %.3g (%.1fx), tmp36 %.3g\n", floatRate, tableRate, tableRate / floatRate, tmp36Rate);
+    CHECK(tableRate > floatRate);
+
+    return simtest::end("ThermistorTableTest");
+}
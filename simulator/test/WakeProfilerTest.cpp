@@ -0,0 +1,202 @@
+#include "SimTest.h"
+#include "SleepHelper.h"
+
+// SleepHelper::WakeProfiler with a fake clock: 100,000 random wake cycles, starting just before the
+// millis() counter wraps, each moving through random phases with data capture, sensor power and
+// publishes interleaved. The phase times of every cycle add up to its awake time, and the data
+// capture, sensor and publish totals match the fake clock. Then the ring of WAKE_CYCLE_RING_SIZE
+// cycles in PersistentData, after a reload from the data file, and every cycle of a day of the
+// application on the simulator's clock.
+
+#include "sleep_helper_config.h"
+
+void setup();
+void loop();
+
+namespace {
+
+uint32_t randomState = 12345;
+
+uint32_t random32() {
+    // xorshift32
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+uint32_t phaseSum(const SleepHelper::WakeCycleProfile &cycle) {
+    uint32_t sum = 0;
+    for (size_t ii = 0; ii < SleepHelper::WakeCycleProfile::numPhases; ii++) {
+        sum += cycle.phaseMs[ii];
+    }
+    return sum;
+}
+
+void testRandomCycles() {
+    const size_t numCycles = 100000;
+    SleepHelper::WakeProfiler profiler;
+    system_tick_t ms = 0xffffffff - 60000;          // Wraps in the first few cycles
+
+    size_t phaseMismatches = 0, awakeMismatches = 0, captureMismatches = 0, sensorMismatches = 0, publishMismatches = 0;
+    bool wrapped = false;
+
+    for (size_t cycleNum = 0; cycleNum < numCycles; cycleNum++) {
+        uint32_t awake = 0, capture = 0, sensor = 0, publishMs = 0, publishes = 0;
+        bool capturing = false, sensorOn = false;
+
+        size_t steps = 1 + random32() % 20;
+        for (size_t step = 0; step < steps; step++) {
+            // The state handlers call enterPhase() every loop, so the same phase is entered repeatedly
+            profiler.enterPhase((uint8_t)(random32() % SleepHelper::WakeCycleProfile::numPhases), ms);
+
+            uint32_t r = random32();
+            if ((r & 0x0f) == 0 && !capturing) {
+                profiler.dataCaptureStart(ms);
+                capturing = true;
+            }
+            else
+            if ((r & 0x0f) == 1 && capturing) {
+                profiler.dataCaptureEnd(ms);
+                capturing = false;
+            }
+            if ((r & 0xf0) == 0x10) {
+                sensorOn = !sensorOn;
+                profiler.sensorPower(sensorOn, ms);
+            }
+            if ((r & 0xf00) == 0x100) {
+                uint32_t elapsed = r >> 20;
+                profiler.addPublish(elapsed);
+                publishMs += elapsed;
+                publishes++;
+            }
+
+            uint32_t duration = random32() % 30000;
+            system_tick_t next = ms + duration;
+            wrapped = wrapped || (next < ms);
+            ms = next;
+            awake += duration;
+            capture += capturing ? duration : 0;
+            sensor += sensorOn ? duration : 0;
+        }
+
+        SleepHelper::WakeCycleProfile cycle;
+        CHECK(profiler.endCycle(ms, 0, cycle));
+        phaseMismatches += (phaseSum(cycle) != cycle.awakeMs);
+        awakeMismatches += (cycle.awakeMs != awake);
+        captureMismatches += (cycle.dataCaptureMs != capture);
+        sensorMismatches += (cycle.sensorMs != sensor);
+        publishMismatches += (cycle.publishMs != publishMs || cycle.publishCount != publishes);
+
+        // Asleep between cycles. A capture or sensor power still on carries into the next cycle.
+        ms += random32() % 900000;
+        if (capturing) {
+            profiler.dataCaptureEnd(ms);
+        }
+        if (sensorOn) {
+            profiler.sensorPower(false, ms);
+        }
+    }
+    CHECK(!profiler.isActive());
+    SleepHelper::WakeCycleProfile cycle;
+    CHECK(!profiler.endCycle(ms, 0, cycle));
+
+    printf("%u random cycles: phase sum mismatches %u, awake %u, data capture %u, sensor %u, publish %u\n", (unsigned)numCycles,
+           (unsigned)phaseMismatches, (unsigned)awakeMismatches, (unsigned)captureMismatches, (unsigned)sensorMismatches, (unsigned)publishMismatches);
+    CHECK(wrapped);
+    CHECK_INT(phaseMismatches, 0);
+    CHECK_INT(awakeMismatches, 0);
+    CHECK_INT(captureMismatches, 0);
+    CHECK_INT(sensorMismatches, 0);
+    CHECK_INT(publishMismatches, 0);
+}
+
+void testRing() {
+    const size_t ringSize = SleepHelper::PersistentData::WAKE_CYCLE_RING_SIZE;
+
+    SleepHelper::PersistentData data;
+    data.withPath("/usr/wakeProfile.dat").withSaveDelayMs(0);
+    data.load();                                    // Not setup(), which adds loop functions for this object
+
+    SleepHelper::WakeCycleProfile cycle;
+    CHECK(!data.getValue_wakeCycle(0, cycle));
+
+    for (uint32_t ii = 0; ii < ringSize + 3; ii++) {
+        SleepHelper::WakeCycleProfile added = {};
+        added.startTime = 1657857600 + ii * 900;
+        added.awakeMs = added.phaseMs[ii % SleepHelper::WakeCycleProfile::numPhases] = 1000 + ii;
+        data.addValue_wakeCycle(added);
+    }
+    CHECK_INT(data.getValue_wakeCycleCount(), ringSize + 3);
+
+    SleepHelper::PersistentData reloaded;
+    reloaded.withPath("/usr/wakeProfile.dat");
+    reloaded.load();
+    for (SleepHelper::PersistentData *pd : {&data, &reloaded}) {
+        for (size_t index = 0; index < ringSize; index++) {
+            uint32_t ii = ringSize + 2 - index;
+            CHECK(pd->getValue_wakeCycle(index, cycle));
+            CHECK_INT(cycle.startTime, 1657857600 + ii * 900);
+            CHECK_INT(cycle.awakeMs, 1000 + ii);
+            CHECK_INT(phaseSum(cycle), cycle.awakeMs);
+        }
+        CHECK(!pd->getValue_wakeCycle(ringSize, cycle));
+    }
+}
+
+uint32_t lastCount = 0;
+size_t appCycles = 0, appMismatches = 0;
+uint64_t appAwakeMs = 0;
+
+/**
+ * @brief Runs every second of virtual time and checks each cycle the application saves
+ */
+void checkNewCycles() {
+    uint32_t count = SleepHelper::instance().persistentData.getValue_wakeCycleCount();
+    for (; lastCount < count; lastCount++) {
+        SleepHelper::WakeCycleProfile cycle;
+        if (SleepHelper::instance().getWakeCycleProfile(count - 1 - lastCount, cycle)) {
+            appCycles++;
+            appAwakeMs += cycle.awakeMs;
+            appMismatches += (phaseSum(cycle) != cycle.awakeMs || cycle.awakeMs == 0);
+        }
+    }
+    sim::at(sim::now() + 1000, checkNewCycles);
+}
+
+} // namespace
+
+int main() {
+    simtest::begin("WakeProfilerTest");
+
+    testRandomCycles();
+    testRing();
+
+    sim::analogSource(A4, []() { return (int32_t)931; });
+    sim::analogSource(A1, []() { return (int32_t)1551; });
+    sim::analogSource(A0, []() { return (int32_t)1861; });
+
+    try {
+        setup();
+        sim::runThreads();
+        lastCount = SleepHelper::instance().persistentData.getValue_wakeCycleCount();
+        sim::at(sim::now() + 1000, checkNewCycles);
+
+        while (sim::now() < 24ULL * 3600 * 1000) {
+            loop();
+            sim::runThreads();
+            sim::advance(10);
+            sim::checkWatchdog();
+        }
+    }
+    catch (const sim::ResetException &e) {
+        simtest::checkFailed(__FILE__, __LINE__, e.reason);
+    }
+
+    printf("a day of the application: %u cycles, %.1f s awake, %u with phases not adding up\n", (unsigned)appCycles,
+           appAwakeMs / 1000.0, (unsigned)appMismatches);
+    CHECK(appCycles > 50);
+    CHECK_INT(appMismatches, 0);
+
+    return simtest::end("WakeProfilerTest");
+}
@@ -29,13 +29,26 @@ STARTUP(System.enableFeature(FEATURE_RESET_INFO));  // So we know why the device
 
 // Instantiate services and objects - all other references need to be external
 AB1805 ab1805(Wire);                                // Rickkas' RTC / Watchdog library
-MB85RC64 fram(Wire, 0);                             // Rickkas' FRAM library
+FramStorage fram(Wire, 0);                          // Rickkas' FRAM library - with a RAM write-back cache (see storage_objects.h)
 
 // Support for Particle Products (changes coming in 4.x - https://docs.particle.io/cards/firmware/macros/product_id/)
 PRODUCT_ID(PLATFORM_ID);                            // Device needs to be added to product ahead of time.  Remove once we go to deviceOS@4.x
 PRODUCT_VERSION(0);
 char currentPointRelease[6] ="0.03";
 
+// Larger Wire buffers so the FRAM library can move a whole storage object in one I2C transaction (Gen3 only)
+hal_i2c_config_t acquireWireBuffer() {
+    hal_i2c_config_t config = {
+        .size = sizeof(hal_i2c_config_t),
+        .version = HAL_I2C_CONFIG_VERSION_1,
+        .rx_buffer = new (std::nothrow) uint8_t[I2C_BUFFER_SIZE],
+        .rx_buffer_size = I2C_BUFFER_SIZE,
+        .tx_buffer = new (std::nothrow) uint8_t[I2C_BUFFER_SIZE],
+        .tx_buffer_size = I2C_BUFFER_SIZE
+    };
+    return config;
+}
+
 void setup() {
 
     initializePinModes();                           // Sets the pinModes
@@ -54,7 +67,7 @@ void setup() {
         ab1805.setWDT(AB1805::WATCHDOG_MAX_SECONDS);// Enable watchdog
     }
 
-	PublishQueuePosix::instance().setup();          // Initialize PublishQueuePosixRK
+	PublishQueuePosix::instance().setup();          // Initialize PublishQueuePosixRK - one file per event, not withSegmentedLog(): the queue only holds the few events of one wake cycle
 
     sleepHelperConfig();                            // This is the function call to configure the sleep helper parameters in sleep_helper_config.h
 
@@ -68,5 +81,5 @@ void loop() {
     
     PublishQueuePosix::instance().loop();           // Monitor and manage the publish queue
 
-    storageObjectLoop();                            // Compares current system and current objects and stores if the hash changes (once / second) in storage_objects.h
+    storageObjectLoop();                            // Stores any changes to the system and current objects and flushes the FRAM cache in storage_objects.h
 }
@@ -0,0 +1,96 @@
+/**
+ * @file adc_sampler.h
+ * @author Chip McClelland (chip@seeinisghts.com)
+ * @brief Oversampling engine for the analog sensors.  Takes a burst of back-to-back conversions on a set of
+ * pins, interleaving the channels, and reduces each channel to a single value that rejects outliers.
+ *
+ * @details Everything lives in fixed-size stack buffers sized by the template parameters - there is no heap use.
+ * A single noisy conversion is dropped by the median or trimmed mean so it cannot trigger a false watering.
+ *
+ * @version 0.1
+ * @date 2022-07-20
+ *
+ */
+
+#ifndef ADC_SAMPLER_H
+#define ADC_SAMPLER_H
+
+#include "Particle.h"
+
+namespace ADC {                                     // How each channel's samples are reduced to one value
+  enum Reduction {
+    median,                                         // Middle value - best at rejecting spikes
+    trimmedMean                                     // Mean of the middle half - rejects spikes and averages out noise
+  };
+}
+
+/**
+ * @brief Sorts a small array of samples in place
+ *
+ * @details Insertion sort - the sample counts are small (16 - 64) and this needs no extra memory
+ *
+ */
+inline void sortAdcSamples(uint16_t *samples, size_t count) {
+  for (size_t i = 1; i < count; i++) {
+    uint16_t value = samples[i];
+    size_t j = i;
+    while (j > 0 && samples[j - 1] > value) {
+      samples[j] = samples[j - 1];
+      j--;
+    }
+    samples[j] = value;
+  }
+}
+
+/**
+ * @brief Reduces a set of samples to a single value
+ *
+ * @details Sorts the samples in place then takes the median or the mean of the middle half (drops the top and bottom quarter)
+ *
+ * @returns Returns the reduced value rounded to the nearest ADC count
+ *
+ */
+inline int reduceAdcSamples(uint16_t *samples, size_t count, ADC::Reduction reduction) {
+  if (count == 0) return 0;
+
+  sortAdcSamples(samples, count);
+
+  if (reduction == ADC::median) {
+    if (count % 2) return samples[count / 2];
+    return (samples[count / 2 - 1] + samples[count / 2] + 1) / 2;
+  }
+
+  size_t trim = count / 4;                          // Drop the lowest and highest quarter
+  uint32_t sum = 0;
+  for (size_t i = trim; i < count - trim; i++) sum += samples[i];
+  size_t kept = count - 2 * trim;
+  return (sum + kept / 2) / kept;
+}
+
+/**
+ * @brief Takes NUM_SAMPLES conversions on each of NUM_PINS analog pins and reduces them to one value per pin
+ *
+ * @details The channels are interleaved (A, B, C, A, B, C ...) so slow drift in the supply affects every channel
+ * equally.  Call this inside the window where the sensors are powered - the whole burst takes a few milliseconds.
+ *
+ * @param pins - The analog pins to sample
+ * @param results - One reduced ADC value per pin, in the same order as pins
+ * @param reduction - Median or trimmed mean
+ *
+ */
+template <size_t NUM_PINS, size_t NUM_SAMPLES>
+void sampleAnalogPins(const pin_t (&pins)[NUM_PINS], int (&results)[NUM_PINS], ADC::Reduction reduction = ADC::trimmedMean) {
+  uint16_t samples[NUM_PINS][NUM_SAMPLES];          // 2 bytes per conversion - 3 channels x 64 samples is 384 bytes of stack
+
+  for (size_t sample = 0; sample < NUM_SAMPLES; sample++) {
+    for (size_t pin = 0; pin < NUM_PINS; pin++) {
+      samples[pin][sample] = (uint16_t)analogRead(pins[pin]);
+    }
+  }
+
+  for (size_t pin = 0; pin < NUM_PINS; pin++) {
+    results[pin] = reduceAdcSamples(samples[pin], NUM_SAMPLES, reduction);
+  }
+}
+
+#endif
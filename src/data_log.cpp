@@ -0,0 +1,227 @@
+#include "Particle.h"
+#include "data_log.h"
+#include <math.h>
+
+const uint32_t dataLogMagic = 0x474c4f47;           // "GLOG"
+
+static size_t logHeaderAddr = 0;                    // Where the header lives in FRAM
+static size_t logRecordsAddr = 0;                   // Where record 0 lives in FRAM
+static uint16_t logCapacity = 0;                    // Number of record slots
+static dataLogHeader header;                        // RAM copy of the header - written back on every change
+
+/**
+ * @brief CRC-8 (Dallas/Maxim polynomial 0x31) used to check records and the header
+ *
+ * @return uint8_t - The CRC of the data
+ */
+uint8_t dataLogCrc(const uint8_t *data, size_t len) {
+  uint8_t crc = 0;
+  while (len--) {
+    crc ^= *data++;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x31) : (uint8_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+static bool storeHeader() {
+  header.crc = dataLogCrc((const uint8_t *)&header, offsetof(dataLogHeader, crc));
+  return fram.writeData(logHeaderAddr, (const uint8_t *)&header, sizeof(header));
+}
+
+static size_t recordAddr(size_t slot) {
+  return logRecordsAddr + slot * sizeof(dataLogRecord);
+}
+
+/**
+ * @brief Loads the log header from FRAM or initializes an empty log
+ *
+ * @details The log is reset if the header is missing, corrupt or was made for a different record size.
+ *
+ * @param framAddr - Start of the FRAM region for the log
+ * @param length - Size of the region in bytes
+ * @param reset - Start with an empty log even if the header is valid (the FRAM memory map has changed)
+ *
+ * @return true - Log is ready
+ * @return false - The region is too small or FRAM could not be accessed
+ */
+bool dataLogStart(size_t framAddr, size_t length, bool reset) {
+  if (length < sizeof(dataLogHeader) + sizeof(dataLogRecord)) return false;
+
+  logHeaderAddr = framAddr;
+  logRecordsAddr = framAddr + sizeof(dataLogHeader);
+  size_t slots = (length - sizeof(dataLogHeader)) / sizeof(dataLogRecord);
+  logCapacity = (slots > 0xffff) ? 0xffff : (uint16_t)slots;
+
+  if (!fram.readData(logHeaderAddr, (uint8_t *)&header, sizeof(header))) return false;
+
+  if (reset || header.magic != dataLogMagic ||
+      header.crc != dataLogCrc((const uint8_t *)&header, offsetof(dataLogHeader, crc)) ||
+      header.recordSize != sizeof(dataLogRecord) ||
+      header.tail >= logCapacity || header.count > logCapacity) {
+    Log.info("Data log initialized - %u records", logCapacity);
+    memset(&header, 0, sizeof(header));
+    header.magic = dataLogMagic;
+    header.recordSize = sizeof(dataLogRecord);
+    return storeHeader();
+  }
+
+  Log.info("Data log loaded - %u of %u records", header.count, logCapacity);
+  return true;
+}
+
+/**
+ * @brief Appends a record to the log, overwriting the oldest record if the log is full
+ *
+ * @details The record is written before the header so a reset part way through never exposes a partial record.
+ * The CRC is filled in here.
+ *
+ * @return true - Record stored
+ * @return false - Log not started or FRAM write failed
+ */
+bool dataLogAppend(const dataLogRecord &record) {
+  if (logCapacity == 0) return false;
+
+  dataLogRecord stored = record;
+  stored.crc = dataLogCrc((const uint8_t *)&stored, offsetof(dataLogRecord, crc));
+
+  size_t slot = (header.tail + header.count) % logCapacity;
+  if (!fram.writeData(recordAddr(slot), (const uint8_t *)&stored, sizeof(stored))) return false;
+
+  if (header.count < logCapacity) header.count++;
+  else header.tail = (header.tail + 1) % logCapacity;       // Full - the oldest record was just overwritten
+
+  return storeHeader();
+}
+
+/**
+ * @brief Appends a record made from the values in the current object
+ *
+ * @details Temperatures are stored in hundredths of a degree and soil moisture in tenths of a percent
+ *
+ */
+bool dataLogAppendCurrent() {
+  dataLogRecord record;
+
+  record.time = (uint32_t)Time.now();
+  record.internalTempC100 = (int16_t)lround(current.internalTempC * 100);
+  record.soilTempC100 = (int16_t)lround(current.soilTempC * 100);
+  record.soilMoisture10 = (uint16_t)lround(current.soilMoisture * 10);
+  record.stateOfCharge = (uint8_t)current.stateOfCharge;
+  record.batteryState = current.batteryState;
+  record.wateringState = current.wateringState;
+
+  return dataLogAppend(record);
+}
+
+size_t dataLogCount() {
+  return header.count;
+}
+
+size_t dataLogCapacity() {
+  return logCapacity;
+}
+
+/**
+ * @brief Reads a range of records, oldest first
+ *
+ * @details The range is read in at most two FRAM reads (one if it does not wrap around the end of the region).
+ * Records that fail their CRC check are dropped from the results.
+ *
+ * @param index - Number of records after the oldest to start at (0 = oldest)
+ * @param records - Buffer to read into
+ * @param maxRecords - Size of the buffer in records
+ *
+ * @return size_t - Number of valid records placed in the buffer
+ */
+size_t dataLogRead(size_t index, dataLogRecord *records, size_t maxRecords) {
+  if (index >= header.count) return 0;
+
+  size_t numRecords = header.count - index;
+  if (numRecords > maxRecords) numRecords = maxRecords;
+
+  size_t slot = (header.tail + index) % logCapacity;
+  size_t firstPart = logCapacity - slot;            // Records before we wrap around to slot 0
+  if (firstPart > numRecords) firstPart = numRecords;
+
+  if (!fram.readData(recordAddr(slot), (uint8_t *)records, firstPart * sizeof(dataLogRecord))) return 0;
+  if (numRecords > firstPart) {
+    if (!fram.readData(recordAddr(0), (uint8_t *)&records[firstPart], (numRecords - firstPart) * sizeof(dataLogRecord))) {
+      numRecords = firstPart;
+    }
+  }
+
+  size_t valid = 0;
+  for (size_t ii = 0; ii < numRecords; ii++) {
+    if (records[ii].crc != dataLogCrc((const uint8_t *)&records[ii], offsetof(dataLogRecord, crc))) {
+      Log.info("Data log record %u failed CRC check", index + ii);
+      continue;
+    }
+    if (valid != ii) records[valid] = records[ii];
+    valid++;
+  }
+  return valid;
+}
+
+/**
+ * @brief Removes the oldest records from the log, typically after they have been published
+ *
+ * @return true - Header updated
+ * @return false - FRAM write failed
+ */
+bool dataLogRemove(size_t numRecords) {
+  if (logCapacity == 0) return false;
+  if (numRecords > header.count) numRecords = header.count;
+
+  header.tail = (header.tail + numRecords) % logCapacity;
+  header.count -= numRecords;
+
+  return storeHeader();
+}
+
+/**
+ * @brief Writes the fields of a record with the event history keys
+ *
+ * @details The same keys the data capture function used to add to the event history directly
+ *
+ */
+void dataLogRecordJson(const dataLogRecord &record, JSONWriter &writer) {
+  writer.name("t").value((int)record.time);
+  writer.name("bs").value(record.batteryState);
+  writer.name("c").value(record.internalTempC100 / 100.0);
+  writer.name("sm").value(record.soilMoisture10 / 10.0);
+  writer.name("st").value(record.soilTempC100 / 100.0);
+  writer.name("ws").value(record.wateringState);
+}
+
+/**
+ * @brief Moves every record in the log to the SleepHelper event history, oldest first, and removes them from the log
+ *
+ * @details Called when there is a connection to publish them.  Records are read in batches and each batch is
+ * appended to the event history file in one write, so the flash is written once per publish instead of once
+ * per measurement.  Records that fail their CRC check are dropped.  A batch is only removed from the log once
+ * it is in the event history file, so if the file can't be opened or written the records stay in FRAM.
+ *
+ * @return size_t - Number of records moved
+ */
+size_t dataLogMoveToEventHistory() {
+  dataLogRecord records[32];                        // 448 bytes of stack
+  size_t moved = 0;
+
+  while (header.count > 0) {
+    size_t batch = (header.count < 32) ? header.count : 32;
+    size_t valid = dataLogRead(0, records, batch);
+    if (!SleepHelper::instance().addEvents(valid, [&records](size_t index, JSONWriter &writer) {
+      dataLogRecordJson(records[index], writer);
+    })) {
+      Log.info("Data log - event history not written, keeping %u records", header.count);
+      break;                                        // The records stay in FRAM for the next connection
+    }
+    if (!dataLogRemove(batch)) break;
+    moved += valid;
+  }
+
+  if (moved) Log.info("Data log - %u records moved to the event history", moved);
+  return moved;
+}
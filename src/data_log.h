@@ -0,0 +1,55 @@
+/**
+ * @file data_log.h
+ * @author Chip McClelland (chip@seeinisghts.com)
+ * @brief This file contains an append-only ring log of measurement records kept in FRAM.
+ *
+ * @details Every measurement is appended as a small packed binary record with its own CRC.  When the log is full
+ * the oldest record is overwritten.  FRAM is byte addressable and does not wear, so this is much cheaper than
+ * appending lines to a file on flash.  Records can be read back in bulk (oldest first) for publishing and then
+ * removed once they have been sent.  dataLogMoveToEventHistory() does this at each full wake - the records go to
+ * the SleepHelper event history in one file append, so the flash is only written when there is a connection
+ * to publish them.  The log holds about 5 days of 15 minute samples; after that the oldest are overwritten.
+ *
+ * @version 0.1
+ * @date 2022-07-22
+ *
+ */
+#ifndef DATA_LOG_H
+#define DATA_LOG_H
+
+#include "Particle.h"
+#include "storage_objects.h"
+#include "SleepHelper.h"
+
+struct __attribute__((packed)) dataLogRecord {      // One measurement - 14 bytes
+  uint32_t time;                                    // Timestamp of the measurement (Unix time)
+  int16_t internalTempC100;                         // Enclosure temperature in hundredths of a degree C
+  int16_t soilTempC100;                             // Soil temperature in hundredths of a degree C
+  uint16_t soilMoisture10;                          // Soil moisture in tenths of a percent
+  uint8_t stateOfCharge;                            // Battery charge level
+  uint8_t batteryState;                             // Battery state (charging, discharging, etc)
+  uint8_t wateringState;                            // Watering state at the time of the measurement
+  uint8_t crc;                                      // CRC-8 of the bytes above
+};
+
+struct __attribute__((packed)) dataLogHeader {      // Stored at the start of the log region - 12 bytes, kept in the FRAM cache
+  uint32_t magic;                                   // Identifies an initialized log
+  uint16_t recordSize;                              // sizeof(dataLogRecord) when the log was created
+  uint16_t tail;                                    // Index of the oldest record
+  uint16_t count;                                   // Number of records in the log
+  uint8_t reserved;
+  uint8_t crc;                                      // CRC-8 of the bytes above
+};
+
+bool dataLogStart(size_t framAddr, size_t length, bool reset = false);  // Load or initialize the log header - called from storageObjectStart()
+bool dataLogAppend(const dataLogRecord &record);    // Add a record, overwriting the oldest if the log is full
+bool dataLogAppendCurrent();                        // Add a record made from the current object
+size_t dataLogCount();                              // Number of records in the log
+size_t dataLogCapacity();                           // Maximum number of records the log can hold
+size_t dataLogRead(size_t index, dataLogRecord *records, size_t maxRecords);  // Bulk read starting index records after the oldest
+bool dataLogRemove(size_t numRecords);              // Remove the oldest records once they have been sent
+size_t dataLogMoveToEventHistory();                 // Move every record to the SleepHelper event history for publishing
+void dataLogRecordJson(const dataLogRecord &record, JSONWriter &writer);  // Write a record as event history keys
+uint8_t dataLogCrc(const uint8_t *data, size_t len); // CRC-8 (Dallas/Maxim) used for records and the header
+
+#endif
@@ -10,14 +10,25 @@ void sleepHelperConfig() {
     SleepHelper::instance()
         .withMinimumCellularOffTime(5min)                                                           // 
         .withMaximumTimeToConnect(11min)
+        .withConnectTimeoutPolicy(SleepHelper::ConnectTimeoutPolicy()                               // Give up sooner than 11 minutes when past connections were faster, see getSignalStrength()
+            .withMaximumTime(11min))                                                                // Same as withMaximumTimeToConnect()
         .withTimeConfig("EST5EDT,M3.2.0/02:00:00,M11.1.0/02:00:00")
         .withEventHistory("/usr/events.txt", "eh")
+        .withEventHistoryHeadOffset()                                                               // Drain the event history without rewriting the file for every publish
+        // The event history is published as a JSON array of events, which the webhook and backend decode today.
+        // Delta encoded columns fit about 3 times as many 15 minute samples in each publish, but change "eh"
+        // to an object that needs a decoder on the cloud side (see EventHistory::columnarToJson()). Once that
+        // is deployed, add:
+        //  .withEventHistoryColumnar(15 * 60)                                                      // Publish the 15 minute samples as delta encoded columns
+        //  .withEventHistoryColumnPrecision("c", 1)                                                // Temperatures to 0.1 degree C, soil moisture to 0.1%
+        //  .withEventHistoryColumnPrecision("st", 1)
+        //  .withEventHistoryColumnPrecision("sm", 1)
+        .withEnergyModel(SleepHelper::EnergyModel()                                                 // Estimated currents - measure a device to calibrate
+            .withSensorMa(10.0))                                                                    // Soil sensor while SOIL_POWER_PIN is high
         .withDataCaptureFunction([](SleepHelper::AppCallbackState &state) {
             if (Time.isValid()) {
 
-                delay(2000);
-
-                takeMeasurements();                 // Collect data from the sensors
+                if (takeMeasurements(state)) return true;   // Keep calling us back until the sensors have settled and been read
 
                 if (current.wateringState == 1) {
                     char data[64];
@@ -26,21 +37,32 @@ void sleepHelperConfig() {
                     Particle.publish("Rachio-WaterGarden", data, PRIVATE);
                 }
 
-                SleepHelper::instance().addEvent([](JSONWriter &writer) {
-                    writer.name("t").value((int) Time.now());
-                    writer.name("bs").value(current.batteryState);
-                    writer.name("c").value(current.internalTempC);
-                    writer.name("sm").value(current.soilMoisture);
-                    writer.name("st").value(current.soilTempC);
-                    writer.name("ws").value(current.wateringState);
-                });
+                if (!dataLogAppendCurrent()) {      // Samples are kept in the FRAM data log until there is a connection to publish them
+                    SleepHelper::instance().addEvent([](JSONWriter &writer) {   // No data log - straight to the event history on flash
+                        writer.name("t").value((int) Time.now());
+                        writer.name("bs").value(current.batteryState);
+                        writer.name("c").value(current.internalTempC);
+                        writer.name("sm").value(current.soilMoisture);
+                        writer.name("st").value(current.soilTempC);
+                        writer.name("ws").value(current.wateringState);
+                    });
+                }
+                else if (Particle.connected()) dataLogMoveToEventHistory(); // Staying connected (sleep disabled) - publish it now
             }
             return false;
         })
+        .withWakeEventFunction([](JSONWriter &, int &) {
+            dataLogMoveToEventHistory();            // Full wake - move the logged samples to the event history just before it is published
+            return true;                            // Priority is left at 0 so nothing is added to the wake event itself
+        })
         .withSleepReadyFunction([](SleepHelper::AppCallbackState &, system_tick_t) {
             if (sysStatus.enableSleep) return false;// Boolean set by Particle.function - If sleep is enabled return false
             else return true;                       // If we need to delay sleep, return true
         })
+        .withSleepOrResetFunction([](bool) {
+            storageObjectLoop();                    // Make sure the storage objects and FRAM cache are written before sleep or reset
+            return true;
+        })
         .withAB1805_WDT(ab1805)                     // Stop the watchdog before sleep or reset, and resume after wake
         .withPublishQueuePosixRK()                  // Manage both internal publish queueing and PublishQueuePosixRK
         ;
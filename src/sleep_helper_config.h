@@ -17,6 +17,7 @@
 #include "SleepHelper.h"
 #include "take_measurements.h"
 #include "storage_objects.h"
+#include "data_log.h"
 #include "device_pinout.h"
 
 extern AB1805 ab1805;                               // This library is initialized in the main source file
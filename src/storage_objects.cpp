@@ -1,14 +1,10 @@
 
 #include "Particle.h"
 #include "storage_objects.h"
+#include "data_log.h"
 
-namespace FRAM {                                    // Moved to namespace instead of #define to limit scope
-  enum Addresses {
-    versionAddr           = 0x00,                   // Version of the FRAM memory map
-    systemStatusAddr      = 0x01,                   // Where we store the system status data structure
-    currentStatusAddr     = 0x50                    // Where we store the current counts data structure
-  };
-}
+static_assert(FRAM::currentStatusAddr + sizeof(current_structure) <= FRAM::dataLogAddr, "current object overlaps the data log");
+static_assert(FRAM_CACHE_SIZE == FRAM::dataLogAddr + sizeof(dataLogHeader), "FRAM cache must end with the data log header");
 
 const int FRAMversionNumber = 1;
 
@@ -16,6 +12,10 @@ const int FRAMversionNumber = 1;
 struct systemStatus_structure sysStatus;            // See structure definition in storage_objects.h
 struct current_structure current;     
 
+// Copies of what is stored in FRAM - storageObjectLoop() compares against these to find the bytes that changed
+static struct systemStatus_structure sysStatusShadow;
+static struct current_structure currentShadow;
+
 /**
  * @brief This function is executed in setup to initialize FRAM and load the storage objects from memory
  * 
@@ -24,12 +24,16 @@ struct current_structure current;
  */
 bool storageObjectStart() {
     // Next we will load FRAM and check or reset variables to their correct values
-  fram.begin();                                     // Initialize the FRAM module
+  fram.withBufferSize(I2C_BUFFER_SIZE).begin();     // Initialize the FRAM module - uses the larger Wire buffers from acquireWireBuffer()
   byte tempVersion;
+  bool newMemoryMap = false;
   fram.get(FRAM::versionAddr, tempVersion);         // Load the FRAM memory map version into a variable for comparison
   if (tempVersion != FRAMversionNumber) {           // Check to see if the memory map in the sketch matches the data on the chip
-    fram.erase();                                   // Reset the FRAM to correct the issue
+    newMemoryMap = true;
+    fram.erase(0, FRAM::dataLogAddr);               // Reset the storage objects - the data log is reset by dataLogStart() so there is no need to erase it
     fram.put(FRAM::versionAddr, FRAMversionNumber); // Put the right value in
+    fram.flush();                                   // Write it through the cache so the check below reads back the chip
+    fram.invalidate();
     fram.get(FRAM::versionAddr, tempVersion);       // See if this worked
     if (tempVersion != FRAMversionNumber) {
       // Need to add an error handler here as the device will not work without FRAM will need to reset
@@ -41,56 +45,78 @@ bool storageObjectStart() {
     Log.info("FRAM initialized, loading objects");
     fram.get(FRAM::systemStatusAddr,sysStatus);     // Loads the System Status array from FRAM
     fram.get(FRAM::currentStatusAddr,current);      // Loead the current values array from FRAM
+    memcpy(&sysStatusShadow, &sysStatus, sizeof(sysStatus));  // FRAM and the objects match - nothing to store yet
+    memcpy(&currentShadow, &current, sizeof(current));
+  }
+
+  if (!dataLogStart(FRAM::dataLogAddr, fram.length() - FRAM::dataLogAddr, newMemoryMap)) {
+    Log.info("Data log could not be started");      // Measurements still work - they just are not logged
   }
 
   return true;
 }
 
 /**
- * @brief In this function, we check each second to see if the values in the storage objects have changed
+ * @brief Writes the bytes of a storage object that differ from its shadow copy to FRAM
+ * 
+ * @details Compares byte by byte so no change can be missed (a sum of hashes can collide).  Runs of changed
+ * bytes that are separated by only a few unchanged bytes are merged so they go out in one I2C transaction.
+ * The shadow is only updated for the bytes that were written successfully.
  * 
- * @return true - One or more of the hash values have changed - object written to FRAM
+ * @return size_t - The number of bytes written to FRAM
+ */
+static size_t storeChangedBytes(size_t framAddr, const uint8_t *object, uint8_t *shadow, size_t size) {
+  const size_t maxGap = 4;                          // Cheaper to rewrite a few unchanged bytes than to start a new transaction
+  size_t bytesWritten = 0;
+  size_t ii = 0;
+
+  while (ii < size) {
+    if (object[ii] == shadow[ii]) {
+      ii++;
+      continue;
+    }
+    size_t start = ii;
+    size_t end = ii + 1;                            // One past the last changed byte in this run
+    for (size_t jj = end; jj < size && jj - end < maxGap; jj++) {
+      if (object[jj] != shadow[jj]) end = jj + 1;
+    }
+    if (fram.writeData(framAddr + start, object + start, end - start)) {
+      memcpy(shadow + start, object + start, end - start);
+      bytesWritten += end - start;
+    }
+    ii = end;
+  }
+  return bytesWritten;
+}
+
+/**
+ * @brief In this function, we check to see if the values in the storage objects have changed
+ * 
+ * @details Each object is compared with a shadow copy of what is in FRAM and only the changed byte ranges
+ * are written.  Those writes land in the FRAM RAM cache, which is then flushed in as few I2C transactions
+ * as possible.  This is called at the end of each loop and before sleep or reset so nothing is lost.
+ * 
+ * @return true - One or more values have changed - changed bytes written to FRAM
  * @return false - No change, nothing written to FRAM
  */
 
-bool storageObjectLoop() {                          // Monitors the values of the two objects and writes to FRAM if changed after a second
-  static time_t lastCheckTime = 0;
-  static size_t lastSysStatusHash;
-  static size_t lastCurrentHash;
+bool storageObjectLoop() {                          // Monitors the values of the two objects and writes the changed bytes to FRAM
   bool returnValue = false;
 
-  if (Time.now() - lastCheckTime) {          // Check once a second
-    lastCheckTime = Time.now();                     // Limit all this math to once a second
-    size_t sysStatusHash =  std::hash<byte>{}(sysStatus.structuresVersion) + \
-                      std::hash<int>{}(sysStatus.currentConnectionLimit)+ \
-                      std::hash<bool>{}(sysStatus.verboseMode) + \
-                      std::hash<bool>{}(sysStatus.enableSleep) + \
-                      std::hash<byte>{}(sysStatus.wakeTime) + \
-                      std::hash<byte>{}(sysStatus.sleepTime) + \
-                      std::hash<double>{}(sysStatus.wateringThresholdPct) + \
-                      std::hash<int>{}(sysStatus.wateringDuration) + \
-                      std::hash<double>{}(sysStatus.heatThreshold);
-    if (sysStatusHash != lastSysStatusHash) {       // If hashes don't match write to FRAM
-      Log.info("sysStaus object stored and hash updated");
-      fram.put(FRAM::systemStatusAddr,sysStatus);
-      lastSysStatusHash = sysStatusHash;
-      returnValue = true;                           // In case I want to test whether values changed
-    } 
-    size_t currentHash =  std::hash<double>{}(current.internalTempC) + \
-                      std::hash<int>{}(current.stateOfCharge)+ \
-                      std::hash<byte>{}(current.batteryState) + \
-                      std::hash<time_t>{}(current.lastSampleTime) + \
-                      std::hash<byte>{}(current.wateringState) + \
-                      std::hash<double>{}(current.soilMoisture) + \
-                      std::hash<double>{}(current.soilTempC);
-    if (currentHash != lastCurrentHash) {           // If hashes don't match write to FRAM
-      Log.info("current object stored and hash updated");
-      fram.put(FRAM::currentStatusAddr,current);
-      lastCurrentHash = currentHash;
-      returnValue = true;
-    } 
+  size_t sysStatusBytes = storeChangedBytes(FRAM::systemStatusAddr, (const uint8_t *)&sysStatus, (uint8_t *)&sysStatusShadow, sizeof(sysStatus));
+  if (sysStatusBytes) {
+    Log.info("sysStatus object - %u bytes stored", sysStatusBytes);
+    returnValue = true;                             // In case I want to test whether values changed
+  }
 
+  size_t currentBytes = storeChangedBytes(FRAM::currentStatusAddr, (const uint8_t *)&current, (uint8_t *)&currentShadow, sizeof(current));
+  if (currentBytes) {
+    Log.info("current object - %u bytes stored", currentBytes);
+    returnValue = true;
   }
+
+  if (fram.isDirty()) fram.flush();                 // Write the changed cache pages (objects and data log header) to the FRAM
+
   return returnValue;
 }
 
@@ -17,9 +17,24 @@
 #include "Particle.h"
 #include "MB85RC256V-FRAM-RK.h"                     // Include this library if you are using FRAM
 
-extern MB85RC64 fram;                               // FRAM storage initilized in main source file
+namespace FRAM {                                    // Moved to namespace instead of #define to limit scope
+  enum Addresses {
+    versionAddr           = 0x00,                   // Version of the FRAM memory map
+    systemStatusAddr      = 0x01,                   // Where we store the system status data structure
+    currentStatusAddr     = 0x50,                   // Where we store the current counts data structure
+    dataLogAddr           = 0x100                   // Start of the measurement ring log - runs to the end of the FRAM (see data_log.h)
+  };
+}
 
-// If you modify the sysStatus or current structures, make sure to update the hash function definitions
+// The storage objects and the data log header are mirrored in RAM and written back by storageObjectLoop() - the
+// data log records that follow the header go straight to the FRAM.  12 is sizeof(dataLogHeader), checked in storage_objects.cpp
+const size_t FRAM_CACHE_SIZE = FRAM::dataLogAddr + 12;
+typedef MB85RCWriteCache<MB85RC64, FRAM_CACHE_SIZE> FramStorage;
+
+extern FramStorage fram;                            // FRAM storage initilized in main source file
+const size_t I2C_BUFFER_SIZE = 128;                 // Wire buffer size - allocated in acquireWireBuffer() in the main source file
+
+// If you modify the sysStatus or current structures, make sure to update FRAMversionNumber in storage_objects.cpp
 struct systemStatus_structure {                     // Where we store the configuration / status of the device
   uint8_t structuresVersion;                        // Version of the data structures (system and current)
   int currentConnectionLimit;                       // Here we will store the connection limit in seconds
@@ -46,7 +61,7 @@ struct current_structure {                          // Where we store values in
 extern struct current_structure current;
 
 bool storageObjectStart();                          // Initialize the storage instance
-bool storageObjectLoop();                           // Store the current and sysStatus objects
+bool storageObjectLoop();                           // Store the bytes of the current and sysStatus objects that changed and flush the FRAM cache
 void loadSystemDefaults();                  // Initilize the object values for new deployments
 
 #endif
@@ -1,6 +1,8 @@
 //Particle Functions
 #include "Particle.h"
 #include "take_measurements.h"
+#include "adc_sampler.h"
+#include "thermistor_table.h"
 #include <math.h>
 
 FuelGauge fuelGauge;                                // Needed to address issue with updates in low battery state 
@@ -10,36 +12,128 @@ char soilTempStr[16] = " ";                           // External as this can be
 char soilMoistureStr[16] = " ";                       // External as this can be called as a Particle variable
 char signalStr[64] = " ";
 
+namespace MEASURE {                                 // Steps in the sensor acquisition state machine - kept in AppCallbackState::callbackState
+  enum States {
+    warmUpState           = 0,                      // Waiting for the device to settle after waking - fuel gauge quickStart is running
+    soilPowerState        = 1,                      // Soil sensor is powered and settling
+    fuelGaugeState        = 2,                      // Analog readings done - waiting out the rest of the fuel gauge settle time
+    completeState         = 3                       // All measurements are in the current object
+  };
+
+  const system_tick_t warmUpMs      = 2000;         // Settle time after waking before we take the analog readings
+  const system_tick_t soilPowerMs   = 100;          // Recommendation from Jay Ham at CSU - have not tested to see if it can be shorter
+  const system_tick_t fuelGaugeMs   = 500;          // Time for the fuel gauge to re-establish the SoC after a quickStart
+
+  const size_t adcSamples           = 16;           // Conversions per analog channel - reduced to one value by adc_sampler.h
+  const ADC::Reduction adcReduction = ADC::trimmedMean;
+}
+
+static system_tick_t measurementStartMs = 0;        // When this acquisition cycle started
+static system_tick_t stateStartMs = 0;              // When we entered the current state
+
 /**
- * @brief This code collects temperature data from the TMP-36
+ * @brief This code collects data from the sensors without blocking
+ * 
+ * @details This is a resumable state machine that is driven by the AppCallbackState that the SleepHelper
+ * passes to the data capture function.  Each call either advances to the next step or returns right away
+ * if the current settle window has not expired, so SleepHelper::loop() keeps servicing publishing and
+ * the watchdog while the sensors settle.  The fuel gauge quickStart is kicked off at the start of the
+ * warm up so its settle time overlaps with the warm up and soil sensor power up.
  * 
- * @details Uses an analog input and the appropriate scaling
+ * @param state - The AppCallbackState for the data capture callback - set to CALLBACK_STATE_START by the SleepHelper each wake
  * 
- * @returns Returns true if succesful and puts the data into the current object
+ * @returns Returns true while measurements are in progress and false once the data is in the current object
  * 
  */
-bool takeMeasurements() { 
+bool takeMeasurements(SleepHelper::AppCallbackState &state) {
+
+  switch (state.callbackState) {
+    case SleepHelper::AppCallbackState::CALLBACK_STATE_START:
+      measurementStartMs = stateStartMs = millis();
+      if (sysStatus.enableSleep) fuelGauge.quickStart();  // May help us re-establish a baseline for SoC - settles while we warm up
+      state.callbackState = MEASURE::warmUpState;
+      return true;
+
+    case MEASURE::warmUpState:
+      if (millis() - stateStartMs < MEASURE::warmUpMs) return true;
+      digitalWrite(SOIL_POWER_PIN, HIGH);           // Power up the soil sensor
+      SleepHelper::instance().setSensorPower(true); // So the energy model includes the soil sensor current
+      stateStartMs = millis();
+      state.callbackState = MEASURE::soilPowerState;
+      return true;
+
+    case MEASURE::soilPowerState:
+      if (millis() - stateStartMs < MEASURE::soilPowerMs) return true;
+      readAnalogSensors();                          // Reads all the analog sensors and powers down the soil sensor
+      state.callbackState = MEASURE::fuelGaugeState;
+      return true;
+
+    case MEASURE::fuelGaugeState:
+      if (sysStatus.enableSleep && millis() - measurementStartMs < MEASURE::fuelGaugeMs) return true;
+      batteryState();
+
+      isItSafeToCharge();
+
+      getSignalStrength();
+
+      Log.info("Measurements complete in %lu mSec", millis() - measurementStartMs);
+      state.callbackState = MEASURE::completeState;
+      return false;
+
+    default:
+      return false;
+  }
+}
 
-    digitalWrite(SOIL_POWER_PIN, HIGH);             // Power up the soil sensor
-    delay(100);                                     // Recommendation from Jay Ham at CSU - have not tested to see if it can be shorter
+/**
+ * @brief This code collects data from the sensors and waits until it is complete
+ * 
+ * @details Runs the same state machine as the SleepHelper data capture callback.  This is only used 
+ * before the SleepHelper is running (in setup) to initialize the sensor values.
+ * 
+ * @returns Returns true when the data is in the current object
+ * 
+ */
+bool takeMeasurements() {
+  SleepHelper::AppCallbackState state;
+
+  while (takeMeasurements(state)) delay(1);
+
+  return true;
+}
+
+/**
+ * @brief Reads the analog sensors while the soil sensor is powered
+ * 
+ * @details Assumes the soil sensor has been powered up and has settled.  Each channel is oversampled
+ * and reduced while the soil sensor is still powered.  Powers the soil sensor down when complete and 
+ * sets the watering state.
+ * 
+ */
+void readAnalogSensors() {
+    const pin_t analogPins[3] = {TMP36_SENSE_PIN, SOIL_TEMP_PIN, SOIL_MOISTURE_PIN};
+    int adcValues[3];
+
+    sampleAnalogPins<3, MEASURE::adcSamples>(analogPins, adcValues, MEASURE::adcReduction);
+
+    digitalWrite(SOIL_POWER_PIN, LOW);              // Analog measurements complete power down the soil sensor
+    SleepHelper::instance().setSensorPower(false);
 
     // Temperature inside the enclosure
-    current.internalTempC = tmp36TemperatureC(analogRead(TMP36_SENSE_PIN));
+    current.internalTempC = tmp36TemperatureC(adcValues[0]);
     snprintf(internalTempStr,sizeof(internalTempStr), "%4.2f C", current.internalTempC);
     Log.info("Internal Temperature is %s",internalTempStr);
 
     // Soil Temperature
-    current.soilTempC = soilTemperarureC(analogRead(SOIL_TEMP_PIN));
+    current.soilTempC = soilTemperatureTableC(adcValues[1]);
     snprintf(soilTempStr,sizeof(soilTempStr), "%4.2f C", current.soilTempC);
     Log.info("Soil Temperature is %s",soilTempStr);
 
     // Soil Moisture
-    current.soilMoisture = map(analogRead(SOIL_MOISTURE_PIN),0,3722,0,100);        // Sensor puts out 0-3V for 0% to 100% soil moisuture
+    current.soilMoisture = map(adcValues[2],0,3722,0,100);        // Sensor puts out 0-3V for 0% to 100% soil moisuture
     snprintf(soilMoistureStr,sizeof(soilMoistureStr), "%4.2f%%", current.soilMoisture);
     Log.info("Soil Moisture is %s",soilMoistureStr);
 
-    digitalWrite(SOIL_POWER_PIN, LOW);              // Analog measurements complete power down the soil sensor
-
     if (current.soilMoisture < sysStatus.wateringThresholdPct) {
       current.wateringState = 1;                    // If the soil is too dry, water
       Log.info("Too dry - watering");
@@ -49,15 +143,6 @@ bool takeMeasurements() {
       Log.info("Too hot - watering");
     }        
     else current.wateringState = 0;                 // Else, don't
-
-    batteryState();
-
-    isItSafeToCharge();
-
-    getSignalStrength();
-
-    return 1;
-
 }
 
 /**
@@ -113,18 +198,31 @@ float soilTemperarureC (int adcValue) {
   } 
   else T=-99.9;                                     // Invalid Reading
 
-  delay(1000);
   Log.info("Vo: %4.2f mV  Rt= %4.2f mV  T = %4.2f", Vo, Rt, T);
 
   return T;
 }
 
 
+/**
+ * @brief Soil Temperature calculation using the compile time lookup table
+ * 
+ * @details Same result as soilTemperarureC() to within 0.01C for every ADC code, but it is usually a table lookup and
+ * a linear interpolation instead of a log and a cubic.  See thermistor_table.h for the coefficients.
+ * 
+ * @returns Returns the soil temperature in C (-99.9 for an invalid reading)
+ * 
+ */
+float soilTemperatureTableC (int adcValue) {
+  return ThermistorTable<MurataNCP18XH103F03RB>::celsius(adcValue);
+}
+
 /**
  * @brief In this function, we will measure the battery state of charge and the current functional state
  * 
  * @details One factor that is an issue today is the accurace of the state of charge if the device is waking
- * from sleep.  In order to help with this, there is a test for enable sleep and an additional delay.
+ * from sleep.  In order to help with this, takeMeasurements() does a quickStart of the fuel gauge at the start
+ * of the cycle and waits for it to settle before calling this function.
  * 
  * @return true  - If the battery has a charge over 60%
  * @return false - Less than 60% indicates a low battery condition
@@ -132,11 +230,6 @@ float soilTemperarureC (int adcValue) {
 bool batteryState() {
     current.batteryState = System.batteryState();                      // Call before isItSafeToCharge() as it may overwrite the context
 
-  if (sysStatus.enableSleep) {                                        // Need to take these steps if we are sleeping
-    fuelGauge.quickStart();                                            // May help us re-establish a baseline for SoC
-    delay(500);
-  }
-
   current.stateOfCharge = int(fuelGauge.getSoC());                   // Assign to system value
 
   if (current.stateOfCharge > 60) return true;
@@ -185,4 +278,6 @@ void getSignalStrength() {
   float qualityPercentage = sig.getQuality();
 
   snprintf(signalStr,sizeof(signalStr), "%s S:%2.0f%%, Q:%2.0f%% ", radioTech[rat], strengthPercentage, qualityPercentage);
+
+  if (rat != NET_ACCESS_TECHNOLOGY_NONE) SleepHelper::instance().setCellularSignal(strengthPercentage, qualityPercentage);  // Only valid while the modem is on
 }
\ No newline at end of file
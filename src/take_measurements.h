@@ -14,6 +14,7 @@
 #define TAKE_MEASUREMENTS_H
 
 #include "Particle.h"
+#include "SleepHelper.h"
 #include "storage_objects.h"
 #include "device_pinout.h"
 
@@ -22,9 +23,12 @@ extern char soilTempStr[16];                           // External as this can b
 extern char soilMoistureStr[16];                       // External as this can be called as a Particle variable
 extern char signalStr[64];
 
-bool takeMeasurements();                               // Function that calls the needed functions in turn
+bool takeMeasurements(SleepHelper::AppCallbackState &state); // Non-blocking - returns true until measurements are complete
+bool takeMeasurements();                               // Blocking version for use in setup - runs the same steps
+void readAnalogSensors();                              // Reads the analog sensors while the soil sensor is powered
 float tmp36TemperatureC (int adcValue);                // Temperature from the tmp36 - inside the enclosure
 float soilTemperarureC (int adcValue);                 // Soil temperature
+float soilTemperatureTableC (int adcValue);            // Soil temperature from the lookup table in thermistor_table.h
 bool batteryState();                                   // Data on state of charge and battery status. Returns true if SOC over 60%
 bool isItSafeToCharge();                               // See if it is safe to charge based on the temperature
 void getSignalStrength();
@@ -0,0 +1,139 @@
+/**
+ * @file thermistor_table.h
+ * @author Chip McClelland (chip@seeinisghts.com)
+ * @brief Lookup table conversion from a 12-bit ADC code to degrees C for a thermistor in a voltage divider.
+ *
+ * @details The table is generated at compile time from the Steinhart-Hart coefficients, so a reading is a table
+ * lookup and a linear interpolation - no log() and no cubic at run time.  The thermistor is a template parameter
+ * so each part gets its own table.  To add a thermistor, define a struct like MurataNCP18XH103F03RB below and use
+ * ThermistorTable<YourThermistor>::celsius(adcValue).
+ *
+ * @version 0.1
+ * @date 2022-07-20
+ *
+ */
+
+#ifndef THERMISTOR_TABLE_H
+#define THERMISTOR_TABLE_H
+
+#include "Particle.h"
+#include <math.h>
+
+/**
+ * @brief Murata NCP18XH103F03RB on the Colorado State soil sensor - 10K fixed resistor, thermistor next to ground
+ *
+ */
+struct MurataNCP18XH103F03RB {
+  static constexpr double c1 = 0.901747748E-03;     // Steinhart-Hart calibration coefficients
+  static constexpr double c2 = 2.489190310E-04;
+  static constexpr double c3 = 2.043213857E-07;
+  static constexpr double seriesOhms = 10000.0;     // Fixed resistor in the divider
+  static constexpr double excitationMv = 2500.0;    // Circuit excitation in mV
+  static constexpr double adcFullScaleMv = 3300.0;  // ADC reference - 4095 = 3.3V
+};
+
+/**
+ * @brief Compile time generated ADC code to temperature table for the Thermistor
+ *
+ * @details One entry every tableStep ADC codes, with linear interpolation in between.  The ends of the curve
+ * (very hot or an open / shorted sensor) are too steep to interpolate, so each segment is checked at compile
+ * time and those where interpolation is off by more than maxInterpolationError use the exact calculation.
+ *
+ */
+template <class Thermistor>
+class ThermistorTable {
+public:
+  static constexpr float invalidReading = -99.9;    // Same value the float calculation uses for an impossible reading
+  static constexpr int tableStep = 16;              // ADC codes between table entries
+  static constexpr int tableSize = 4096 / tableStep + 1;
+  static constexpr double maxInterpolationError = 0.01; // C at the middle of a segment
+
+  /**
+   * @brief Converts an ADC code to degrees C using the table
+   *
+   * @returns Returns the temperature in C or invalidReading
+   */
+  static float celsius(int adcValue) {
+    if (adcValue < 0 || adcValue > 4095) return invalidReading;
+    int index = adcValue / tableStep;
+    int offset = adcValue % tableStep;
+    if (offset == 0) return table.celsius[index];
+    if (!table.interpolate[index]) return celsiusExact(adcValue);
+    float low = table.celsius[index];
+    float high = table.celsius[index + 1];
+    return low + (high - low) * offset / tableStep;
+  }
+
+  /**
+   * @brief Converts an ADC code to degrees C with the full Steinhart-Hart calculation
+   *
+   * @returns Returns the temperature in C or invalidReading
+   */
+  static float celsiusExact(int adcValue) {
+    double rt = resistance(adcValue);
+    if (rt <= 0) return invalidReading;
+    double logRt = log(rt);
+    return steinhartHart(logRt);
+  }
+
+  struct Table {
+    float celsius[tableSize];
+    bool interpolate[tableSize];                    // Segment from this entry to the next is close enough to a line
+
+    constexpr Table() : celsius(), interpolate() {
+      bool valid[tableSize] = {};
+      for (int i = 0; i < tableSize; i++) {
+        int code = (i * tableStep > 4095) ? 4095 : i * tableStep;
+        double rt = resistance(code);
+        valid[i] = rt > 0;
+        celsius[i] = valid[i] ? (float)steinhartHart(constLog(rt)) : invalidReading;
+      }
+      for (int i = 0; i < tableSize - 1; i++) {
+        double rt = resistance(i * tableStep + tableStep / 2);
+        if (!valid[i] || !valid[i + 1] || rt <= 0) continue;
+        double error = (celsius[i] + celsius[i + 1]) / 2.0 - steinhartHart(constLog(rt));
+        interpolate[i] = error < maxInterpolationError && error > -maxInterpolationError;
+      }
+    }
+  };
+
+  static constexpr Table table = Table();
+
+private:
+  static constexpr double resistance(int adcValue) {
+    double vo = adcValue * Thermistor::adcFullScaleMv / 4095;
+    if (vo <= 0) return 0;
+    double divisor = Thermistor::excitationMv / vo - 1;
+    if (divisor <= 0) return 0;                     // Output above the excitation voltage - not a real reading
+    return Thermistor::seriesOhms / divisor;
+  }
+
+  static constexpr double steinhartHart(double logRt) {
+    return (1.0 / (Thermistor::c1 + Thermistor::c2 * logRt + Thermistor::c3 * logRt * logRt * logRt)) - 273.15;
+  }
+
+  /**
+   * @brief Natural log that can be evaluated at compile time (log() is not constexpr)
+   *
+   * @details Scales x into [1, 2) by powers of 2 and then uses the atanh series, which converges quickly there
+   */
+  static constexpr double constLog(double x) {
+    int exponent = 0;
+    while (x >= 2.0) { x /= 2.0; exponent++; }
+    while (x < 1.0) { x *= 2.0; exponent--; }
+    double y = (x - 1.0) / (x + 1.0);
+    double y2 = y * y;
+    double term = y;
+    double sum = 0;
+    for (int n = 1; n < 40; n += 2) {
+      sum += term / n;
+      term *= y2;
+    }
+    return 2.0 * sum + exponent * 0.69314718055994530942;
+  }
+};
+
+template <class Thermistor>
+constexpr typename ThermistorTable<Thermistor>::Table ThermistorTable<Thermistor>::table;
+
+#endif